@@ -31,11 +31,12 @@ show_usage_and_exit () {
     echo "  $0 restart                                       restart qconf agent."
     echo "  $0 stop                                          stop qconf agent."
 #    echo "  $0 info                                          show information of agent."
-#    echo "  $0 list-all                                      get the whole nodes in share memory."
+    echo "  $0 list-all                                      get the whole nodes in share memory."
 #    echo "  $0 clear-all                                     clear the whole nodes in share memory."
+#    echo "  $0 resize SLOTS                                  resize share memory to SLOTS online."
 #    echo "  $0 stop_listen HOST                              stop listening to HOST. "
 #    echo "  $0 restart_listen HOST                           restart to listen to HOST."
-#    echo "  $0 ls idc path                                   list nodes."
+    echo "  $0 ls idc path                                   list nodes in share memory under path."
 #    echo "  $0 delete -i HOST -p PATH...                     delete node with path."
 #    echo "  $0 get -i HOST -p PATH...                        get value of paths."
 #    echo "  $0 create -i HOST -p PATH... -v VALUE            create node with path and set its value."
@@ -224,7 +225,7 @@ wait_process () {
     done
 
     #line=${wc l $resultfile}
-    tail -n 2 $resultfile
+    cat $resultfile
     rm -f "$resultfile"
 }
 
@@ -287,6 +288,12 @@ common_arg_parsing () {
             fi
             command_to_agent="$1#"
             ;;
+        "resize")
+            if [ $# -ne 2 ]; then
+                show_usage_and_exit
+            fi
+            command_to_agent="$1#$2#"
+            ;;
         "stop_listen")
             if [ $# -ne 2 ]; then
                 show_usage_and_exit $*
@@ -22,6 +22,10 @@
 using namespace std;
 
 extern int maxSlotsNum;
+extern int shmFormat;
+extern size_t shmHeapSize;
+extern int shmBackend;
+extern bool shmHugePages;
 const string QCONF_PID_FILE("/pid");
 const string QCONF_LOG_FMT("/logs/qconf.log.%Y-%m-%d-%H");
 
@@ -126,6 +130,49 @@ int main(int argc, char* argv[])
     else {
         maxSlotsNum = QCONF_MAX_SLOTS_NUM;
     }
+    ret = get_agent_conf(SHARED_MEMORY_FORMAT, value);
+    if (ret == QCONF_OK) {
+        shmFormat = atoi(value.c_str());
+        if (QHASHARR_FORMAT_LINEAR != shmFormat && QHASHARR_FORMAT_GROUP != shmFormat
+                && QHASHARR_FORMAT_FPRINT != shmFormat)
+        {
+            LOG_ERR("Unknown shared memory format:%s, use %d", value.c_str(), QHASHARR_FORMAT_LINEAR);
+            shmFormat = QHASHARR_FORMAT_LINEAR;
+        }
+    }
+    ret = get_agent_conf(SHARED_MEMORY_HEAP_SIZE, value);
+    if (ret == QCONF_OK) {
+        long heap_mb = atol(value.c_str());
+        shmHeapSize = (heap_mb > 0) ? ((size_t)heap_mb << 20) : 0;
+    }
+    ret = get_agent_conf(SHARED_MEMORY_BACKEND, value);
+    if (ret == QCONF_OK) {
+        if (value == "posix") {
+            shmBackend = QCONF_SHM_BACKEND_POSIX;
+        }
+        else if (value != "sysv") {
+            LOG_ERR("Unknown shared memory backend:%s, use sysv", value.c_str());
+        }
+    }
+    ret = get_agent_conf(SHARED_MEMORY_HUGE_PAGES, value);
+    if (ret == QCONF_OK) {
+        shmHugePages = (atoi(value.c_str()) > 0);
+    }
+    ret = get_agent_conf(SHARED_MEMORY_NUMA_REPLICAS, value);
+    if (ret == QCONF_OK) {
+        qconf_init_shm_numa_replicas(atoi(value.c_str()) > 0);
+    }
+    ret = get_agent_conf(SHARED_MEMORY_MAX_SIZE, value);
+    if (ret == QCONF_OK) {
+        qconf_init_shm_max_slots(atoi(value.c_str()));
+    }
+    map<string, string> ns_confs;
+    get_ns_confs(ns_confs);
+    for (map<string, string>::const_iterator it = ns_confs.begin(); it != ns_confs.end(); ++it) {
+        if (QCONF_OK != qconf_add_shm_ns(it->first, it->second)) {
+            LOG_ERR("Invalid share memory namespace:%s=%s", it->first.c_str(), it->second.c_str());
+        }
+    }
 
     ret = qconf_agent_init(agent_dir, log_dir);
     if (QCONF_OK != ret)
@@ -220,6 +267,23 @@ static int qconf_agent_init(const string &agent_dir, const string &log_dir)
     if (QCONF_OK == ret) get_integer(value, sc_timeout);
     qconf_init_scexec_timeout(static_cast<int>(sc_timeout));
 
+    long absent_ttl = 60;
+    ret = get_agent_conf(QCONF_KEY_ABSENT_NODE_TTL, value);
+    if (QCONF_OK == ret) get_integer(value, absent_ttl);
+    qconf_init_absent_ttl(static_cast<int>(absent_ttl));
+
+    long miss_interval = 1000;
+    ret = get_agent_conf(QCONF_KEY_MISS_MSG_INTERVAL, value);
+    if (QCONF_OK == ret) get_integer(value, miss_interval);
+    qconf_init_miss_msg_interval(static_cast<int>(miss_interval));
+
+    long snapshot_interval = 0, snapshot_delay = 3000;
+    ret = get_agent_conf(QCONF_KEY_SNAPSHOT_INTERVAL, value);
+    if (QCONF_OK == ret) get_integer(value, snapshot_interval);
+    ret = get_agent_conf(QCONF_KEY_SNAPSHOT_DELAY, value);
+    if (QCONF_OK == ret) get_integer(value, snapshot_delay);
+    qconf_init_snapshot(static_cast<int>(snapshot_interval), static_cast<int>(snapshot_delay));
+
 #ifdef QCONF_CURL_ENABLE
     long fd_enable = 0;
     ret = get_agent_conf(QCONF_KEY_FEEDBACK_ENABLE, value);
@@ -35,6 +35,7 @@ const string _cmd_stop_listen("stop_listen");
 const string _cmd_restart_listen("restart_listen");
 const string _cmd_list_all("list-all");
 const string _cmd_clear_all("clear-all");
+const string _cmd_resize("resize");
 const string _cmd_ls("ls");
 const string _cmd_del("delete");
 const string _cmd_get("get");
@@ -46,6 +47,7 @@ const string _cmd_server_del("serve_delete");
 int qconf_write_file(const string &file_str, const string &content, int append);
 static int operate_list_all(string &result);
 static int operate_clear_all(string &result);
+static int operate_resize(const string &slots, string &result);
 
 /**
  * initial method
@@ -116,8 +118,33 @@ static int operate_restart_listen(const string &host, string &result)
     return QCONF_OK;
 }
 
+/**
+ * One line for each path, like "idc path node,service"
+ */
+static void format_shm_items(const vector<qconf_shm_index_item_t> &items, string &result)
+{
+    for (size_t i = 0; i < items.size(); i++)
+    {
+        string types;
+        if (items[i].types & QCONF_SHM_INDEX_NODE) types.append(",node");
+        if (items[i].types & QCONF_SHM_INDEX_SERVICE) types.append(",service");
+        if (items[i].types & QCONF_SHM_INDEX_BATCH) types.append(",batch");
+
+        if (!result.empty()) result.append("\n");
+        result.append(items[i].idc + " " + items[i].path + " " + types.substr(1));
+    }
+    if (items.empty()) result = "no path in share memory!";
+}
+
 static int operate_list_all(string &result)
 {
+    vector<qconf_shm_index_item_t> items;
+    int ret = qconf_list_shm_tbl("", "", items);
+    if (QCONF_OK != ret && QCONF_ERR_SHM_INDEX_FULL != ret) return ret;
+
+    format_shm_items(items, result);
+    if (QCONF_ERR_SHM_INDEX_FULL == ret) result.append("\nsome paths are not listed since the index is full!");
+
     return QCONF_OK;
 }
 
@@ -132,8 +159,28 @@ static int operate_clear_all(string &result)
     return QCONF_OK;
 }
 
-static int operate_list(const string &host, const string &path, string &result)
+static int operate_resize(const string &slots, string &result)
 {
+    int max_slots = atoi(slots.c_str());
+    if (max_slots <= 0) return QCONF_ERR_PARAM;
+
+    int ret = qconf_resize_shm_tbl(max_slots);
+    if (QCONF_OK != ret) return ret;
+
+    result = "resize share memory success!";
+
+    return QCONF_OK;
+}
+
+static int operate_list(const string &idc, const string &path, string &result)
+{
+    vector<qconf_shm_index_item_t> items;
+    int ret = qconf_list_shm_tbl(idc, path, items);
+    if (QCONF_OK != ret && QCONF_ERR_SHM_INDEX_FULL != ret) return ret;
+
+    format_shm_items(items, result);
+    if (QCONF_ERR_SHM_INDEX_FULL == ret) result.append("\nsome paths are not listed since the index is full!");
+
     return QCONF_OK;
 }
 
@@ -227,6 +274,15 @@ static int single_command_process(const string &line, const string &custom_id)
             }
             ret = operate_clear_all(result);
         }
+        else if (_cmd_resize == command)
+        {
+            if (2 != para_length)
+            {
+                LOG_ERR("Operand error for command:%s", _cmd_resize.c_str());
+                return QCONF_ERR_CMD;
+            }
+            ret = operate_resize(parameters[1], result);
+        }
         else if (_cmd_ls == command)
         {
             if (3 != para_length)
@@ -43,6 +43,7 @@ static void printf_map(const map<string, string> &map);
 //data structure
 static map<string, string> _agent_conf_map;
 static map<string, string> _idc_conf_map;
+static map<string, string> _ns_conf_map;
 
 typedef map<string, string>::iterator map_iterator;
 typedef map<string, string>::const_iterator const_map_iterator;
@@ -348,6 +349,25 @@ static int load_conf_(const string &conf_path)
                 continue;
             }
         }
+        //share memory namespace map
+        else if (0 == key.find(SHARED_MEMORY_NAMESPACE_PREFIX))
+        {
+            string name(key, sizeof(SHARED_MEMORY_NAMESPACE_PREFIX) - 1);
+            if (name.empty() || QCONF_OK != is_valid_conf(key, value))
+            {
+                LOG_ERR("Invalid share memory namespace! line_num:%zd, key:%s, value:%s",
+                        line_num, key.c_str(), value.c_str());
+                continue;
+            }
+
+            ret = _ns_conf_map.insert(make_pair(name, value));
+            if (!ret.second)
+            {
+                LOG_ERR("Failed to put namespace map item:<%s, %s>",
+                        name.c_str(), value.c_str());
+                continue;
+            }
+        }
         else
         {
             if (QCONF_OK != is_valid_conf(key, value))
@@ -411,6 +431,15 @@ int get_idc_conf(const string &idc, string &value)
     return QCONF_OK;
 }
 
+/**
+ * Get the conf of all share memory namespaces
+ */
+int get_ns_confs(map<string, string> &ns_confs)
+{
+    ns_confs = _ns_conf_map;
+    return QCONF_OK;
+}
+
 /**
  * Destroy the configuration environment
  */
@@ -418,4 +447,5 @@ void qconf_destroy_conf_map()
 {
     _agent_conf_map.clear();
     _idc_conf_map.clear();
+    _ns_conf_map.clear();
 }
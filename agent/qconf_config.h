@@ -19,6 +19,11 @@ int get_agent_conf(const std::string &key, std::string &value);
  */
 int get_idc_conf(const std::string &idc, std::string &value);
 
+/**
+ * Get the conf of all share memory namespaces, name => conf
+ */
+int get_ns_confs(std::map<std::string, std::string> &ns_confs);
+
 /**
  * Destory environment
  */
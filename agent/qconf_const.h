@@ -62,6 +62,13 @@
 #define QCONF_KEY_FEEDBACK_ENABLE           "feedback_enable"
 #define QCONF_KEY_FEEDBACK_URL              "feedback_url"
 #define	QCONF_KEY_SCEXECTIMEOUT             "script_execute_timeout"
+#define QCONF_KEY_ABSENT_NODE_TTL           "absent_node_ttl"
+#define QCONF_KEY_MISS_MSG_INTERVAL         "miss_msg_interval"
+#define QCONF_KEY_SNAPSHOT_INTERVAL         "snapshot_interval"
+#define QCONF_KEY_SNAPSHOT_DELAY            "snapshot_delay"
+
+// keys of messages from clients remembered for rate limiting
+#define QCONF_MISS_MSG_KEYS_MAX             100000
 
 // no need feedbcak nodes
 #define QCONF_ANCHOR_NODE                   "/qconf/__qconf_anchor_node"
@@ -85,6 +92,20 @@
 
 //shared memory size
 #define SHARED_MEMORY_SIZE                  "shared_memory_size"
+//shared memory format
+#define SHARED_MEMORY_FORMAT                "shared_memory_format"
+//shared memory value heap size in MB
+#define SHARED_MEMORY_HEAP_SIZE             "shared_memory_heap_size"
+//shared memory grows up to this size when it's nearly full
+#define SHARED_MEMORY_MAX_SIZE              "shared_memory_max_size"
+//shared memory is a SysV segment or a POSIX object
+#define SHARED_MEMORY_BACKEND               "shared_memory_backend"
+//shared memory is backed by huge pages
+#define SHARED_MEMORY_HUGE_PAGES            "shared_memory_huge_pages"
+//shared memory is replicated on each NUMA node
+#define SHARED_MEMORY_NUMA_REPLICAS         "shared_memory_numa_replicas"
+//namespace of share memory, shm_namespace.<name>=<prefix>,<key>,<size>[,lru|none]
+#define SHARED_MEMORY_NAMESPACE_PREFIX      "shm_namespace."
 
 /* trigger type */
 #define QCONF_TRIGGER_TYPE_ADD_OR_MODIFY    '0'
@@ -214,6 +214,9 @@ int qconf_dump_tbl(qhasharr_t *tbl)
 
         if (QCONF_OK == ret) 
         {
+            // marks of absent nodes are kept in share memory only
+            if (QCONF_DATA_TYPE_ABSENT == get_data_type(tblkey)) continue;
+
             // write dump
             ret = qconf_dump_set(tblkey, tblval);
             if (QCONF_OK != ret) break;
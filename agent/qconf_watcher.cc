@@ -1,16 +1,20 @@
+#include <time.h>
 #include <string.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <sys/time.h>
 
 #include <map>
 #include <set>
 #include <deque>
 #include <vector>
+#include <algorithm>
 
 #include "qconf_zoo.h"
 #include "qconf_log.h"
 #include "qconf_msg.h"
 #include "qconf_shm.h"
+#include "qconf_snapshot.h"
 #include "qconf_dump.h"
 #include "qconf_const.h"
 #include "qconf_script.h"
@@ -27,7 +31,19 @@ using namespace std;
 /**
  * Global variable
  */
+extern int maxSlotsNum;
+
 static qhasharr_t *_shm_tbl = NULL; //share memory table
+static qconf_shm_ctrl_t *_shm_ctrl = NULL; //control segment publishing _shm_tbl
+static qconf_shm_gens_t *_shm_gens = NULL; //generation words clients wait on
+static qconf_shm_journal_t *_shm_journal = NULL; //change journal clients tail
+static qconf_shm_ns_t *_shm_ns = NULL; //directory of namespaces clients route paths by
+static qconf_shm_index_t *_shm_index = NULL; //sorted paths of all tables clients list
+static qconf_shm_replicas_t *_shm_replicas = NULL; //replicas of _shm_tbl on NUMA nodes
+static bool _numa_replicas = false; //whether _shm_tbl is replicated on each NUMA node
+static vector<qconf_shm_ns_entry_t> _ns_entries; //namespaces configured
+static vector<qhasharr_t*> _ns_tbls; //tables of _ns_entries
+static int _max_slots_limit = 0; //share memory table grows up to it, 0 for never
 static int _msg_queue_id = -1;  // message queue id for sending or receiving message
 static string _register_node_path;
 static int _recv_timeout = 3000; //zookeeper timeout
@@ -36,6 +52,13 @@ static bool _stop_watcher_setting = false;  //stop flag
 static bool _fb_enable = false;             //whether enable feedback
 static bool _finish_process_tbl_sleep_setting = true; //process tbl thread finish sleep
 static string _local_idc; //local idc
+static int _absent_ttl = 60; //seconds nodes absent on zookeeper are marked so, 0 for never
+static int _miss_msg_interval = 1000; //ms messages of a key being fetched are ignored in
+static int _snapshot_interval = 0; //seconds a snapshot of share memory is taken in at most, 0 for never
+static int _snapshot_delay = 3000; //ms writes settle for before a snapshot is taken
+
+// key => ms the last message of it is got, used by the message thread only
+static std::map<string, uint64_t> _miss_msg_times;
 
 // key: zkhost => value: pointer to zhandle_t
 static Mutex _ht_ih_mutex;
@@ -45,10 +68,15 @@ static std::map<string, zhandle_t*> _ht_idchost_handle;
 static Mutex _ht_hi_mutex;
 static std::map<unsigned long, string> _ht_handle_idchost;
 
+// Keys of users' data in the last snapshot written
+static Mutex _snapshot_keys_mutex;
+static set<string> _snapshot_keys;
+
 // Nodes need to be get from zk and set into share memory
 static Mutex _watch_nodes_mutex;
 static CondVar _watch_nodes_cond(&_watch_nodes_mutex);
 static deque<string> _need_watch_nodes;
+static deque< vector<string> > _need_watch_groups; //nodes published together
 static set<string> _exist_watch_nodes;
 
 // Nodes receiving data from zk, and watcher may check this set
@@ -74,12 +102,21 @@ static void *msg_process(void *p);
 static void *assist_watcher_process(void *p);
 static void *change_trigger_process(void *p);
 static void *do_gray_process(void *p);
+static void *snapshot_process(void *p);
 static void deque_process();
 
 /**
  * Traverse share memory and update its item
  */
 static int process_tbl();
+static void process_one_tbl(qhasharr_t *tbl, const char *name);
+static qhasharr_t *shm_tbl_of(const string &tblkey);
+static void qconf_init_shm_ns();
+static void qconf_init_shm_index();
+static void qconf_init_shm_replicas();
+static int write_snapshot(uint64_t &generation);
+static bool tblkey_kept(const string &tblkey);
+static void get_snapshot_entries(qhasharr_t *tbl, map<string, string> &entries);
 static void msleep_interval(int num);
 
 /**
@@ -99,9 +136,18 @@ static void init_env_for_zk(zhandle_t *zh, const string &idc_host, const string
  * Send node which need to update or remove to the thread who do that
  */
 static void add_watcher_node(const string &key);
+static void add_watcher_group(const vector<string> &keys);
+static bool miss_msg_limited(const string &key);
+static void set_absent_node(zhandle_t *zh, const string &tblkey, const string &path);
+static void del_absent_node(const string &tblkey);
+static bool process_absent_node(const string &tblkey, const string &tblval);
 static int process_node(zhandle_t *zh, const string &tblkey, const string &path);
 static int process_service(zhandle_t *zh, const string &tblkey, const string &path);
 static int process_batch(zhandle_t *zh, const string &tblkey, const string &path);
+static int get_node_entry(zhandle_t *zh, const string &tblkey, const string &path, qconf_tbl_entry_t &entry);
+static int publish_batch(zhandle_t *zh, const string &tblkey, const string &tblval, const struct Stat &stat, const string &path, const string_vector_t &nodes);
+static void finish_node_entry(zhandle_t *zh, const qconf_tbl_entry_t &entry, const string &path);
+static void publish_node_group(const vector<string> &tblkeys);
 
 static zhandle_t *get_zhandle_by_idc(const string &idc);
 static int get_idc_by_zhandle(const zhandle_t *zh, string &idc, string &host);
@@ -171,20 +217,255 @@ static void lock_ht_keys(const map<K, V> &ht, Mutex &mu, vector<K> &idcs)
 
 int qconf_init_shm_tbl()
 {
-    int ret = create_hash_tbl(_shm_tbl, QCONF_DEFAULT_SHM_KEY, 0644);
-    if (ret == QCONF_OK) {
-        bool initRet = LRU::getInstance()->initLruMem(_shm_tbl);
-        if (!initRet) {
-            LOG_ERR("Init LRU memory failed");
-            ret = QCONF_ERR_MEM; 
+    key_t shmkey = QCONF_DEFAULT_SHM_KEY;
+    uint32_t generation = 0;
+    int ret = create_shm_ctrl(_shm_ctrl, QCONF_DEFAULT_SHM_CTRL_KEY, QCONF_DEFAULT_SHM_KEY, 0644);
+    if (QCONF_OK == ret) ret = shm_ctrl_get(_shm_ctrl, shmkey, generation);
+    if (QCONF_OK != ret)
+    {
+        LOG_FATAL_ERR("Failed to init share memory control segment! ret:%d", ret);
+        return ret;
+    }
+
+    // clients poll the table without them
+    int gens_ret = create_shm_gens(_shm_gens, QCONF_DEFAULT_SHM_GENS_KEY, QCONF_SHM_GENS_NUM, 0644);
+    if (QCONF_OK != gens_ret)
+        LOG_ERR("Failed to init generation words of share memory! ret:%d", gens_ret);
+    int journal_ret = create_shm_journal(_shm_journal, QCONF_DEFAULT_SHM_JOURNAL_KEY, QCONF_SHM_JOURNAL_NUM, 0644);
+    if (QCONF_OK != journal_ret)
+        LOG_ERR("Failed to init change journal of share memory! ret:%d", journal_ret);
+
+    // the tables may be recreated since the last snapshot was written
+    unlink(QCONF_DEFAULT_SNAPSHOT_PATH);
+
+    ret = create_hash_tbl(_shm_tbl, shmkey, 0644);
+    if (QCONF_OK == ret) qconf_init_shm_ns();
+    if (QCONF_OK == ret)
+    {
+        // the table is resized when shared_memory_size changes, but the
+        // slots grown automatically are kept
+        int max_slots = _shm_tbl->maxslots;
+        if (max_slots < maxSlotsNum || (max_slots > maxSlotsNum && max_slots > _max_slots_limit))
+        {
+            int resize_ret = hash_tbl_resize(_shm_tbl, _shm_ctrl, maxSlotsNum, 0644);
+            if (QCONF_OK != resize_ret)
+                LOG_ERR("Failed to resize share memory to %d slots! ret:%d", maxSlotsNum, resize_ret);
         }
+        qconf_init_shm_replicas();
+        qconf_init_shm_index();
     }
     return ret;
 }
 
+/**
+ * Index the paths kept in the tables. It's sized for the slots the tables
+ * may grow to, paths beyond that are dropped
+ */
+static void qconf_init_shm_index()
+{
+    uint32_t max_keys = max(max(maxSlotsNum, _max_slots_limit), _shm_tbl->maxslots);
+    for (size_t i = 0; i < _ns_entries.size(); i++)
+        max_keys += _ns_entries[i].max_slots;
+
+    int ret = create_shm_index(_shm_index, QCONF_DEFAULT_SHM_INDEX_KEY, max_keys, 0644);
+    if (QCONF_OK != ret)
+    {
+        LOG_ERR("Failed to init path index of share memory! ret:%d", ret);
+        return;
+    }
+
+    shm_index_add_tbl(_shm_tbl);
+    for (size_t i = 0; i < _ns_tbls.size(); i++)
+        shm_index_add_tbl(_ns_tbls[i]);
+}
+
+/**
+ * Replicate the table on each NUMA node, or publish it alone so replicas left
+ * by the last agent are dropped. Clients read the table itself without them
+ */
+static void qconf_init_shm_replicas()
+{
+    int ret = create_shm_replicas(_shm_replicas, QCONF_DEFAULT_SHM_REPLICAS_KEY, 0644);
+    key_t shmkey = QCONF_DEFAULT_SHM_KEY;
+    uint32_t generation = 0;
+    if (QCONF_OK == ret) ret = shm_ctrl_get(_shm_ctrl, shmkey, generation);
+    if (QCONF_OK == ret)
+    {
+        int nreplicas = _numa_replicas ? qconf_numa_nodes() : 1;
+        ret = hash_tbl_replicate(_shm_tbl, shmkey, _shm_replicas, nreplicas, 0644);
+    }
+    if (QCONF_OK != ret)
+        LOG_ERR("Failed to replicate share memory on numa nodes! ret:%d", ret);
+}
+
+/**
+ * Create the tables of namespaces and publish them, paths of the ones
+ * failed stay in the default table
+ */
+static void qconf_init_shm_ns()
+{
+    int ret = create_shm_ns(_shm_ns, QCONF_DEFAULT_SHM_NS_KEY, 0644);
+    if (QCONF_OK != ret)
+    {
+        LOG_ERR("Failed to init namespace directory of share memory! ret:%d", ret);
+        _ns_entries.clear();
+        return;
+    }
+
+    vector<qconf_shm_ns_entry_t> entries;
+    for (size_t i = 0; i < _ns_entries.size(); i++)
+    {
+        qhasharr_t *tbl = NULL;
+        const qconf_shm_ns_entry_t &entry = _ns_entries[i];
+        ret = create_hash_tbl(tbl, entry.shmkey, 0644, entry.max_slots, entry.evict);
+        if (QCONF_OK != ret)
+        {
+            LOG_ERR("Failed to init share memory of namespace:%s key:%#x! ret:%d",
+                    entry.name, entry.shmkey, ret);
+            continue;
+        }
+        entries.push_back(entry);
+        _ns_tbls.push_back(tbl);
+    }
+    _ns_entries.swap(entries);
+
+    ret = shm_ns_publish(_shm_ns, _ns_entries);
+    if (QCONF_OK != ret)
+        LOG_ERR("Failed to publish namespaces of share memory! ret:%d", ret);
+}
+
+int qconf_add_shm_ns(const string &name, const string &conf)
+{
+    if (name.empty() || name.size() >= QCONF_SHM_NS_NAME_LEN) return QCONF_ERR_PARAM;
+    if (_ns_entries.size() >= QCONF_SHM_NS_MAX) return QCONF_ERR_OUT_OF_RANGE;
+
+    // <prefix>,<key>,<size>[,lru|none]
+    vector<string> items;
+    size_t pos = 0, next = 0;
+    while (string::npos != (next = conf.find(',', pos)))
+    {
+        items.push_back(conf.substr(pos, next - pos));
+        pos = next + 1;
+    }
+    items.push_back(conf.substr(pos));
+    if (items.size() < 3 || items.size() > 4) return QCONF_ERR_PARAM;
+
+    qconf_shm_ns_entry_t entry;
+    memset(&entry, 0, sizeof(entry));
+    long shmkey = 0, max_slots = 0;
+    if ('/' != items[0][0] || items[0].size() >= QCONF_SHM_NS_PREFIX_LEN
+            || QCONF_OK != get_integer(items[1], shmkey)
+            || QCONF_OK != get_integer(items[2], max_slots) || max_slots <= 0)
+        return QCONF_ERR_PARAM;
+    if (QCONF_DEFAULT_SHM_KEY == shmkey || QCONF_DEFAULT_SHM_KEY + 1 == shmkey)
+        return QCONF_ERR_PARAM;
+    if (items.size() > 3 && "none" == items[3])
+        entry.evict = QCONF_SHM_EVICT_NONE;
+    else if (items.size() > 3 && "lru" != items[3])
+        return QCONF_ERR_PARAM;
+
+    memcpy(entry.name, name.data(), name.size());
+    memcpy(entry.prefix, items[0].data(), items[0].size());
+    entry.shmkey = shmkey;
+    entry.max_slots = max_slots;
+    _ns_entries.push_back(entry);
+    return QCONF_OK;
+}
+
 void qconf_clear_shm_tbl()
 {
     hash_tbl_clear(_shm_tbl);
+    for (size_t i = 0; i < _ns_tbls.size(); i++)
+        hash_tbl_clear(_ns_tbls[i]);
+}
+
+int qconf_list_shm_tbl(const string &idc, const string &prefix, vector<qconf_shm_index_item_t> &items)
+{
+    if (NULL == _shm_index) return QCONF_ERR_SHMINIT;
+    return shm_index_list(_shm_index, idc, prefix, items);
+}
+
+void qconf_init_shm_max_slots(int max_slots)
+{
+    _max_slots_limit = max_slots;
+}
+
+void qconf_init_shm_numa_replicas(bool numa_replicas)
+{
+    _numa_replicas = numa_replicas;
+}
+
+int qconf_resize_shm_tbl(int max_slots)
+{
+    if (NULL == _shm_tbl || NULL == _shm_ctrl) return QCONF_ERR_SHMINIT;
+    return hash_tbl_resize(_shm_tbl, _shm_ctrl, max_slots, 0644);
+}
+
+/**
+ * Double the share memory table when it's nearly full instead of evicting
+ */
+static void grow_shm_tbl()
+{
+    if (_max_slots_limit <= 0) return;
+
+    int max_slots = 0, used_slots = 0;
+    hash_tbl_get_count(_shm_tbl, max_slots, used_slots);
+    if (max_slots >= _max_slots_limit || used_slots < max_slots / 10 * 9) return;
+
+    int new_slots = (max_slots > _max_slots_limit / 2) ? _max_slots_limit : max_slots * 2;
+    int ret = hash_tbl_resize(_shm_tbl, _shm_ctrl, new_slots, 0644);
+    if (QCONF_OK != ret)
+        LOG_ERR("Failed to grow share memory from %d to %d slots! ret:%d", max_slots, new_slots, ret);
+}
+
+/**
+ * Table keeping tblkey, the one of its namespace or the default one
+ */
+static qhasharr_t *shm_tbl_of(const string &tblkey)
+{
+    int index = shm_ns_route(_ns_entries, tblkey.data(), tblkey.size());
+    return (index < 0) ? _shm_tbl : _ns_tbls[index];
+}
+
+static int shm_tbl_set(const string &tblkey, const string &tblval, int64_t mzxid = 0, int64_t pzxid = 0)
+{
+    qhasharr_t *tbl = shm_tbl_of(tblkey);
+    if (tbl == _shm_tbl) grow_shm_tbl();
+    return hash_tbl_set(tbl, tblkey, tblval, mzxid, pzxid);
+}
+
+/**
+ * Entries of one table are written at once, entries of several namespaces
+ * are written table by table
+ */
+static int shm_tbl_set_batch(vector<qconf_tbl_entry_t> &entries)
+{
+    map<qhasharr_t*, vector<size_t> > groups;
+    for (size_t i = 0; i < entries.size(); i++)
+        groups[shm_tbl_of(entries[i].key)].push_back(i);
+
+    if (groups.size() <= 1)
+    {
+        qhasharr_t *tbl = groups.empty() ? _shm_tbl : groups.begin()->first;
+        if (tbl == _shm_tbl) grow_shm_tbl();
+        return hash_tbl_set_batch(tbl, entries);
+    }
+
+    int ret = QCONF_OK;
+    map<qhasharr_t*, vector<size_t> >::const_iterator it;
+    for (it = groups.begin(); it != groups.end(); ++it)
+    {
+        vector<qconf_tbl_entry_t> group;
+        for (size_t i = 0; i < it->second.size(); i++)
+            group.push_back(entries[it->second[i]]);
+
+        if (it->first == _shm_tbl) grow_shm_tbl();
+        int group_ret = hash_tbl_set_batch(it->first, group);
+        for (size_t i = 0; i < it->second.size(); i++)
+            entries[it->second[i]].ret = group[i].ret;
+        if (QCONF_OK == ret) ret = group_ret;
+    }
+    return ret;
 }
 
 int qconf_init_msg_key()
@@ -248,6 +529,22 @@ int qconf_init_local_idc(const string &idc)
     return ret;
 }
 
+void qconf_init_absent_ttl(int ttl)
+{
+    _absent_ttl = (ttl < 0) ? 0 : ttl;
+}
+
+void qconf_init_miss_msg_interval(int interval)
+{
+    _miss_msg_interval = (interval < 0) ? 0 : interval;
+}
+
+void qconf_init_snapshot(int interval, int delay)
+{
+    _snapshot_interval = (interval < 0) ? 0 : interval;
+    _snapshot_delay = (delay < 0) ? 0 : delay;
+}
+
 void qconf_init_scexec_timeout(int timeout)
 {
     _scexec_timeout = (timeout < 500) ? 500 : timeout;
@@ -259,7 +556,7 @@ void qconf_init_scexec_timeout(int timeout)
 int watcher_setting_start()
 {
     int ret = 0;
-    pthread_t assist_watcher_thread, msg_thread, change_trigger_thread, gray_thread;
+    pthread_t assist_watcher_thread, msg_thread, change_trigger_thread, gray_thread, snapshot_thread;
 
     // Assist watcher thread, scan share tbl regularly
     ret = pthread_create(&assist_watcher_thread, NULL, assist_watcher_process, NULL);
@@ -302,10 +599,22 @@ int watcher_setting_start()
         return QCONF_ERR_OTHER;
     }
 
+    // Snapshot thread, write the snapshot of share table once it settles
+    bool snapshot_started = false;
+    if (_snapshot_interval > 0 && NULL != _shm_journal)
+    {
+        ret = pthread_create(&snapshot_thread, NULL, snapshot_process, NULL);
+        if (0 == ret)
+            snapshot_started = true;
+        else
+            LOG_ERR("Failed create snapshot_thread! errno: %d", ret);
+    }
+
     // Main thread, set watcher on zookeeper and write share table
     deque_process();
 
     qconf_thread_exit();
+    if (snapshot_started) pthread_join(snapshot_thread, NULL);
     pthread_join(gray_thread, NULL);
     pthread_join(change_trigger_thread, NULL);
     pthread_join(msg_thread, NULL);
@@ -327,6 +636,107 @@ static void *assist_watcher_process(void *p)
     pthread_exit(NULL);
 }
 
+static void *snapshot_process(void *p)
+{
+    uint64_t seen = 0, taken = (uint64_t)-1;
+    uint64_t changed_ms = 0, taken_ms = 0;
+
+    while (!_stop_watcher_setting)
+    {
+        usleep(100000);
+        if (_stop_watcher_setting) break;
+
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        uint64_t now = (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+        uint64_t head = shm_journal_head(_shm_journal);
+        if (head != seen)
+        {
+            seen = head;
+            changed_ms = now;
+        }
+        if (head == taken) continue;
+
+        // wait for writes to settle, but not longer than the interval
+        if (now - changed_ms < (uint64_t)_snapshot_delay
+                && now - taken_ms < (uint64_t)_snapshot_interval * 1000)
+            continue;
+
+        uint64_t generation = 0;
+        if (QCONF_OK == write_snapshot(generation)) taken = generation;
+        taken_ms = now;
+    }
+    pthread_exit(NULL);
+}
+
+/**
+ * Write users' data of all tables into the snapshot file. Clients get the
+ * keys written since generation from the tables instead
+ */
+static int write_snapshot(uint64_t &generation)
+{
+    generation = shm_journal_head(_shm_journal);
+
+    map<string, string> entries;
+    get_snapshot_entries(_shm_tbl, entries);
+    for (size_t i = 0; i < _ns_tbls.size(); i++)
+        get_snapshot_entries(_ns_tbls[i], entries);
+
+    int ret = qconf_snapshot_write(QCONF_DEFAULT_SNAPSHOT_PATH, entries, generation);
+    if (QCONF_OK != ret)
+    {
+        LOG_ERR("Failed to write snapshot of share memory! ret:%d", ret);
+        return ret;
+    }
+    LOG_INFO("Snapshot of share memory written, keys:%zu generation:%llu",
+            entries.size(), (unsigned long long)generation);
+
+    set<string> keys;
+    for (map<string, string>::const_iterator it = entries.begin(); it != entries.end(); ++it)
+        keys.insert(keys.end(), it->first);
+    _snapshot_keys_mutex.Lock();
+    _snapshot_keys.swap(keys);
+    _snapshot_keys_mutex.Unlock();
+    return QCONF_OK;
+}
+
+/**
+ * Whether tblkey is kept in share memory, or in the snapshot clients read
+ * even if it's evicted from the table
+ */
+static bool tblkey_kept(const string &tblkey)
+{
+    if (hash_tbl_exist(shm_tbl_of(tblkey), tblkey)) return true;
+
+    _snapshot_keys_mutex.Lock();
+    bool kept = (_snapshot_keys.end() != _snapshot_keys.find(tblkey));
+    _snapshot_keys_mutex.Unlock();
+    return kept;
+}
+
+static void get_snapshot_entries(qhasharr_t *tbl, map<string, string> &entries)
+{
+    int max_slots = 0, used_slots = 0;
+    hash_tbl_get_count(tbl, max_slots, used_slots);
+
+    string tblkey, tblval;
+    for (int idx = 0; idx < max_slots && !_stop_watcher_setting; )
+    {
+        if (QCONF_OK != hash_tbl_getnext(tbl, tblkey, tblval, idx)) continue;
+
+        switch (get_data_type(tblkey))
+        {
+            case QCONF_DATA_TYPE_NODE:
+            case QCONF_DATA_TYPE_SERVICE:
+            case QCONF_DATA_TYPE_BATCH_NODE:
+                entries[tblkey] = tblval;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
 static void msleep_interval(int msecond)
 {
     int count = 0, num = msecond / 10;
@@ -344,9 +754,19 @@ static void *msg_process(void *p)
     {
         int ret = receive_msg(_msg_queue_id, key);
         if (_stop_watcher_setting) break;
-        if (QCONF_OK == ret)
+        if (QCONF_OK == ret && QCONF_DATA_TYPE_MULTI_KEYS == key[0])
         {
-            add_watcher_node(key);
+            vector<string> tblkeys;
+            if (QCONF_OK != msg_to_tblkeys(key, tblkeys))
+                LOG_ERR("Failed to get keys from message of %zd bytes!", key.size());
+            for (size_t i = 0; i < tblkeys.size(); i++)
+            {
+                if (!miss_msg_limited(tblkeys[i])) add_watcher_node(tblkeys[i]);
+            }
+        }
+        else if (QCONF_OK == ret)
+        {
+            if (!miss_msg_limited(key)) add_watcher_node(key);
         }
         else if (QCONF_ERR_MSGIDRM == ret)
         {
@@ -392,19 +812,33 @@ static void deque_process()
     while (!_stop_watcher_setting)
     {
         string tblkey;
+        vector<string> group;
         _watch_nodes_mutex.Lock();
-        while (!_stop_watcher_setting && _need_watch_nodes.size() == 0)
+        while (!_stop_watcher_setting && _need_watch_nodes.size() == 0 && _need_watch_groups.size() == 0)
         {
             _watch_nodes_cond.Wait();
         }
 
-        if (!_need_watch_nodes.empty())
+        if (!_need_watch_groups.empty())
+        {
+            group.swap(_need_watch_groups.front());
+            _need_watch_groups.pop_front();
+        }
+        else if (!_need_watch_nodes.empty())
         {
             tblkey = _need_watch_nodes.front();
             _need_watch_nodes.pop_front();
             _exist_watch_nodes.erase(tblkey);
         }
         _watch_nodes_mutex.Unlock();
+        if (!group.empty())
+        {
+            for (size_t i = 0; i < group.size(); i++) add_pending_node(group[i]);
+            publish_node_group(group);
+            for (size_t i = 0; i < group.size(); i++) del_pending_node(group[i]);
+            continue;
+        }
+
         add_pending_node(tblkey);
         if (!tblkey.empty() && QCONF_OK != set_watcher_and_update_tbl(tblkey))
         {
@@ -414,18 +848,22 @@ static void deque_process()
     }
 }
 
-static int process_tbl()
+/**
+ * Dump the entries of tbl and check them against zookeeper
+ */
+static void process_one_tbl(qhasharr_t *tbl, const char *name)
 {
-    // Check share memory
     int max_slots = 0, used_slots = 0;
-    hash_tbl_get_count(_shm_tbl, max_slots, used_slots);
+    hash_tbl_get_count(tbl, max_slots, used_slots);
 
     string tblkey, tblval;
     for (int idx = 0; idx < max_slots && !_stop_watcher_setting; ) 
     {
-        int ret = hash_tbl_getnext(_shm_tbl, tblkey, tblval, idx);
+        int ret = hash_tbl_getnext(tbl, tblkey, tblval, idx);
         if (QCONF_OK == ret)
         {
+            if (process_absent_node(tblkey, tblval)) continue;
+
             // do dump everytime
             if (QCONF_OK != qconf_dump_set(tblkey, tblval))
             {
@@ -447,6 +885,23 @@ static int process_tbl()
         }
     }
 
+    // Report occupancy of the value heap
+    qhasharr_heap_stat_t heap_stat;
+    if (QCONF_OK == hash_tbl_get_heap_stat(tbl, heap_stat))
+    {
+        LOG_INFO("shm %s slots used:%d/%d, heap used:%zu/%zu values:%zu free blocks:%zu max free:%zu",
+                name, used_slots, max_slots, heap_stat.used, heap_stat.size, heap_stat.values,
+                heap_stat.freeblocks, heap_stat.maxfree);
+    }
+}
+
+static int process_tbl()
+{
+    // Check share memory
+    process_one_tbl(_shm_tbl, "default");
+    for (size_t i = 0; i < _ns_tbls.size(); i++)
+        process_one_tbl(_ns_tbls[i], _ns_entries[i].name);
+
     // Watch notify node for current machine
     zhandle_t *zh = NULL;
     vector<string> idcs;
@@ -541,7 +996,7 @@ static int set_watcher_and_update_tbl(const string &tblkey)
     // If the node is gray nodes
     if (is_gray_node(tblkey, gray_value))
     {
-        ret = hash_tbl_set(_shm_tbl, tblkey, gray_value);
+        ret = shm_tbl_set(tblkey, gray_value);
         if (QCONF_OK == ret)
         {
             add_change_trigger_node(tblkey, gray_value, QCONF_TRIGGER_TYPE_ADD_OR_MODIFY);
@@ -584,7 +1039,7 @@ static int set_watcher_and_update_tbl(const string &tblkey)
             LOG_ERR_KEY_INFO(tblkey, "Failed to get value from dump!");
             return QCONF_ERR_OTHER;
         }
-        ret = hash_tbl_set(_shm_tbl, tblkey, tblval);
+        ret = shm_tbl_set(tblkey, tblval);
         ret = (QCONF_ERR_SAME_VALUE == ret) ? QCONF_OK : ret;
         return ret;
     }
@@ -595,13 +1050,16 @@ static int set_watcher_and_update_tbl(const string &tblkey)
 static int process_node(zhandle_t *zh, const string &tblkey, const string &path)
 {
     string val, tblval;
-    int ret = zk_get_node(zh, path, val, 1);
+    struct Stat stat;
+    memset(&stat, 0, sizeof(stat));
+    int ret = zk_get_node(zh, path, val, 1, &stat);
     
     switch (ret)
     {
     case QCONF_OK:
+        del_absent_node(tblkey);
         nodeval_to_tblval(tblkey, val, tblval);
-        ret = hash_tbl_set(_shm_tbl, tblkey, tblval);
+        ret = shm_tbl_set(tblkey, tblval, stat.mzxid, stat.pzxid);
         if (QCONF_OK == ret)
         {
             add_change_trigger_node(tblkey, tblval, QCONF_TRIGGER_TYPE_ADD_OR_MODIFY);
@@ -609,8 +1067,9 @@ static int process_node(zhandle_t *zh, const string &tblkey, const string &path)
         ret = (QCONF_ERR_SAME_VALUE == ret) ? QCONF_OK : ret;
         return ret;
     case QCONF_NODE_NOT_EXIST:
-        ret = hash_tbl_remove(_shm_tbl, tblkey);
+        ret = hash_tbl_remove(shm_tbl_of(tblkey), tblkey);
         add_change_trigger_node(tblkey, tblval, QCONF_TRIGGER_TYPE_REMOVE);
+        set_absent_node(zh, tblkey, path);
         return ret;
     default:
         LOG_ERR("Failed to get node value! path:%s", path.c_str());
@@ -625,12 +1084,15 @@ static int process_service(zhandle_t *zh, const string &tblkey, const string &pa
     string_vector_t chdnodes;
     memset(&chdnodes, 0, sizeof(string_vector_t));
 
-    int ret = zk_get_chdnodes_with_status(zh, path, chdnodes, status);
+    struct Stat stat;
+    memset(&stat, 0, sizeof(stat));
+    int ret = zk_get_chdnodes_with_status(zh, path, chdnodes, status, &stat);
     switch (ret)
     {
     case QCONF_OK:
+        del_absent_node(tblkey);
         chdnodeval_to_tblval(tblkey, chdnodes, tblval, status);
-        ret = hash_tbl_set(_shm_tbl, tblkey, tblval);
+        ret = shm_tbl_set(tblkey, tblval, stat.mzxid, stat.pzxid);
         if (QCONF_OK == ret)
         {
 #ifdef QCONF_CURL_ENABLE
@@ -642,8 +1104,9 @@ static int process_service(zhandle_t *zh, const string &tblkey, const string &pa
         ret = (QCONF_ERR_SAME_VALUE == ret) ? QCONF_OK : ret;
         return ret;
     case QCONF_NODE_NOT_EXIST:
-        ret = hash_tbl_remove(_shm_tbl, tblkey);
+        ret = hash_tbl_remove(shm_tbl_of(tblkey), tblkey);
         add_change_trigger_node(tblkey, tblval, QCONF_TRIGGER_TYPE_REMOVE);
+        set_absent_node(zh, tblkey, path);
         return ret;
     default:
         return ret;
@@ -655,12 +1118,15 @@ static int process_batch(zhandle_t *zh, const string &tblkey, const string &path
     string_vector_t nodes;
     memset(&nodes, 0, sizeof(string_vector_t));
     string tblval, fb_val;
-    int ret = zk_get_chdnodes(zh, path, nodes);
+    struct Stat stat;
+    memset(&stat, 0, sizeof(stat));
+    int ret = zk_get_chdnodes(zh, path, nodes, &stat);
     switch (ret)
     {
     case QCONF_OK:
+        del_absent_node(tblkey);
         batchnodeval_to_tblval(tblkey, nodes, tblval);
-        ret = hash_tbl_set(_shm_tbl, tblkey, tblval);
+        ret = publish_batch(zh, tblkey, tblval, stat, path, nodes);
         if (QCONF_OK == ret)
         {
 #ifdef QCONF_CURL_ENABLE
@@ -672,14 +1138,232 @@ static int process_batch(zhandle_t *zh, const string &tblkey, const string &path
         ret = (QCONF_ERR_SAME_VALUE == ret) ? QCONF_OK : ret;
         return ret;
     case QCONF_NODE_NOT_EXIST:
-        ret = hash_tbl_remove(_shm_tbl, tblkey);
+        ret = hash_tbl_remove(shm_tbl_of(tblkey), tblkey);
         add_change_trigger_node(tblkey, tblval, QCONF_TRIGGER_TYPE_REMOVE);
+        set_absent_node(zh, tblkey, path);
         return ret;
     default:
         return ret;
     }
 }
 
+/**
+ * Get the entry of node tblkey from zookeeper, or the gray value if it's in
+ * a gray release. The entry removes tblkey if the node doesn't exist
+ */
+static int get_node_entry(zhandle_t *zh, const string &tblkey, const string &path, qconf_tbl_entry_t &entry)
+{
+    entry.key = tblkey;
+    entry.val.clear();
+    entry.mzxid = entry.pzxid = 0;
+    entry.remove = false;
+    entry.ret = QCONF_OK;
+    if (is_gray_node(tblkey, entry.val)) return QCONF_OK;
+
+    string val;
+    struct Stat stat;
+    memset(&stat, 0, sizeof(stat));
+    int ret = zk_get_node(zh, path, val, 1, &stat);
+    switch (ret)
+    {
+    case QCONF_OK:
+        nodeval_to_tblval(tblkey, val, entry.val);
+        entry.mzxid = stat.mzxid;
+        entry.pzxid = stat.pzxid;
+        return QCONF_OK;
+    case QCONF_NODE_NOT_EXIST:
+        entry.remove = true;
+        return QCONF_OK;
+    default:
+        LOG_ERR("Failed to get node value! path:%s", path.c_str());
+        return ret;
+    }
+}
+
+/**
+ * Trigger the change of a node entry written by shm_tbl_set_batch, as
+ * process_node does
+ */
+static void finish_node_entry(zhandle_t *zh, const qconf_tbl_entry_t &entry, const string &path)
+{
+    if (entry.remove)
+    {
+        add_change_trigger_node(entry.key, entry.val, QCONF_TRIGGER_TYPE_REMOVE);
+        set_absent_node(zh, entry.key, path);
+        return;
+    }
+
+    del_absent_node(entry.key);
+    if (QCONF_OK == entry.ret)
+        add_change_trigger_node(entry.key, entry.val, QCONF_TRIGGER_TYPE_ADD_OR_MODIFY);
+}
+
+/**
+ * Write the batch key together with the values of its children kept in share
+ * memory, so clients never get a child listed with the value of another
+ * update. The others are left to be got once clients ask for them
+ */
+static int publish_batch(zhandle_t *zh, const string &tblkey, const string &tblval, const struct Stat &stat, const string &path, const string_vector_t &nodes)
+{
+    char data_type = QCONF_DATA_TYPE_UNKNOWN;
+    string idc, batch_path;
+    deserialize_from_tblkey(tblkey, data_type, idc, batch_path);
+
+    vector<qconf_tbl_entry_t> entries(1);
+    vector<string> paths(1, path);
+    entries[0].key = tblkey;
+    entries[0].val = tblval;
+    entries[0].mzxid = stat.mzxid;
+    entries[0].pzxid = stat.pzxid;
+    entries[0].remove = false;
+    entries[0].ret = QCONF_OK;
+    for (int i = 0; i < nodes.count; i++)
+    {
+        // the children failed to get are left to their own messages
+        qconf_tbl_entry_t entry;
+        string child_key, child_path = path + "/" + nodes.data[i];
+        serialize_to_tblkey(QCONF_DATA_TYPE_NODE, idc, child_path, child_key);
+        if (!tblkey_kept(child_key)) continue;
+        if (QCONF_OK != get_node_entry(zh, child_key, child_path, entry)) continue;
+        entries.push_back(entry);
+        paths.push_back(child_path);
+    }
+
+    int ret = shm_tbl_set_batch(entries);
+    if (QCONF_OK != ret) return ret;
+
+    for (size_t i = 1; i < entries.size(); i++) finish_node_entry(zh, entries[i], paths[i]);
+    return entries[0].ret;
+}
+
+/**
+ * Publish the nodes of a gray release, or of its rollback, in one write.
+ * Nodes out of any gray release get their values from zookeeper
+ */
+static void publish_node_group(const vector<string> &tblkeys)
+{
+    vector<qconf_tbl_entry_t> entries;
+    vector<string> paths;
+    vector<zhandle_t*> zhs;
+    for (vector<string>::const_iterator it = tblkeys.begin(); it != tblkeys.end(); ++it)
+    {
+        char data_type = QCONF_DATA_TYPE_UNKNOWN;
+        string idc, path;
+        deserialize_from_tblkey(*it, data_type, idc, path);
+
+        qconf_tbl_entry_t entry;
+        zhandle_t *zh = get_zhandle_by_idc(idc);
+        if (QCONF_DATA_TYPE_NODE != data_type || NULL == zh || QCONF_OK != get_node_entry(zh, *it, path, entry))
+        {
+            add_watcher_node(*it);
+            continue;
+        }
+        entries.push_back(entry);
+        paths.push_back(path);
+        zhs.push_back(zh);
+    }
+
+    int ret = shm_tbl_set_batch(entries);
+    if (QCONF_OK != ret)
+    {
+        LOG_ERR("Failed to publish %zu nodes together! ret:%d", entries.size(), ret);
+        for (size_t i = 0; i < entries.size(); i++) add_watcher_node(entries[i].key);
+        return;
+    }
+
+    for (size_t i = 0; i < entries.size(); i++) finish_node_entry(zhs[i], entries[i], paths[i]);
+}
+
+/**
+ * Whether clients have asked for key lately and it's still being fetched, a
+ * missing key is asked again and again by clients waiting for it. Once the
+ * fetch is done the key is admitted again, clients give up waiting sooner
+ * than the interval and ask again if the fetch failed
+ */
+static bool miss_msg_limited(const string &key)
+{
+    if (_miss_msg_interval <= 0) return false;
+
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    uint64_t now = (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+
+    // a key still queued is dropped by add_watcher_node
+    map<string, uint64_t>::iterator it = _miss_msg_times.find(key);
+    if (it != _miss_msg_times.end() && now - it->second < (uint64_t)_miss_msg_interval
+            && pending_node_exist(key))
+    {
+        return true;
+    }
+
+    // forget the keys not asked for lately
+    if (_miss_msg_times.size() >= QCONF_MISS_MSG_KEYS_MAX)
+    {
+        for (it = _miss_msg_times.begin(); it != _miss_msg_times.end(); )
+        {
+            if (now - it->second >= (uint64_t)_miss_msg_interval)
+                _miss_msg_times.erase(it++);
+            else
+                ++it;
+        }
+        if (_miss_msg_times.size() >= QCONF_MISS_MSG_KEYS_MAX) _miss_msg_times.clear();
+    }
+    _miss_msg_times[key] = now;
+    return false;
+}
+
+/**
+ * Mark tblkey absent in share memory, so clients don't ask for it until the
+ * node is created or the mark expires
+ */
+static void set_absent_node(zhandle_t *zh, const string &tblkey, const string &path)
+{
+    if (_absent_ttl <= 0) return;
+
+    string absent_key, tblval;
+    if (QCONF_OK != serialize_to_absent_tblkey(tblkey, absent_key)) return;
+
+    // watch the creation of the node
+    switch (zk_exists(zh, path))
+    {
+    case QCONF_NODE_NOT_EXIST:
+        break;
+    case QCONF_OK:
+        add_watcher_node(tblkey);
+        return;
+    default:
+        return;
+    }
+
+    absentval_to_tblval(absent_key, (int64_t)time(NULL) + _absent_ttl, tblval);
+    int ret = shm_tbl_set(absent_key, tblval);
+    if (QCONF_OK != ret && QCONF_ERR_SAME_VALUE != ret)
+        LOG_ERR_KEY_INFO(tblkey, "Failed to mark absent node in share memory!");
+}
+
+static void del_absent_node(const string &tblkey)
+{
+    string absent_key;
+    if (QCONF_OK != serialize_to_absent_tblkey(tblkey, absent_key)) return;
+
+    // removing bumps the version clients check, so only do it if needed
+    if (hash_tbl_exist(shm_tbl_of(absent_key), absent_key)) hash_tbl_remove(shm_tbl_of(absent_key), absent_key);
+}
+
+/**
+ * Remove the expired mark of an absent node, returns false if tblkey is not
+ * a mark
+ */
+static bool process_absent_node(const string &tblkey, const string &tblval)
+{
+    if (QCONF_DATA_TYPE_ABSENT != get_data_type(tblkey)) return false;
+
+    int64_t expire = 0;
+    if (QCONF_OK != tblval_to_absentval(tblval, expire) || expire <= (int64_t)time(NULL))
+        hash_tbl_remove(shm_tbl_of(tblkey), tblkey);
+    return true;
+}
+
 static zhandle_t *get_zhandle_by_idc(const string &idc)
 {
     if (idc.empty()) return NULL;
@@ -855,19 +1539,19 @@ static void process_deleted_event(const string &idc, const string &path)
     
     string tblkey;
     serialize_to_tblkey(QCONF_DATA_TYPE_NODE, idc, path, tblkey); 
-    if (pending_node_exist(tblkey) || hash_tbl_exist(_shm_tbl, tblkey))
+    if (pending_node_exist(tblkey) || tblkey_kept(tblkey))
     {
         add_watcher_node(tblkey);
     }
 
     serialize_to_tblkey(QCONF_DATA_TYPE_SERVICE, idc, path, tblkey);
-    if (pending_node_exist(tblkey) || hash_tbl_exist(_shm_tbl, tblkey))
+    if (pending_node_exist(tblkey) || tblkey_kept(tblkey))
     {
         add_watcher_node(tblkey);
     }
 
     serialize_to_tblkey(QCONF_DATA_TYPE_BATCH_NODE, idc, path, tblkey);
-    if (pending_node_exist(tblkey) || hash_tbl_exist(_shm_tbl, tblkey))
+    if (pending_node_exist(tblkey) || tblkey_kept(tblkey))
     {
         add_watcher_node(tblkey);
     }
@@ -878,8 +1562,17 @@ static void process_deleted_event(const string &idc, const string &path)
  */
 static void process_created_event(const string &idc, const string &path)
 {
-    // There is no need operation for created event
-    // For it is user's duty to decide to get the nodes
+    // It is user's duty to decide to get the nodes, so only the marks of
+    // absent nodes are removed
+    string tblkey;
+    serialize_to_tblkey(QCONF_DATA_TYPE_NODE, idc, path, tblkey);
+    del_absent_node(tblkey);
+
+    serialize_to_tblkey(QCONF_DATA_TYPE_SERVICE, idc, path, tblkey);
+    del_absent_node(tblkey);
+
+    serialize_to_tblkey(QCONF_DATA_TYPE_BATCH_NODE, idc, path, tblkey);
+    del_absent_node(tblkey);
 }
 
 /**
@@ -889,7 +1582,7 @@ static void process_changed_event(const string &idc, const string &path)
 {
     string tblkey;
     serialize_to_tblkey(QCONF_DATA_TYPE_NODE, idc, path, tblkey);
-    if (pending_node_exist(tblkey) || hash_tbl_exist(_shm_tbl, tblkey))
+    if (pending_node_exist(tblkey) || tblkey_kept(tblkey))
     {
         add_watcher_node(tblkey);
     }
@@ -900,7 +1593,7 @@ static void process_changed_event(const string &idc, const string &path)
     {
         string parent_tblkey;   
         serialize_to_tblkey(QCONF_DATA_TYPE_SERVICE, idc, path.substr(0, pos), parent_tblkey);
-        if (pending_node_exist(tblkey) || hash_tbl_exist(_shm_tbl, parent_tblkey))
+        if (pending_node_exist(tblkey) || tblkey_kept(parent_tblkey))
         {
             add_watcher_node(parent_tblkey);
         }
@@ -915,13 +1608,13 @@ static void process_child_event(const string &idc, const string &path)
     string tblkey;
 
     serialize_to_tblkey(QCONF_DATA_TYPE_SERVICE, idc, path, tblkey);
-    if (pending_node_exist(tblkey) || hash_tbl_exist(_shm_tbl, tblkey))
+    if (pending_node_exist(tblkey) || tblkey_kept(tblkey))
     {
         add_watcher_node(tblkey);
     }
 
     serialize_to_tblkey(QCONF_DATA_TYPE_BATCH_NODE, idc, path, tblkey);
-    if (pending_node_exist(tblkey) || hash_tbl_exist(_shm_tbl, tblkey))
+    if (pending_node_exist(tblkey) || tblkey_kept(tblkey))
     {
         add_watcher_node(tblkey);
     }
@@ -940,6 +1633,15 @@ static void add_watcher_node(const string &key)
     _watch_nodes_mutex.Unlock();
 }
 
+static void add_watcher_group(const vector<string> &keys)
+{
+    if (keys.empty()) return;
+    _watch_nodes_mutex.Lock();
+    _need_watch_groups.push_back(keys);
+    _watch_nodes_cond.SignalAll();
+    _watch_nodes_mutex.Unlock();
+}
+
 static void add_gray_idc(const string &key)
 {
     if (key.empty()) return;
@@ -1150,11 +1852,13 @@ static void *do_gray_process(void *p)
             {
                 LOG_FATAL_ERR("Failed to do the gray release process!");
             }
-            // send to the main thread to modify the share memory
+            // send to the main thread to modify the share memory at once
+            vector<string> gray_keys;
             for (vector< pair<string, string> >::const_iterator it = gray_nodes.begin(); it != gray_nodes.end(); ++it)
             {
-                add_watcher_node((*it).first);
+                gray_keys.push_back((*it).first);
             }
+            add_watcher_group(gray_keys);
         }
         // eles maybe signaled by _stop_watcher_setting
     }
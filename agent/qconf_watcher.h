@@ -2,6 +2,9 @@
 #define QCONF_WATCHER_H
 
 #include <string>
+#include <vector>
+
+#include "qconf_shm.h"
 
 /* zookeeper state constants */
 #define EXPIRED_SESSION_STATE_DEF -112
@@ -31,6 +34,32 @@ int qconf_init_shm_tbl();
  */
 void qconf_clear_shm_tbl();
 
+/**
+ * Initialize the size the hash table grows up to, 0 for never
+ */
+void qconf_init_shm_max_slots(int max_slots);
+
+/**
+ * Initialize whether the hash table is replicated on each NUMA node
+ */
+void qconf_init_shm_numa_replicas(bool numa_replicas);
+
+/**
+ * Add a namespace of share memory from its conf, <prefix>,<key>,<size>[,lru|none]
+ */
+int qconf_add_shm_ns(const std::string &name, const std::string &conf);
+
+/**
+ * List the paths kept in the hash tables which are prefix or under it, of
+ * every idc if idc is empty
+ */
+int qconf_list_shm_tbl(const std::string &idc, const std::string &prefix, std::vector<qconf_shm_index_item_t> &items);
+
+/**
+ * Resize current hash table online
+ */
+int qconf_resize_shm_tbl(int max_slots);
+
 /**
  * Initialize the message key
  */
@@ -61,6 +90,22 @@ int qconf_init_local_idc(const std::string &idc);
  */
 void qconf_init_fb_flg(bool enable_flags);
 
+/**
+ * Initialize the seconds nodes absent on zookeeper are marked so, 0 for never
+ */
+void qconf_init_absent_ttl(int ttl);
+
+/**
+ * Initialize the ms messages of the same key from clients are ignored in
+ */
+void qconf_init_miss_msg_interval(int interval);
+
+/**
+ * Initialize the seconds a snapshot is taken in at most, 0 for never, and
+ * the ms writes settle for before it's taken
+ */
+void qconf_init_snapshot(int interval, int delay);
+
 /**
  * Initialize the script execute timeout
  */
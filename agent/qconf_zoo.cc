@@ -72,7 +72,7 @@ static void destroy_safe_key_(void *p)
 /**
  * Get znode from zookeeper, and set a watcher
  */
-int zk_get_node(zhandle_t *zh, const string &path, string &buf, int watcher)
+int zk_get_node(zhandle_t *zh, const string &path, string &buf, int watcher, struct Stat *stat)
 {
     int ret = 0;
     int buffer_len = QCONF_MAX_VALUE_SIZE;
@@ -86,7 +86,7 @@ int zk_get_node(zhandle_t *zh, const string &path, string &buf, int watcher)
 
     for (int i = 0; i < QCONF_GET_RETRIES; ++i)
     {
-        ret = zoo_get(zh, path.c_str(), watcher, buffer, &buffer_len, NULL);
+        ret = zoo_get(zh, path.c_str(), watcher, buffer, &buffer_len, stat);
         switch (ret)
         {
             case ZOK:
@@ -144,14 +144,15 @@ int zk_create_node(zhandle_t *zh, const string &path, const string &value, int f
 /**
  * Get children nodes from zookeeper and set a watcher
  */
-int zk_get_chdnodes(zhandle_t *zh, const string &path, string_vector_t &nodes)
+int zk_get_chdnodes(zhandle_t *zh, const string &path, string_vector_t &nodes, struct Stat *stat)
 {
     if (NULL == zh || path.empty()) return QCONF_ERR_PARAM;
 
     int ret;
     for (int i = 0; i < QCONF_GET_RETRIES; ++i)
     {
-        ret = zoo_get_children(zh, path.c_str(), 1, &nodes);
+        ret = (NULL == stat) ? zoo_get_children(zh, path.c_str(), 1, &nodes)
+            : zoo_get_children2(zh, path.c_str(), 1, &nodes, stat);
         switch(ret)
         {
             case ZOK:
@@ -174,10 +175,10 @@ int zk_get_chdnodes(zhandle_t *zh, const string &path, string_vector_t &nodes)
     return QCONF_ERR_ZOO_FAILED;
 }
 
-int zk_get_chdnodes_with_status(zhandle_t *zh, const string &path, string_vector_t &nodes, vector<char> &status)
+int zk_get_chdnodes_with_status(zhandle_t *zh, const string &path, string_vector_t &nodes, vector<char> &status, struct Stat *stat)
 {
     if (NULL == zh || path.empty()) return QCONF_ERR_PARAM;
-    int ret = zk_get_chdnodes(zh, path, nodes);
+    int ret = zk_get_chdnodes(zh, path, nodes, stat);
     if (QCONF_OK == ret)
     {
         string child_path;
@@ -6,9 +6,9 @@
 #include "qconf_const.h"
 
 /**
- *  Get conf from zookeeper
+ *  Get conf from zookeeper, the stat of the node is kept in stat if it's not NULL
  */
-int zk_get_node(zhandle_t *zh, const std::string &path, std::string &buf, int watcher);
+int zk_get_node(zhandle_t *zh, const std::string &path, std::string &buf, int watcher, struct Stat *stat = NULL);
 
 /**
  * Create znode on zookeeper
@@ -16,14 +16,14 @@ int zk_get_node(zhandle_t *zh, const std::string &path, std::string &buf, int wa
 int zk_create_node(zhandle_t *zh, const std::string &path, const std::string &value, int flags);
 
     /**
- *  Get child nodes from zookeeper
+ *  Get child nodes from zookeeper, the stat of the parent is kept in stat if it's not NULL
  */
-int zk_get_chdnodes(zhandle_t *zh, const std::string &path, string_vector_t &nodes);
+int zk_get_chdnodes(zhandle_t *zh, const std::string &path, string_vector_t &nodes, struct Stat *stat = NULL);
 
 /**
  *  Get child nodes together with their status
  */
-int zk_get_chdnodes_with_status(zhandle_t *zh, const std::string &path, string_vector_t &nodes, std::vector<char> &status);
+int zk_get_chdnodes_with_status(zhandle_t *zh, const std::string &path, string_vector_t &nodes, std::vector<char> &status, struct Stat *stat = NULL);
 
 /**
  *  Create ephemeral node on zookeeper
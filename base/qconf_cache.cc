@@ -0,0 +1,310 @@
+#include <pthread.h>
+
+#include <map>
+#include <set>
+#include <string>
+
+#include "qconf_common.h"
+#include "qconf_cache.h"
+#include "qlibc/qlibc.h"
+
+// entries of each thread, a power of 2
+#define QCONF_CACHE_FRONT_SLOTS 64
+// larger values are not copied into the entries of threads
+#define QCONF_CACHE_FRONT_VAL_MAX 4096
+// memory of a shared entry beside its key and value
+#define QCONF_CACHE_ENTRY_OVERHEAD 128
+
+using namespace std;
+
+typedef struct cache_entry_s
+{
+    string tblval;
+    const volatile uint32_t *word;      // generation word of the key
+    uint32_t gen;
+    uint32_t epoch;                     // the entry is dropped once the epoch moves
+    qconf_shm_refs_t *refs;
+    int idx;
+    volatile unsigned char used;        // got since the last sweep
+} cache_entry_t;
+
+typedef struct cache_front_slot_s
+{
+    string tblkey;
+    string tblval;
+    const volatile uint32_t *word;
+    uint32_t gen;
+    uint32_t epoch;                     // 0 while the slot is empty
+    qconf_shm_refs_t *refs;
+    int idx;
+} cache_front_slot_t;
+
+// entries and counters of one thread, the counters are written by the
+// thread only
+typedef struct cache_front_s
+{
+    cache_front_slot_t slots[QCONF_CACHE_FRONT_SLOTS];
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t stales;
+} cache_front_t;
+
+static pthread_rwlock_t _cache_lock = PTHREAD_RWLOCK_INITIALIZER;
+static map<string, cache_entry_t> _cache_entries;
+static string _cache_hand;                      // key the sweep goes on from
+static size_t _cache_bytes = 0;
+static uint64_t _cache_evictions = 0;
+static volatile size_t _cache_max = 0;
+static volatile uint32_t _cache_epoch = 1;
+
+static pthread_mutex_t _cache_fronts_mutex = PTHREAD_MUTEX_INITIALIZER;
+static set<cache_front_t*> _cache_fronts;
+static qconf_cache_stat_t _cache_exited = {0, 0, 0, 0, 0, 0};   // counters of threads exited
+static pthread_once_t _cache_front_once = PTHREAD_ONCE_INIT;
+static pthread_key_t _cache_front_key;
+static __thread cache_front_t *_cache_front = NULL;
+
+static cache_front_t *cache_front_();
+static void cache_front_init_();
+static void cache_front_free_(void *ptr);
+static void cache_count_(uint64_t &counter);
+static bool cache_valid_(const volatile uint32_t *word, uint32_t gen);
+static size_t cache_entry_size_(const string &tblkey, const string &tblval);
+static void cache_evict_();
+static void cache_drop_();
+
+static void cache_front_init_()
+{
+    pthread_key_create(&_cache_front_key, cache_front_free_);
+}
+
+/**
+ * Entries of the calling thread, they're freed once it exits
+ */
+static cache_front_t *cache_front_()
+{
+    if (NULL != _cache_front) return _cache_front;
+
+    pthread_once(&_cache_front_once, cache_front_init_);
+    cache_front_t *front = new cache_front_t();
+    for (int i = 0; i < QCONF_CACHE_FRONT_SLOTS; i++)
+        front->slots[i].epoch = 0;
+    front->hits = front->misses = front->stales = 0;
+
+    pthread_mutex_lock(&_cache_fronts_mutex);
+    _cache_fronts.insert(front);
+    pthread_mutex_unlock(&_cache_fronts_mutex);
+    pthread_setspecific(_cache_front_key, front);
+
+    _cache_front = front;
+    return front;
+}
+
+static void cache_front_free_(void *ptr)
+{
+    cache_front_t *front = (cache_front_t*)ptr;
+
+    pthread_mutex_lock(&_cache_fronts_mutex);
+    _cache_exited.hits += front->hits;
+    _cache_exited.misses += front->misses;
+    _cache_exited.stales += front->stales;
+    _cache_fronts.erase(front);
+    pthread_mutex_unlock(&_cache_fronts_mutex);
+
+    _cache_front = NULL;
+    delete front;
+}
+
+static void cache_count_(uint64_t &counter)
+{
+    // summed by other threads without locking
+    __atomic_store_n(&counter, counter + 1, __ATOMIC_RELAXED);
+}
+
+static bool cache_valid_(const volatile uint32_t *word, uint32_t gen)
+{
+    return __atomic_load_n(word, __ATOMIC_ACQUIRE) == gen;
+}
+
+static size_t cache_entry_size_(const string &tblkey, const string &tblval)
+{
+    return tblkey.size() + tblval.size() + QCONF_CACHE_ENTRY_OVERHEAD;
+}
+
+/**
+ * Drop the first entry the sweep finds not got since it passed last time,
+ * the caller holds the write lock
+ */
+static void cache_evict_()
+{
+    uint32_t epoch = _cache_epoch;
+    map<string, cache_entry_t>::iterator it = _cache_entries.lower_bound(_cache_hand);
+    while (!_cache_entries.empty())
+    {
+        if (it == _cache_entries.end()) it = _cache_entries.begin();
+        if (it->second.used && it->second.epoch == epoch)
+        {
+            it->second.used = 0;
+            ++it;
+            continue;
+        }
+
+        map<string, cache_entry_t>::iterator next = it;
+        ++next;
+        _cache_hand = (next == _cache_entries.end()) ? string() : next->first;
+        _cache_bytes -= cache_entry_size_(it->first, it->second.tblval);
+        _cache_entries.erase(it);
+        _cache_evictions++;
+        return;
+    }
+}
+
+/**
+ * Drop every entry and move the epoch, the caller holds the write lock
+ */
+static void cache_drop_()
+{
+    _cache_entries.clear();
+    _cache_hand.clear();
+    _cache_bytes = 0;
+
+    uint32_t epoch = _cache_epoch + 1;
+    __atomic_store_n(&_cache_epoch, (0 == epoch) ? 1 : epoch, __ATOMIC_RELEASE);
+}
+
+void qconf_cache_set_max(size_t max_bytes)
+{
+    pthread_rwlock_wrlock(&_cache_lock);
+    _cache_max = max_bytes;
+    if (0 == max_bytes)
+    {
+        cache_drop_();
+    }
+    else
+    {
+        while (_cache_bytes > max_bytes && !_cache_entries.empty())
+            cache_evict_();
+    }
+    pthread_rwlock_unlock(&_cache_lock);
+}
+
+bool qconf_cache_enabled()
+{
+    return 0 != _cache_max;
+}
+
+void qconf_cache_clear()
+{
+    pthread_rwlock_wrlock(&_cache_lock);
+    cache_drop_();
+    pthread_rwlock_unlock(&_cache_lock);
+}
+
+int qconf_cache_get(const string &tblkey, string &tblval)
+{
+    if (0 == _cache_max || tblkey.empty()) return QCONF_ERR_NOT_FOUND;
+
+    cache_front_t *front = cache_front_();
+    uint32_t epoch = __atomic_load_n(&_cache_epoch, __ATOMIC_ACQUIRE);
+    cache_front_slot_t &slot = front->slots[qhashmurmur3_32(tblkey.data(), tblkey.size()) & (QCONF_CACHE_FRONT_SLOTS - 1)];
+    bool stale = false;
+
+    if (slot.epoch == epoch && slot.tblkey == tblkey)
+    {
+        if (cache_valid_(slot.word, slot.gen))
+        {
+            hash_tbl_touch(slot.refs, slot.idx);
+            tblval = slot.tblval;
+            cache_count_(front->hits);
+            return QCONF_OK;
+        }
+        slot.epoch = 0;
+        stale = true;
+    }
+
+    int ret = QCONF_ERR_NOT_FOUND;
+    pthread_rwlock_rdlock(&_cache_lock);
+    map<string, cache_entry_t>::iterator it = _cache_entries.find(tblkey);
+    if (it != _cache_entries.end() && it->second.epoch == epoch)
+    {
+        cache_entry_t &entry = it->second;
+        if (cache_valid_(entry.word, entry.gen))
+        {
+            if (!entry.used) entry.used = 1;
+            hash_tbl_touch(entry.refs, entry.idx);
+            tblval = entry.tblval;
+            if (tblval.size() <= QCONF_CACHE_FRONT_VAL_MAX)
+            {
+                slot.tblkey = tblkey;
+                slot.tblval = tblval;
+                slot.word = entry.word;
+                slot.gen = entry.gen;
+                slot.refs = entry.refs;
+                slot.idx = entry.idx;
+                slot.epoch = epoch;
+            }
+            ret = QCONF_OK;
+        }
+        else
+        {
+            stale = true;
+        }
+    }
+    pthread_rwlock_unlock(&_cache_lock);
+
+    if (stale) cache_count_(front->stales);
+    cache_count_((QCONF_OK == ret) ? front->hits : front->misses);
+    return ret;
+}
+
+void qconf_cache_put(const string &tblkey, const string &tblval, const volatile uint32_t *word, uint32_t gen, qconf_shm_refs_t *refs, int idx)
+{
+    if (0 == _cache_max || tblkey.empty() || NULL == word) return;
+
+    size_t size = cache_entry_size_(tblkey, tblval);
+    // changed already since it was got
+    if (size > _cache_max || !cache_valid_(word, gen)) return;
+
+    pthread_rwlock_wrlock(&_cache_lock);
+    map<string, cache_entry_t>::iterator it = _cache_entries.find(tblkey);
+    if (it != _cache_entries.end())
+    {
+        _cache_bytes -= cache_entry_size_(it->first, it->second.tblval);
+        _cache_entries.erase(it);
+    }
+    while (_cache_bytes + size > _cache_max && !_cache_entries.empty())
+        cache_evict_();
+
+    if (_cache_bytes + size <= _cache_max)
+    {
+        cache_entry_t &entry = _cache_entries[tblkey];
+        entry.tblval = tblval;
+        entry.word = word;
+        entry.gen = gen;
+        entry.epoch = _cache_epoch;
+        entry.refs = refs;
+        entry.idx = idx;
+        entry.used = 0;
+        _cache_bytes += size;
+    }
+    pthread_rwlock_unlock(&_cache_lock);
+}
+
+void qconf_cache_get_stat(qconf_cache_stat_t &stat)
+{
+    pthread_mutex_lock(&_cache_fronts_mutex);
+    stat = _cache_exited;
+    for (set<cache_front_t*>::const_iterator it = _cache_fronts.begin(); it != _cache_fronts.end(); ++it)
+    {
+        stat.hits += __atomic_load_n(&(*it)->hits, __ATOMIC_RELAXED);
+        stat.misses += __atomic_load_n(&(*it)->misses, __ATOMIC_RELAXED);
+        stat.stales += __atomic_load_n(&(*it)->stales, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&_cache_fronts_mutex);
+
+    pthread_rwlock_rdlock(&_cache_lock);
+    stat.evictions = _cache_evictions;
+    stat.entries = _cache_entries.size();
+    stat.bytes = _cache_bytes;
+    pthread_rwlock_unlock(&_cache_lock);
+}
@@ -0,0 +1,59 @@
+#ifndef QCONF_CACHE_H
+#define QCONF_CACHE_H
+
+#include <string>
+
+#include <stdint.h>
+
+#include "qconf_shm.h"
+
+/**
+ * Values of tblkeys cached in the process. Each entry keeps the generation
+ * word of its key and the generation read before the value was got, it's
+ * served while the word still holds it. Every thread keeps a few entries of
+ * its own in front of the ones shared, so hits take no lock. The shared
+ * entries are bounded in memory, and the ones not got since the last sweep
+ * are dropped first
+ */
+typedef struct qconf_cache_stat_s
+{
+    uint64_t hits;                      // gets served by the cache
+    uint64_t misses;                    // gets not served, stale ones included
+    uint64_t stales;                    // entries found changed in share memory
+    uint64_t evictions;                 // entries dropped for the bound of memory
+    uint64_t entries;                   // entries shared
+    uint64_t bytes;                     // memory of the entries shared
+} qconf_cache_stat_t;
+
+/**
+ * Bound the memory of the entries shared, 0 disables the cache and drops
+ * every entry. It's disabled by default
+ */
+void qconf_cache_set_max(size_t max_bytes);
+bool qconf_cache_enabled();
+
+/**
+ * Drop every entry, the ones got before are not served any more
+ */
+void qconf_cache_clear();
+
+/**
+ * Get the value of tblkey cached, the entry of it in share memory is
+ * marked referenced
+ *
+ * @return QCONF_ERR_NOT_FOUND: if it's not cached or it has changed
+ */
+int qconf_cache_get(const std::string &tblkey, std::string &tblval);
+
+/**
+ * Cache the value of tblkey got after word held gen. refs and idx are of
+ * the entry in share memory, idx is -1 if it's not known
+ */
+void qconf_cache_put(const std::string &tblkey, const std::string &tblval, const volatile uint32_t *word, uint32_t gen, qconf_shm_refs_t *refs, int idx);
+
+/**
+ * Get the counters of the cache, summed over the threads
+ */
+void qconf_cache_get_stat(qconf_cache_stat_t &stat);
+
+#endif
@@ -65,6 +65,18 @@ typedef struct String_vector string_vector_t;
 #define QCONF_ERR_SHMGET                    201
 #define QCONF_ERR_SHMAT                     202
 #define QCONF_ERR_SHMINIT                   203
+// share memory changed since the value was referenced
+#define QCONF_ERR_SHM_CHANGED               204
+// value is not kept contiguous in share memory
+#define QCONF_ERR_SHM_SPLIT                 205
+// share memory table is too small to keep the entries
+#define QCONF_ERR_SHM_RESIZE                206
+// no write to the key in share memory before the deadline
+#define QCONF_ERR_SHM_TIMEOUT               207
+// records of the change journal were rewritten before they were read
+#define QCONF_ERR_SHM_OVERRUN               208
+// paths were dropped by the path index of share memory once it was full
+#define QCONF_ERR_SHM_INDEX_FULL            209
 
 #define QCONF_ERR_LOG_LEVEL                 211
 
@@ -92,6 +104,35 @@ typedef struct String_vector string_vector_t;
 
 // qconf share memory key
 #define QCONF_DEFAULT_SHM_KEY               0x10cf21d3
+// key of the segment publishing which share memory table is in use
+#define QCONF_DEFAULT_SHM_CTRL_KEY          0x10cf21d2
+// key of the generation words clients wait on for writes of the agent
+#define QCONF_DEFAULT_SHM_GENS_KEY          0x10cf21d0
+#define QCONF_SHM_GENS_NUM                  4096
+// key of the change journal of share memory
+#define QCONF_DEFAULT_SHM_JOURNAL_KEY       0x10cf21cf
+#define QCONF_SHM_JOURNAL_NUM               65536
+// key of the directory of namespaces, tables routed by path prefix
+#define QCONF_DEFAULT_SHM_NS_KEY            0x10cf21ce
+#define QCONF_SHM_NS_MAX                    16
+#define QCONF_SHM_NS_NAME_LEN               32
+#define QCONF_SHM_NS_PREFIX_LEN             256
+// key of the sorted index of paths kept in share memory tables
+#define QCONF_DEFAULT_SHM_INDEX_KEY         0x10cf21cd
+// bytes kept for the path of one key in the index on average
+#define QCONF_SHM_INDEX_RECORD_AVG          96
+// key of the directory of replicas of the table on NUMA nodes
+#define QCONF_DEFAULT_SHM_REPLICAS_KEY      0x10cf21cc
+#define QCONF_SHM_REPLICA_MAX               8
+// entries are evicted when a table is full, or the write fails instead
+#define QCONF_SHM_EVICT_LRU                 0
+#define QCONF_SHM_EVICT_NONE                1
+// snapshot of share memory tables clients read first
+#define QCONF_DEFAULT_SNAPSHOT_PATH         "/dev/shm/qconf.snapshot"
+// share memory tables are SysV segments or POSIX objects named by their keys
+#define QCONF_SHM_BACKEND_SYSV              0
+#define QCONF_SHM_BACKEND_POSIX             1
+#define QCONF_POSIX_SHM_NAME_FMT            "/qconf.%x"
 #define QCONF_MAX_SLOTS_NUM                 800000 
 
 #define QCONF_FILE_PATH_LEN                 2048
@@ -108,6 +149,10 @@ typedef struct String_vector string_vector_t;
 
 #define QCONF_DATA_TYPE_LOCAL_IDC           'a'
 #define QCONF_KEY_TYPE_LOCAL_IDC            "a"
+// the key of users' data after it is known to be absent on zookeeper
+#define QCONF_DATA_TYPE_ABSENT              'b'
+// message asking the agent for several tblkeys at once
+#define QCONF_DATA_TYPE_MULTI_KEYS          'c'
 
 // zookeeper default recv timeout(unit:millisecond)
 #define QCONF_ZK_DEFAULT_RECV_TIMEOUT       3000
@@ -24,9 +24,16 @@ static int qconf_sub_path(const string &tblkey, size_t &pos, string &path);
 static int qconf_sub_host(const string &tblkey, size_t &pos, string &host);
 static int qconf_sub_nodeval(const string &tblkey, size_t &pos, string &nodeval);
 static int qconf_sub_vectorval(const string &tblval, size_t &pos, string_vector_t &nodes);
+static int qconf_sub_packed_vectorval(const string &tblval, size_t &pos, string_vector_t &nodes, char *buf, size_t &buf_len);
+static int tblval_to_packed_vectorval(const string &tblval, char data_type, string_vector_t &nodes, char *buf, size_t &buf_len);
 
 int serialize_to_tblkey(char data_type, const string &idc, const string &path, string &tblkey)
 {
+    QCONF_IDC_SIZE_TYPE idc_size = idc.size();
+    QCONF_HOST_PATH_SIZE_TYPE path_size = path.size();
+    tblkey.clear();
+    if (idc_size != idc.size() || path_size != path.size()) return QCONF_ERR_PARAM;
+
     tblkey.assign(1, data_type);
     switch (data_type)
     {
@@ -46,6 +53,36 @@ int serialize_to_tblkey(char data_type, const string &idc, const string &path, s
     }
 }
 
+int serialize_to_tblkey(char data_type, const char *idc, size_t idc_len, const char *path, size_t path_len, char *tblkey, size_t &tblkey_len)
+{
+    QCONF_IDC_SIZE_TYPE idc_size = idc_len;
+    QCONF_HOST_PATH_SIZE_TYPE path_size = path_len;
+
+    if (NULL == tblkey || idc_size != idc_len || path_size != path_len ||
+            1 + QCONF_IDC_SIZE_LEN + idc_len + QCONF_HOST_PATH_SIZE_LEN + path_len > QCONF_TBLKEY_MAX_LEN)
+        return QCONF_ERR_PARAM;
+
+    switch (data_type)
+    {
+    case QCONF_DATA_TYPE_NODE:
+    case QCONF_DATA_TYPE_SERVICE:
+    case QCONF_DATA_TYPE_BATCH_NODE:
+        tblkey_len = 0;
+        tblkey[tblkey_len++] = data_type;
+        qconf_encode_num(tblkey + tblkey_len, idc_size, QCONF_IDC_SIZE_TYPE);
+        tblkey_len += QCONF_IDC_SIZE_LEN;
+        memcpy(tblkey + tblkey_len, idc, idc_len);
+        tblkey_len += idc_len;
+        qconf_encode_num(tblkey + tblkey_len, path_size, QCONF_HOST_PATH_SIZE_TYPE);
+        tblkey_len += QCONF_HOST_PATH_SIZE_LEN;
+        memcpy(tblkey + tblkey_len, path, path_len);
+        tblkey_len += path_len;
+        return QCONF_OK;
+    default:
+        return QCONF_ERR_DATA_TYPE;
+    }
+}
+
 int deserialize_from_tblkey(const string &tblkey, char &data_type, string &idc, string &path)
 {
     size_t pos = 0;
@@ -75,6 +112,125 @@ int deserialize_from_tblkey(const string &tblkey, char &data_type, string &idc,
     }
 }
 
+int tblkeys_to_msgs(const vector<string> &tblkeys, vector<string> &msgs)
+{
+    msgs.clear();
+    for (size_t i = 0; i < tblkeys.size(); i++)
+    {
+        const string &tblkey = tblkeys[i];
+        if (tblkey.empty() || 1 + QCONF_HOST_PATH_SIZE_LEN + tblkey.size() >= QCONF_MAX_MSG_LEN)
+            return QCONF_ERR_PARAM;
+
+        if (msgs.empty() || msgs.back().size() + QCONF_HOST_PATH_SIZE_LEN + tblkey.size() >= QCONF_MAX_MSG_LEN)
+            msgs.push_back(string(1, QCONF_DATA_TYPE_MULTI_KEYS));
+        qconf_string_append(msgs.back(), tblkey, QCONF_HOST_PATH_SIZE_TYPE);
+    }
+
+    return QCONF_OK;
+}
+
+int msg_to_tblkeys(const string &msg, vector<string> &tblkeys)
+{
+    tblkeys.clear();
+    if (msg.empty() || QCONF_DATA_TYPE_MULTI_KEYS != msg[0]) return QCONF_ERR_DATA_TYPE;
+
+    size_t pos = 1;
+    while (pos < msg.size())
+    {
+        int ret = QCONF_OK;
+        string tblkey;
+        qconf_string_sub(msg, pos, tblkey, QCONF_HOST_PATH_SIZE_TYPE, ret);
+        if (QCONF_OK != ret) return ret;
+        tblkeys.push_back(tblkey);
+    }
+
+    return QCONF_OK;
+}
+
+int serialize_to_absent_tblkey(const string &tblkey, string &absent_key)
+{
+    switch (get_data_type(tblkey))
+    {
+        case QCONF_DATA_TYPE_NODE:
+        case QCONF_DATA_TYPE_SERVICE:
+        case QCONF_DATA_TYPE_BATCH_NODE:
+            absent_key.assign(1, QCONF_DATA_TYPE_ABSENT);
+            absent_key.append(tblkey);
+            return QCONF_OK;
+        default:
+            return QCONF_ERR_DATA_TYPE;
+    }
+}
+
+int absentval_to_tblval(const string &key, int64_t expire, string &tblval)
+{
+    char buf[QCONF_EXPIRE_TIME_LEN] = {0};
+
+    tblval.clear();
+    qconf_encode_num(buf, expire, QCONF_EXPIRE_TIME_TYPE);
+    tblval.append(buf, QCONF_EXPIRE_TIME_LEN);
+    tblval.append(key);
+
+    return QCONF_OK;
+}
+
+int tblval_to_absentval(const string &tblval, int64_t &expire)
+{
+    if (tblval.size() < QCONF_EXPIRE_TIME_LEN + 1 ||
+            tblval[QCONF_EXPIRE_TIME_LEN] != QCONF_DATA_TYPE_ABSENT)
+        return QCONF_ERR_DATA_FORMAT;
+
+    qconf_decode_num(tblval.data(), expire, QCONF_EXPIRE_TIME_TYPE);
+    return QCONF_OK;
+}
+
+int tblval_to_absentval(const string &tblval, int64_t &expire, string &key)
+{
+    int ret = tblval_to_absentval(tblval, expire);
+    if (QCONF_OK != ret) return ret;
+
+    key.assign(tblval, QCONF_EXPIRE_TIME_LEN, string::npos);
+    return QCONF_OK;
+}
+
+/**
+ * | value | mzxid | pzxid | counter | digest |
+ */
+int stamp_to_tblval(const qconf_stamp_t &stamp, string &tblval)
+{
+    char buf[QCONF_ZXID_LEN] = {0};
+
+    qconf_encode_num(buf, stamp.mzxid, QCONF_ZXID_TYPE);
+    tblval.append(buf, QCONF_ZXID_LEN);
+    qconf_encode_num(buf, stamp.pzxid, QCONF_ZXID_TYPE);
+    tblval.append(buf, QCONF_ZXID_LEN);
+    qconf_encode_num(buf, stamp.counter, QCONF_STAMP_COUNTER_TYPE);
+    tblval.append(buf, QCONF_STAMP_COUNTER_LEN);
+    tblval.append(stamp.digest, QCONF_STAMP_DIGEST_LEN);
+
+    return QCONF_OK;
+}
+
+int tblval_to_stamp(const char *tblval, size_t &tblval_len, qconf_stamp_t *stamp)
+{
+    if (NULL == tblval || tblval_len < QCONF_STAMP_LEN)
+        return QCONF_ERR_DATA_FORMAT;
+
+    tblval_len -= QCONF_STAMP_LEN;
+    if (NULL == stamp) return QCONF_OK;
+
+    const char *pos = tblval + tblval_len;
+    qconf_decode_num(pos, stamp->mzxid, QCONF_ZXID_TYPE);
+    pos += QCONF_ZXID_LEN;
+    qconf_decode_num(pos, stamp->pzxid, QCONF_ZXID_TYPE);
+    pos += QCONF_ZXID_LEN;
+    qconf_decode_num(pos, stamp->counter, QCONF_STAMP_COUNTER_TYPE);
+    pos += QCONF_STAMP_COUNTER_LEN;
+    memcpy(stamp->digest, pos, QCONF_STAMP_DIGEST_LEN);
+
+    return QCONF_OK;
+}
+
 int localidc_to_tblval(const string &key, const string &local_idc, string &tblval)
 {
     tblval.clear();
@@ -105,6 +261,9 @@ int chdnodeval_to_tblval(const string &key, const string_vector_t &nodes, string
         if (STATUS_UP == valid_flg[i]) ++valid_cnt;
     }
 
+    vector<QCONF_HOST_OFFSET_TYPE> offsets;
+    offsets.reserve(valid_cnt);
+
     tblval.clear();
     qconf_encode_num(buf, valid_cnt, QCONF_VECTOR_COUNT_TYPE);
     tblval.append(buf, QCONF_VECTOR_COUNT_LEN);
@@ -112,6 +271,7 @@ int chdnodeval_to_tblval(const string &key, const string_vector_t &nodes, string
     {
         if (STATUS_UP == valid_flg[i])
         {
+            offsets.push_back(tblval.size());
             node_size = strlen(nodes.data[i]);
             qconf_encode_num(buf, node_size, QCONF_HOST_PATH_SIZE_TYPE);
             tblval.append(buf, QCONF_HOST_PATH_SIZE_LEN);
@@ -120,9 +280,68 @@ int chdnodeval_to_tblval(const string &key, const string_vector_t &nodes, string
     }
     tblval.append(key);
 
+    // offsets of the nodes, so one node is got without going through the
+    // others. Readers of the key ignore them
+    char off_buf[QCONF_HOST_OFFSET_LEN] = {0};
+    for (size_t i = 0; i < offsets.size(); ++i)
+    {
+        qconf_encode_num(off_buf, offsets[i], QCONF_HOST_OFFSET_TYPE);
+        tblval.append(off_buf, QCONF_HOST_OFFSET_LEN);
+    }
+    QCONF_HOST_OFFSET_TYPE magic = QCONF_HOST_INDEX_MAGIC;
+    qconf_encode_num(off_buf, magic, QCONF_HOST_OFFSET_TYPE);
+    tblval.append(off_buf, QCONF_HOST_OFFSET_LEN);
+
+    return QCONF_OK;
+}
+
+int tblval_to_chdnodecount(const char *tblval, size_t tblval_len, int &count)
+{
+    if (NULL == tblval || tblval_len < QCONF_VECTOR_COUNT_LEN) return QCONF_ERR_DATA_FORMAT;
+
+    QCONF_VECTOR_COUNT_TYPE size = 0;
+    qconf_decode_num(tblval, size, QCONF_VECTOR_COUNT_TYPE);
+    count = size;
     return QCONF_OK;
 }
 
+int tblval_to_chdnode(const char *tblval, size_t tblval_len, int i, const char *&node, size_t &node_len)
+{
+    int count = 0;
+    if (QCONF_OK != tblval_to_chdnodecount(tblval, tblval_len, count)) return QCONF_ERR_DATA_FORMAT;
+    if (i < 0 || i >= count) return QCONF_ERR_PARAM;
+
+    size_t pos = QCONF_VECTOR_COUNT_LEN;
+    size_t index_len = (count + 1) * QCONF_HOST_OFFSET_LEN;
+    QCONF_HOST_OFFSET_TYPE magic = 0, offset = 0;
+    if (tblval_len >= pos + index_len)
+    {
+        qconf_decode_num(tblval + tblval_len - QCONF_HOST_OFFSET_LEN, magic, QCONF_HOST_OFFSET_TYPE);
+    }
+
+    if (QCONF_HOST_INDEX_MAGIC == magic)
+    {
+        const char *index = tblval + tblval_len - index_len;
+        qconf_decode_num(index + i * QCONF_HOST_OFFSET_LEN, offset, QCONF_HOST_OFFSET_TYPE);
+        pos = offset;
+    }
+    else
+    {
+        // kept by an older agent, go through the nodes before
+        for (int j = 0; j < i; ++j)
+        {
+            QCONF_HOST_PATH_SIZE_TYPE size = 0;
+            if (tblval_len < pos + QCONF_HOST_PATH_SIZE_LEN) return QCONF_ERR_DATA_FORMAT;
+            qconf_decode_num(tblval + pos, size, QCONF_HOST_PATH_SIZE_TYPE);
+            pos += QCONF_HOST_PATH_SIZE_LEN + size;
+        }
+    }
+
+    int ret = QCONF_ERR_OTHER;
+    qconf_buf_sub(tblval, tblval_len, pos, node, node_len, QCONF_HOST_PATH_SIZE_TYPE, ret);
+    return ret;
+}
+
 int batchnodeval_to_tblval(const string &key, const string_vector_t &nodes, string &tblval)
 {
     QCONF_VECTOR_COUNT_TYPE size = 0;
@@ -173,6 +392,22 @@ int tblval_to_localidc(const string &tblval, string &idc)
     return QCONF_OK;
 }
 
+int tblval_to_localidc(const char *tblval, size_t tblval_len, const char *&idc, size_t &idc_len)
+{
+    size_t pos = 0;
+    int ret = QCONF_ERR_OTHER;
+
+    // idc
+    qconf_buf_sub(tblval, tblval_len, pos, idc, idc_len, QCONF_IDC_SIZE_TYPE, ret);
+    if (QCONF_OK != ret) return ret;
+
+    // data type
+    if (tblval_len < pos + 1 || tblval[pos] != QCONF_DATA_TYPE_LOCAL_IDC)
+        return QCONF_ERR_DATA_FORMAT;
+
+    return QCONF_OK;
+}
+
 int tblval_to_idcval(const string &tblval, string &host)
 {
     size_t pos = 0;
@@ -221,6 +456,22 @@ int tblval_to_nodeval(const string &tblval, string &nodeval)
     return QCONF_OK;
 }
 
+int tblval_to_nodeval(const char *tblval, size_t tblval_len, const char *&nodeval, size_t &nodeval_len)
+{
+    size_t pos = 0;
+    int ret = QCONF_ERR_OTHER;
+
+    // nodeval
+    qconf_buf_sub(tblval, tblval_len, pos, nodeval, nodeval_len, QCONF_VALUE_SIZE_TYPE, ret);
+    if (QCONF_OK != ret) return ret;
+
+    // data type
+    if (tblval_len < pos + 1 || tblval[pos] != QCONF_DATA_TYPE_NODE)
+        return QCONF_ERR_DATA_FORMAT;
+
+    return QCONF_OK;
+}
+
 int tblval_to_nodeval(const string &tblval, string &nodeval, string &idc, string &path)
 {
     size_t pos = 0;
@@ -303,6 +554,33 @@ static int tblval_to_vectorval(const string &tblval, char data_type, string_vect
     return QCONF_OK;
 }
 
+int tblval_to_packed_chdnodeval(const string &tblval, string_vector_t &nodes, char *buf, size_t &buf_len)
+{
+    return tblval_to_packed_vectorval(tblval, QCONF_DATA_TYPE_SERVICE, nodes, buf, buf_len);
+}
+
+int tblval_to_packed_batchnodeval(const string &tblval, string_vector_t &nodes, char *buf, size_t &buf_len)
+{
+    return tblval_to_packed_vectorval(tblval, QCONF_DATA_TYPE_BATCH_NODE, nodes, buf, buf_len);
+}
+
+static int tblval_to_packed_vectorval(const string &tblval, char data_type, string_vector_t &nodes, char *buf, size_t &buf_len)
+{
+    size_t pos = 0;
+    int ret = qconf_sub_packed_vectorval(tblval, pos, nodes, buf, buf_len);
+    if (QCONF_OK != ret) return ret;
+
+    // data type
+    if (tblval.size() < pos + 1 || tblval[pos] != data_type)
+    {
+        nodes.count = 0;
+        nodes.data = NULL;
+        return QCONF_ERR_DATA_FORMAT;
+    }
+
+    return QCONF_OK;
+}
+
 void serialize_to_idc_host(const string &idc, const string &host, string &dest)
 {
     dest.clear();
@@ -410,6 +688,63 @@ static int qconf_sub_vectorval(const string &tblval, size_t &pos, string_vector_
     return QCONF_OK;
 }
 
+static int qconf_sub_packed_vectorval(const string &tblval, size_t &pos, string_vector_t &nodes, char *buf, size_t &buf_len)
+{
+    QCONF_VECTOR_COUNT_TYPE count = 0;
+    QCONF_HOST_PATH_SIZE_TYPE size = 0;
+
+    // nodes
+    if (tblval.size() < pos + QCONF_VECTOR_COUNT_LEN)
+        return QCONF_ERR_DATA_FORMAT;
+
+    qconf_decode_num(tblval.data() + pos, count, QCONF_VECTOR_COUNT_TYPE);
+    pos += QCONF_VECTOR_COUNT_LEN;
+    if (0 == count)
+    {
+        nodes.count = 0;
+        nodes.data = NULL;
+        buf_len = 0;
+        return QCONF_OK;
+    }
+
+    // the size needed is known once all nodes are checked
+    size_t need = QCONF_PACKED_ALIGN_SLACK + count * sizeof(char*);
+    size_t end = pos;
+    for (int i = 0; i < count; ++i)
+    {
+        if (tblval.size() < end + QCONF_HOST_PATH_SIZE_LEN)
+            return QCONF_ERR_DATA_FORMAT;
+        qconf_decode_num(tblval.data() + end, size, QCONF_HOST_PATH_SIZE_TYPE);
+        end += QCONF_HOST_PATH_SIZE_LEN;
+        if (tblval.size() < end + size) return QCONF_ERR_DATA_FORMAT;
+        end += size;
+        need += size + 1;
+    }
+    if (NULL == buf || buf_len < need)
+    {
+        buf_len = need;
+        return QCONF_ERR_BUF_NOT_ENOUGH;
+    }
+
+    char **data = (char**)qconf_packed_align(buf);
+    char *node = (char*)(data + count);
+    for (int i = 0; i < count; ++i)
+    {
+        qconf_decode_num(tblval.data() + pos, size, QCONF_HOST_PATH_SIZE_TYPE);
+        pos += QCONF_HOST_PATH_SIZE_LEN;
+        memcpy(node, tblval.data() + pos, size);
+        node[size] = '\0';
+        data[i] = node;
+        node += size + 1;
+        pos += size;
+    }
+
+    nodes.count = count;
+    nodes.data = data;
+    buf_len = node - buf;
+    return QCONF_OK;
+}
+
 int graynodeval_to_tblval(const set<string> &nodes, string &tblval)
 {
     QCONF_VECTOR_COUNT_TYPE size = 0;
@@ -15,6 +15,20 @@
 #define QCONF_HOST_PATH_SIZE_LEN        sizeof(uint16_t)
 #define QCONF_VALUE_SIZE_TYPE           uint32_t
 #define QCONF_VALUE_SIZE_LEN            sizeof(uint32_t)
+#define QCONF_HOST_OFFSET_TYPE          uint32_t
+#define QCONF_HOST_OFFSET_LEN           sizeof(uint32_t)
+// ends the offsets of children nodes behind the key of a service, a key is
+// UTF-8 so it never ends with byte 0xff
+#define QCONF_HOST_INDEX_MAGIC          0xff00d1c5
+#define QCONF_EXPIRE_TIME_TYPE          int64_t
+#define QCONF_EXPIRE_TIME_LEN           sizeof(int64_t)
+#define QCONF_ZXID_TYPE                 int64_t
+#define QCONF_ZXID_LEN                  sizeof(int64_t)
+#define QCONF_STAMP_COUNTER_TYPE        uint32_t
+#define QCONF_STAMP_COUNTER_LEN         sizeof(uint32_t)
+// the leading bytes of md5 of the value
+#define QCONF_STAMP_DIGEST_LEN          8
+#define QCONF_STAMP_LEN                 (QCONF_ZXID_LEN * 2 + QCONF_STAMP_COUNTER_LEN + QCONF_STAMP_DIGEST_LEN)
 
 #if (BYTE_ORDER == LITTLE_ENDIAN)
 #define QCONF_IS_LITTLE_ENDIAN true
@@ -67,6 +81,24 @@
         }\
     }
 
+#define qconf_buf_sub(buf, buf_len, sub_pos, sub_buf, sub_len, d_type, ret)\
+    {\
+        ret = QCONF_ERR_DATA_FORMAT;\
+        if (buf_len >= sub_pos + sizeof(d_type))\
+        {\
+            d_type size = 0;\
+            qconf_decode_num(buf + sub_pos, size, d_type);\
+            sub_pos += sizeof(d_type);\
+            if (buf_len >= sub_pos + size)\
+            {\
+                sub_buf = buf + sub_pos;\
+                sub_len = size;\
+                sub_pos += size;\
+                ret = QCONF_OK;\
+            }\
+        }\
+    }
+
 /**
  * free the string vector according to the free_size
  */
@@ -82,17 +114,56 @@ static inline void free_string_vector(string_vector_t &vector, size_t free_size)
     vector.count = 0;
 }
 
+// bytes a packed buffer may need beyond its content to align the array at its head
+#define QCONF_PACKED_ALIGN_SLACK    (sizeof(void*) - 1)
+
+/**
+ * the place of the array at the head of a packed buffer, aligned for pointers
+ */
+static inline char *qconf_packed_align(char *buf)
+{
+    return buf + (sizeof(void*) - (uintptr_t)buf % sizeof(void*)) % sizeof(void*);
+}
+
 /**
  * Format the data_type, idc and path to tblkey
  */
 int serialize_to_tblkey(char data_type, const std::string &idc, const std::string &path, std::string &tblkey);
 
+/**
+ * Format the data_type, idc and path to tblkey, which is a buffer of QCONF_TBLKEY_MAX_LEN
+ */
+int serialize_to_tblkey(char data_type, const char *idc, size_t idc_len, const char *path, size_t path_len, char *tblkey, size_t &tblkey_len);
+
 /**
  * Get data_type, idc and path from tblkey
  */
 int deserialize_from_tblkey(const std::string &tblkey, char &data_type, std::string &idc, std::string &path);
 
 
+/**
+ * Pack tblkeys into as few messages to the agent as QCONF_MAX_MSG_LEN allows,
+ * or get them back from one message
+ */
+int tblkeys_to_msgs(const std::vector<std::string> &tblkeys, std::vector<std::string> &msgs);
+int msg_to_tblkeys(const std::string &msg, std::vector<std::string> &tblkeys);
+
+/**
+ * Format the tblkey marking the key of tblkey absent
+ */
+int serialize_to_absent_tblkey(const std::string &tblkey, std::string &absent_key);
+
+/**
+ * Version stamp kept behind the value of users' data in share memory
+ */
+typedef struct qconf_stamp_s
+{
+    int64_t mzxid;                      // zxid of the last change of the node
+    int64_t pzxid;                      // zxid of the last change of the children
+    uint32_t counter;                   // times the value changed in share memory
+    char digest[QCONF_STAMP_DIGEST_LEN];    // md5 of tblval of the value
+} qconf_stamp_t;
+
 /**
  * Format local idc to tblval
  */
@@ -118,6 +189,16 @@ int batchnodeval_to_tblval(const std::string &key, const string_vector_t &nodes,
  */
 int idcval_to_tblval(const std::string &key, const std::string &host, std::string &tblval_buf);
 
+/**
+ * Format the time an absent key expires at to tblval
+ */
+int absentval_to_tblval(const std::string &key, int64_t expire, std::string &tblval);
+
+/**
+ * Append the version stamp to the value kept in share memory
+ */
+int stamp_to_tblval(const qconf_stamp_t &stamp, std::string &tblval);
+
 /**
  * Get current data type
  */
@@ -128,6 +209,11 @@ char get_data_type(const std::string &value);
  */
 int tblval_to_localidc(const std::string &tblval, std::string &idc);
 
+/**
+ * Reference the local idc in tblval without copying
+ */
+int tblval_to_localidc(const char *tblval, size_t tblval_len, const char *&idc, size_t &idc_len);
+
 /**
  * Get the host from tblval
  */
@@ -138,11 +224,33 @@ int tblval_to_idcval(const std::string &tblval, std::string &host);
  */
 int tblval_to_idcval(const std::string &tblval, std::string &host, std::string &idc);
 
+/**
+ * Get the time an absent key expires at from tblval
+ */
+int tblval_to_absentval(const std::string &tblval, int64_t &expire);
+
+/**
+ * Get the time an absent key expires at and the key from tblval
+ */
+int tblval_to_absentval(const std::string &tblval, int64_t &expire, std::string &key);
+
+/**
+ * Get the version stamp at the end of the value kept in share memory,
+ * tblval_len is cut to the length without it. stamp may be NULL if only the
+ * cut is needed
+ */
+int tblval_to_stamp(const char *tblval, size_t &tblval_len, qconf_stamp_t *stamp);
+
 /**
  * Get node value from tblval
  */
 int tblval_to_nodeval(const std::string &tblval, std::string &nodeval);
 
+/**
+ * Reference node value in tblval without copying
+ */
+int tblval_to_nodeval(const char *tblval, size_t tblval_len, const char *&nodeval, size_t &nodeval_len);
+
 /**
  * Get idc, path and node value from tblval
  */
@@ -153,6 +261,17 @@ int tblval_to_nodeval(const std::string &tblval, std::string &nodeval, std::stri
  */
 int tblval_to_chdnodeval(const std::string &tblval, string_vector_t &nodes);
 
+/**
+ * Get the count of children nodes from tblval of a service
+ */
+int tblval_to_chdnodecount(const char *tblval, size_t tblval_len, int &count);
+
+/**
+ * Reference children node i in tblval of a service without copying it, the
+ * offsets behind the key are used if there are
+ */
+int tblval_to_chdnode(const char *tblval, size_t tblval_len, int i, const char *&node, size_t &node_len);
+
 /**
  * Get idc, path and nodes from tblval
  */
@@ -168,6 +287,17 @@ int tblval_to_batchnodeval(const std::string &tblval, string_vector_t &nodes);
  */
 int tblval_to_batchnodeval(const std::string &tblval, string_vector_t &nodes, std::string &idc, std::string &path);
 
+/**
+ * Get nodes or batch nodes from tblval packed into buf, the array of nodes is
+ * kept at the head of buf and the nodes behind it, so they're freed along
+ * with buf. buf_len is the capacity of buf, and the bytes used once packed
+ *
+ * @return QCONF_ERR_BUF_NOT_ENOUGH: if buf is NULL or less than the size
+ *         needed, which is kept in buf_len
+ */
+int tblval_to_packed_chdnodeval(const std::string &tblval, string_vector_t &nodes, char *buf, size_t &buf_len);
+int tblval_to_packed_batchnodeval(const std::string &tblval, string_vector_t &nodes, char *buf, size_t &buf_len);
+
 /**
  * format the idc and host
  */
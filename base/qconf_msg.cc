@@ -35,7 +35,7 @@ int create_msg_queue(key_t key, int &msqid)
     return QCONF_OK;
 }
 
-int send_msg(int msqid, const string &msg)
+int send_msg(int msqid, const string &msg, int try_times)
 {
     int ret = QCONF_OK;
     int try_send_times = 1;
@@ -58,7 +58,7 @@ int send_msg(int msqid, const string &msg)
 
         if (EAGAIN == errno)
         {
-            if (try_send_times < QCONF_MAX_SEND_MSG_TIMES)
+            if (try_send_times < try_times)
             {
                 usleep(5000);
                 try_send_times++;
@@ -18,7 +18,11 @@ typedef struct
 
 int init_msg_queue(key_t key, int &msqid);
 int create_msg_queue(key_t key, int &msqid);
-int send_msg(int msqid, const std::string &msg);
+
+/**
+ * Send msg, retrying a while if the queue is full unless try_times is 1
+ */
+int send_msg(int msqid, const std::string &msg, int try_times = QCONF_MAX_SEND_MSG_TIMES);
 int receive_msg(int msqid, std::string &msg);
 
 #endif
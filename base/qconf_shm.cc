@@ -3,16 +3,26 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <pthread.h>
+#include <time.h>
+#include <stddef.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/file.h>
 
 #include <vector>
 #include <string>
 #include <map>
+#include <set>
 #include <list>
+#include <algorithm>
 
 #include "qconf_log.h"
 #include "qconf_shm.h"
@@ -22,15 +32,133 @@
 
 #define NEED_MD5_TBLLEN 1024
 #define USE_MIXED_VERIFY
+#define QCONF_SHM_CTRL_MAGIC 0x51435452
+#define QCONF_SHM_REFS_MAGIC 0x51524632
+// reference bytes of a table take the key of the table with this bit flipped
+#define QCONF_SHM_REFS_KEY_MASK 0x40000000
+#define QCONF_SHM_GENS_MAGIC 0x51474533
+#define QCONF_SHM_JOURNAL_MAGIC 0x514a524e
+#define QCONF_SHM_NS_MAGIC 0x514e5344
+#define QCONF_SHM_INDEX_MAGIC 0x51494458
+#define QCONF_SHM_REPLICAS_MAGIC 0x5152504c
+// replica n of a table takes the key of the table ^ (n << 24)
+#define QCONF_SHM_REPLICA_KEY_SHIFT 24
+#define QCONF_NUMA_ONLINE_PATH "/sys/devices/system/node/online"
+// policy and flag of mbind(2), numaif.h of libnuma is not required
+#define QCONF_MPOL_BIND 2
+#define QCONF_MPOL_MF_MOVE (1 << 1)
+// | u8 types | u8 idc len | u16 path len | before idc and path of a record
+#define QCONF_SHM_INDEX_REC_HEAD 4
+// keys of a batch get whose slots are prefetched ahead of the one probed
+#define QCONF_PREFETCH_DISTANCE 8
 
 using namespace std;
 
-// share memory set and remove lock
-static pthread_mutex_t _qhasharr_op_mutex = PTHREAD_MUTEX_INITIALIZER;
+// share memory set and remove lock, readers go through the write sequence
+// of the table and take no lock. Linear tables keep no write sequence, they
+// are read under the lock, so it's recursive for the reads of writers
+static pthread_mutex_t _qhasharr_op_mutex = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
 
-static int hash_tbl_get_(qhasharr_t *tbl, const string &key, string &val);
-static int hash_tbl_set_(qhasharr_t *tbl, const string &key, const string &val);
+// tables replaced by hash_tbl_resize => tables replacing them, guarded by
+// the op mutex
+static map<qhasharr_t*, qhasharr_t*> _resized_tbls;
+
+// tables => their reference bytes, guarded by the op mutex
+static map<qhasharr_t*, qconf_shm_refs_t*> _tbl_refs;
+
+// tables => slot the eviction sweep goes on from, kept out of the reference
+// bytes since any client writes them, guarded by the op mutex
+static map<qhasharr_t*, int> _tbl_hands;
+
+// generation words bumped by writes of this process and the number of them,
+// which is not read back from the share memory, guarded by the op mutex
+static qconf_shm_gens_t *_shm_gens = NULL;
+static uint32_t _shm_ngens = 0;
+
+// journal recording writes of this process, guarded by the op mutex
+static qconf_shm_journal_t *_shm_journal = NULL;
+
+// index of paths kept up to date by writes of this process, guarded by the
+// op mutex
+static qconf_shm_index_t *_shm_index = NULL;
+// key of the entry being evicted, guarded by the op mutex
+static string _evicting_key;
+
+typedef struct shm_index_rec_s
+{
+    uint8_t types;
+    size_t idc_len;
+    size_t path_len;
+    const char *idc;
+    const char *path;
+} shm_index_rec_t;
+
+// tables failing writes instead of evicting once they're full, guarded by
+// the op mutex
+static set<qhasharr_t*> _noevict_tbls;
+
+// table replicated on NUMA nodes, its replicas on nodes 1 on and the
+// directory they're published in, guarded by the op mutex
+static qhasharr_t *_replicated_tbl = NULL;
+static vector<qhasharr_t*> _replica_tbls;
+static qconf_shm_replicas_t *_shm_replicas = NULL;
+static int _nreplicas = 1;
+static mode_t _replicas_mode = 0644;
+
+// writes applied to the replicas of a table
+#define QCONF_REPLICA_PUT       0
+#define QCONF_REPLICA_BATCH     1
+#define QCONF_REPLICA_REMOVE    2
+#define QCONF_REPLICA_EVICT     3
+#define QCONF_REPLICA_CLEAR     4
+
+// tables mapped from POSIX objects => mapped size
+static pthread_mutex_t _posix_tbls_mutex = PTHREAD_MUTEX_INITIALIZER;
+static map<qhasharr_t*, size_t> _posix_tbls;
+
+static int hash_tbl_get_(qhasharr_t *tbl, const string &key, string &val, qconf_shm_refs_t *refs, qhasharr_key_t *hkey = NULL);
+static bool hash_tbl_read_lock_(qhasharr_t *tbl);
+static int hash_tbl_set_(qhasharr_t *tbl, const string &key, const string &val, bool journal);
+static int hash_tbl_encode_(qhasharr_t *tbl, const string &key, const string &val, int64_t mzxid, int64_t pzxid, string &val_tmp, bool &same);
+static int create_hash_tbl_(qhasharr_t *&tbl, key_t shmkey, mode_t mode, int max_slots);
+static int hash_tbl_migrate_(qhasharr_t *src, qhasharr_t *dst);
+static void encode_tblval_(const string &val, string &tblval, const qconf_stamp_t *stamp = NULL);
+static int decode_stamp_(const char *tblval, size_t tblval_len, qconf_stamp_t &stamp);
+static qhasharr_t *current_tbl_(qhasharr_t *tbl);
+static int create_sysv_shm_(key_t shmkey, size_t memsize, mode_t mode, void *&shmptr);
+static int create_posix_shm_(key_t shmkey, size_t memsize, mode_t mode, void *&shmptr);
+static int init_posix_shm_(qhasharr_t *&tbl, key_t shmkey, int flags);
+static bool posix_shm_exist_(key_t shmkey);
+static void posix_shm_name_(key_t shmkey, char *name, size_t len);
+static void advise_huge_pages_(void *shmptr, size_t memsize);
+static void attach_hash_tbl_refs_(qhasharr_t *tbl, key_t shmkey);
+static bool hash_tbl_evict_(qhasharr_t *tbl);
+static bool tblkey_pinned_(const char *key, size_t key_len, const void *val, size_t val_len);
+static int tblval_to_tblkey_(const string &tblval, string &tblkey);
+static bool tblkey_stamped_(const string &key);
+static int attach_shm_gens_(qconf_shm_gens_t *&gens, key_t genskey, int flags);
+static void shm_gens_bump_(const char *key, size_t key_len);
+static void shm_gens_bump_all_();
+static int shm_gens_wait_(volatile uint32_t *word, uint32_t gen, const struct timespec &deadline);
+static void shm_gens_wake_(volatile uint32_t *word);
+static void shm_journal_append_(const char *key, size_t key_len, char type);
+static bool shm_index_rec_(const qconf_shm_index_t *index, uint32_t off, shm_index_rec_t &rec);
+static int shm_index_cmp_(const shm_index_rec_t &rec, const string &idc, const char *path, size_t path_len);
+static uint32_t shm_index_find_(const qconf_shm_index_t *index, uint32_t nkeys, const string &idc, const string &path);
+static void shm_index_reset_(qconf_shm_index_t *index);
+static void shm_index_compact_(qconf_shm_index_t *index);
+static void shm_index_update_(const char *key, size_t key_len, bool set);
+static void shm_index_clear_();
+static int hash_tbl_replicate_(qhasharr_t *tbl, key_t shmkey, int nreplicas);
+static void hash_tbl_fanout_(qhasharr_t *tbl, int type, const qhasharr_op_t *ops, int nops, int idx);
+static size_t hash_tbl_memsize_(qhasharr_t *tbl);
+static void bind_numa_node_(void *shmptr, size_t memsize, int node);
 int maxSlotsNum = 0;
+// the layout clients linked before the other formats read
+int shmFormat = QHASHARR_FORMAT_LINEAR;
+size_t shmHeapSize = 0;
+int shmBackend = QCONF_SHM_BACKEND_SYSV;
+bool shmHugePages = false;
     
 void qconf_destroy_qhasharr_lock()
 {
@@ -82,78 +210,1663 @@ int qconf_exist_tblkey(qhasharr_t *tbl, const string &key, bool &status)
     return QCONF_OK;
 }
 
+int create_shm_ctrl(qconf_shm_ctrl_t *&ctrl, key_t ctrlkey, key_t basekey, mode_t mode)
+{
+    int shmid = shmget(ctrlkey, sizeof(qconf_shm_ctrl_t), IPC_CREAT | IPC_EXCL | mode);
+    if (-1 == shmid)
+    {
+        if (EEXIST == errno)
+        {
+            int ret = init_shm_ctrl(ctrl, ctrlkey, mode, 0);
+            if (QCONF_OK == ret && (ctrl->generation & 1))
+            {
+                // the last publisher died, both tables are still there
+                LOG_ERR("Interrupted publish found in control segment of key:%#x", ctrlkey);
+                ctrl->generation++;
+            }
+            return ret;
+        }
+
+        LOG_FATAL_ERR("Failed to create control segment of key:%#x! errno:%d",
+                  ctrlkey, errno);
+        return QCONF_ERR_SHMGET;
+    }
+
+    ctrl = (qconf_shm_ctrl_t*)shmat(shmid, NULL, 0);
+    if ((void*)-1 == (void*)ctrl)
+    {
+        ctrl = NULL;
+        LOG_FATAL_ERR("Failed to shmat key:%#x! errno:%d", ctrlkey, errno);
+        return QCONF_ERR_SHMAT;
+    }
+
+    ctrl->generation = 0;
+    ctrl->basekey = basekey;
+    ctrl->shmkey = basekey;
+    __sync_synchronize();
+    ctrl->magic = QCONF_SHM_CTRL_MAGIC;
+
+    return QCONF_OK;
+}
+
+int init_shm_ctrl(qconf_shm_ctrl_t *&ctrl, key_t ctrlkey, mode_t mode, int flags)
+{
+    int shmid = shmget(ctrlkey, 0, mode);
+    if (-1 == shmid) return QCONF_ERR_SHMGET;
+
+    ctrl = (qconf_shm_ctrl_t*)shmat(shmid, NULL, flags);
+    if ((void*)-1 == (void*)ctrl)
+    {
+        ctrl = NULL;
+        return QCONF_ERR_SHMAT;
+    }
+    return QCONF_OK;
+}
+
+int shm_ctrl_get(const qconf_shm_ctrl_t *ctrl, key_t &shmkey, uint32_t &generation)
+{
+    if (NULL == ctrl) return QCONF_ERR_PARAM;
+    if (QCONF_SHM_CTRL_MAGIC != ctrl->magic) return QCONF_ERR_SHMINIT;
+
+    for (int count = 0; count < QCONF_MAX_READ_TIMES; count++)
+    {
+        generation = ctrl->generation;
+        __sync_synchronize();
+        shmkey = ctrl->shmkey;
+        __sync_synchronize();
+        if (0 == (generation & 1) && generation == ctrl->generation) return QCONF_OK;
+    }
+    return QCONF_ERR_SHM_CHANGED;
+}
+
 int create_hash_tbl(qhasharr_t *&tbl, key_t shmkey, mode_t mode)
 {
-    int shmid = -1;
-    size_t memsize = 0;
-    void* shmptr = NULL;
+    int ret = create_hash_tbl_(tbl, shmkey, mode, maxSlotsNum);
+    if (QCONF_OK != ret) return ret;
+
+    pthread_mutex_lock(&_qhasharr_op_mutex);
+    attach_hash_tbl_refs_(tbl, shmkey);
+    pthread_mutex_unlock(&_qhasharr_op_mutex);
+
+    return ret;
+}
+
+int create_hash_tbl(qhasharr_t *&tbl, key_t shmkey, mode_t mode, int max_slots, int evict)
+{
+    int ret = create_hash_tbl_(tbl, shmkey, mode, max_slots);
+    if (QCONF_OK != ret) return ret;
+
+    pthread_mutex_lock(&_qhasharr_op_mutex);
+    attach_hash_tbl_refs_(tbl, shmkey);
+    if (QCONF_SHM_EVICT_NONE == evict)
+        _noevict_tbls.insert(tbl);
+    else
+        _noevict_tbls.erase(tbl);
+    pthread_mutex_unlock(&_qhasharr_op_mutex);
 
-    memsize = qhasharr_calculate_memsize(maxSlotsNum);
+    return ret;
+}
+
+/**
+ * Create or attach the reference bytes of tbl, the caller holds the op mutex.
+ * Entries are evicted in order of slots without them
+ */
+static void attach_hash_tbl_refs_(qhasharr_t *tbl, key_t shmkey)
+{
+    key_t refskey = shmkey ^ QCONF_SHM_REFS_KEY_MASK;
+    size_t memsize = sizeof(qconf_shm_refs_t) + tbl->maxslots;
+
+    qconf_shm_refs_t *refs = NULL;
+    if (QCONF_OK == init_hash_tbl_refs(refs, shmkey))
+    {
+        if (refs->nrefs == tbl->maxslots)
+        {
+            _tbl_refs[tbl] = refs;
+            return;
+        }
+        // left by a table of another size
+        shmdt(refs);
+        shmctl(shmget(refskey, 0, 0), IPC_RMID, NULL);
+    }
 
-    shmid = shmget(shmkey, memsize, IPC_CREAT | IPC_EXCL | mode);
+    // any client marks the entries it gets
+    int shmid = shmget(refskey, memsize, IPC_CREAT | IPC_EXCL | 0666);
     if (-1 == shmid)
     {
-        if (EEXIST == errno)
+        LOG_ERR("Failed to create reference bytes of key:%#x! errno:%d", refskey, errno);
+        return;
+    }
+    refs = (qconf_shm_refs_t*)shmat(shmid, NULL, 0);
+    if ((void*)-1 == (void*)refs)
+    {
+        LOG_ERR("Failed to shmat key:%#x! errno:%d", refskey, errno);
+        return;
+    }
+
+    refs->nrefs = tbl->maxslots;
+    __sync_synchronize();
+    refs->magic = QCONF_SHM_REFS_MAGIC;
+    _tbl_refs[tbl] = refs;
+}
+
+int init_hash_tbl_refs(qconf_shm_refs_t *&refs, key_t shmkey)
+{
+    int shmid = shmget(shmkey ^ QCONF_SHM_REFS_KEY_MASK, 0, 0);
+    if (-1 == shmid) return QCONF_ERR_SHMGET;
+
+    refs = (qconf_shm_refs_t*)shmat(shmid, NULL, 0);
+    if ((void*)-1 == (void*)refs)
+    {
+        refs = NULL;
+        return QCONF_ERR_SHMAT;
+    }
+    if (QCONF_SHM_REFS_MAGIC != refs->magic)
+    {
+        shmdt(refs);
+        refs = NULL;
+        return QCONF_ERR_SHMINIT;
+    }
+    return QCONF_OK;
+}
+
+void detach_hash_tbl_refs(qconf_shm_refs_t *refs)
+{
+    if (NULL != refs) shmdt(refs);
+}
+
+int create_shm_gens(qconf_shm_gens_t *&gens, key_t genskey, uint32_t ngens, mode_t mode)
+{
+    if (0 == ngens) return QCONF_ERR_PARAM;
+
+    int ret = attach_shm_gens_(gens, genskey, 0);
+    struct shmid_ds ds;
+    if (QCONF_OK == ret && (0 != shmctl(shmget(genskey, 0, 0), IPC_STAT, &ds)
+                || (ds.shm_perm.mode & 0777) != mode || ds.shm_perm.uid != geteuid()))
+    {
+        // left with other permissions, by an older agent or someone else
+        shmdt(gens);
+        gens = NULL;
+        ret = QCONF_ERR_SHMINIT;
+    }
+    if (QCONF_ERR_SHMINIT == ret)
+    {
+        // left by an agent died before publishing it
+        shmctl(shmget(genskey, 0, 0), IPC_RMID, NULL);
+    }
+    if (QCONF_OK != ret)
+    {
+        size_t memsize = sizeof(qconf_shm_gens_t) + ngens * sizeof(uint32_t);
+        int shmid = shmget(genskey, memsize, IPC_CREAT | IPC_EXCL | mode);
+        if (-1 == shmid)
+        {
+            LOG_ERR("Failed to create generation words of key:%#x! errno:%d", genskey, errno);
+            return QCONF_ERR_SHMGET;
+        }
+        gens = (qconf_shm_gens_t*)shmat(shmid, NULL, 0);
+        if ((void*)-1 == (void*)gens)
         {
-            return init_hash_tbl(tbl, shmkey, mode, 0);
+            LOG_ERR("Failed to shmat key:%#x! errno:%d", genskey, errno);
+            gens = NULL;
+            return QCONF_ERR_SHMAT;
         }
 
-        LOG_FATAL_ERR("Failed to create share memory of key:%#x! errno:%d",
-                  shmkey, errno);
+        gens->ngens = ngens;
+        __sync_synchronize();
+        gens->magic = QCONF_SHM_GENS_MAGIC;
+    }
+
+    pthread_mutex_lock(&_qhasharr_op_mutex);
+    _shm_gens = gens;
+    _shm_ngens = gens->ngens;
+    pthread_mutex_unlock(&_qhasharr_op_mutex);
+    return QCONF_OK;
+}
+
+int init_shm_gens(qconf_shm_gens_t *&gens, key_t genskey)
+{
+    return attach_shm_gens_(gens, genskey, SHM_RDONLY);
+}
+
+/**
+ * Attach the generation words of genskey, the number of them is checked
+ * against the size of the segment
+ */
+static int attach_shm_gens_(qconf_shm_gens_t *&gens, key_t genskey, int flags)
+{
+    int shmid = shmget(genskey, 0, 0);
+    if (-1 == shmid) return QCONF_ERR_SHMGET;
+
+    gens = (qconf_shm_gens_t*)shmat(shmid, NULL, flags);
+    if ((void*)-1 == (void*)gens)
+    {
+        gens = NULL;
+        return QCONF_ERR_SHMAT;
+    }
+
+    struct shmid_ds ds;
+    if (QCONF_SHM_GENS_MAGIC != gens->magic || 0 == gens->ngens
+            || 0 != shmctl(shmid, IPC_STAT, &ds) || ds.shm_segsz < sizeof(qconf_shm_gens_t)
+            || gens->ngens > (ds.shm_segsz - sizeof(qconf_shm_gens_t)) / sizeof(uint32_t))
+    {
+        shmdt(gens);
+        gens = NULL;
+        return QCONF_ERR_SHMINIT;
+    }
+    return QCONF_OK;
+}
+
+void detach_shm_gens(qconf_shm_gens_t *gens)
+{
+    if (NULL == gens) return;
+
+    pthread_mutex_lock(&_qhasharr_op_mutex);
+    if (gens == _shm_gens)
+    {
+        _shm_gens = NULL;
+        _shm_ngens = 0;
+    }
+    pthread_mutex_unlock(&_qhasharr_op_mutex);
+    shmdt(gens);
+}
+
+volatile uint32_t *shm_gens_word(const qconf_shm_gens_t *gens, const char *key, size_t key_len)
+{
+    if (NULL == gens || NULL == key) return NULL;
+
+    return const_cast<volatile uint32_t*>(&gens->gens[qhashmurmur3_32(key, key_len) % gens->ngens]);
+}
+
+uint32_t shm_gens_get(const qconf_shm_gens_t *gens, const char *key, size_t key_len)
+{
+    if (NULL == gens || NULL == key) return 0;
+
+    // read before the table, so no write after it is missed
+    uint32_t gen = *shm_gens_word(gens, key, key_len);
+    __sync_synchronize();
+    return gen;
+}
+
+int shm_gens_wait(qconf_shm_gens_t *gens, const char *key, size_t key_len, uint32_t gen, const struct timespec &deadline)
+{
+    if (NULL == gens || NULL == key) return QCONF_ERR_PARAM;
+
+    return shm_gens_wait_(shm_gens_word(gens, key, key_len), gen, deadline);
+}
+
+uint32_t shm_gens_get_any(const qconf_shm_gens_t *gens)
+{
+    if (NULL == gens) return 0;
+
+    uint32_t gen = gens->any;
+    __sync_synchronize();
+    return gen;
+}
+
+int shm_gens_wait_any(qconf_shm_gens_t *gens, uint32_t gen, const struct timespec &deadline)
+{
+    if (NULL == gens) return QCONF_ERR_PARAM;
+
+    return shm_gens_wait_(&gens->any, gen, deadline);
+}
+
+void shm_gens_wake_any(qconf_shm_gens_t *gens)
+{
+    if (NULL != gens) shm_gens_wake_(&gens->any);
+}
+
+static int shm_gens_wait_(volatile uint32_t *word, uint32_t gen, const struct timespec &deadline)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    struct timespec timeout = {deadline.tv_sec - now.tv_sec, deadline.tv_nsec - now.tv_nsec};
+    if (timeout.tv_nsec < 0)
+    {
+        timeout.tv_sec--;
+        timeout.tv_nsec += 1000000000L;
+    }
+    if (timeout.tv_sec < 0) return QCONF_ERR_SHM_TIMEOUT;
+
+    long ret = syscall(SYS_futex, word, FUTEX_WAIT, gen, &timeout, NULL, 0);
+
+    // woken up, moved already or interrupted, the caller checks again
+    return (-1 == ret && ETIMEDOUT == errno) ? QCONF_ERR_SHM_TIMEOUT : QCONF_OK;
+}
+
+/**
+ * Bump the word of key and wake its waiters, the caller holds the op mutex.
+ * Clients wait on the key marked absent rather than on the mark
+ */
+static void shm_gens_bump_(const char *key, size_t key_len)
+{
+    qconf_shm_gens_t *gens = _shm_gens;
+    if (NULL == gens) return;
+
+    if (key_len > 1 && QCONF_DATA_TYPE_ABSENT == key[0])
+    {
+        key++;
+        key_len--;
+    }
+
+    volatile uint32_t *word = &gens->gens[qhashmurmur3_32(key, key_len) % _shm_ngens];
+    __sync_fetch_and_add(word, 1);
+    shm_gens_wake_(word);
+    __sync_fetch_and_add(&gens->any, 1);
+    shm_gens_wake_(&gens->any);
+}
+
+static void shm_gens_bump_all_()
+{
+    qconf_shm_gens_t *gens = _shm_gens;
+    if (NULL == gens) return;
+
+    for (uint32_t i = 0; i < _shm_ngens; i++)
+    {
+        __sync_fetch_and_add(&gens->gens[i], 1);
+        shm_gens_wake_(&gens->gens[i]);
+    }
+    __sync_fetch_and_add(&gens->any, 1);
+    shm_gens_wake_(&gens->any);
+}
+
+static void shm_gens_wake_(volatile uint32_t *word)
+{
+    // clients can't tell whether they block, so they're always woken up
+    syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+int create_shm_journal(qconf_shm_journal_t *&journal, key_t journalkey, uint32_t nrecs, mode_t mode)
+{
+    if (0 == nrecs) return QCONF_ERR_PARAM;
+
+    int ret = init_shm_journal(journal, journalkey);
+    if (QCONF_OK == ret && journal->nrecs != nrecs)
+    {
+        // left by an agent of another size, readers see it overrun
+        shmdt(journal);
+        ret = QCONF_ERR_SHMINIT;
+    }
+    if (QCONF_ERR_SHMINIT == ret) shmctl(shmget(journalkey, 0, 0), IPC_RMID, NULL);
+    if (QCONF_OK != ret)
+    {
+        size_t memsize = sizeof(qconf_shm_journal_t) + nrecs * sizeof(qconf_shm_journal_rec_t);
+        int shmid = shmget(journalkey, memsize, IPC_CREAT | IPC_EXCL | mode);
+        if (-1 == shmid)
+        {
+            LOG_ERR("Failed to create change journal of key:%#x! errno:%d", journalkey, errno);
+            return QCONF_ERR_SHMGET;
+        }
+        journal = (qconf_shm_journal_t*)shmat(shmid, NULL, 0);
+        if ((void*)-1 == (void*)journal)
+        {
+            LOG_ERR("Failed to shmat key:%#x! errno:%d", journalkey, errno);
+            journal = NULL;
+            return QCONF_ERR_SHMAT;
+        }
+
+        journal->nrecs = nrecs;
+        journal->head = 0;
+        __sync_synchronize();
+        journal->magic = QCONF_SHM_JOURNAL_MAGIC;
+    }
+
+    pthread_mutex_lock(&_qhasharr_op_mutex);
+    _shm_journal = journal;
+    pthread_mutex_unlock(&_qhasharr_op_mutex);
+    return QCONF_OK;
+}
+
+int init_shm_journal(qconf_shm_journal_t *&journal, key_t journalkey)
+{
+    int shmid = shmget(journalkey, 0, 0);
+    if (-1 == shmid) return QCONF_ERR_SHMGET;
+
+    // attached writable, the agent reattaches the one it created
+    journal = (qconf_shm_journal_t*)shmat(shmid, NULL, 0);
+    if ((void*)-1 == (void*)journal) journal = (qconf_shm_journal_t*)shmat(shmid, NULL, SHM_RDONLY);
+    if ((void*)-1 == (void*)journal)
+    {
+        journal = NULL;
+        return QCONF_ERR_SHMAT;
+    }
+    if (QCONF_SHM_JOURNAL_MAGIC != journal->magic || 0 == journal->nrecs)
+    {
+        shmdt(journal);
+        journal = NULL;
+        return QCONF_ERR_SHMINIT;
+    }
+    return QCONF_OK;
+}
+
+void detach_shm_journal(qconf_shm_journal_t *journal)
+{
+    if (NULL == journal) return;
+
+    pthread_mutex_lock(&_qhasharr_op_mutex);
+    if (journal == _shm_journal) _shm_journal = NULL;
+    pthread_mutex_unlock(&_qhasharr_op_mutex);
+    shmdt(journal);
+}
+
+uint64_t shm_journal_head(const qconf_shm_journal_t *journal)
+{
+    if (NULL == journal) return 0;
+    return __atomic_load_n(&journal->head, __ATOMIC_ACQUIRE);
+}
+
+int shm_journal_tail(const qconf_shm_journal_t *journal, uint64_t &cursor, qconf_shm_journal_rec_t *recs, int max_recs, int &nrecs)
+{
+    nrecs = 0;
+    if (NULL == journal || NULL == recs || max_recs <= 0) return QCONF_ERR_PARAM;
+
+    uint64_t head = shm_journal_head(journal);
+    // a cursor of another journal is behind or beyond its head
+    if (cursor > head || head - cursor > journal->nrecs)
+    {
+        cursor = head;
+        return QCONF_ERR_SHM_OVERRUN;
+    }
+
+    for (; cursor < head && nrecs < max_recs; cursor++)
+    {
+        const qconf_shm_journal_rec_t *rec = &journal->recs[cursor % journal->nrecs];
+        uint64_t seq = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+        recs[nrecs].keyhash = rec->keyhash;
+        recs[nrecs].type = rec->type;
+        recs[nrecs].dtype = rec->dtype;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (seq != cursor + 1 || seq != __atomic_load_n(&rec->seq, __ATOMIC_RELAXED))
+        {
+            // the writer has lapped the reader
+            cursor = shm_journal_head(journal);
+            nrecs = 0;
+            return QCONF_ERR_SHM_OVERRUN;
+        }
+        recs[nrecs].seq = cursor;
+        nrecs++;
+    }
+    return QCONF_OK;
+}
+
+/**
+ * Append a record of key to the journal, the caller holds the op mutex
+ */
+static void shm_journal_append_(const char *key, size_t key_len, char type)
+{
+    qconf_shm_journal_t *journal = _shm_journal;
+    if (NULL == journal) return;
+
+    uint64_t seq = journal->head;
+    qconf_shm_journal_rec_t *rec = &journal->recs[seq % journal->nrecs];
+
+    // readers see a record being rewritten by its sequence
+    __atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    rec->keyhash = (key_len > 0) ? qhashmurmur3_32(key, key_len) : 0;
+    rec->type = type;
+    rec->dtype = (key_len > 0) ? key[0] : QCONF_DATA_TYPE_UNKNOWN;
+    __atomic_store_n(&rec->seq, seq + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&journal->head, seq + 1, __ATOMIC_RELEASE);
+}
+
+int create_shm_ns(qconf_shm_ns_t *&ns, key_t nskey, mode_t mode)
+{
+    int ret = init_shm_ns(ns, nskey);
+    if (QCONF_OK == ret)
+    {
+        shmdt(ns);
+        ns = NULL;
+    }
+    else if (QCONF_ERR_SHMINIT == ret)
+    {
+        // left by an agent of another layout
+        shmctl(shmget(nskey, 0, 0), IPC_RMID, NULL);
+    }
+
+    int shmid = shmget(nskey, sizeof(qconf_shm_ns_t), IPC_CREAT | mode);
+    if (-1 == shmid)
+    {
+        LOG_ERR("Failed to create namespace directory of key:%#x! errno:%d", nskey, errno);
         return QCONF_ERR_SHMGET;
     }
+    ns = (qconf_shm_ns_t*)shmat(shmid, NULL, 0);
+    if ((void*)-1 == (void*)ns)
+    {
+        LOG_ERR("Failed to shmat key:%#x! errno:%d", nskey, errno);
+        ns = NULL;
+        return QCONF_ERR_SHMAT;
+    }
+    if (QCONF_SHM_NS_MAGIC != ns->magic)
+    {
+        ns->generation = 0;
+        ns->nns = 0;
+        __sync_synchronize();
+        ns->magic = QCONF_SHM_NS_MAGIC;
+    }
+    // the last publisher died while rewriting it
+    if (ns->generation & 1) ns->generation++;
+    return QCONF_OK;
+}
 
-    shmptr = shmat(shmid, NULL, 0);
-    if ((void*)-1 == shmptr)
+int init_shm_ns(qconf_shm_ns_t *&ns, key_t nskey)
+{
+    int shmid = shmget(nskey, 0, 0);
+    if (-1 == shmid) return QCONF_ERR_SHMGET;
+
+    ns = (qconf_shm_ns_t*)shmat(shmid, NULL, SHM_RDONLY);
+    if ((void*)-1 == (void*)ns)
     {
-        LOG_FATAL_ERR("Failed to shmat key:%#x! errno:%d",
-                  shmkey, errno);
+        ns = NULL;
         return QCONF_ERR_SHMAT;
     }
-    
-    tbl = qhasharr(shmptr, memsize);
-    if (NULL == tbl)
+    struct shmid_ds ds;
+    if (QCONF_SHM_NS_MAGIC != ns->magic
+            || 0 != shmctl(shmid, IPC_STAT, &ds) || ds.shm_segsz != sizeof(qconf_shm_ns_t))
+    {
+        shmdt(ns);
+        ns = NULL;
+        return QCONF_ERR_SHMINIT;
+    }
+    return QCONF_OK;
+}
+
+void detach_shm_ns(qconf_shm_ns_t *ns)
+{
+    if (NULL != ns) shmdt(ns);
+}
+
+int shm_ns_publish(qconf_shm_ns_t *ns, const vector<qconf_shm_ns_entry_t> &entries)
+{
+    if (NULL == ns || entries.size() > QCONF_SHM_NS_MAX) return QCONF_ERR_PARAM;
+
+    __atomic_store_n(&ns->generation, ns->generation + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    ns->nns = entries.size();
+    for (size_t i = 0; i < entries.size(); i++)
+        ns->ns[i] = entries[i];
+    __atomic_store_n(&ns->generation, ns->generation + 1, __ATOMIC_RELEASE);
+    return QCONF_OK;
+}
+
+int shm_ns_get(const qconf_shm_ns_t *ns, vector<qconf_shm_ns_entry_t> &entries, uint32_t &generation)
+{
+    if (NULL == ns) return QCONF_ERR_PARAM;
+    if (QCONF_SHM_NS_MAGIC != ns->magic) return QCONF_ERR_SHMINIT;
+
+    for (int count = 0; count < QCONF_MAX_READ_TIMES; count++)
+    {
+        generation = __atomic_load_n(&ns->generation, __ATOMIC_ACQUIRE);
+        int nns = ns->nns;
+        if (nns < 0 || nns > QCONF_SHM_NS_MAX) nns = 0;
+        entries.assign(ns->ns, ns->ns + nns);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (0 == (generation & 1) && generation == __atomic_load_n(&ns->generation, __ATOMIC_RELAXED))
+        {
+            for (size_t i = 0; i < entries.size(); i++)
+            {
+                entries[i].name[QCONF_SHM_NS_NAME_LEN - 1] = '\0';
+                entries[i].prefix[QCONF_SHM_NS_PREFIX_LEN - 1] = '\0';
+            }
+            return QCONF_OK;
+        }
+    }
+    entries.clear();
+    return QCONF_ERR_SHM_CHANGED;
+}
+
+int shm_ns_route(const vector<qconf_shm_ns_entry_t> &entries, const char *tblkey, size_t tblkey_len)
+{
+    if (entries.empty() || NULL == tblkey || 0 == tblkey_len) return -1;
+
+    if (QCONF_DATA_TYPE_ABSENT == tblkey[0])
+    {
+        tblkey++;
+        tblkey_len--;
+    }
+    if (0 == tblkey_len) return -1;
+
+    switch (tblkey[0])
+    {
+        case QCONF_DATA_TYPE_NODE:
+        case QCONF_DATA_TYPE_SERVICE:
+        case QCONF_DATA_TYPE_BATCH_NODE:
+            break;
+        default:
+            return -1;
+    }
+
+    // | type | idc size | idc | path size | path |
+    size_t pos = 1;
+    QCONF_IDC_SIZE_TYPE idc_size = 0;
+    QCONF_HOST_PATH_SIZE_TYPE path_size = 0;
+    if (pos + QCONF_IDC_SIZE_LEN > tblkey_len) return -1;
+    qconf_decode_num(tblkey + pos, idc_size, QCONF_IDC_SIZE_TYPE);
+    pos += QCONF_IDC_SIZE_LEN + idc_size;
+    if (pos + QCONF_HOST_PATH_SIZE_LEN > tblkey_len) return -1;
+    qconf_decode_num(tblkey + pos, path_size, QCONF_HOST_PATH_SIZE_TYPE);
+    pos += QCONF_HOST_PATH_SIZE_LEN;
+    if (pos + path_size > tblkey_len) return -1;
+    const char *path = tblkey + pos;
+
+    int index = -1;
+    size_t matched = 0;
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        const char *prefix = entries[i].prefix;
+        size_t prefix_len = strnlen(prefix, QCONF_SHM_NS_PREFIX_LEN);
+        if (0 == prefix_len || prefix_len > path_size || prefix_len <= matched) continue;
+        if (0 != memcmp(path, prefix, prefix_len)) continue;
+        // "/a" takes "/a" and "/a/b", but not "/ab"
+        if (prefix_len < path_size && '/' != path[prefix_len] && '/' != prefix[prefix_len - 1]) continue;
+
+        index = i;
+        matched = prefix_len;
+    }
+    return index;
+}
+
+int create_shm_index(qconf_shm_index_t *&index, key_t indexkey, uint32_t max_keys, mode_t mode)
+{
+    if (0 == max_keys || max_keys > (uint32_t)-1 / (QCONF_SHM_INDEX_RECORD_AVG + sizeof(uint32_t)))
+        return QCONF_ERR_PARAM;
+
+    uint32_t pool_size = max_keys * QCONF_SHM_INDEX_RECORD_AVG;
+    size_t memsize = sizeof(qconf_shm_index_t) + (size_t)max_keys * sizeof(uint32_t) + pool_size;
+    int shmid = shmget(indexkey, 0, 0);
+    struct shmid_ds ds;
+    if (-1 != shmid && (0 != shmctl(shmid, IPC_STAT, &ds) || ds.shm_segsz != memsize))
+    {
+        // left by an agent of another size
+        shmctl(shmid, IPC_RMID, NULL);
+        shmid = -1;
+    }
+    if (-1 == shmid) shmid = shmget(indexkey, memsize, IPC_CREAT | mode);
+    if (-1 == shmid)
+    {
+        LOG_ERR("Failed to create path index of key:%#x! errno:%d", indexkey, errno);
+        return QCONF_ERR_SHMGET;
+    }
+    index = (qconf_shm_index_t*)shmat(shmid, NULL, 0);
+    if ((void*)-1 == (void*)index)
+    {
+        LOG_ERR("Failed to shmat key:%#x! errno:%d", indexkey, errno);
+        index = NULL;
+        return QCONF_ERR_SHMAT;
+    }
+
+    // paths are indexed again from the tables
+    pthread_mutex_lock(&_qhasharr_op_mutex);
+    if (QCONF_SHM_INDEX_MAGIC != index->magic) index->generation = 0;
+    __atomic_store_n(&index->generation, index->generation | 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    index->max_keys = max_keys;
+    index->pool_size = pool_size;
+    index->magic = QCONF_SHM_INDEX_MAGIC;
+    shm_index_reset_(index);
+    __atomic_store_n(&index->generation, index->generation + 1, __ATOMIC_RELEASE);
+    _shm_index = index;
+    pthread_mutex_unlock(&_qhasharr_op_mutex);
+    return QCONF_OK;
+}
+
+int init_shm_index(qconf_shm_index_t *&index, key_t indexkey)
+{
+    int shmid = shmget(indexkey, 0, 0);
+    if (-1 == shmid) return QCONF_ERR_SHMGET;
+
+    // attached writable, the agent reattaches the one it created
+    index = (qconf_shm_index_t*)shmat(shmid, NULL, 0);
+    if ((void*)-1 == (void*)index) index = (qconf_shm_index_t*)shmat(shmid, NULL, SHM_RDONLY);
+    if ((void*)-1 == (void*)index)
+    {
+        index = NULL;
+        return QCONF_ERR_SHMAT;
+    }
+    struct shmid_ds ds;
+    if (QCONF_SHM_INDEX_MAGIC != index->magic || 0 != shmctl(shmid, IPC_STAT, &ds)
+            || ds.shm_segsz != sizeof(qconf_shm_index_t) + (size_t)index->max_keys * sizeof(uint32_t) + index->pool_size)
+    {
+        shmdt(index);
+        index = NULL;
+        return QCONF_ERR_SHMINIT;
+    }
+    return QCONF_OK;
+}
+
+void detach_shm_index(qconf_shm_index_t *index)
+{
+    if (NULL == index) return;
+
+    pthread_mutex_lock(&_qhasharr_op_mutex);
+    if (index == _shm_index) _shm_index = NULL;
+    pthread_mutex_unlock(&_qhasharr_op_mutex);
+    shmdt(index);
+}
+
+int shm_index_add_tbl(qhasharr_t *tbl)
+{
+    if (NULL == tbl) return QCONF_ERR_PARAM;
+
+    pthread_mutex_lock(&_qhasharr_op_mutex);
+    tbl = current_tbl_(tbl);
+    if (NULL == _shm_index)
+    {
+        pthread_mutex_unlock(&_qhasharr_op_mutex);
+        return QCONF_ERR_SHMINIT;
+    }
+
+    string tblkey, tblval;
+    for (int idx = 0; idx < tbl->maxslots; )
+    {
+        if (QCONF_OK == hash_tbl_getnext(tbl, tblkey, tblval, idx))
+            shm_index_update_(tblkey.data(), tblkey.size(), true);
+    }
+    pthread_mutex_unlock(&_qhasharr_op_mutex);
+    return QCONF_OK;
+}
+
+int shm_index_list(const qconf_shm_index_t *index, const string &idc, const string &prefix, vector<qconf_shm_index_item_t> &items)
+{
+    items.clear();
+    if (NULL == index) return QCONF_ERR_PARAM;
+    if (QCONF_SHM_INDEX_MAGIC != index->magic) return QCONF_ERR_SHMINIT;
+
+    // "/a" takes "/a" and "/a/b", but not "/ab"
+    string dir(prefix);
+    if (dir.empty() || '/' != dir[dir.size() - 1]) dir.push_back('/');
+
+    for (int count = 0; count < QCONF_MAX_READ_TIMES; count++)
+    {
+        uint32_t generation = __atomic_load_n(&index->generation, __ATOMIC_ACQUIRE);
+        if (generation & 1) continue;
+
+        items.clear();
+        uint32_t nkeys = index->nkeys;
+        if (nkeys > index->max_keys) nkeys = 0;
+        string cur_idc(idc);
+        shm_index_rec_t rec;
+        // an idc is jumped to at most once for each key
+        for (uint32_t jumps = 0; jumps <= nkeys; jumps++)
+        {
+            for (uint32_t i = shm_index_find_(index, nkeys, cur_idc, prefix); i < nkeys; i++)
+            {
+                if (!shm_index_rec_(index, index->offs[i], rec)) break;
+                if (rec.idc_len != cur_idc.size() || 0 != memcmp(rec.idc, cur_idc.data(), rec.idc_len)) break;
+                if (rec.path_len < prefix.size() || 0 != memcmp(rec.path, prefix.data(), prefix.size())) break;
+                if (rec.path_len != prefix.size()
+                        && (rec.path_len < dir.size() || 0 != memcmp(rec.path, dir.data(), dir.size())))
+                    continue;
+
+                qconf_shm_index_item_t item;
+                item.idc.assign(rec.idc, rec.idc_len);
+                item.path.assign(rec.path, rec.path_len);
+                item.types = rec.types;
+                items.push_back(item);
+            }
+            if (!idc.empty()) break;
+
+            // go on with the first idc after this one
+            string next_idc(cur_idc);
+            next_idc.push_back('\0');
+            uint32_t i = shm_index_find_(index, nkeys, next_idc, string());
+            if (i >= nkeys || !shm_index_rec_(index, index->offs[i], rec)) break;
+            cur_idc.assign(rec.idc, rec.idc_len);
+        }
+        bool dropped = (0 != index->dropped);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (generation == __atomic_load_n(&index->generation, __ATOMIC_RELAXED))
+            return dropped ? QCONF_ERR_SHM_INDEX_FULL : QCONF_OK;
+    }
+    items.clear();
+    return QCONF_ERR_SHM_CHANGED;
+}
+
+/**
+ * Decode the record at off of the pool, false if it's out of the pool
+ */
+static bool shm_index_rec_(const qconf_shm_index_t *index, uint32_t off, shm_index_rec_t &rec)
+{
+    const char *pool = (const char*)(index->offs + index->max_keys);
+    if ((uint64_t)off + QCONF_SHM_INDEX_REC_HEAD > index->pool_size) return false;
+
+    const char *head = pool + off;
+    uint16_t path_len = 0;
+    memcpy(&path_len, head + 2, sizeof(path_len));
+    rec.types = (uint8_t)head[0];
+    rec.idc_len = (uint8_t)head[1];
+    rec.path_len = path_len;
+    rec.idc = head + QCONF_SHM_INDEX_REC_HEAD;
+    rec.path = rec.idc + rec.idc_len;
+    return (uint64_t)off + QCONF_SHM_INDEX_REC_HEAD + rec.idc_len + rec.path_len <= index->pool_size;
+}
+
+/**
+ * Compare the record with idc and path, by idc first
+ */
+static int shm_index_cmp_(const shm_index_rec_t &rec, const string &idc, const char *path, size_t path_len)
+{
+    int ret = memcmp(rec.idc, idc.data(), min(rec.idc_len, idc.size()));
+    if (0 != ret) return ret;
+    if (rec.idc_len != idc.size()) return (rec.idc_len < idc.size()) ? -1 : 1;
+
+    ret = memcmp(rec.path, path, min(rec.path_len, path_len));
+    if (0 != ret) return ret;
+    if (rec.path_len != path_len) return (rec.path_len < path_len) ? -1 : 1;
+    return 0;
+}
+
+/**
+ * Position of the first record not less than idc and path
+ */
+static uint32_t shm_index_find_(const qconf_shm_index_t *index, uint32_t nkeys, const string &idc, const string &path)
+{
+    uint32_t low = 0, high = nkeys;
+    while (low < high)
+    {
+        uint32_t mid = low + (high - low) / 2;
+        shm_index_rec_t rec;
+        // a record torn by the writer is skipped, the reader retries anyway
+        if (shm_index_rec_(index, index->offs[mid], rec) && shm_index_cmp_(rec, idc, path.data(), path.size()) < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+/**
+ * Empty the index, the caller holds the op mutex and rewrites it
+ */
+static void shm_index_reset_(qconf_shm_index_t *index)
+{
+    index->nkeys = 0;
+    index->dropped = 0;
+    index->pool_used = 0;
+    index->pool_freed = 0;
+}
+
+/**
+ * Move the records kept to the front of the pool, the caller holds the op
+ * mutex and rewrites the index
+ */
+static void shm_index_compact_(qconf_shm_index_t *index)
+{
+    char *pool = (char*)(index->offs + index->max_keys);
+    string kept;
+    kept.reserve(index->pool_used - index->pool_freed);
+    uint32_t nkeys = 0;
+    for (uint32_t i = 0; i < index->nkeys; i++)
+    {
+        shm_index_rec_t rec;
+        if (!shm_index_rec_(index, index->offs[i], rec)) continue;
+        size_t size = QCONF_SHM_INDEX_REC_HEAD + rec.idc_len + rec.path_len;
+        index->offs[nkeys++] = kept.size();
+        kept.append(rec.idc - QCONF_SHM_INDEX_REC_HEAD, size);
+    }
+    memcpy(pool, kept.data(), kept.size());
+    index->nkeys = nkeys;
+    index->pool_used = kept.size();
+    index->pool_freed = 0;
+}
+
+/**
+ * Add or remove the data type of key to the path of key in the index, keys
+ * of no user data or cut in the slot are ignored. The caller holds the op
+ * mutex
+ */
+static void shm_index_update_(const char *key, size_t key_len, bool set)
+{
+    qconf_shm_index_t *index = _shm_index;
+    if (NULL == index || 0 == key_len) return;
+
+    uint8_t type = 0;
+    switch (key[0])
+    {
+        case QCONF_DATA_TYPE_NODE:
+            type = QCONF_SHM_INDEX_NODE;
+            break;
+        case QCONF_DATA_TYPE_SERVICE:
+            type = QCONF_SHM_INDEX_SERVICE;
+            break;
+        case QCONF_DATA_TYPE_BATCH_NODE:
+            type = QCONF_SHM_INDEX_BATCH;
+            break;
+        default:
+            return;
+    }
+
+    // | type | idc size | idc | path size | path |
+    size_t pos = 1;
+    QCONF_IDC_SIZE_TYPE idc_size = 0;
+    QCONF_HOST_PATH_SIZE_TYPE path_size = 0;
+    if (pos + QCONF_IDC_SIZE_LEN > key_len) return;
+    qconf_decode_num(key + pos, idc_size, QCONF_IDC_SIZE_TYPE);
+    pos += QCONF_IDC_SIZE_LEN;
+    if (pos + idc_size + QCONF_HOST_PATH_SIZE_LEN > key_len) return;
+    string idc(key + pos, idc_size);
+    pos += idc_size;
+    qconf_decode_num(key + pos, path_size, QCONF_HOST_PATH_SIZE_TYPE);
+    pos += QCONF_HOST_PATH_SIZE_LEN;
+    if (pos + path_size != key_len) return;
+    const char *path = key + pos;
+
+    uint32_t i = shm_index_find_(index, index->nkeys, idc, string(path, path_size));
+    shm_index_rec_t rec;
+    memset(&rec, 0, sizeof(rec));
+    bool found = i < index->nkeys && shm_index_rec_(index, index->offs[i], rec)
+        && 0 == shm_index_cmp_(rec, idc, path, path_size);
+    if (found && (set == (0 != (rec.types & type)))) return;
+    if (!found && !set) return;
+
+    char *pool = (char*)(index->offs + index->max_keys);
+    __atomic_store_n(&index->generation, index->generation + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    if (found)
+    {
+        uint8_t types = set ? (rec.types | type) : (rec.types & ~type);
+        pool[index->offs[i]] = (char)types;
+        if (0 == types)
+        {
+            memmove(index->offs + i, index->offs + i + 1, (index->nkeys - i - 1) * sizeof(uint32_t));
+            index->nkeys--;
+            index->pool_freed += QCONF_SHM_INDEX_REC_HEAD + rec.idc_len + rec.path_len;
+        }
+    }
+    else
+    {
+        uint32_t size = QCONF_SHM_INDEX_REC_HEAD + idc_size + path_size;
+        if (index->pool_used + size > index->pool_size && index->pool_used - index->pool_freed + size <= index->pool_size)
+            shm_index_compact_(index);
+
+        if (index->nkeys >= index->max_keys || index->pool_used + size > index->pool_size)
+        {
+            if (0 == index->dropped++)
+                LOG_ERR("Path index of share memory is full! keys:%u", index->nkeys);
+        }
+        else
+        {
+            char *head = pool + index->pool_used;
+            uint16_t path_len = path_size;
+            // the idc size is a byte in keys as well, serialize_to_tblkey
+            // rejects longer idcs
+            head[0] = (char)type;
+            head[1] = (char)idc_size;
+            memcpy(head + 2, &path_len, sizeof(path_len));
+            memcpy(head + QCONF_SHM_INDEX_REC_HEAD, idc.data(), idc_size);
+            memcpy(head + QCONF_SHM_INDEX_REC_HEAD + idc_size, path, path_size);
+
+            memmove(index->offs + i + 1, index->offs + i, (index->nkeys - i) * sizeof(uint32_t));
+            index->offs[i] = index->pool_used;
+            index->nkeys++;
+            index->pool_used += size;
+        }
+    }
+    __atomic_store_n(&index->generation, index->generation + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Remove every path from the index, the caller holds the op mutex
+ */
+static void shm_index_clear_()
+{
+    qconf_shm_index_t *index = _shm_index;
+    if (NULL == index) return;
+
+    __atomic_store_n(&index->generation, index->generation + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    shm_index_reset_(index);
+    __atomic_store_n(&index->generation, index->generation + 1, __ATOMIC_RELEASE);
+}
+
+int create_shm_replicas(qconf_shm_replicas_t *&replicas, key_t replicaskey, mode_t mode)
+{
+    int ret = init_shm_replicas(replicas, replicaskey);
+    if (QCONF_OK == ret)
+    {
+        shmdt(replicas);
+        replicas = NULL;
+    }
+    else if (QCONF_ERR_SHMINIT == ret)
+    {
+        // left by an agent of another layout
+        shmctl(shmget(replicaskey, 0, 0), IPC_RMID, NULL);
+    }
+
+    int shmid = shmget(replicaskey, sizeof(qconf_shm_replicas_t), IPC_CREAT | mode);
+    if (-1 == shmid)
+    {
+        LOG_ERR("Failed to create replica directory of key:%#x! errno:%d", replicaskey, errno);
+        return QCONF_ERR_SHMGET;
+    }
+    replicas = (qconf_shm_replicas_t*)shmat(shmid, NULL, 0);
+    if ((void*)-1 == (void*)replicas)
+    {
+        LOG_ERR("Failed to shmat key:%#x! errno:%d", replicaskey, errno);
+        replicas = NULL;
+        return QCONF_ERR_SHMAT;
+    }
+    if (QCONF_SHM_REPLICAS_MAGIC != replicas->magic)
+    {
+        replicas->generation = 0;
+        replicas->shmkey = QCONF_INVALID_KEY;
+        replicas->nreplicas = 0;
+        __sync_synchronize();
+        replicas->magic = QCONF_SHM_REPLICAS_MAGIC;
+    }
+    // the last publisher died while rewriting it
+    if (replicas->generation & 1) replicas->generation++;
+    return QCONF_OK;
+}
+
+int init_shm_replicas(qconf_shm_replicas_t *&replicas, key_t replicaskey)
+{
+    int shmid = shmget(replicaskey, 0, 0);
+    if (-1 == shmid) return QCONF_ERR_SHMGET;
+
+    replicas = (qconf_shm_replicas_t*)shmat(shmid, NULL, SHM_RDONLY);
+    if ((void*)-1 == (void*)replicas)
+    {
+        replicas = NULL;
+        return QCONF_ERR_SHMAT;
+    }
+    struct shmid_ds ds;
+    if (QCONF_SHM_REPLICAS_MAGIC != replicas->magic
+            || 0 != shmctl(shmid, IPC_STAT, &ds) || ds.shm_segsz != sizeof(qconf_shm_replicas_t))
+    {
+        shmdt(replicas);
+        replicas = NULL;
+        return QCONF_ERR_SHMINIT;
+    }
+    return QCONF_OK;
+}
+
+void detach_shm_replicas(qconf_shm_replicas_t *replicas)
+{
+    if (NULL != replicas) shmdt(replicas);
+}
+
+int shm_replicas_get(const qconf_shm_replicas_t *replicas, key_t shmkey, int node, key_t &replica_key, uint32_t &generation)
+{
+    if (NULL == replicas) return QCONF_ERR_PARAM;
+    if (QCONF_SHM_REPLICAS_MAGIC != replicas->magic) return QCONF_ERR_SHMINIT;
+
+    for (int count = 0; count < QCONF_MAX_READ_TIMES; count++)
+    {
+        generation = __atomic_load_n(&replicas->generation, __ATOMIC_ACQUIRE);
+        key_t key = replicas->shmkey;
+        int nreplicas = replicas->nreplicas;
+        key_t node_key = (node >= 0 && node < nreplicas && nreplicas <= QCONF_SHM_REPLICA_MAX)
+            ? replicas->keys[node] : QCONF_INVALID_KEY;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (0 == (generation & 1) && generation == __atomic_load_n(&replicas->generation, __ATOMIC_RELAXED))
+        {
+            if (key != shmkey || QCONF_INVALID_KEY == node_key) return QCONF_ERR_NOT_FOUND;
+            replica_key = node_key;
+            return QCONF_OK;
+        }
+    }
+    return QCONF_ERR_SHM_CHANGED;
+}
+
+int hash_tbl_replicate(qhasharr_t *tbl, key_t shmkey, qconf_shm_replicas_t *replicas, int nreplicas, mode_t mode)
+{
+    if (NULL == tbl || NULL == replicas || nreplicas < 1 || nreplicas > QCONF_SHM_REPLICA_MAX)
+        return QCONF_ERR_PARAM;
+
+    pthread_mutex_lock(&_qhasharr_op_mutex);
+    _shm_replicas = replicas;
+    _replicas_mode = mode;
+    int ret = hash_tbl_replicate_(current_tbl_(tbl), shmkey, nreplicas);
+    pthread_mutex_unlock(&_qhasharr_op_mutex);
+
+    return ret;
+}
+
+/**
+ * Replace the replicas with new copies of tbl and publish them, the caller
+ * holds the op mutex
+ */
+static int hash_tbl_replicate_(qhasharr_t *tbl, key_t shmkey, int nreplicas)
+{
+    qconf_shm_replicas_t *replicas = _shm_replicas;
+
+    // readers go back to the table itself until the new replicas are copied
+    vector<key_t> old_keys;
+    __atomic_store_n(&replicas->generation, replicas->generation + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for (int n = 1; n < replicas->nreplicas && n < QCONF_SHM_REPLICA_MAX; n++)
+        old_keys.push_back(replicas->keys[n]);
+    replicas->shmkey = shmkey;
+    replicas->nreplicas = 1;
+    replicas->keys[0] = shmkey;
+    __atomic_store_n(&replicas->generation, replicas->generation + 1, __ATOMIC_RELEASE);
+
+    // replicas are freed once all readers detach from them
+    for (size_t i = 0; i < _replica_tbls.size(); i++)
+        detach_hash_tbl(_replica_tbls[i]);
+    _replica_tbls.clear();
+    for (int n = 1; n < QCONF_SHM_REPLICA_MAX; n++)
+        old_keys.push_back(shmkey ^ ((key_t)n << QCONF_SHM_REPLICA_KEY_SHIFT));
+    for (size_t i = 0; i < old_keys.size(); i++)
+        remove_hash_tbl(old_keys[i], _replicas_mode);
+
+    _replicated_tbl = tbl;
+    _nreplicas = nreplicas;
+    if (1 == nreplicas) return QCONF_OK;
+
+    pthread_mutex_lock(&_posix_tbls_mutex);
+    bool posix = (_posix_tbls.end() != _posix_tbls.find(tbl));
+    pthread_mutex_unlock(&_posix_tbls_mutex);
+
+    size_t memsize = hash_tbl_memsize_(tbl);
+    key_t keys[QCONF_SHM_REPLICA_MAX] = {shmkey};
+    int ret = QCONF_OK;
+    for (int n = 1; n < nreplicas; n++)
+    {
+        keys[n] = shmkey ^ ((key_t)n << QCONF_SHM_REPLICA_KEY_SHIFT);
+        void *shmptr = NULL;
+        ret = posix ? create_posix_shm_(keys[n], memsize, _replicas_mode, shmptr)
+            : create_sysv_shm_(keys[n], memsize, _replicas_mode, shmptr);
+        if (QCONF_OK != ret)
+        {
+            LOG_ERR("Failed to create replica of share memory of key:%#x! errno:%d", keys[n], errno);
+            break;
+        }
+        if (posix)
+        {
+            pthread_mutex_lock(&_posix_tbls_mutex);
+            _posix_tbls[(qhasharr_t*)shmptr] = memsize;
+            pthread_mutex_unlock(&_posix_tbls_mutex);
+        }
+
+        // pages are placed by the policy when they're first written
+        bind_numa_node_(shmptr, memsize, n);
+        qhasharr_copy((qhasharr_t*)shmptr, tbl, memsize);
+        _replica_tbls.push_back((qhasharr_t*)shmptr);
+    }
+
+    __atomic_store_n(&replicas->generation, replicas->generation + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    replicas->nreplicas = _replica_tbls.size() + 1;
+    for (int n = 1; n < replicas->nreplicas; n++)
+        replicas->keys[n] = keys[n];
+    __atomic_store_n(&replicas->generation, replicas->generation + 1, __ATOMIC_RELEASE);
+
+    LOG_INFO("Replicated share memory of key:%#x on %d numa nodes", shmkey, replicas->nreplicas);
+    return ret;
+}
+
+/**
+ * Apply a write done to tbl to its replicas, so they keep the same slots. A
+ * replica ending up otherwise is copied from tbl again. The caller holds the
+ * op mutex
+ */
+static void hash_tbl_fanout_(qhasharr_t *tbl, int type, const qhasharr_op_t *ops, int nops, int idx)
+{
+    if (tbl != _replicated_tbl) return;
+
+    for (size_t i = 0; i < _replica_tbls.size(); i++)
+    {
+        qhasharr_t *replica = _replica_tbls[i];
+        bool ret = true;
+        switch (type)
+        {
+            case QCONF_REPLICA_PUT:
+                ret = qhasharr_put(replica, ops[0].key, ops[0].key_size, ops[0].value, ops[0].val_size);
+                break;
+            case QCONF_REPLICA_BATCH:
+                ret = qhasharr_put_batch(replica, ops, nops);
+                break;
+            case QCONF_REPLICA_REMOVE:
+                ret = qhasharr_remove(replica, ops[0].key, ops[0].key_size);
+                break;
+            case QCONF_REPLICA_EVICT:
+                // the entry evicted starts at the same slot of the replica
+                ret = qhasharr_evict(replica, NULL, &idx, NULL);
+                break;
+            case QCONF_REPLICA_CLEAR:
+                qhasharr_clear(replica);
+                break;
+        }
+        if (ret && replica->num == tbl->num && replica->usedslots == tbl->usedslots) continue;
+
+        LOG_ERR("Replica %zu of share memory differs from the table after write:%d, copy it again", i + 1, type);
+        qhasharr_copy(replica, tbl, hash_tbl_memsize_(tbl));
+    }
+}
+
+/**
+ * Size of the memory tbl was made of
+ */
+static size_t hash_tbl_memsize_(qhasharr_t *tbl)
+{
+    int format = qhasharr_format(tbl);
+    size_t heapsize = (QHASHARR_FORMAT_LINEAR == format) ? 0 : tbl->heapsize;
+    return qhasharr_calculate_memsize_heap(tbl->maxslots, format, heapsize);
+}
+
+/**
+ * Bind the pages of the memory to node, a node the machine has not is left
+ * as it is
+ */
+static void bind_numa_node_(void *shmptr, size_t memsize, int node)
+{
+#ifdef SYS_mbind
+    unsigned long mask = 1UL << node;
+    if (0 != syscall(SYS_mbind, shmptr, memsize, QCONF_MPOL_BIND, &mask, sizeof(mask) * 8 + 1, QCONF_MPOL_MF_MOVE))
+        LOG_ERR("Failed to bind share memory to numa node:%d! errno:%d", node, errno);
+#endif
+}
+
+int qconf_numa_nodes()
+{
+    FILE *fp = fopen(QCONF_NUMA_ONLINE_PATH, "r");
+    if (NULL == fp) return 1;
+
+    // a list of ranges like 0-1,3, the last number is the highest node
+    char buf[256] = {0};
+    int max_node = 0;
+    if (NULL != fgets(buf, sizeof(buf), fp))
+    {
+        for (char *p = buf; '\0' != *p; )
+        {
+            char *end = NULL;
+            long node = strtol(p, &end, 10);
+            if (end == p)
+            {
+                p++;
+                continue;
+            }
+            if (node > max_node) max_node = node;
+            p = end;
+        }
+    }
+    fclose(fp);
+
+    return min(max_node + 1, QCONF_SHM_REPLICA_MAX);
+}
+
+int qconf_numa_node()
+{
+#ifdef SYS_getcpu
+    unsigned int cpu = 0, node = 0;
+    if (0 == syscall(SYS_getcpu, &cpu, &node, NULL)) return node;
+#endif
+    return 0;
+}
+
+void hash_tbl_touch(qconf_shm_refs_t *refs, int idx)
+{
+    if (NULL == refs || idx < 0 || idx >= refs->nrefs) return;
+
+    // keep the cache line shared while the entry stays referenced
+    if (0 == refs->refs[idx]) refs->refs[idx] = 1;
+}
+
+static int create_hash_tbl_(qhasharr_t *&tbl, key_t shmkey, mode_t mode, int max_slots)
+{
+    void* shmptr = NULL;
+    // the linear layout has no heap
+    size_t heapsize = (QHASHARR_FORMAT_LINEAR == shmFormat) ? 0 : shmHeapSize;
+    size_t memsize = qhasharr_calculate_memsize_heap(max_slots, shmFormat, heapsize);
+
+    // a table of either backend is kept until it's removed
+    bool posix = (QCONF_SHM_BACKEND_POSIX == shmBackend)
+        ? (-1 == shmget(shmkey, 0, mode)) : posix_shm_exist_(shmkey);
+    int ret = posix ? create_posix_shm_(shmkey, memsize, mode, shmptr)
+        : create_sysv_shm_(shmkey, memsize, mode, shmptr);
+    if (QCONF_ERR_SHMGET == ret && EEXIST == errno)
+    {
+        ret = init_hash_tbl(tbl, shmkey, mode, 0);
+        if (QCONF_OK == ret && qhasharr_write_interrupted(tbl))
+        {
+            // the last writer died in the middle of an update
+            LOG_ERR("Interrupted write found in share memory of key:%#x, clear it", shmkey);
+            hash_tbl_clear(tbl);
+        }
+        if (QCONF_OK == ret && qhasharr_format(tbl) != shmFormat)
+        {
+            // the table keeps its layout until the share memory is removed
+            LOG_ERR("Share memory of key:%#x keeps format:%d, not format:%d",
+                    shmkey, qhasharr_format(tbl), shmFormat);
+        }
+        return ret;
+    }
+    if (QCONF_OK != ret)
+    {
+        LOG_FATAL_ERR("Failed to create share memory of key:%#x! errno:%d",
+                  shmkey, errno);
+        return ret;
+    }
+
+    tbl = qhasharr_fmt_heap(shmptr, memsize, shmFormat, heapsize);
+    if (NULL == tbl)
+    {
+        LOG_FATAL_ERR("Failed to init shm of key:%#x errno:%d", shmkey, errno);
+        return QCONF_ERR_SHMINIT;
+    }
+    if (posix)
+    {
+        pthread_mutex_lock(&_posix_tbls_mutex);
+        _posix_tbls[tbl] = memsize;
+        pthread_mutex_unlock(&_posix_tbls_mutex);
+    }
+
+    return QCONF_OK;
+}
+
+static int create_sysv_shm_(key_t shmkey, size_t memsize, mode_t mode, void *&shmptr)
+{
+    int shmid = -1;
+#ifdef SHM_HUGETLB
+    // only works with huge pages reserved in vm.nr_hugepages
+    if (shmHugePages)
+        shmid = shmget(shmkey, memsize, IPC_CREAT | IPC_EXCL | SHM_HUGETLB | mode);
+    if (-1 == shmid && EEXIST == errno) return QCONF_ERR_SHMGET;
+#endif
+    if (-1 == shmid) shmid = shmget(shmkey, memsize, IPC_CREAT | IPC_EXCL | mode);
+    if (-1 == shmid) return QCONF_ERR_SHMGET;
+
+    shmptr = shmat(shmid, NULL, 0);
+    if ((void*)-1 == shmptr)
+    {
+        LOG_FATAL_ERR("Failed to shmat key:%#x! errno:%d",
+                  shmkey, errno);
+        return QCONF_ERR_SHMAT;
+    }
+    advise_huge_pages_(shmptr, memsize);
+
+    return QCONF_OK;
+}
+
+static int create_posix_shm_(key_t shmkey, size_t memsize, mode_t mode, void *&shmptr)
+{
+    char name[32];
+    posix_shm_name_(shmkey, name, sizeof(name));
+
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, mode);
+    if (-1 == fd) return QCONF_ERR_SHMGET;
+
+    // the permission is not masked by umask as the SysV one
+    if (-1 == fchmod(fd, mode) || -1 == ftruncate(fd, memsize))
+    {
+        LOG_FATAL_ERR("Failed to size share memory of name:%s! errno:%d", name, errno);
+        close(fd);
+        shm_unlink(name);
+        return QCONF_ERR_SHMINIT;
+    }
+
+    int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+    // fault in the whole table once instead of page by page on the first puts
+    flags |= MAP_POPULATE;
+#endif
+    shmptr = mmap(NULL, memsize, PROT_READ | PROT_WRITE, flags, fd, 0);
+    close(fd);
+    if (MAP_FAILED == shmptr)
+    {
+        LOG_FATAL_ERR("Failed to mmap name:%s! errno:%d", name, errno);
+        shm_unlink(name);
+        return QCONF_ERR_SHMAT;
+    }
+    advise_huge_pages_(shmptr, memsize);
+
+    return QCONF_OK;
+}
+
+int init_hash_tbl(qhasharr_t *&tbl, key_t shmkey, mode_t mode, int flags)
+{
+    int shmid = -1;
+
+    shmid = shmget(shmkey, 0, mode);
+    if (-1 == shmid) return init_posix_shm_(tbl, shmkey, flags);
+
+    tbl = (qhasharr_t*)shmat(shmid, NULL, flags);
+    if ((void*)-1 == (void*)tbl)
+    {
+        tbl = NULL;
+        return QCONF_ERR_SHMAT;
+    }
+
+    // a layout this version doesn't know is not read
+    struct shmid_ds ds;
+    if (-1 == shmctl(shmid, IPC_STAT, &ds) || !qhasharr_check_layout(tbl, ds.shm_segsz))
+    {
+        LOG_ERR("Unknown layout of share memory of key:%#x", shmkey);
+        shmdt(tbl);
+        tbl = NULL;
+        return QCONF_ERR_SHMINIT;
+    }
+    return QCONF_OK;
+}
+
+static int init_posix_shm_(qhasharr_t *&tbl, key_t shmkey, int flags)
+{
+    char name[32];
+    posix_shm_name_(shmkey, name, sizeof(name));
+
+    bool rdonly = (flags & SHM_RDONLY);
+    int fd = shm_open(name, rdonly ? O_RDONLY : O_RDWR, 0);
+    if (-1 == fd) return QCONF_ERR_SHMGET;
+
+    struct stat st;
+    if (-1 == fstat(fd, &st) || (size_t)st.st_size < sizeof(qhasharr_t))
+    {
+        close(fd);
+        return QCONF_ERR_SHMGET;
+    }
+
+    void *shmptr = mmap(NULL, st.st_size, rdonly ? PROT_READ : (PROT_READ | PROT_WRITE),
+            MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == shmptr) return QCONF_ERR_SHMAT;
+    if (!qhasharr_check_layout((qhasharr_t*)shmptr, st.st_size))
+    {
+        LOG_ERR("Unknown layout of share memory of key:%#x", shmkey);
+        munmap(shmptr, st.st_size);
+        return QCONF_ERR_SHMINIT;
+    }
+#ifdef MADV_HUGEPAGE
+    // map the huge pages of the agent as huge ones, no-op for 4KB pages
+    madvise(shmptr, st.st_size, MADV_HUGEPAGE);
+#endif
+
+    tbl = (qhasharr_t*)shmptr;
+    pthread_mutex_lock(&_posix_tbls_mutex);
+    _posix_tbls[tbl] = st.st_size;
+    pthread_mutex_unlock(&_posix_tbls_mutex);
+
+    return QCONF_OK;
+}
+
+void detach_hash_tbl(qhasharr_t *tbl)
+{
+    if (NULL == tbl) return;
+
+    pthread_mutex_lock(&_posix_tbls_mutex);
+    map<qhasharr_t*, size_t>::iterator it = _posix_tbls.find(tbl);
+    if (it != _posix_tbls.end())
+    {
+        munmap(tbl, it->second);
+        _posix_tbls.erase(it);
+    }
+    else
+    {
+        shmdt(tbl);
+    }
+    pthread_mutex_unlock(&_posix_tbls_mutex);
+}
+
+int remove_hash_tbl(key_t shmkey, mode_t mode)
+{
+    int ret = QCONF_ERR_NOT_FOUND;
+
+    int shmid = shmget(shmkey, 0, mode);
+    if (-1 != shmid && 0 == shmctl(shmid, IPC_RMID, NULL)) ret = QCONF_OK;
+
+    shmid = shmget(shmkey ^ QCONF_SHM_REFS_KEY_MASK, 0, 0);
+    if (-1 != shmid) shmctl(shmid, IPC_RMID, NULL);
+
+    char name[32];
+    posix_shm_name_(shmkey, name, sizeof(name));
+    if (0 == shm_unlink(name)) ret = QCONF_OK;
+
+    return ret;
+}
+
+static bool posix_shm_exist_(key_t shmkey)
+{
+    char name[32];
+    posix_shm_name_(shmkey, name, sizeof(name));
+
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (-1 == fd) return (EACCES == errno);
+    close(fd);
+    return true;
+}
+
+static void posix_shm_name_(key_t shmkey, char *name, size_t len)
+{
+    snprintf(name, len, QCONF_POSIX_SHM_NAME_FMT, (unsigned int)shmkey);
+}
+
+/**
+ * Back the table with transparent huge pages, lookups land on random slots
+ * and each one misses the TLB with 4KB pages
+ */
+static void advise_huge_pages_(void *shmptr, size_t memsize)
+{
+#ifdef MADV_HUGEPAGE
+    if (shmHugePages) madvise(shmptr, memsize, MADV_HUGEPAGE);
+#endif
+}
+
+int hash_tbl_resize(qhasharr_t *&tbl, qconf_shm_ctrl_t *ctrl, int max_slots, mode_t mode)
+{
+    if (NULL == tbl || NULL == ctrl || max_slots <= 0) return QCONF_ERR_PARAM;
+
+    pthread_mutex_lock(&_qhasharr_op_mutex);
+    qhasharr_t *old_tbl = current_tbl_(tbl);
+    if (old_tbl->maxslots == max_slots)
+    {
+        tbl = old_tbl;
+        pthread_mutex_unlock(&_qhasharr_op_mutex);
+        return QCONF_OK;
+    }
+
+    key_t old_key = ctrl->shmkey;
+    key_t new_key = (old_key == ctrl->basekey) ? ctrl->basekey + 1 : ctrl->basekey;
+
+    // drop the table left by a resize which was not published
+    remove_hash_tbl(new_key, mode);
+
+    qhasharr_t *new_tbl = NULL;
+    int ret = create_hash_tbl_(new_tbl, new_key, mode, max_slots);
+    if (QCONF_OK == ret) ret = hash_tbl_migrate_(old_tbl, new_tbl);
+    if (QCONF_OK != ret)
     {
-        LOG_FATAL_ERR("Failed to init shm of shmid:%d errno:%d", shmid, errno);
-        return QCONF_ERR_SHMINIT;
+        pthread_mutex_unlock(&_qhasharr_op_mutex);
+        detach_hash_tbl(new_tbl);
+        remove_hash_tbl(new_key, mode);
+        LOG_ERR("Failed to resize share memory of key:%#x from %d to %d slots! ret:%d",
+                old_key, old_tbl->maxslots, max_slots, ret);
+        return ret;
     }
 
+    // publish the new table, readers see either the old key or the new one
+    ctrl->generation++;
+    __sync_synchronize();
+    ctrl->shmkey = new_key;
+    __sync_synchronize();
+    ctrl->generation++;
+
+    attach_hash_tbl_refs_(new_tbl, new_key);
+    _resized_tbls[old_tbl] = new_tbl;
+    tbl = new_tbl;
+    if (old_tbl == _replicated_tbl) hash_tbl_replicate_(new_tbl, new_key, _nreplicas);
+    pthread_mutex_unlock(&_qhasharr_op_mutex);
+
+    // the old table is freed once all readers detach from it
+    remove_hash_tbl(old_key, mode);
+    LOG_INFO("Resized share memory from key:%#x of %d slots to key:%#x of %d slots, generation:%u",
+            old_key, old_tbl->maxslots, new_key, max_slots, ctrl->generation);
+
     return QCONF_OK;
 }
 
-int init_hash_tbl(qhasharr_t *&tbl, key_t shmkey, mode_t mode, int flags)
+/**
+ * Copy the entries of src into dst, the caller holds the op mutex
+ */
+static int hash_tbl_migrate_(qhasharr_t *src, qhasharr_t *dst)
 {
-    int shmid = -1;
+    // the write sequence goes on, so a version got from src never matches dst
+    qhasharr_seq_follow(dst, src);
 
-    shmid = shmget(shmkey, 0, mode);
-    if (-1 == shmid) return QCONF_ERR_SHMGET;
+    int max_slots = 0, used_slots = 0;
+    hash_tbl_get_count(src, max_slots, used_slots);
 
-    tbl = (qhasharr_t*)shmat(shmid, NULL, flags);
-    if ((void*)-1 == (void*)tbl)
+    string tblkey, tblval, val_tmp;
+    qconf_stamp_t stamp;
+    for (int idx = 0; idx < max_slots; )
     {
-        tbl = NULL;
-        return QCONF_ERR_SHMAT;
+        int ret = hash_tbl_getnext(src, tblkey, tblval, idx);
+        if (QCONF_ERR_TBL_END == ret) break;
+        // broken entry is got from zookeeper again on demand
+        if (QCONF_OK != ret) continue;
+
+        bool stamped = (QCONF_OK == hash_tbl_get_stamp(src, tblkey, stamp));
+        encode_tblval_(tblval, val_tmp, stamped ? &stamp : NULL);
+        if (!qhasharr_put(dst, tblkey.data(), tblkey.size(), val_tmp.data(), val_tmp.size()))
+            return QCONF_ERR_SHM_RESIZE;
     }
     return QCONF_OK;
 }
 
+/**
+ * The table replacing tbl, the caller holds the op mutex
+ */
+static qhasharr_t *current_tbl_(qhasharr_t *tbl)
+{
+    map<qhasharr_t*, qhasharr_t*>::const_iterator it;
+    while ((it = _resized_tbls.find(tbl)) != _resized_tbls.end()) tbl = it->second;
+    return tbl;
+}
+
 int hash_tbl_get_count(qhasharr_t *tbl, int &max_slots, int &used_slots)
 {
     if (NULL == tbl) return -1;
     return qhasharr_size(tbl, &max_slots, &used_slots);
 }
 
-static int hash_tbl_get_(qhasharr_t *tbl, const string &key, string &val) 
+int hash_tbl_get_heap_stat(qhasharr_t *tbl, qhasharr_heap_stat_t &stat)
+{
+    if (NULL == tbl) return QCONF_ERR_PARAM;
+    if (!qhasharr_heap_stat(tbl, &stat))
+        return (ENOENT == errno) ? QCONF_ERR_NOT_FOUND : QCONF_ERR_OTHER;
+    return QCONF_OK;
+}
+
+int hash_tbl_getnext_stat(qhasharr_t *tbl, qhasharr_key_stat_t &stat, int &idx)
+{
+    if (NULL == tbl) return QCONF_ERR_PARAM;
+    if (!qhasharr_getnext_stat(tbl, &stat, &idx))
+        return (ENOENT == errno) ? QCONF_ERR_TBL_END : QCONF_ERR_OTHER;
+    return QCONF_OK;
+}
+
+static int hash_tbl_get_(qhasharr_t *tbl, const string &key, string &val, qconf_shm_refs_t *refs, qhasharr_key_t *hkey)
 {
     if (key.empty()) return QCONF_ERR_PARAM;
 
     char *val_tmp = NULL;
     size_t val_tmp_len = 0;
+    int idx = -1;
 
-    pthread_mutex_lock(&_qhasharr_op_mutex);
-    val_tmp = (char*)qhasharr_get(tbl, key.data(), key.size(), &val_tmp_len);
-    pthread_mutex_unlock(&_qhasharr_op_mutex);
+    bool locked = hash_tbl_read_lock_(tbl);
+    val_tmp = (char*)qhasharr_get_key(tbl, key.data(), key.size(), hkey, &val_tmp_len, &idx);
+    if (locked) pthread_mutex_unlock(&_qhasharr_op_mutex);
     if (NULL == val_tmp) return QCONF_ERR_NOT_FOUND;
+    hash_tbl_touch(refs, idx);
 
     val.assign(val_tmp, val_tmp_len);
     free(val_tmp);
@@ -162,17 +1875,98 @@ static int hash_tbl_get_(qhasharr_t *tbl, const string &key, string &val)
     return QCONF_OK;
 }
 
-int hash_tbl_get(qhasharr_t *tbl, const string &key, string &val)
+int hash_tbl_prepare(qhasharr_t *tbl, const char *key, size_t key_len, qhasharr_key_t &hkey)
+{
+    if (NULL == tbl || NULL == key || 0 == key_len) return QCONF_ERR_PARAM;
+
+    return qhasharr_prepare(tbl, key, key_len, &hkey) ? QCONF_OK : QCONF_ERR_OTHER;
+}
+
+int hash_tbl_get(qhasharr_t *tbl, const string &key, string &val, qconf_shm_refs_t *refs, qhasharr_key_t *hkey)
 {
     if (NULL == tbl || key.empty()) return QCONF_ERR_PARAM;
 
-    int ret = hash_tbl_get_(tbl, key, val);
+    int ret = hash_tbl_get_(tbl, key, val, refs, hkey);
     if (QCONF_OK != ret)
         return ret;
 
     return qconf_verify(val);
 }
 
+/**
+ * Reference the value of key in place. The verification code is not checked,
+ * the caller must call hash_tbl_check_ref with version after using the value.
+ */
+int hash_tbl_get_ref(qhasharr_t *tbl, const char *key, size_t key_len, const char *&val, size_t &val_len, uint32_t &version, qconf_shm_refs_t *refs, qhasharr_key_t *hkey)
+{
+    if (NULL == tbl || NULL == key || 0 == key_len) return QCONF_ERR_PARAM;
+
+    size_t tblval_size = 0;
+    int idx = -1;
+    const char *tblval = (const char*)qhasharr_get_ref_key(tbl, key, key_len, hkey, &tblval_size, &version, &idx);
+    if (NULL == tblval) return (E2BIG == errno) ? QCONF_ERR_SHM_SPLIT : QCONF_ERR_NOT_FOUND;
+    hash_tbl_touch(refs, idx);
+
+#ifdef USE_MIXED_VERIFY
+    QCONF_VALUE_SIZE_TYPE val_size = 0;
+    if (tblval_size < QCONF_VALUE_SIZE_LEN) return QCONF_ERR_TBL_DATA_MESS;
+    qconf_decode_num(tblval, val_size, QCONF_VALUE_SIZE_TYPE);
+    if (tblval_size < QCONF_VALUE_SIZE_LEN + val_size) return QCONF_ERR_TBL_DATA_MESS;
+
+    val = tblval + QCONF_VALUE_SIZE_LEN;
+    val_len = val_size;
+#else
+    if (tblval_size < QCONF_MD5_INT_LEN) return QCONF_ERR_TBL_DATA_MESS;
+
+    val = tblval;
+    val_len = tblval_size - QCONF_MD5_INT_LEN;
+#endif
+
+    return QCONF_OK;
+}
+
+int hash_tbl_check_ref(qhasharr_t *tbl, uint32_t version)
+{
+    if (NULL == tbl) return QCONF_ERR_PARAM;
+
+    return qhasharr_read_retry(tbl, version) ? QCONF_ERR_SHM_CHANGED : QCONF_OK;
+}
+
+/**
+ * Get the version stamp kept behind the value of key, the value itself is
+ * neither copied nor verified if it's kept in one slot
+ *
+ * @return QCONF_ERR_NOT_FOUND: if key is not found or it has no stamp
+ */
+int hash_tbl_get_stamp(qhasharr_t *tbl, const string &key, qconf_stamp_t &stamp, qconf_shm_refs_t *refs)
+{
+    if (NULL == tbl || key.empty()) return QCONF_ERR_PARAM;
+
+    for (int count = 0; count < QCONF_MAX_READ_TIMES; count++)
+    {
+        size_t tblval_size = 0;
+        uint32_t version = 0;
+        int idx = -1;
+        const char *tblval = (const char*)qhasharr_get_ref_idx(tbl, key.data(), key.size(), &tblval_size, &version, &idx);
+        if (NULL == tblval)
+        {
+            if (E2BIG == errno) break;
+            return QCONF_ERR_NOT_FOUND;
+        }
+        hash_tbl_touch(refs, idx);
+
+        int ret = decode_stamp_(tblval, tblval_size, stamp);
+        if (QCONF_OK == hash_tbl_check_ref(tbl, version)) return ret;
+    }
+
+    // value is not in one piece of share memory, copy it
+    string tblval;
+    int ret = hash_tbl_get_(tbl, key, tblval, refs);
+    if (QCONF_OK != ret) return ret;
+
+    return decode_stamp_(tblval.data(), tblval.size(), stamp);
+}
+
 #ifdef USE_MIXED_VERIFY
 int qconf_verify(string &tblval)
 {
@@ -232,48 +2026,296 @@ int qconf_verify(string &val)
 }
 #endif
 
-static int hash_tbl_set_(qhasharr_t *tbl, const string &key, const string &val)
+/**
+ * Put val of key, the write is journaled before the generation of key moves
+ * so clients never cache a value of the snapshot under the new generation
+ */
+static int hash_tbl_set_(qhasharr_t *tbl, const string &key, const string &val, bool journal)
 {
     if (key.empty()) return QCONF_ERR_PARAM;
     pthread_mutex_lock(&_qhasharr_op_mutex);
+    tbl = current_tbl_(tbl);
     bool ret = qhasharr_put(tbl, key.data(), key.size(), val.data(), val.size());
-    pthread_mutex_unlock(&_qhasharr_op_mutex);
-
     while (!ret && errno == ENOBUFS) {
-        string removeKey = (LRU::getInstance())->getRemoveKey();
         errno = 0;
-        bool removeRet = hash_tbl_remove(tbl, removeKey);
-        if (removeRet == QCONF_OK) {
-            LRU::getInstance()->removeKey();
-        }
-        else {
+        if (!hash_tbl_evict_(tbl)) {
             LOG_ERR("remove key from shared memory failed");
             break;
         }
-        pthread_mutex_lock(&_qhasharr_op_mutex);
         ret = qhasharr_put(tbl, key.data(), key.size(), val.data(), val.size());
-        pthread_mutex_unlock(&_qhasharr_op_mutex);
     }
-    if (ret) {
-        LRU::getInstance()->visitKey(key);
+    if (ret)
+    {
+        qhasharr_op_t op = {key.data(), key.size(), val.data(), val.size()};
+        hash_tbl_fanout_(tbl, QCONF_REPLICA_PUT, &op, 1, -1);
+        if (journal) shm_journal_append_(key.data(), key.size(), QCONF_JOURNAL_SET);
+        shm_gens_bump_(key.data(), key.size());
+        shm_index_update_(key.data(), key.size(), true);
     }
+    pthread_mutex_unlock(&_qhasharr_op_mutex);
 
     return ret ? QCONF_OK : QCONF_ERR_TBL_SET;
 }
 
-int hash_tbl_set(qhasharr_t *tbl, const string &key, const string &val)
+/**
+ * Remove an entry which clients have not got since the last sweep, the
+ * caller holds the op mutex
+ */
+static bool hash_tbl_evict_(qhasharr_t *tbl)
+{
+    if (_noevict_tbls.find(tbl) != _noevict_tbls.end()) return false;
+
+    int &hand = _tbl_hands[tbl];
+    map<qhasharr_t*, qconf_shm_refs_t*>::iterator it = _tbl_refs.find(tbl);
+    bool ret = (it == _tbl_refs.end())
+        ? qhasharr_evict(tbl, NULL, &hand, tblkey_pinned_)
+        : qhasharr_evict(tbl, it->second->refs, &hand, tblkey_pinned_);
+    if (ret)
+    {
+        // the hand stops right after the entry evicted
+        hash_tbl_fanout_(tbl, QCONF_REPLICA_EVICT, NULL, 0, (hand + tbl->maxslots - 1) % tbl->maxslots);
+        shm_index_update_(_evicting_key.data(), _evicting_key.size(), false);
+        // values cached by clients are dropped along with it, the word is
+        // the one of the whole key even if the key is cut in its slot
+        shm_gens_bump_(_evicting_key.data(), _evicting_key.size());
+    }
+    return ret;
+}
+
+/**
+ * Only users' data is stamped with its version
+ */
+static bool tblkey_stamped_(const string &key)
+{
+    switch (get_data_type(key))
+    {
+        case QCONF_DATA_TYPE_NODE:
+        case QCONF_DATA_TYPE_SERVICE:
+        case QCONF_DATA_TYPE_BATCH_NODE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * Local idc and hosts of idcs are never evicted, the key of others is kept
+ * for the index and the generation words since it's evicted next. A key cut
+ * in its slot is got again from the value, as hash_tbl_getnext does
+ */
+static bool tblkey_pinned_(const char *key, size_t key_len, const void *val, size_t val_len)
+{
+    if (0 == key_len || QCONF_DATA_TYPE_ZK_HOST == key[0]) return true;
+    if (1 == key_len && QCONF_DATA_TYPE_LOCAL_IDC == key[0]) return true;
+
+    if (NULL == _shm_index && NULL == _shm_gens) return false;
+
+    _evicting_key.assign(key, key_len);
+    if (_Q_HASHARR_KEYSIZE == key_len && NULL != val)
+    {
+        string tblval((const char*)val, val_len), tblkey(_evicting_key);
+        if (QCONF_OK == qconf_verify(tblval) && QCONF_OK == tblval_to_tblkey_(tblval, tblkey))
+            _evicting_key.swap(tblkey);
+    }
+    return false;
+}
+
+/**
+ * Set the value of key. Users' data is stamped with mzxid, pzxid and the
+ * digest of val, and compared with the digest instead of the value in share
+ * memory
+ */
+int hash_tbl_set(qhasharr_t *tbl, const string &key, const string &val, int64_t mzxid, int64_t pzxid)
 {
     if (NULL == tbl || key.empty()) return QCONF_ERR_PARAM;
 
     string val_tmp;
+    bool same = false;
+
+    pthread_mutex_lock(&_qhasharr_op_mutex);
+    tbl = current_tbl_(tbl);
+    pthread_mutex_unlock(&_qhasharr_op_mutex);
+
+    int ret = hash_tbl_encode_(tbl, key, val, mzxid, pzxid, val_tmp, same);
+    if (QCONF_OK != ret) return ret;
+
+    ret = hash_tbl_set_(tbl, key, val_tmp, !same);
+
+    return (QCONF_OK == ret && same) ? QCONF_ERR_SAME_VALUE : ret;
+}
+
+int hash_tbl_set_batch(qhasharr_t *tbl, vector<qconf_tbl_entry_t> &entries)
+{
+    if (NULL == tbl) return QCONF_ERR_PARAM;
+
+    pthread_mutex_lock(&_qhasharr_op_mutex);
+    tbl = current_tbl_(tbl);
+    pthread_mutex_unlock(&_qhasharr_op_mutex);
+
+    vector<string> vals(entries.size());
+    vector<qhasharr_op_t> ops;
+    vector<bool> sames(entries.size(), false);
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        qconf_tbl_entry_t &entry = entries[i];
+        if (entry.key.empty()) return QCONF_ERR_PARAM;
+
+        if (entry.remove)
+        {
+            entry.ret = hash_tbl_exist(tbl, entry.key) ? QCONF_OK : QCONF_ERR_SAME_VALUE;
+        }
+        else
+        {
+            bool same = false;
+            entry.ret = hash_tbl_encode_(tbl, entry.key, entry.val, entry.mzxid, entry.pzxid, vals[i], same);
+            sames[i] = same;
+        }
+        if (QCONF_ERR_SAME_VALUE == entry.ret) continue;
+        if (QCONF_OK != entry.ret) return entry.ret;
+
+        qhasharr_op_t op = {entry.key.data(), entry.key.size(),
+            entry.remove ? NULL : vals[i].data(), entry.remove ? 0 : vals[i].size()};
+        ops.push_back(op);
+    }
+    if (ops.empty()) return QCONF_OK;
+
+    pthread_mutex_lock(&_qhasharr_op_mutex);
+    tbl = current_tbl_(tbl);
+    // a batch larger than the table fails without evicting anything for it
+    bool ret = qhasharr_put_batch(tbl, &ops[0], ops.size());
+    int err = ret ? 0 : errno;
+    if (E2BIG == err) LOG_ERR("Failed to put a batch of %d keys larger than share memory", (int)ops.size());
+    while (!ret && err == ENOBUFS) {
+        if (!hash_tbl_evict_(tbl)) {
+            LOG_ERR("remove key from shared memory failed");
+            break;
+        }
+        ret = qhasharr_put_batch(tbl, &ops[0], ops.size());
+        err = ret ? 0 : errno;
+    }
+    // a batch failed halfway is rolled back, unless the table is broken. Its
+    // keys are told changed then, readers check them again
+    bool changed = ret || EFAULT == err;
+    if (ret) hash_tbl_fanout_(tbl, QCONF_REPLICA_BATCH, &ops[0], ops.size(), -1);
+    // journaled before the generations move, as hash_tbl_set_ does
+    for (size_t i = 0; changed && i < entries.size(); i++)
+    {
+        if (QCONF_OK != entries[i].ret || sames[i]) continue;
+        shm_journal_append_(entries[i].key.data(), entries[i].key.size(),
+                entries[i].remove ? QCONF_JOURNAL_REMOVE : QCONF_JOURNAL_SET);
+    }
+    for (size_t i = 0; changed && i < ops.size(); i++)
+    {
+        bool exist = ret ? (NULL != ops[i].value) : qhasharr_exist(tbl, ops[i].key, ops[i].key_size);
+        shm_gens_bump_(ops[i].key, ops[i].key_size);
+        shm_index_update_(ops[i].key, ops[i].key_size, exist);
+    }
+    if (EFAULT == err) LOG_ERR("Failed to roll back a batch of %d keys in share memory", (int)ops.size());
+    pthread_mutex_unlock(&_qhasharr_op_mutex);
+
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        if (QCONF_OK != entries[i].ret) continue;
+        if (!ret)
+            entries[i].ret = QCONF_ERR_TBL_SET;
+        else if (sames[i])
+            entries[i].ret = QCONF_ERR_SAME_VALUE;
+    }
+
+    return ret ? QCONF_OK : QCONF_ERR_TBL_SET;
+}
+
+int hash_tbl_get_batch(qhasharr_t *tbl, const vector<string> &keys, vector<string> &vals, vector<int> &rets, qconf_shm_refs_t *refs)
+{
+    if (NULL == tbl) return QCONF_ERR_PARAM;
+
+    vals.resize(keys.size());
+    rets.resize(keys.size());
+
+    // keys are hashed in one pass, then the slots of the keys a few ahead
+    // are prefetched while one is probed
+    vector<qhasharr_key_t> hkeys(keys.size());
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        if (keys[i].empty()) return QCONF_ERR_PARAM;
+        qhasharr_prepare(tbl, keys[i].data(), keys[i].size(), &hkeys[i]);
+    }
+
+    for (int count = 0; count < QCONF_MAX_READ_TIMES; count++)
+    {
+        // any write to the table in between makes the values got again
+        uint32_t seq = qhasharr_read_begin(tbl);
+        for (size_t i = 0; i < keys.size() && i < QCONF_PREFETCH_DISTANCE; i++)
+            qhasharr_prefetch(tbl, &hkeys[i]);
+        for (size_t i = 0; i < keys.size(); i++)
+        {
+            if (i + QCONF_PREFETCH_DISTANCE < keys.size())
+                qhasharr_prefetch(tbl, &hkeys[i + QCONF_PREFETCH_DISTANCE]);
+            rets[i] = hash_tbl_get_(tbl, keys[i], vals[i], refs, &hkeys[i]);
+            if (QCONF_OK == rets[i]) rets[i] = qconf_verify(vals[i]);
+        }
+        if (!qhasharr_read_retry(tbl, seq)) return QCONF_OK;
+    }
+
+    return QCONF_ERR_SHM_CHANGED;
+}
+
+/**
+ * Encode val of key for writing it. QCONF_ERR_SAME_VALUE is returned if
+ * there is nothing to write, same is set if the value is written again
+ * only to keep the stamp up to date
+ */
+static int hash_tbl_encode_(qhasharr_t *tbl, const string &key, const string &val, int64_t mzxid, int64_t pzxid, string &val_tmp, bool &same)
+{
     string val_in_mem;
+    qconf_stamp_t stamp;
     int ret = QCONF_OK;
-    char val_md5[QCONF_MD5_INT_LEN] = {0};
 
-    ret = hash_tbl_get(tbl, key, val_in_mem);
+    same = false;
+    if (!tblkey_stamped_(key))
+    {
+        ret = hash_tbl_get(tbl, key, val_in_mem);
+
+        if (QCONF_OK == ret && 0 == val.compare(val_in_mem))
+            return QCONF_ERR_SAME_VALUE;
+
+        encode_tblval_(val, val_tmp);
+        return QCONF_OK;
+    }
+
+    char digest[QCONF_MD5_INT_LEN] = {0};
+    qhashmd5(val.data(), val.size(), digest);
+
+    if (QCONF_OK == hash_tbl_get_stamp(tbl, key, stamp))
+    {
+        same = (0 == memcmp(digest, stamp.digest, QCONF_STAMP_DIGEST_LEN));
+        // the node is written again with the same value
+        if (same && (0 == mzxid || mzxid == stamp.mzxid) && (0 == pzxid || pzxid == stamp.pzxid))
+            return QCONF_ERR_SAME_VALUE;
+    }
+    else
+    {
+        // value set by older agent has no stamp, compare it as a whole
+        memset(&stamp, 0, sizeof(qconf_stamp_t));
+        ret = hash_tbl_get(tbl, key, val_in_mem);
+        same = (QCONF_OK == ret && 0 == val.compare(val_in_mem));
+    }
+
+    if (!same) stamp.counter++;
+    stamp.mzxid = mzxid;
+    stamp.pzxid = pzxid;
+    memcpy(stamp.digest, digest, QCONF_STAMP_DIGEST_LEN);
+
+    encode_tblval_(val, val_tmp, &stamp);
+    return QCONF_OK;
+}
 
-    if (QCONF_OK == ret && 0 == val.compare(val_in_mem))
-        return QCONF_ERR_SAME_VALUE;
+/**
+ * Append the verification code to val, and the stamp if it's not NULL
+ */
+static void encode_tblval_(const string &val, string &val_tmp, const qconf_stamp_t *stamp)
+{
+    char val_md5[QCONF_MD5_INT_LEN] = {0};
 
 #ifdef USE_MIXED_VERIFY
     /*        __________
@@ -295,38 +2337,76 @@ int hash_tbl_set(qhasharr_t *tbl, const string &key, const string &val)
     // Use original value as verification code
     else
         val_tmp += val;
+
+    /*
+     *  | value len | value | verification code | stamp |
+     *
+     * readers take no notice of what is behind the verification code
+     */
+    if (NULL != stamp) stamp_to_tblval(*stamp, val_tmp);
 #else
+    // readers take the verification code at the end, so no stamp is kept
     qhashmd5(val.data(), val.size(), val_md5);
 
     val_tmp.assign(val);
     val_tmp.append(val_md5, QCONF_MD5_INT_LEN);
 #endif
+}
+
+/**
+ * Get the stamp behind the verification code of tblval
+ */
+static int decode_stamp_(const char *tblval, size_t tblval_len, qconf_stamp_t &stamp)
+{
+#ifdef USE_MIXED_VERIFY
+    QCONF_VALUE_SIZE_TYPE val_size = 0;
+    if (tblval_len < QCONF_VALUE_SIZE_LEN) return QCONF_ERR_TBL_DATA_MESS;
+    qconf_decode_num(tblval, val_size, QCONF_VALUE_SIZE_TYPE);
 
-    ret = hash_tbl_set_(tbl, key, val_tmp);
+    // the stamp is there only if it fills the rest exactly
+    size_t veri_size = (val_size > NEED_MD5_TBLLEN) ? QCONF_MD5_INT_LEN : val_size;
+    size_t stamped_len = QCONF_VALUE_SIZE_LEN + val_size + veri_size + QCONF_STAMP_LEN;
+    if (tblval_len != stamped_len) return QCONF_ERR_NOT_FOUND;
 
-    return ret;
+    return tblval_to_stamp(tblval, tblval_len, &stamp);
+#else
+    return QCONF_ERR_NOT_FOUND;
+#endif
 }
 
 bool hash_tbl_exist(qhasharr_t *tbl, const string &key)
 {
     if (NULL == tbl || key.empty()) return false;
-    bool ret;
-    pthread_mutex_lock(&_qhasharr_op_mutex);
-    ret = qhasharr_exist(tbl, key.data(), key.size());
-    pthread_mutex_unlock(&_qhasharr_op_mutex);
+
+    bool locked = hash_tbl_read_lock_(tbl);
+    bool ret = qhasharr_exist(tbl, key.data(), key.size());
+    if (locked) pthread_mutex_unlock(&_qhasharr_op_mutex);
     return ret;
 }
 
+/**
+ * Lock the op mutex for reading tbl if it keeps no write sequence, a write
+ * may move the entries of a linear table under readers without telling them
+ */
+static bool hash_tbl_read_lock_(qhasharr_t *tbl)
+{
+    if (QHASHARR_FORMAT_LINEAR != qhasharr_format(tbl)) return false;
+
+    pthread_mutex_lock(&_qhasharr_op_mutex);
+    return true;
+}
+
 int hash_tbl_getnext(qhasharr_t *tbl, string &tblkey, string &tblval, int &idx)
 {
     if (NULL == tbl) return QCONF_ERR_PARAM; 
     qnobj_t obj;
     char data_type;
     int ret = QCONF_OK;
-    string idc, path, host;
 
     memset(&obj, 0, sizeof(qnobj_t));
+    bool locked = hash_tbl_read_lock_(tbl);
     bool status = qhasharr_getnext(tbl, &obj, &idx);
+    if (locked) pthread_mutex_unlock(&_qhasharr_op_mutex);
     if (!status)
     {
         idx++;
@@ -348,21 +2428,47 @@ int hash_tbl_getnext(qhasharr_t *tbl, string &tblkey, string &tblval, int &idx)
     tblkey.assign(obj.name, obj.name_size);
     data_type = get_data_type(tblkey);
 
+    // tblkey is got again from the value only if it's cut in the slot
+    if (_Q_HASHARR_KEYSIZE != obj.name_size && (QCONF_DATA_TYPE_NODE == data_type
+                || QCONF_DATA_TYPE_SERVICE == data_type || QCONF_DATA_TYPE_BATCH_NODE == data_type
+                || QCONF_DATA_TYPE_ZK_HOST == data_type || QCONF_DATA_TYPE_LOCAL_IDC == data_type
+                || QCONF_DATA_TYPE_ABSENT == data_type))
+    {
+        free(obj.name);
+        free(obj.data);
+        return QCONF_OK;
+    }
+
+    ret = tblval_to_tblkey_(tblval, tblkey);
+    if (QCONF_OK != ret) LOG_ERR("Failed to get key from value! idx:%d", idx-1);
+
+    free(obj.name);
+    free(obj.data);
+
+    return ret;
+}
+
+/**
+ * Get the whole tblkey of the verified tblval from its idc and path, tblkey
+ * is the key got from the slot, maybe cut
+ */
+static int tblval_to_tblkey_(const string &tblval, string &tblkey)
+{
+    int ret = QCONF_OK;
+    char data_type = get_data_type(tblkey);
+    string idc, path, host;
+
     // get idc and path
     if (QCONF_DATA_TYPE_NODE == data_type)
     {
         string nodeval;
         ret = tblval_to_nodeval(tblval, nodeval, idc, path);
-        if (QCONF_OK != ret)
-            LOG_ERR("Failed to get nodeval! idx:%d", idx-1);
     }
     else if (QCONF_DATA_TYPE_SERVICE == data_type)
     {
         string_vector_t chdnodes;
         memset(&chdnodes, 0, sizeof(string_vector_t));
         ret = tblval_to_chdnodeval(tblval, chdnodes, idc, path);
-        if (QCONF_OK != ret)
-            LOG_ERR("Failed to get children service nodes! idx:%d", idx-1);
 
         if (chdnodes.count > 0) free_string_vector(chdnodes, chdnodes.count);
     }
@@ -371,27 +2477,26 @@ int hash_tbl_getnext(qhasharr_t *tbl, string &tblkey, string &tblval, int &idx)
         string_vector_t batchnodes;
         memset(&batchnodes, 0, sizeof(string_vector_t));
         ret = tblval_to_batchnodeval(tblval, batchnodes, idc, path);
-        if (QCONF_OK != ret)
-            LOG_ERR("Failed to get batch nodes! idx:%d", idx-1);
 
         if (batchnodes.count > 0) free_string_vector(batchnodes, batchnodes.count);
     }
     else if (QCONF_DATA_TYPE_ZK_HOST == data_type)
     {
         ret = tblval_to_idcval(tblval, host, idc);
-        if (QCONF_OK != ret)
-            LOG_ERR("Failed to get host of idc! idx:%d", idx-1);
     }
     else if (QCONF_DATA_TYPE_LOCAL_IDC == data_type)
         ret = QCONF_OK;
+    else if (QCONF_DATA_TYPE_ABSENT == data_type)
+    {
+        // the value ends with the whole tblkey
+        int64_t expire = 0;
+        return tblval_to_absentval(tblval, expire, tblkey);
+    }
     else
         ret = QCONF_ERR_DATA_TYPE;
 
     if (QCONF_OK == ret) serialize_to_tblkey(data_type, idc, path, tblkey);
 
-    free(obj.name);
-    free(obj.data);
-
     return ret;
 }
 
@@ -400,10 +2505,22 @@ int hash_tbl_remove(qhasharr_t *tbl, const string &key)
     if (NULL == tbl || key.empty()) return QCONF_ERR_PARAM;
 
     pthread_mutex_lock(&_qhasharr_op_mutex);
+    tbl = current_tbl_(tbl);
     bool ret = qhasharr_remove(tbl, key.data(), key.size());
+    bool absent = !ret && ENOENT == errno;
+    if (ret)
+    {
+        qhasharr_op_t op = {key.data(), key.size(), NULL, 0};
+        hash_tbl_fanout_(tbl, QCONF_REPLICA_REMOVE, &op, 1, -1);
+    }
+    // a key evicted is still kept by older copies like the snapshot, it's
+    // journaled before the generation moves as hash_tbl_set_ does
+    if (ret || absent) shm_journal_append_(key.data(), key.size(), QCONF_JOURNAL_REMOVE);
+    if (ret) shm_gens_bump_(key.data(), key.size());
+    if (ret) shm_index_update_(key.data(), key.size(), false);
     pthread_mutex_unlock(&_qhasharr_op_mutex);
 
-    if (!ret) return (ENOENT == errno) ? QCONF_OK : QCONF_ERR_OTHER;
+    if (!ret) return absent ? QCONF_OK : QCONF_ERR_OTHER;
 
     return QCONF_OK;
 }
@@ -413,91 +2530,13 @@ int hash_tbl_clear(qhasharr_t *tbl)
     if (NULL == tbl) return QCONF_ERR_PARAM;
     
     pthread_mutex_lock(&_qhasharr_op_mutex);
+    tbl = current_tbl_(tbl);
     qhasharr_clear(tbl);
+    hash_tbl_fanout_(tbl, QCONF_REPLICA_CLEAR, NULL, 0, -1);
+    shm_journal_append_(NULL, 0, QCONF_JOURNAL_CLEAR);
+    shm_gens_bump_all_();
+    shm_index_clear_();
     pthread_mutex_unlock(&_qhasharr_op_mutex);
 
     return QCONF_OK;
 }
-
-LRU* LRU::lruInstance = NULL;
-
-LRU::LRU() {
-    lruMem.clear();
-    keyToIterator.clear();
-}
-
-LRU::~LRU() {
-    delete lruInstance;
-    lruInstance = NULL;
-}
-
-LRU* LRU::getInstance() {
-    if (!lruInstance) {
-        lruInstance = new LRU();
-    }
-    return lruInstance;
-}
-
-string LRU::getRemoveKey() {
-    if (lruMem.empty()) {
-        LOG_ERR("Memory is empty nothing to remove. Maybe it's too small");
-        return "";
-    }
-    return lruMem.back();
-}
-
-string LRU::removeKey() {
-    string key = lruMem.back();
-    lruMem.pop_back();
-    if (keyToIterator.find(key) != keyToIterator.end()) {
-        keyToIterator.erase(key);
-    }
-
-    return key;
-}
-
-void LRU::visitKey(string key) {
-    if (key == QCONF_KEY_TYPE_LOCAL_IDC) {
-        return;
-    }
-    if (keyToIterator.find(key) == keyToIterator.end()) {
-        lruMem.push_front(key);
-        keyToIterator[key] = lruMem.begin();
-    }
-    else {
-        list<string>::iterator it = keyToIterator[key];
-        lruMem.erase(it);
-        lruMem.push_front(key);
-        keyToIterator[key] = lruMem.begin();
-    }
-    return;
-}
-
-
-bool LRU::initLruMem(qhasharr_t* tbl) {
-    int max_slots = 0, used_slots = 0;
-    hash_tbl_get_count(tbl, max_slots, used_slots);
-
-    string tblkey, tblval;
-
-    for (int idx = 0; idx < max_slots;) {
-        int ret = hash_tbl_getnext(tbl, tblkey, tblval, idx);
-        if (ret == QCONF_OK) {
-
-            char data_type;
-            string idc, path;
-            deserialize_from_tblkey(tblkey, data_type, idc, path);
-            if (!path.empty()) {
-                visitKey(tblkey);
-            }
-
-        }
-        else if (QCONF_ERR_TBL_END == ret){}
-        else{
-            LOG_ERR_KEY_INFO(tblkey, "Failed to get next item in shmtbl");
-            return false;
-        }
-    }
-    return true;
-}
-
@@ -4,8 +4,12 @@
 #include <string>
 #include <list>
 #include <map>
+#include <vector>
+
+#include <time.h>
 
 #include "qlibc/qlibc.h"
+#include "qconf_format.h"
 
 /**
  * Destroy qhasharr mutex lock
@@ -28,35 +32,351 @@ int qconf_update_localidc(qhasharr_t *tbl, const std::string &local_idc);
 int qconf_exist_tblkey(qhasharr_t *tbl, const std::string &key, bool &status);
 
 /**
- * Create or init hashtable
+ * Control segment publishing the share memory table in use. The table is
+ * replaced when it's resized, readers attach the table of shmkey again
+ * once generation moves
+ */
+typedef struct qconf_shm_ctrl_s
+{
+    uint32_t magic;
+    volatile uint32_t generation;   // odd while a table is being published
+    key_t basekey;                  // tables take basekey and basekey + 1 in turn
+    volatile key_t shmkey;          // key of the table in use
+} qconf_shm_ctrl_t;
+
+/**
+ * Create or init the control segment, a new one publishes basekey
+ */
+int create_shm_ctrl(qconf_shm_ctrl_t *&ctrl, key_t ctrlkey, key_t basekey, mode_t mode);
+int init_shm_ctrl(qconf_shm_ctrl_t *&ctrl, key_t ctrlkey, mode_t mode, int flags);
+
+/**
+ * Get the key and generation of the table in use
+ */
+int shm_ctrl_get(const qconf_shm_ctrl_t *ctrl, key_t &shmkey, uint32_t &generation);
+
+/**
+ * Create or init hashtable, it's a SysV segment or a POSIX object of the key
  */
 int create_hash_tbl(qhasharr_t *&tbl, key_t shmkey, mode_t mode);
+int create_hash_tbl(qhasharr_t *&tbl, key_t shmkey, mode_t mode, int max_slots, int evict);
 int init_hash_tbl(qhasharr_t *&tbl, key_t shmkey, mode_t mode, int flags);
 
 /**
- * Operation of hashtable
+ * Detach hashtable, or remove the one of shmkey of either backend
+ */
+void detach_hash_tbl(qhasharr_t *tbl);
+int remove_hash_tbl(key_t shmkey, mode_t mode);
+
+/**
+ * Reference bytes of a table, one per slot. Readers set the byte of the
+ * entry they get, the agent evicts the entries not referenced since its
+ * last sweep once the table is full
+ */
+typedef struct qconf_shm_refs_s
+{
+    uint32_t magic;
+    int nrefs;
+    volatile unsigned char refs[];
+} qconf_shm_refs_t;
+
+/**
+ * Init the reference bytes of the table of shmkey, or detach them
+ */
+int init_hash_tbl_refs(qconf_shm_refs_t *&refs, key_t shmkey);
+void detach_hash_tbl_refs(qconf_shm_refs_t *refs);
+
+/**
+ * Mark the entry of slot idx referenced, for entries got without the table
+ */
+void hash_tbl_touch(qconf_shm_refs_t *refs, int idx);
+
+/**
+ * Generation words striped by the hash of tblkey. The agent bumps the word
+ * of the keys it sets, removes or evicts and wakes the clients blocked on
+ * it, so clients wait on a futex instead of polling the table. They are
+ * kept across resizes of the table
+ */
+typedef struct qconf_shm_gens_s
+{
+    uint32_t magic;
+    uint32_t ngens;                     // checked against the segment by clients
+    volatile uint32_t any;              // bumped with any word, for waiters of several keys
+    volatile uint32_t gens[];
+} qconf_shm_gens_t;
+
+/**
+ * Create or init the generation words, the ones created are bumped by the
+ * writes of this process until they are detached. Only the creator writes
+ * them, clients attach them read-only
+ */
+int create_shm_gens(qconf_shm_gens_t *&gens, key_t genskey, uint32_t ngens, mode_t mode);
+int init_shm_gens(qconf_shm_gens_t *&gens, key_t genskey);
+void detach_shm_gens(qconf_shm_gens_t *gens);
+
+/**
+ * Get the generation of key or the word keeping it, or block until it moves
+ * from gen. The deadline is of CLOCK_MONOTONIC, QCONF_ERR_SHM_TIMEOUT is
+ * returned once it passes.
+ * Keys share words, so the caller checks its key again after waking up
+ */
+uint32_t shm_gens_get(const qconf_shm_gens_t *gens, const char *key, size_t key_len);
+volatile uint32_t *shm_gens_word(const qconf_shm_gens_t *gens, const char *key, size_t key_len);
+int shm_gens_wait(qconf_shm_gens_t *gens, const char *key, size_t key_len, uint32_t gen, const struct timespec &deadline);
+
+/**
+ * Same as above for the word bumped with any key, so one thread can wait on
+ * several keys. Waking its waiters moves nothing, they check their deadline
+ * again, but a wake before they block is missed
+ */
+uint32_t shm_gens_get_any(const qconf_shm_gens_t *gens);
+int shm_gens_wait_any(qconf_shm_gens_t *gens, uint32_t gen, const struct timespec &deadline);
+void shm_gens_wake_any(qconf_shm_gens_t *gens);
+
+/**
+ * Change journal of the table, a ring of the writes the agent makes. A
+ * record is rewritten once the ring wraps, readers tailing it behind that
+ * get QCONF_ERR_SHM_OVERRUN and re-read everything
+ */
+#define QCONF_JOURNAL_SET               's'
+#define QCONF_JOURNAL_REMOVE            'r'
+#define QCONF_JOURNAL_CLEAR             'c'     // every key is removed
+
+typedef struct qconf_shm_journal_rec_s
+{
+    volatile uint64_t seq;              // sequence + 1 of the write, 0 while it's rewritten
+    uint32_t keyhash;                   // qhashmurmur3_32 of tblkey
+    char type;                          // QCONF_JOURNAL_SET, REMOVE or CLEAR
+    char dtype;                         // data type of tblkey
+} qconf_shm_journal_rec_t;
+
+typedef struct qconf_shm_journal_s
+{
+    uint32_t magic;
+    uint32_t nrecs;
+    volatile uint64_t head;             // sequence of the next write
+    qconf_shm_journal_rec_t recs[];
+} qconf_shm_journal_t;
+
+/**
+ * Create or init the journal, the one created records the writes of this
+ * process until it's detached
+ */
+int create_shm_journal(qconf_shm_journal_t *&journal, key_t journalkey, uint32_t nrecs, mode_t mode);
+int init_shm_journal(qconf_shm_journal_t *&journal, key_t journalkey);
+void detach_shm_journal(qconf_shm_journal_t *journal);
+
+/**
+ * Copy the records from cursor on into recs, at most max_recs of them, and
+ * move cursor past them. If records after cursor are rewritten already,
+ * cursor is moved to the head and QCONF_ERR_SHM_OVERRUN is returned
+ */
+int shm_journal_tail(const qconf_shm_journal_t *journal, uint64_t &cursor, qconf_shm_journal_rec_t *recs, int max_recs, int &nrecs);
+uint64_t shm_journal_head(const qconf_shm_journal_t *journal);
+
+/**
+ * Directory of namespaces. Paths under the prefix of a namespace are kept in
+ * a table of its own, which only evicts its own entries once it's full.
+ * Other paths and qconf's own data stay in the default table
+ */
+typedef struct qconf_shm_ns_entry_s
+{
+    char name[QCONF_SHM_NS_NAME_LEN];
+    char prefix[QCONF_SHM_NS_PREFIX_LEN];   // path prefix, matched by whole nodes
+    key_t shmkey;                           // key of the table of the namespace
+    int max_slots;
+    int evict;                              // QCONF_SHM_EVICT_LRU or QCONF_SHM_EVICT_NONE
+} qconf_shm_ns_entry_t;
+
+typedef struct qconf_shm_ns_s
+{
+    uint32_t magic;
+    volatile uint32_t generation;           // odd while the directory is rewritten
+    int nns;
+    qconf_shm_ns_entry_t ns[QCONF_SHM_NS_MAX];
+} qconf_shm_ns_t;
+
+/**
+ * Create or init the directory of namespaces
+ */
+int create_shm_ns(qconf_shm_ns_t *&ns, key_t nskey, mode_t mode);
+int init_shm_ns(qconf_shm_ns_t *&ns, key_t nskey);
+void detach_shm_ns(qconf_shm_ns_t *ns);
+
+/**
+ * Publish the namespaces in the directory, or get them as of one generation
+ */
+int shm_ns_publish(qconf_shm_ns_t *ns, const std::vector<qconf_shm_ns_entry_t> &entries);
+int shm_ns_get(const qconf_shm_ns_t *ns, std::vector<qconf_shm_ns_entry_t> &entries, uint32_t &generation);
+
+/**
+ * Get the index in entries of the namespace tblkey belongs to, the longest
+ * prefix of its path wins. An absent mark goes with the key it's of
+ *
+ * @return -1: if tblkey is kept in the default table
+ */
+int shm_ns_route(const std::vector<qconf_shm_ns_entry_t> &entries, const char *tblkey, size_t tblkey_len);
+
+/**
+ * Index of the paths of users' data kept in the tables, sorted by idc and
+ * path, so the paths under a prefix are listed without scanning the slots.
+ * Writes of the process which created it keep it up to date
+ *
+ * | header | offsets of records, sorted | pool of records |
+ * record: | u8 types | u8 idc len | u16 path len | idc | path |
+ */
+#define QCONF_SHM_INDEX_NODE            0x01
+#define QCONF_SHM_INDEX_SERVICE         0x02
+#define QCONF_SHM_INDEX_BATCH           0x04
+
+typedef struct qconf_shm_index_s
+{
+    uint32_t magic;
+    volatile uint32_t generation;       // odd while the index is rewritten
+    uint32_t max_keys;
+    uint32_t nkeys;
+    uint32_t dropped;                   // paths not indexed since it was full
+    uint32_t pool_size;
+    uint32_t pool_used;
+    uint32_t pool_freed;                // bytes of records removed, reclaimed once the pool is full
+    uint32_t offs[];
+} qconf_shm_index_t;
+
+typedef struct qconf_shm_index_item_s
+{
+    std::string idc;
+    std::string path;
+    int types;                          // QCONF_SHM_INDEX_NODE, SERVICE and BATCH of path
+} qconf_shm_index_item_t;
+
+/**
+ * Create or init the index, the one created is emptied and indexes the
+ * writes of this process until it's detached
+ */
+int create_shm_index(qconf_shm_index_t *&index, key_t indexkey, uint32_t max_keys, mode_t mode);
+int init_shm_index(qconf_shm_index_t *&index, key_t indexkey);
+void detach_shm_index(qconf_shm_index_t *index);
+
+/**
+ * Index the paths kept in tbl already
  */
-int hash_tbl_get(qhasharr_t *tbl, const std::string &key, std::string &val);
-int hash_tbl_set(qhasharr_t *tbl, const std::string &key, const std::string &val);
+int shm_index_add_tbl(qhasharr_t *tbl);
+
+/**
+ * List the paths of idc which are prefix or under it, every idc if idc is
+ * empty. Items are sorted by idc and path
+ *
+ * @return QCONF_ERR_SHM_INDEX_FULL: if paths were dropped by the index, the
+ *         ones indexed are still listed
+ */
+int shm_index_list(const qconf_shm_index_t *index, const std::string &idc, const std::string &prefix, std::vector<qconf_shm_index_item_t> &items);
+
+/**
+ * Replicas of the table in use, one per NUMA node and bound to its memory.
+ * Replica 0 is the table itself, writes to it are applied to the others in
+ * the same order so every replica keeps the same slots. Readers attach the
+ * replica of the node they run on while shmkey is the table in use
+ */
+typedef struct qconf_shm_replicas_s
+{
+    uint32_t magic;
+    volatile uint32_t generation;       // odd while the replicas are republished
+    key_t shmkey;                       // key of the table replicated
+    int nreplicas;
+    key_t keys[QCONF_SHM_REPLICA_MAX];
+} qconf_shm_replicas_t;
+
+/**
+ * Create or init the directory of replicas
+ */
+int create_shm_replicas(qconf_shm_replicas_t *&replicas, key_t replicaskey, mode_t mode);
+int init_shm_replicas(qconf_shm_replicas_t *&replicas, key_t replicaskey);
+void detach_shm_replicas(qconf_shm_replicas_t *replicas);
+
+/**
+ * Copy tbl of shmkey into a new replica on each of nodes 1 to nreplicas - 1
+ * and publish them in replicas, replicas left by the last call are removed.
+ * Writes to tbl go to the replicas from then on, and a table replacing it by
+ * a resize is replicated as well. One replica publishes tbl alone
+ */
+int hash_tbl_replicate(qhasharr_t *tbl, key_t shmkey, qconf_shm_replicas_t *replicas, int nreplicas, mode_t mode);
+
+/**
+ * Get the key of the replica on node of the table of shmkey, and the
+ * generation of the directory it's got as of
+ *
+ * @return QCONF_ERR_NOT_FOUND: if the table of shmkey has no replica on node
+ */
+int shm_replicas_get(const qconf_shm_replicas_t *replicas, key_t shmkey, int node, key_t &replica_key, uint32_t &generation);
+
+/**
+ * Number of NUMA nodes of the machine, at most QCONF_SHM_REPLICA_MAX, and the
+ * node the calling thread runs on. A machine without NUMA has one node 0
+ */
+int qconf_numa_nodes();
+int qconf_numa_node();
+
+/**
+ * Move the entries of tbl into a new table of max_slots and publish it in
+ * ctrl, tbl is set to the new table. Writes through the old table go to the
+ * new one afterwards
+ */
+int hash_tbl_resize(qhasharr_t *&tbl, qconf_shm_ctrl_t *ctrl, int max_slots, mode_t mode);
+
+/**
+ * Operation of hashtable, the entry got is marked in refs if it's not NULL.
+ * A key prepared by hash_tbl_prepare is passed in hkey to skip hashing it and
+ * to check the slot it was found at last first
+ */
+int hash_tbl_prepare(qhasharr_t *tbl, const char *key, size_t key_len, qhasharr_key_t &hkey);
+int hash_tbl_get(qhasharr_t *tbl, const std::string &key, std::string &val, qconf_shm_refs_t *refs = NULL, qhasharr_key_t *hkey = NULL);
+int hash_tbl_get_ref(qhasharr_t *tbl, const char *key, size_t key_len, const char *&val, size_t &val_len, uint32_t &version, qconf_shm_refs_t *refs = NULL, qhasharr_key_t *hkey = NULL);
+int hash_tbl_check_ref(qhasharr_t *tbl, uint32_t version);
+int hash_tbl_get_stamp(qhasharr_t *tbl, const std::string &key, qconf_stamp_t &stamp, qconf_shm_refs_t *refs = NULL);
+int hash_tbl_set(qhasharr_t *tbl, const std::string &key, const std::string &val, int64_t mzxid = 0, int64_t pzxid = 0);
 bool hash_tbl_exist(qhasharr_t *tbl, const std::string &key);
 int hash_tbl_remove(qhasharr_t *tbl, const std::string &key);
 int hash_tbl_getnext(qhasharr_t *tbl, std::string &tblkey, std::string &tblval, int &idx);
 int hash_tbl_get_count(qhasharr_t *tbl, int &max_slots, int &used_slots);
+int hash_tbl_get_heap_stat(qhasharr_t *tbl, qhasharr_heap_stat_t &stat);
+
+/**
+ * Get the placement of the key in the next slot from idx on, for inspecting
+ * the table without copying values
+ *
+ * @return QCONF_ERR_TBL_END: if no key is left
+ */
+int hash_tbl_getnext_stat(qhasharr_t *tbl, qhasharr_key_stat_t &stat, int &idx);
+
 int qconf_verify(std::string &val);
 int hash_tbl_clear(qhasharr_t *tbl);
 
-class LRU{
-private:
-	std::list<std::string> lruMem;
-	std::map<std::string, std::list<std::string>::iterator> keyToIterator;
-	LRU();
-public:
-	static LRU* lruInstance;
-	~LRU();
-    std::string getRemoveKey();
-	std::string removeKey();
-	void visitKey(std::string key);
-	static LRU* getInstance();
-    bool initLruMem(qhasharr_t* tbl);
-};
+/**
+ * Entry of a batch write, ret is set to QCONF_OK if it's written, or
+ * QCONF_ERR_SAME_VALUE if it's kept as hash_tbl_set does
+ */
+typedef struct qconf_tbl_entry_s
+{
+    std::string key;
+    std::string val;
+    int64_t mzxid;
+    int64_t pzxid;
+    bool remove;                        // remove key instead of setting val
+    int ret;
+} qconf_tbl_entry_t;
+
+/**
+ * Write the entries in one write sequence of the table, readers see either
+ * none or all of them. Nothing is written if there is no room for them.
+ * Tables of QHASHARR_FORMAT_LINEAR keep no write sequence, readers may see
+ * part of the entries there
+ */
+int hash_tbl_set_batch(qhasharr_t *tbl, std::vector<qconf_tbl_entry_t> &entries);
+
+/**
+ * Get the values of keys as of one write sequence of the table, the result
+ * of each key is kept in rets. A table of QHASHARR_FORMAT_LINEAR keeps no
+ * write sequence, the values are read one by one there
+ */
+int hash_tbl_get_batch(qhasharr_t *tbl, const std::vector<std::string> &keys, std::vector<std::string> &vals, std::vector<int> &rets, qconf_shm_refs_t *refs = NULL);
 #endif
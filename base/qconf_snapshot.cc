@@ -0,0 +1,276 @@
+#include <errno.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <map>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "qconf_log.h"
+#include "qconf_common.h"
+#include "qconf_snapshot.h"
+#include "qlibc/qlibc.h"
+
+#define QCONF_SNAPSHOT_MAGIC 0x51534e50
+#define QCONF_SNAPSHOT_FORMAT 1
+// keys per bucket of the index on average
+#define QCONF_SNAPSHOT_BUCKET_KEYS 4
+// first displacements tried for a bucket before another seed is tried
+#define QCONF_SNAPSHOT_MAX_D0 16
+#define QCONF_SNAPSHOT_MAX_SEEDS 8
+#define QCONF_SNAPSHOT_NONE 0xffffffff
+
+using namespace std;
+
+typedef struct snapshot_key_hash_s
+{
+    uint32_t bucket;
+    uint32_t h1;
+    uint32_t h2;
+} snapshot_key_hash_t;
+
+static void snapshot_hash_(const char *key, size_t key_len, uint64_t seed, uint32_t nbuckets, snapshot_key_hash_t &hash);
+static uint32_t snapshot_pos_(const snapshot_key_hash_t &hash, uint32_t d0, uint32_t d1, uint32_t nkeys);
+static bool snapshot_place_(const vector<snapshot_key_hash_t> &hashes, uint32_t nbuckets, vector<uint32_t> &disps, vector<uint32_t> &keys_at);
+static bool bucket_larger_(const vector<uint32_t> *a, const vector<uint32_t> *b);
+static int write_file_(const string &path, const string &data);
+
+static void snapshot_hash_(const char *key, size_t key_len, uint64_t seed, uint32_t nbuckets, snapshot_key_hash_t &hash)
+{
+    uint64_t h = qhashxxh64(key, key_len, seed);
+    hash.bucket = (uint32_t)(h % nbuckets);
+    hash.h1 = (uint32_t)(h >> 32);
+    hash.h2 = (uint32_t)qhashxxh64(key, key_len, ~seed) | 1;
+}
+
+static uint32_t snapshot_pos_(const snapshot_key_hash_t &hash, uint32_t d0, uint32_t d1, uint32_t nkeys)
+{
+    return (uint32_t)(((uint64_t)hash.h1 + (uint64_t)d0 * hash.h2 + d1) % nkeys);
+}
+
+static bool bucket_larger_(const vector<uint32_t> *a, const vector<uint32_t> *b)
+{
+    return a->size() > b->size();
+}
+
+/**
+ * Find displacements of buckets taking each position by one key, larger
+ * buckets are placed first. keys_at is set to the key in each position
+ */
+static bool snapshot_place_(const vector<snapshot_key_hash_t> &hashes, uint32_t nbuckets, vector<uint32_t> &disps, vector<uint32_t> &keys_at)
+{
+    uint32_t nkeys = hashes.size();
+    vector< vector<uint32_t> > buckets(nbuckets);
+    for (uint32_t i = 0; i < nkeys; i++)
+        buckets[hashes[i].bucket].push_back(i);
+
+    vector<const vector<uint32_t>*> order;
+    for (uint32_t b = 0; b < nbuckets; b++)
+        order.push_back(&buckets[b]);
+    stable_sort(order.begin(), order.end(), bucket_larger_);
+
+    disps.assign(2 * nbuckets, 0);
+    keys_at.assign(nkeys, QCONF_SNAPSHOT_NONE);
+    vector<uint32_t> pos;
+    for (size_t i = 0; i < order.size() && !order[i]->empty(); i++)
+    {
+        const vector<uint32_t> &bucket = *order[i];
+        bool placed = false;
+        for (uint32_t d0 = 0; d0 < QCONF_SNAPSHOT_MAX_D0 && !placed; d0++)
+        {
+            for (uint32_t d1 = 0; d1 < nkeys && !placed; d1++)
+            {
+                pos.clear();
+                for (size_t k = 0; k < bucket.size(); k++)
+                {
+                    uint32_t p = snapshot_pos_(hashes[bucket[k]], d0, d1, nkeys);
+                    if (QCONF_SNAPSHOT_NONE != keys_at[p] || pos.end() != find(pos.begin(), pos.end(), p)) break;
+                    pos.push_back(p);
+                }
+                if (pos.size() != bucket.size()) continue;
+
+                for (size_t k = 0; k < bucket.size(); k++)
+                    keys_at[pos[k]] = bucket[k];
+                uint32_t b = hashes[bucket[0]].bucket;
+                disps[2 * b] = d0;
+                disps[2 * b + 1] = d1;
+                placed = true;
+            }
+        }
+        if (!placed) return false;
+    }
+    return true;
+}
+
+int qconf_snapshot_write(const string &path, const map<string, string> &entries, uint64_t generation)
+{
+    if (path.empty() || entries.size() >= QCONF_SNAPSHOT_NONE) return QCONF_ERR_PARAM;
+
+    vector<const pair<const string, string>*> kvs;
+    for (map<string, string>::const_iterator it = entries.begin(); it != entries.end(); ++it)
+        kvs.push_back(&*it);
+
+    uint32_t nkeys = kvs.size();
+    uint32_t nbuckets = nkeys / QCONF_SNAPSHOT_BUCKET_KEYS + 1;
+    uint64_t seed = generation;
+    vector<snapshot_key_hash_t> hashes(nkeys);
+    vector<uint32_t> disps, keys_at;
+    bool placed = false;
+    for (int i = 0; i < QCONF_SNAPSHOT_MAX_SEEDS && !placed; i++)
+    {
+        seed = qhashxxh64(&seed, sizeof(seed), i);
+        for (uint32_t k = 0; k < nkeys; k++)
+            snapshot_hash_(kvs[k]->first.data(), kvs[k]->first.size(), seed, nbuckets, hashes[k]);
+        placed = snapshot_place_(hashes, nbuckets, disps, keys_at);
+    }
+    if (!placed)
+    {
+        LOG_ERR("Failed to index %u keys of snapshot", nkeys);
+        return QCONF_ERR_OTHER;
+    }
+
+    qconf_snapshot_hdr_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = QCONF_SNAPSHOT_MAGIC;
+    hdr.format = QCONF_SNAPSHOT_FORMAT;
+    hdr.generation = generation;
+    hdr.seed = seed;
+    hdr.nkeys = nkeys;
+    hdr.nbuckets = nbuckets;
+
+    // records are laid out in order of positions
+    uint64_t off = sizeof(hdr) + disps.size() * sizeof(uint32_t) + (uint64_t)nkeys * sizeof(uint64_t);
+    vector<uint64_t> offs(nkeys);
+    string records;
+    for (uint32_t p = 0; p < nkeys; p++)
+    {
+        const pair<const string, string> &kv = *kvs[keys_at[p]];
+        uint32_t lens[2] = {(uint32_t)kv.first.size(), (uint32_t)kv.second.size()};
+        offs[p] = off + records.size();
+        records.append((const char*)lens, sizeof(lens));
+        records.append(kv.first);
+        records.append(kv.second);
+    }
+    hdr.size = off + records.size();
+
+    string data;
+    data.reserve(hdr.size);
+    data.append((const char*)&hdr, sizeof(hdr));
+    data.append((const char*)&disps[0], disps.size() * sizeof(uint32_t));
+    if (nkeys > 0) data.append((const char*)&offs[0], offs.size() * sizeof(uint64_t));
+    data.append(records);
+
+    return write_file_(path, data);
+}
+
+/**
+ * Write data into a temporary file and rename it to path, readers of path
+ * see either the old file or the new one
+ */
+static int write_file_(const string &path, const string &data)
+{
+    char tmp_path[QCONF_FILE_PATH_LEN];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp.%d", path.c_str(), getpid());
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (-1 == fd)
+    {
+        LOG_ERR("Failed to open snapshot file:%s! errno:%d", tmp_path, errno);
+        return QCONF_ERR_OPEN;
+    }
+
+    size_t written = 0;
+    while (written < data.size())
+    {
+        ssize_t n = write(fd, data.data() + written, data.size() - written);
+        if (-1 == n && EINTR == errno) continue;
+        if (n <= 0)
+        {
+            LOG_ERR("Failed to write snapshot file:%s! errno:%d", tmp_path, errno);
+            close(fd);
+            unlink(tmp_path);
+            return QCONF_ERR_WRITE;
+        }
+        written += n;
+    }
+    close(fd);
+
+    if (0 != rename(tmp_path, path.c_str()))
+    {
+        LOG_ERR("Failed to rename snapshot file:%s to %s! errno:%d", tmp_path, path.c_str(), errno);
+        unlink(tmp_path);
+        return QCONF_ERR_WRITE;
+    }
+    return QCONF_OK;
+}
+
+int qconf_snapshot_open(qconf_snapshot_t &snap, const string &path)
+{
+    memset(&snap, 0, sizeof(snap));
+    if (path.empty()) return QCONF_ERR_PARAM;
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (-1 == fd) return QCONF_ERR_OPEN;
+
+    struct stat st;
+    if (0 != fstat(fd, &st) || (size_t)st.st_size < sizeof(qconf_snapshot_hdr_t))
+    {
+        close(fd);
+        return QCONF_ERR_DATA_FORMAT;
+    }
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == base) return QCONF_ERR_READ;
+
+    const qconf_snapshot_hdr_t *hdr = (const qconf_snapshot_hdr_t*)base;
+    uint64_t index_size = (uint64_t)hdr->nbuckets * 2 * sizeof(uint32_t) + (uint64_t)hdr->nkeys * sizeof(uint64_t);
+    if (QCONF_SNAPSHOT_MAGIC != hdr->magic || QCONF_SNAPSHOT_FORMAT != hdr->format
+            || hdr->size != (uint64_t)st.st_size || 0 == hdr->nbuckets
+            || sizeof(qconf_snapshot_hdr_t) + index_size > hdr->size)
+    {
+        munmap(base, st.st_size);
+        return QCONF_ERR_DATA_FORMAT;
+    }
+
+    snap.base = (const char*)base;
+    snap.size = st.st_size;
+    snap.hdr = hdr;
+    snap.disps = (const uint32_t*)(snap.base + sizeof(qconf_snapshot_hdr_t));
+    snap.offs = (const uint64_t*)(snap.disps + 2 * hdr->nbuckets);
+    return QCONF_OK;
+}
+
+void qconf_snapshot_close(qconf_snapshot_t &snap)
+{
+    if (NULL != snap.base) munmap((void*)snap.base, snap.size);
+    memset(&snap, 0, sizeof(snap));
+}
+
+int qconf_snapshot_get(const qconf_snapshot_t &snap, const char *key, size_t key_len, const char *&val, size_t &val_len)
+{
+    if (NULL == snap.base || NULL == key || 0 == key_len) return QCONF_ERR_PARAM;
+    if (0 == snap.hdr->nkeys) return QCONF_ERR_NOT_FOUND;
+
+    snapshot_key_hash_t hash;
+    snapshot_hash_(key, key_len, snap.hdr->seed, snap.hdr->nbuckets, hash);
+    uint32_t p = snapshot_pos_(hash, snap.disps[2 * hash.bucket], snap.disps[2 * hash.bucket + 1], snap.hdr->nkeys);
+
+    // keys not in the snapshot are hashed to some record as well
+    uint64_t off = snap.offs[p];
+    uint32_t lens[2];
+    if (off + sizeof(lens) > snap.size) return QCONF_ERR_TBL_DATA_MESS;
+    memcpy(lens, snap.base + off, sizeof(lens));
+    off += sizeof(lens);
+    if (off + lens[0] + lens[1] > snap.size) return QCONF_ERR_TBL_DATA_MESS;
+    if (lens[0] != key_len || 0 != memcmp(snap.base + off, key, key_len)) return QCONF_ERR_NOT_FOUND;
+
+    val = snap.base + off + lens[0];
+    val_len = lens[1];
+    return QCONF_OK;
+}
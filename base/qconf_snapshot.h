@@ -0,0 +1,56 @@
+#ifndef QCONF_SNAPSHOT_H
+#define QCONF_SNAPSHOT_H
+
+#include <map>
+#include <string>
+
+#include <stdint.h>
+
+/**
+ * Snapshot of the share memory tables in a file. The agent writes a new file
+ * and renames it into place, so a file mapped never changes. Keys are indexed
+ * by a minimal perfect hash built by hash and displace, values are packed
+ * behind the index
+ *
+ * | header | displacements of buckets | offsets of records | records |
+ * record: | u32 key len | u32 value len | key | value |
+ */
+typedef struct qconf_snapshot_hdr_s
+{
+    uint32_t magic;
+    uint32_t format;
+    uint64_t generation;                // journal sequence the snapshot is taken at
+    uint64_t seed;                      // seed of the hashes of keys
+    uint32_t nkeys;
+    uint32_t nbuckets;
+    uint64_t size;                      // size of the file
+} qconf_snapshot_hdr_t;
+
+typedef struct qconf_snapshot_s
+{
+    const char *base;                   // the file mapped
+    size_t size;
+    const qconf_snapshot_hdr_t *hdr;
+    const uint32_t *disps;              // two per bucket
+    const uint64_t *offs;               // offset of the record in each position
+} qconf_snapshot_t;
+
+/**
+ * Write entries into a new snapshot file and rename it to path
+ */
+int qconf_snapshot_write(const std::string &path, const std::map<std::string, std::string> &entries, uint64_t generation);
+
+/**
+ * Map the snapshot file of path, or unmap it
+ */
+int qconf_snapshot_open(qconf_snapshot_t &snap, const std::string &path);
+void qconf_snapshot_close(qconf_snapshot_t &snap);
+
+/**
+ * Reference the value of key in the snapshot mapped
+ *
+ * @return QCONF_ERR_NOT_FOUND: if key is not in the snapshot
+ */
+int qconf_snapshot_get(const qconf_snapshot_t &snap, const char *key, size_t key_len, const char *&val, size_t &val_len);
+
+#endif
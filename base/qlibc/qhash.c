@@ -162,6 +162,122 @@ uint32_t qhashmurmur3_32(const void *data, size_t nbytes)
     return h;
 }
 
+#define _Q_XXH64_P1 0x9E3779B185EBCA87ULL
+#define _Q_XXH64_P2 0xC2B2AE3D27D4EB4FULL
+#define _Q_XXH64_P3 0x165667B19E3779F9ULL
+#define _Q_XXH64_P4 0x85EBCA77C2B2AE63ULL
+#define _Q_XXH64_P5 0x27D4EB2F165667C5ULL
+#define _Q_XXH64_ROTL(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+static uint64_t _xxh64_round(uint64_t acc, uint64_t input)
+{
+    acc += input * _Q_XXH64_P2;
+    acc = _Q_XXH64_ROTL(acc, 31);
+    return acc * _Q_XXH64_P1;
+}
+
+static uint64_t _xxh64_merge(uint64_t acc, uint64_t val)
+{
+    acc ^= _xxh64_round(0, val);
+    return acc * _Q_XXH64_P1 + _Q_XXH64_P4;
+}
+
+/**
+ * Get 64-bit xxHash(XXH64) hash.
+ *
+ * @param data      source data
+ * @param nbytes    size of data
+ * @param seed      hash seed
+ *
+ * @return 64-bit unsigned hash value.
+ *
+ * @code
+ *  uint64_t hashval = qhashxxh64((void*)"hello", 5, 0);
+ * @endcode
+ *
+ * @code
+ *  xxHash was created by Yann Collet, the algorithm is in the public at
+ *
+ *    https://github.com/Cyan4973/xxHash
+ *
+ *  It reads the input 8 bytes at a time, the bytes are taken as little
+ *  endian words.
+ * @endcode
+ */
+uint64_t qhashxxh64(const void *data, size_t nbytes, uint64_t seed)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    const uint8_t *end = p + nbytes;
+    uint64_t h, k;
+    uint32_t k32;
+
+    if (data == NULL) nbytes = 0, p = end = NULL;
+
+    if (nbytes >= 32)
+    {
+        const uint8_t *limit = end - 32;
+        uint64_t v1 = seed + _Q_XXH64_P1 + _Q_XXH64_P2;
+        uint64_t v2 = seed + _Q_XXH64_P2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - _Q_XXH64_P1;
+
+        do
+        {
+            memcpy(&k, p, 8);
+            v1 = _xxh64_round(v1, k);
+            memcpy(&k, p + 8, 8);
+            v2 = _xxh64_round(v2, k);
+            memcpy(&k, p + 16, 8);
+            v3 = _xxh64_round(v3, k);
+            memcpy(&k, p + 24, 8);
+            v4 = _xxh64_round(v4, k);
+            p += 32;
+        } while (p <= limit);
+
+        h = _Q_XXH64_ROTL(v1, 1) + _Q_XXH64_ROTL(v2, 7)
+            + _Q_XXH64_ROTL(v3, 12) + _Q_XXH64_ROTL(v4, 18);
+        h = _xxh64_merge(h, v1);
+        h = _xxh64_merge(h, v2);
+        h = _xxh64_merge(h, v3);
+        h = _xxh64_merge(h, v4);
+    }
+    else
+    {
+        h = seed + _Q_XXH64_P5;
+    }
+
+    h += (uint64_t)nbytes;
+
+    while (p + 8 <= end)
+    {
+        memcpy(&k, p, 8);
+        h ^= _xxh64_round(0, k);
+        h = _Q_XXH64_ROTL(h, 27) * _Q_XXH64_P1 + _Q_XXH64_P4;
+        p += 8;
+    }
+    if (p + 4 <= end)
+    {
+        memcpy(&k32, p, 4);
+        h ^= (uint64_t)k32 * _Q_XXH64_P1;
+        h = _Q_XXH64_ROTL(h, 23) * _Q_XXH64_P2 + _Q_XXH64_P3;
+        p += 4;
+    }
+    while (p < end)
+    {
+        h ^= (*p) * _Q_XXH64_P5;
+        h = _Q_XXH64_ROTL(h, 11) * _Q_XXH64_P1;
+        p++;
+    }
+
+    h ^= h >> 33;
+    h *= _Q_XXH64_P2;
+    h ^= h >> 29;
+    h *= _Q_XXH64_P3;
+    h ^= h >> 32;
+
+    return h;
+}
+
 int qhashmd5_bin_to_hex(char *md5_str, const unsigned char *md5_int, int md5_int_len)
 { 
     const char *hexs = "0123456789abcdef"; 
@@ -51,9 +51,39 @@
  * you set _Q_HASHARR_KEYSIZE big enough at compile time to make sure all keys
  * fits in it.
  *
- * qhasharr hash-table does not support thread-safe. So users should handle
+ * qhasharr hash-table does not serialize writers. So users should handle
  * race conditions on application side by raising user lock before calling
- * functions which modify the table data.
+ * functions which modify the table data. Readers need no lock at all: every
+ * modification is wrapped in a write sequence(seqlock) kept in the table
+ * header, which is odd while a writer is in progress. Readers take a snapshot
+ * of the sequence, read the slots and retry if the sequence has moved, so a
+ * torn read is detected even when the writer lives in another process.
+ * Tables of QHASHARR_FORMAT_LINEAR keep the header of the tables created
+ * before, which has no room for it: their readers must verify the objects
+ * themselves, and objects in them are never referenced in place.
+ *
+ * Tables created with QHASHARR_FORMAT_GROUP keep one control byte per slot in
+ * front of the slots. A control byte is a 7 bits tag of the key hash for a
+ * slot keeping a key, or marks the slot empty, deleted or extended. Lookups
+ * compare the control bytes of 16 slots at a time(SSE2 if available) from the
+ * home slot and only touch the slots whose tag matches, and stop at the first
+ * empty slot. So a removed slot is marked deleted until no probe can go
+ * across it. Tables of QHASHARR_FORMAT_LINEAR have no control bytes and are
+ * probed slot by slot, the layout is kept to read tables created before.
+ *
+ * QHASHARR_FORMAT_FPRINT tables have the same layout as QHASHARR_FORMAT_GROUP,
+ * but the key is hashed once by 64-bit xxHash: the home slot and the tag are
+ * taken from it and it's kept in place of the MD5 of the key as fingerprint.
+ * So lookups compute no MD5, a slot is only compared with the key if the
+ * fingerprint matches. A truncated key is kept whole in the value heap if
+ * there is one, otherwise the fingerprint stands for the cut part of the key.
+ *
+ * A QHASHARR_FORMAT_GROUP table may also keep a value heap behind the slots,
+ * see qhasharr_fmt_heap(). A value which doesn't fit in a slot is stored in a
+ * single block of the heap, so it's read with one memcpy and can be referenced
+ * in place by qhasharr_get_ref(). The heap is a buddy allocator whose free
+ * lists are kept in the heap itself, blocks are 128 bytes at least. The value
+ * is stored across linked slots as before if the heap is full.
  *
  * @code
  *  [Data Structure Diagram]
@@ -71,6 +101,22 @@
  *  | +--------+ +------------+ +------------+ +------------+ +--------------+ |
  *  |                      ^~~link~~^     ^~~~~~~~~~link~~~~~~~~~^             |
  *  +--------------------------------------------------------------------------+
+ *
+ *  Below diagram shows the table of QHASHARR_FORMAT_GROUP.
+ *  +--[Static Flat Memory Area]-----------------------------------------------+
+ *  | +--------+ +-[Control]---------------+ +-[Slot 0]---+        +-[Slot N]-+ |
+ *  | |TBL INFO| |C0|C1|...|CN|C0 ... C15  | |KEY A|DATA A|  ....  |KEY N|DATA| |
+ *  | +--------+ +-------------------------+ +------------+        +----------+ |
+ *  |                          ^~mirror of the first 16 bytes for group loads  |
+ *  +--------------------------------------------------------------------------+
+ *
+ *  Below diagram shows a big value stored in the value heap.
+ *  +--[Static Flat Memory Area]-----------------------------------------------+
+ *  | +--------+ +-[Control]-+ +-[Slot 0]------+     +-[Heap]------------------+ |
+ *  | |TBL INFO| |C0|C1|...  | |KEY A|OFF A    | ... |FREE LISTS|BLOCK A|...  | |
+ *  | +--------+ +-----------+ +---------------+     +------------------------+ |
+ *  |                                   ^~~~~~~~offset~~~~~~~~~~~~~^           |
+ *  +--------------------------------------------------------------------------+
  * @endcode
  *
  * @code
@@ -132,15 +178,115 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
+#include <time.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "qlibc.h"
 
 #ifndef _DOXYGEN_SKIP
+// times a reader spins on an odd write sequence before sleeping
+#define _Q_HASHARR_READ_SPINS (128)
+// nanoseconds a reader sleeps between looks at an odd write sequence
+#define _Q_HASHARR_READ_NAP_NS (50 * 1000)
+// milliseconds a reader waits for a writer in progress before giving up
+#define _Q_HASHARR_READ_WAIT_MS (100)
+// times a reader retries a torn read before giving up
+#define _Q_HASHARR_READ_RETRIES (1024)
+
+// header mark of the tables keeping their layout
+#define _Q_HASHARR_MAGIC (0x51484131)
+// size of the header of QHASHARR_FORMAT_LINEAR tables
+#define _Q_HASHARR_LINEAR_HDRSIZE (offsetof(qhasharr_t, magic))
+// slots whose control bytes are probed at a time
+#define _Q_HASHARR_GROUP (16)
+// control bytes, a slot keeping a key has a tag in 0x00 - 0x7f
+#define _Q_HASHARR_CTRL_EMPTY (0x80)
+#define _Q_HASHARR_CTRL_DELETED (0xfe)
+#define _Q_HASHARR_CTRL_EXT (0xfd)
+#define _Q_HASHARR_TAG(keyhash) ((unsigned char)((keyhash) >> 25))
+#define _Q_HASHARR_ALIGN(size) (((size) + 7) & ~(size_t)7)
+// slot size of a value kept in the heap, a slot keeps 146 bytes at most
+#define _Q_HASHARR_SIZE_HEAP (0xff)
+// heap blocks are 2^7 to 2^(7+_Q_HASHARR_HEAP_ORDERS-1) bytes
+#define _Q_HASHARR_HEAP_MINORDER (7)
+#define _Q_HASHARR_HEAP_ORDERS (34)
+#define _Q_HASHARR_BLOCK_FREE (0x46524545)
+#define _Q_HASHARR_BLOCK_USED (0x55534544)
+
+// value heap, kept at the beginning of the heap region
+struct _Q_HASHARR_HEAP
+{
+    uint64_t base;      // offset of the first block from the heap
+    uint64_t size;      // bytes of blocks
+    uint64_t used;      // bytes of allocated blocks
+    uint64_t values;    // number of allocated blocks
+    uint64_t freelist[_Q_HASHARR_HEAP_ORDERS];  // offset + 1 of the first free block
+};
+
+// buddy block, data of an allocated block starts at next
+struct _Q_HASHARR_BLOCK
+{
+    uint32_t state;
+    uint32_t order;
+    uint64_t size;      // value size of an allocated block
+    uint64_t next;      // offset + 1 of the next free block of the same order
+    uint64_t prev;      // offset + 1 of the previous free block of the same order
+};
+#define _Q_HASHARR_BLOCK_HDRSIZE (offsetof(struct _Q_HASHARR_BLOCK, next))
+
+// kept in place of the key md5 by QHASHARR_FORMAT_FPRINT tables
+struct _Q_HASHARR_KEY_FPRINT
+{
+    uint64_t fprint;    // 64-bit fingerprint of the key
+    uint64_t offset;    // offset of the block keeping the whole key, 0 if none
+};
+
+// reference to the value in a slot of _Q_HASHARR_SIZE_HEAP
+struct _Q_HASHARR_HEAP_REF
+{
+    uint64_t offset;    // offset of the block from the heap
+    uint64_t size;      // value size
+};
+
 // internal usages
+static size_t _ctrl_size(int maxslots);
+static unsigned char *_get_ctrl(qhasharr_t *tbl);
+static void _set_ctrl(qhasharr_t *tbl, int idx, unsigned char ctrl);
+static void _free_ctrl(qhasharr_t *tbl, int idx);
+static size_t _dir_size(int maxslots);
+static int *_get_dir(qhasharr_t *tbl);
+static void _dir_add(qhasharr_t *tbl, int idx);
+static void _dir_del(qhasharr_t *tbl, int idx);
+static uint32_t _group_match(const unsigned char *group, unsigned char ctrl);
+static uint32_t _key_hash(qhasharr_t *tbl, const char *key, size_t key_size, uint64_t *fprint);
+static bool _same_key(qhasharr_t *tbl, qhasharr_slot_t *slot, const char *key, size_t key_size, uint64_t fprint);
+static const char *_slot_key(qhasharr_t *tbl, qhasharr_slot_t *slot, size_t *key_size);
+static size_t _heap_size(size_t heapsize);
+static struct _Q_HASHARR_HEAP *_get_heap(qhasharr_t *tbl);
+static void _heap_reset(qhasharr_t *tbl);
+static uint64_t _heap_alloc(qhasharr_t *tbl, size_t size);
+static void _heap_free(qhasharr_t *tbl, uint64_t offset);
+static void _heap_push(struct _Q_HASHARR_HEAP *heap, uint64_t offset, uint32_t order);
+static void _heap_unlink(struct _Q_HASHARR_HEAP *heap, uint64_t offset);
+static const void *_heap_value(qhasharr_t *tbl, qhasharr_slot_t *slot, size_t *size);
+static const void *_heap_block(qhasharr_t *tbl, uint64_t offset, size_t size);
+static int  _get_idx_group(qhasharr_t *tbl, const char *key, size_t key_size, unsigned int hash, uint32_t keyhash, uint64_t fprint);
+static uint32_t *_get_seq(qhasharr_t *tbl);
+static void _seq_write_begin(qhasharr_t *tbl);
+static void _seq_write_end(qhasharr_t *tbl);
+static bool _put(qhasharr_t *tbl, const char *key, size_t key_size, const void *value, size_t val_size);
+static bool _remove(qhasharr_t *tbl, const char *key, size_t key_size);
+static int  _slots_needed(size_t val_size);
+static bool _remove_idx(qhasharr_t *tbl, int idx);
 static int  _find_empty(qhasharr_t *tbl, int startidx);
-static int  _get_idx(qhasharr_t *tbl, const char *key, size_t key_size, unsigned int hash);
+static int  _get_idx(qhasharr_t *tbl, const char *key, size_t key_size, unsigned int hash, uint32_t keyhash, uint64_t fprint);
+static const unsigned char *_key_hashes(qhasharr_t *tbl, const char *key, size_t key_size, const qhasharr_key_t *hkey, uint32_t *keyhash, uint64_t *fprint);
+static int  _get_idx_hint(qhasharr_t *tbl, const char *key, size_t key_size, const qhasharr_key_t *hkey, unsigned int hash, uint32_t keyhash, uint64_t fprint, const unsigned char *keymd5);
 static void *_get_data(qhasharr_t *tbl, int idx, size_t *size);
-static bool _put_data(qhasharr_t *tbl, int idx, unsigned int hash, const char *key, size_t key_size, const void *value, size_t val_size, int count);
+static bool _put_data(qhasharr_t *tbl, int idx, unsigned int hash, uint32_t keyhash, uint64_t fprint, const char *key, size_t key_size, const void *value, size_t val_size, int count);
 static bool _copy_slot(qhasharr_t *tbl, int idx1, int idx2);
 static bool _remove_slot(qhasharr_t *tbl, int idx);
 static bool _remove_data(qhasharr_t *tbl, int idx);
@@ -159,7 +305,42 @@ static bool _remove_data(qhasharr_t *tbl, int idx);
  */
 size_t qhasharr_calculate_memsize(int max)
 {
-    size_t memsize = sizeof(qhasharr_t) + (sizeof(qhasharr_slot_t) * (max));
+    return qhasharr_calculate_memsize_fmt(max, QHASHARR_FORMAT_LINEAR);
+}
+
+/**
+ * Get how much memory is needed for N slots of the given layout.
+ *
+ * @param max       a number of maximum internal slots
+ * @param format    QHASHARR_FORMAT_LINEAR, QHASHARR_FORMAT_GROUP or QHASHARR_FORMAT_FPRINT
+ *
+ * @return memory size needed
+ */
+size_t qhasharr_calculate_memsize_fmt(int max, int format)
+{
+    return qhasharr_calculate_memsize_heap(max, format, 0);
+}
+
+/**
+ * Get how much memory is needed for N slots and a value heap.
+ *
+ * @param max       a number of maximum internal slots
+ * @param format    QHASHARR_FORMAT_LINEAR, QHASHARR_FORMAT_GROUP or QHASHARR_FORMAT_FPRINT
+ * @param heapsize  size of the value heap, QHASHARR_FORMAT_LINEAR has none
+ *
+ * @return memory size needed
+ */
+size_t qhasharr_calculate_memsize_heap(int max, int format, size_t heapsize)
+{
+    if (QHASHARR_FORMAT_GROUP == format || QHASHARR_FORMAT_FPRINT == format)
+    {
+        size_t memsize = sizeof(qhasharr_t) + _ctrl_size(max) + (sizeof(qhasharr_slot_t) * (max));
+        memsize = _Q_HASHARR_ALIGN(memsize) + _dir_size(max);
+        if (heapsize > 0) memsize = _Q_HASHARR_ALIGN(memsize) + _heap_size(heapsize);
+        return memsize;
+    }
+
+    size_t memsize = _Q_HASHARR_LINEAR_HDRSIZE + (sizeof(qhasharr_slot_t) * (max));
     return memsize;
 }
 
@@ -187,12 +368,61 @@ size_t qhasharr_calculate_memsize(int max)
  *  pointer exactly same as memory pointer.
  */
 qhasharr_t *qhasharr(void *memory, size_t memsize)
+{
+    return qhasharr_fmt(memory, memsize, QHASHARR_FORMAT_LINEAR);
+}
+
+/**
+ * Initialize static hash table of the given layout
+ *
+ * @param memory    a pointer of buffer memory.
+ * @param memsize   a size of buffer memory.
+ * @param format    QHASHARR_FORMAT_LINEAR, QHASHARR_FORMAT_GROUP or QHASHARR_FORMAT_FPRINT
+ *
+ * @return qhasharr_t container pointer, otherwise returns NULL.
+ * @retval errno  will be set in error condition.
+ *  - EINVAL : Assigned memory is too small or format is unknown.
+ */
+qhasharr_t *qhasharr_fmt(void *memory, size_t memsize, int format)
+{
+    return qhasharr_fmt_heap(memory, memsize, format, 0);
+}
+
+/**
+ * Initialize static hash table of the given layout with a value heap.
+ *
+ * @param memory    a pointer of buffer memory.
+ * @param memsize   a size of buffer memory.
+ * @param format    QHASHARR_FORMAT_LINEAR, QHASHARR_FORMAT_GROUP or QHASHARR_FORMAT_FPRINT
+ * @param heapsize  size of the value heap taken from memory, 0 for no heap.
+ *
+ * @return qhasharr_t container pointer, otherwise returns NULL.
+ * @retval errno  will be set in error condition.
+ *  - EINVAL : Assigned memory is too small, format is unknown or has no heap.
+ *
+ * @note
+ *  Values larger than a slot are kept contiguous in the heap, and in linked
+ *  slots only when the heap is full.
+ */
+qhasharr_t *qhasharr_fmt_heap(void *memory, size_t memsize, int format, size_t heapsize)
 {
     if (NULL == memory) return (qhasharr_t *)memory;
 
     // calculate max
-    int maxslots = (memsize - sizeof(qhasharr_t)) / sizeof(qhasharr_slot_t);
-    if (maxslots < 1 || memsize <= sizeof(qhasharr_t))
+    int maxslots = 0;
+    if (QHASHARR_FORMAT_LINEAR == format && 0 == heapsize)
+    {
+        if (memsize > _Q_HASHARR_LINEAR_HDRSIZE)
+            maxslots = (memsize - _Q_HASHARR_LINEAR_HDRSIZE) / sizeof(qhasharr_slot_t);
+    }
+    else if (QHASHARR_FORMAT_GROUP == format || QHASHARR_FORMAT_FPRINT == format)
+    {
+        size_t minsize = qhasharr_calculate_memsize_heap(0, format, heapsize);
+        if (memsize > minsize)
+            maxslots = (memsize - minsize) / (sizeof(qhasharr_slot_t) + 1 + _dir_size(1));
+        while (maxslots > 0 && qhasharr_calculate_memsize_heap(maxslots, format, heapsize) > memsize) maxslots--;
+    }
+    if (maxslots < 1)
     {
         errno = EINVAL;
         return NULL;
@@ -206,7 +436,22 @@ qhasharr_t *qhasharr(void *memory, size_t memsize)
     tbl->usedslots = 0;
     tbl->num = 0;
 
-//  _tbl_slots = (qhasharr_slot_t *)((char*)memory + sizeof(qhasharr_t));
+    if (QHASHARR_FORMAT_GROUP == format || QHASHARR_FORMAT_FPRINT == format)
+    {
+        tbl->magic = _Q_HASHARR_MAGIC;
+        tbl->format = format;
+        tbl->ctrloff = sizeof(qhasharr_t);
+        tbl->slotoff = sizeof(qhasharr_t) + _ctrl_size(maxslots);
+        memset((char *)tbl + tbl->ctrloff, _Q_HASHARR_CTRL_EMPTY, maxslots + _Q_HASHARR_GROUP);
+        tbl->diroff = _Q_HASHARR_ALIGN(tbl->slotoff + sizeof(qhasharr_slot_t) * maxslots);
+
+        if (heapsize > 0)
+        {
+            tbl->heapoff = tbl->diroff + _dir_size(maxslots);
+            tbl->heapsize = _heap_size(heapsize);
+            _heap_reset(tbl);
+        }
+    }
 
     return (qhasharr_t *)memory;
 }
@@ -215,10 +460,59 @@ int qhasharr_init(qhasharr_t *tbl, qhasharr_slot_t **_tbl_slots)
 {
     if (NULL == tbl ||  NULL == _tbl_slots) return -1;
 
-    *_tbl_slots = (qhasharr_slot_t *)((char*)tbl + sizeof(qhasharr_t));
+    // slot 0 of a linear table is where the magic would be, the padding after
+    // its count is zero
+    if (tbl->maxslots > 0 && _Q_HASHARR_MAGIC == tbl->magic)
+        *_tbl_slots = (qhasharr_slot_t *)((char*)tbl + tbl->slotoff);
+    else
+        *_tbl_slots = (qhasharr_slot_t *)((char*)tbl + _Q_HASHARR_LINEAR_HDRSIZE);
     return 0;
 }
 
+/**
+ * Get the layout of table.
+ *
+ * @param tbl       qhasharr_t container pointer.
+ *
+ * @return QHASHARR_FORMAT_LINEAR, QHASHARR_FORMAT_GROUP or QHASHARR_FORMAT_FPRINT
+ */
+int qhasharr_format(qhasharr_t *tbl)
+{
+    if (NULL == tbl || NULL == _get_ctrl(tbl)) return QHASHARR_FORMAT_LINEAR;
+
+    return tbl->format;
+}
+
+/**
+ * Check the layout of a table mapped from memory another process created,
+ * before trusting the offsets kept in it.
+ *
+ * @param tbl       qhasharr_t container pointer.
+ * @param memsize   size of the memory mapped.
+ *
+ * @return true if the table has a layout known and fits in memsize,
+ *  otherwise returns false
+ */
+bool qhasharr_check_layout(qhasharr_t *tbl, size_t memsize)
+{
+    if (NULL == tbl || memsize < _Q_HASHARR_LINEAR_HDRSIZE || tbl->maxslots < 0) return false;
+
+    if (NULL == _get_ctrl(tbl))
+        return qhasharr_calculate_memsize(tbl->maxslots) <= memsize;
+
+    if (memsize < sizeof(qhasharr_t)) return false;
+    if (QHASHARR_FORMAT_GROUP != tbl->format && QHASHARR_FORMAT_FPRINT != tbl->format) return false;
+
+    // the offsets are the ones this version lays out for the slots
+    size_t heapsize = (0 == tbl->heapoff) ? 0 : tbl->heapsize;
+    size_t slotoff = sizeof(qhasharr_t) + _ctrl_size(tbl->maxslots);
+    size_t diroff = _Q_HASHARR_ALIGN(slotoff + sizeof(qhasharr_slot_t) * tbl->maxslots);
+    if (tbl->ctrloff != sizeof(qhasharr_t) || tbl->slotoff != slotoff || tbl->diroff != diroff) return false;
+    if (0 != heapsize && (tbl->heapoff != diroff + _dir_size(tbl->maxslots) || heapsize != _heap_size(heapsize))) return false;
+
+    return qhasharr_calculate_memsize_heap(tbl->maxslots, tbl->format, heapsize) <= memsize;
+}
+
 bool qhasharr_exist(qhasharr_t *tbl, const char *key, size_t key_size)
 {
     if ( NULL == tbl ||  NULL == key)
@@ -233,12 +527,22 @@ bool qhasharr_exist(qhasharr_t *tbl, const char *key, size_t key_size)
     }
 
     // get hash integer
-    unsigned int hash = qhashmurmur3_32(key, key_size) % tbl->maxslots;
-    if (_get_idx(tbl, key, key_size, hash) >= 0)    //same key
+    uint64_t fprint = 0;
+    uint32_t keyhash = _key_hash(tbl, key, key_size, &fprint);
+    unsigned int hash = keyhash % tbl->maxslots;
+
+    int tries;
+    for (tries = 0; tries < _Q_HASHARR_READ_RETRIES; tries++)
     {
-        return true;
+        uint32_t seq = qhasharr_read_begin(tbl);
+        int idx = _get_idx(tbl, key, key_size, hash, keyhash, fprint);
+        if (!qhasharr_read_retry(tbl, seq))
+        {
+            return (idx >= 0);    //same key
+        }
     }
 
+    errno = EAGAIN;
     return false;
 }
 
@@ -264,108 +568,116 @@ bool qhasharr_put(qhasharr_t *tbl, const char *key, size_t key_size, const void
         return false;
     }
 
-    qhasharr_slot_t *_tbl_slots = NULL;
-    qhasharr_init(tbl, &_tbl_slots);
-    
-    if (tbl->maxslots == 0)
-    {
-        return false;  
-    }
-    // check full
-    if (tbl->usedslots >= tbl->maxslots)
+    _seq_write_begin(tbl);
+    bool ret = _put(tbl, key, key_size, value, val_size);
+    _seq_write_end(tbl);
+
+    return ret;
+}
+
+/**
+ * Put and remove objects in one write sequence, readers see either none or
+ * all of them.
+ *
+ * @param tbl       qhasharr_t container pointer.
+ * @param ops       objects to put, the ones of NULL value are removed
+ * @param nops      number of ops
+ *
+ * @return true if successful, otherwise returns false
+ * @retval errno will be set in error condition.
+ *  - ENOBUFS   : Table may not have enough space for the objects.
+ *  - E2BIG     : Objects don't fit even if the table is emptied.
+ *  - EINVAL    : Invalid argument.
+ *  - ENOMEM    : Memory allocation failure.
+ *  - EFAULT    : Unexpected error. Data structure is not constant, the
+ *                batch may be left partly done.
+ *
+ * @note
+ *  Space is checked as if no object replaced is freed, so ENOBUFS may be
+ *  returned though the objects would fit. A batch failing halfway is rolled
+ *  back, nothing is changed unless errno is EFAULT.
+ */
+bool qhasharr_put_batch(qhasharr_t *tbl, const qhasharr_op_t *ops, int nops)
+{
+    if (NULL == tbl || nops < 0 || (NULL == ops && nops > 0))
     {
-        errno = ENOBUFS;
+        errno = EINVAL;
         return false;
     }
 
-    // get hash integer
-    unsigned int hash = qhashmurmur3_32(key, key_size) % tbl->maxslots;
-
-    // check, is slot empty
-    if (_tbl_slots[hash].count == 0)   // empty slot
+    int needed = 0;
+    for (int i = 0; i < nops; i++)
     {
-        // put data
-        if (_put_data(tbl, hash, hash, key, key_size, value, val_size, 1) == false)
+        if (NULL == ops[i].key)
         {
+            errno = EINVAL;
             return false;
         }
+        if (NULL != ops[i].value) needed += _slots_needed(ops[i].val_size);
     }
-    else if (_tbl_slots[hash].count > 0)     // same key or hash collision
+    if (needed > tbl->maxslots)
     {
-        // check same key;
-        int idx = _get_idx(tbl, key, key_size, hash);
-        if (idx >= 0)   // same key
-        {
-            // remove and recall
-            if (!qhasharr_remove(tbl, key, key_size))
-                return false;
-            return qhasharr_put(tbl, key, key_size, value, val_size);
-        }
-        else     // no same key, just hash collision
-        {
-            // find empty slot
-            int idx = _find_empty(tbl, hash);
-            if (idx < 0)
-            {
-                errno = ENOBUFS;
-                return false;
-            }
-
-            // put data. -1 is used for collision resolution (idx != hash);
-            if (_put_data(tbl, idx, hash, key, key_size, value, val_size, -1) == false)
-            {
-                return false;
-            }
-
-            // increase counter from leading slot
-            _tbl_slots[hash].count++;
-
-            //      key, idx, hash, tbl->usedslots);
-        }
+        errno = E2BIG;
+        return false;
     }
-    else
+    if (needed > tbl->maxslots - tbl->usedslots || (nops > 0 && 0 == tbl->maxslots))
     {
-        // in case of -1 or -2, move it. -1 used for collision resolution,
-        // -2 used for oversized value data.
+        errno = ENOBUFS;
+        return false;
+    }
 
-        // find empty slot
-        int idx = _find_empty(tbl, hash + 1);
-        if (idx < 0)
+    // objects replaced are kept to put them back if the batch fails halfway
+    qhasharr_op_t *olds = (qhasharr_op_t *)calloc(nops > 0 ? nops : 1, sizeof(qhasharr_op_t));
+    if (NULL == olds)
+    {
+        errno = ENOMEM;
+        return false;
+    }
+
+    int i, last = nops - 1;
+    _seq_write_begin(tbl);
+    for (i = 0; i < nops; i++)
+    {
+        uint64_t fprint = 0;
+        uint32_t keyhash = _key_hash(tbl, ops[i].key, ops[i].key_size, &fprint);
+        int idx = _get_idx(tbl, ops[i].key, ops[i].key_size, keyhash % tbl->maxslots, keyhash, fprint);
+        olds[i].value = (idx < 0) ? NULL : _get_data(tbl, idx, &olds[i].val_size);
+        if (idx >= 0 && NULL == olds[i].value)
         {
-            errno = ENOBUFS;
-            return false;
+            last = i - 1;
+            break;
         }
 
-        // move dup slot to empty
-        _copy_slot(tbl, idx, hash);
-
-        _remove_slot(tbl, hash);
-
-        // in case of -2, adjust link of mother
-        if (_tbl_slots[idx].count == -2)
+        bool done = (NULL != ops[i].value)
+            ? _put(tbl, ops[i].key, ops[i].key_size, ops[i].value, ops[i].val_size)
+            : (_remove(tbl, ops[i].key, ops[i].key_size) || ENOENT == errno);
+        if (!done)
         {
-            _tbl_slots[ _tbl_slots[idx].hash ].link = idx;
-            if (_tbl_slots[idx].link != -1)
-            {
-                _tbl_slots[ _tbl_slots[idx].link ].hash = idx;
-            }
+            last = i;
+            break;
         }
-        else if (_tbl_slots[idx].count == -1)
+    }
+
+    bool ret = (i == nops);
+    if (!ret)
+    {
+        int err = errno;
+        for (i = last; i >= 0; i--)
         {
-            if (_tbl_slots[idx].link != -1)
+            if (!_remove(tbl, ops[i].key, ops[i].key_size) && ENOENT != errno) err = EFAULT;
+            if (NULL != olds[i].value
+                    && !_put(tbl, ops[i].key, ops[i].key_size, olds[i].value, olds[i].val_size))
             {
-                _tbl_slots[ _tbl_slots[idx].link ].hash = idx;
+                err = EFAULT;
             }
         }
-
-        // store data
-        if (_put_data(tbl, hash, hash, key, key_size, value, val_size, 1) == false)
-        {
-            return false;
-        }
+        errno = err;
     }
+    _seq_write_end(tbl);
 
-    return true;
+    for (i = 0; i < nops; i++) free((void *)olds[i].value);
+    free(olds);
+    return ret;
 }
 
 /**
@@ -442,84 +754,477 @@ bool qhasharr_putint(qhasharr_t *tbl, const char *key, int64_t num)
  */
 void *qhasharr_get(qhasharr_t *tbl, const char *key, size_t key_size, size_t *val_size)
 {
-    if (NULL == tbl || NULL == key)
-    {
-        errno = EINVAL;
-        return NULL;
-    }
-
-    qhasharr_slot_t *_tbl_slots = NULL;
-    qhasharr_init(tbl, &_tbl_slots);
-    // get hash integer
-    if (tbl->maxslots == 0)
-    {
-        return NULL;  
-    }
-
-    unsigned int hash = qhashmurmur3_32(key, key_size) % tbl->maxslots;
-
-    int idx = _get_idx(tbl, key, key_size, hash);
-    if (idx < 0)
-    {
-        errno = ENOENT;
-        return NULL;
-    }
+    return qhasharr_get_idx(tbl, key, key_size, val_size, NULL);
+}
 
-    return _get_data(tbl, idx, val_size);
+/**
+ * Get an object from this table, and the slot it starts at.
+ *
+ * @param tbl       qhasharr_t container pointer.
+ * @param key       key string
+ * @param key_size  key size
+ * @param val_size  if not NULL, oject size will be stored
+ * @param idx       if not NULL, index of the slot the object starts at will
+ *                  be stored
+ *
+ * @return same as qhasharr_get()
+ */
+void *qhasharr_get_idx(qhasharr_t *tbl, const char *key, size_t key_size, size_t *val_size, int *idx)
+{
+    return qhasharr_get_key(tbl, key, key_size, NULL, val_size, idx);
 }
 
 /**
- * Finds an object with given name and returns as
- * string type.
+ * Get a reference to an object kept in a single slot, without copying it.
  *
  * @param tbl       qhasharr_t container pointer.
  * @param key       key string
+ * @param size      if not NULL, oject size will be stored
+ * @param seq       write sequence the reference was taken at
  *
- * @return string pointer if successful, otherwise(not found) returns NULL
+ * @return pointer to the object inside the table if successful, otherwise
+ *  returns NULL
  * @retval errno will be set in error condition.
  *  - ENOENT    : No such key found.
  *  - EINVAL    : Invalid argument.
- *  - ENOMEM    : Memory allocation failed.
+ *  - E2BIG     : The object is stored across several slots, objects in the
+ *                value heap are referenced in place. Or the table is of
+ *                QHASHARR_FORMAT_LINEAR, which has no write sequence.
+ *  - EAGAIN    : The table kept changing while reading.
  *
  * @note
- * returned object must be freed after done using.
+ *  The object may be overwritten by a writer at any time. Check the
+ *  reference with qhasharr_read_retry(tbl, *seq) after using it.
  */
-char *qhasharr_getstr(qhasharr_t *tbl, const char *key, size_t key_size)
+const void *qhasharr_get_ref(qhasharr_t *tbl, const char *key, size_t key_size, size_t *val_size, uint32_t *seq)
 {
-    return (char *)qhasharr_get(tbl, key, key_size, NULL);
+    return qhasharr_get_ref_idx(tbl, key, key_size, val_size, seq, NULL);
 }
 
 /**
- * Finds an object with given name and returns as integer type.
+ * Same as qhasharr_get_ref(), and the index of the slot the object starts
+ * at is stored in idx if it's not NULL.
+ */
+const void *qhasharr_get_ref_idx(qhasharr_t *tbl, const char *key, size_t key_size, size_t *val_size, uint32_t *seq, int *idx)
+{
+    return qhasharr_get_ref_key(tbl, key, key_size, NULL, val_size, seq, idx);
+}
+
+/**
+ * Prepare a key for getting it repeatedly. The key is hashed once for
+ * tables of the format of tbl, and the slot it's found at is remembered and
+ * checked first by the next get.
  *
  * @param tbl       qhasharr_t container pointer.
  * @param key       key string
+ * @param key_size  key size
+ * @param hkey      key prepared
  *
- * @return value integer if successful, otherwise(not found) returns 0
+ * @return true if successful, otherwise returns false
  * @retval errno will be set in error condition.
- *  - ENOENT    : No such key found.
  *  - EINVAL    : Invalid argument.
- *  - ENOMEM    : Memory allocation failed.
+ *
+ * @note
+ *  A prepared key works with any table, the hashes of it are only used for
+ *  tables of the same format. It may be used by several readers at once.
  */
-int64_t qhasharr_getint(qhasharr_t *tbl, const char *key, size_t key_size)
+bool qhasharr_prepare(qhasharr_t *tbl, const char *key, size_t key_size, qhasharr_key_t *hkey)
 {
-    int64_t num = 0;
-    char *str = qhasharr_getstr(tbl, key, key_size);
-    if (str != NULL)
+    if (NULL == tbl || NULL == key || NULL == hkey)
     {
-        num = atoll(str);
-        free(str);
-        str = NULL;
+        errno = EINVAL;
+        return false;
     }
 
-    return num;
+    memset(hkey, 0, sizeof(qhasharr_key_t));
+    hkey->format = qhasharr_format(tbl);
+    hkey->keyhash = _key_hash(tbl, key, key_size, &hkey->fprint);
+    if (QHASHARR_FORMAT_FPRINT != hkey->format && key_size > _Q_HASHARR_KEYSIZE)
+        qhashmd5(key, key_size, hkey->keymd5);
+    hkey->hint = -1;
+
+    return true;
 }
 
 /**
- * Get next element.
+ * Prefetch the slot a get of the prepared key probes first, and the control
+ * bytes of it, so the gets of several keys wait for memory at once.
  *
  * @param tbl       qhasharr_t container pointer.
- * @param idx       index pointer
+ * @param hkey      key prepared for tbl
+ */
+void qhasharr_prefetch(qhasharr_t *tbl, const qhasharr_key_t *hkey)
+{
+    if (NULL == tbl || NULL == hkey || tbl->maxslots <= 0) return;
+    if (hkey->format != qhasharr_format(tbl)) return;
+
+    qhasharr_slot_t *_tbl_slots = NULL;
+    qhasharr_init(tbl, &_tbl_slots);
+
+    unsigned int hash = hkey->keyhash % tbl->maxslots;
+    int hint = __atomic_load_n(&hkey->hint, __ATOMIC_RELAXED);
+    int idx = (hint >= 0 && hint < tbl->maxslots) ? hint : (int)hash;
+    __builtin_prefetch(&_tbl_slots[idx], 0, 1);
+
+    unsigned char *ctrl = _get_ctrl(tbl);
+    if (NULL != ctrl && idx == (int)hash) __builtin_prefetch(ctrl + hash, 0, 1);
+}
+
+/**
+ * Same as qhasharr_get_idx() with a key prepared by qhasharr_prepare(), NULL
+ * for a key not prepared.
+ */
+void *qhasharr_get_key(qhasharr_t *tbl, const char *key, size_t key_size, qhasharr_key_t *hkey, size_t *val_size, int *idx)
+{
+    if (NULL == tbl || NULL == key)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    qhasharr_slot_t *_tbl_slots = NULL;
+    qhasharr_init(tbl, &_tbl_slots);
+    // get hash integer
+    if (tbl->maxslots == 0)
+    {
+        return NULL;  
+    }
+
+    uint64_t fprint = 0;
+    uint32_t keyhash = 0;
+    const unsigned char *keymd5 = _key_hashes(tbl, key, key_size, hkey, &keyhash, &fprint);
+    unsigned int hash = keyhash % tbl->maxslots;
+
+    int tries;
+    for (tries = 0; tries < _Q_HASHARR_READ_RETRIES; tries++)
+    {
+        uint32_t seq = qhasharr_read_begin(tbl);
+
+        int found = _get_idx_hint(tbl, key, key_size, hkey, hash, keyhash, fprint, keymd5);
+        void *value = (found < 0) ? NULL : _get_data(tbl, found, val_size);
+
+        if (!qhasharr_read_retry(tbl, seq))
+        {
+            if (found < 0) errno = ENOENT;
+            if (found >= 0 && hkey != NULL) __atomic_store_n(&hkey->hint, found, __ATOMIC_RELAXED);
+            if (idx != NULL) *idx = found;
+            return value;
+        }
+
+        // torn read, the writer moved the slots under us
+        free(value);
+    }
+
+    errno = EAGAIN;
+    return NULL;
+}
+
+/**
+ * Same as qhasharr_get_ref_idx() with a key prepared by qhasharr_prepare(),
+ * NULL for a key not prepared.
+ */
+const void *qhasharr_get_ref_key(qhasharr_t *tbl, const char *key, size_t key_size, qhasharr_key_t *hkey, size_t *val_size, uint32_t *seq, int *idx)
+{
+    if (NULL == tbl || NULL == key || NULL == seq)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    qhasharr_slot_t *_tbl_slots = NULL;
+    qhasharr_init(tbl, &_tbl_slots);
+    if (tbl->maxslots == 0)
+    {
+        errno = ENOENT;
+        return NULL;
+    }
+    // a reference nothing can check must be copied
+    if (NULL == _get_seq(tbl))
+    {
+        errno = E2BIG;
+        return NULL;
+    }
+
+    uint64_t fprint = 0;
+    uint32_t keyhash = 0;
+    const unsigned char *keymd5 = _key_hashes(tbl, key, key_size, hkey, &keyhash, &fprint);
+    unsigned int hash = keyhash % tbl->maxslots;
+
+    int tries;
+    for (tries = 0; tries < _Q_HASHARR_READ_RETRIES; tries++)
+    {
+        *seq = qhasharr_read_begin(tbl);
+
+        int found = _get_idx_hint(tbl, key, key_size, hkey, hash, keyhash, fprint, keymd5);
+        int link = (found < 0) ? -1 : _tbl_slots[found].link;
+        size_t size = (found < 0) ? 0 : _tbl_slots[found].size;
+        bool inheap = (_Q_HASHARR_SIZE_HEAP == size);
+        const void *value = (found < 0) ? NULL : _tbl_slots[found].data.pair.value;
+        if (inheap) value = _heap_value(tbl, &_tbl_slots[found], &size);
+
+        if (qhasharr_read_retry(tbl, *seq)) continue;
+
+        if (found < 0)
+        {
+            errno = ENOENT;
+            return NULL;
+        }
+        if (hkey != NULL) __atomic_store_n(&hkey->hint, found, __ATOMIC_RELAXED);
+        if (idx != NULL) *idx = found;
+        if (inheap && NULL == value) return NULL;
+        if (link != -1 || (!inheap && size > _Q_HASHARR_VALUESIZE))
+        {
+            errno = E2BIG;
+            return NULL;
+        }
+
+        if (val_size != NULL) *val_size = size;
+        return value;
+    }
+
+    errno = EAGAIN;
+    return NULL;
+}
+
+/**
+ * Get the occupancy of the value heap.
+ *
+ * @param tbl       qhasharr_t container pointer.
+ * @param stat      occupancy of the heap
+ *
+ * @return true if successful, otherwise returns false
+ * @retval errno will be set in error condition.
+ *  - EINVAL    : Invalid argument.
+ *  - ENOENT    : The table has no heap.
+ *  - EAGAIN    : The table kept changing while reading.
+ */
+bool qhasharr_heap_stat(qhasharr_t *tbl, qhasharr_heap_stat_t *stat)
+{
+    if (NULL == tbl || NULL == stat)
+    {
+        errno = EINVAL;
+        return false;
+    }
+
+    struct _Q_HASHARR_HEAP *heap = _get_heap(tbl);
+    if (NULL == heap)
+    {
+        errno = ENOENT;
+        return false;
+    }
+
+    int tries;
+    for (tries = 0; tries < _Q_HASHARR_READ_RETRIES; tries++)
+    {
+        uint32_t seq = qhasharr_read_begin(tbl);
+
+        memset(stat, 0, sizeof(qhasharr_heap_stat_t));
+        stat->size = heap->size;
+        stat->used = heap->used;
+        stat->values = heap->values;
+
+        int order;
+        for (order = 0; order < _Q_HASHARR_HEAP_ORDERS; order++)
+        {
+            size_t blocks = 0;
+            uint64_t link;
+            for (link = heap->freelist[order]; link != 0 && link <= heap->size; blocks++)
+            {
+                // the free list may be changed by a concurrent writer
+                if (blocks > (heap->size >> _Q_HASHARR_HEAP_MINORDER)) break;
+                link = ((struct _Q_HASHARR_BLOCK *)((char *)heap + link - 1))->next;
+            }
+            stat->freeblocks += blocks;
+            if (blocks > 0) stat->maxfree = (size_t)1 << (order + _Q_HASHARR_HEAP_MINORDER);
+        }
+
+        if (!qhasharr_read_retry(tbl, seq)) return true;
+    }
+
+    errno = EAGAIN;
+    return false;
+}
+
+/**
+ * Start a lock-free read of the table.
+ *
+ * @param tbl       qhasharr_t container pointer.
+ *
+ * @return write sequence snapshot to be checked by qhasharr_read_retry()
+ *
+ * @note
+ *  Waits while a writer is in progress, spinning shortly and then sleeping.
+ *  If the writer does not leave in _Q_HASHARR_READ_WAIT_MS, it's taken for
+ *  dead and the odd sequence is returned: the read is a best-effort one and
+ *  qhasharr_read_retry() only fails if the sequence moves on. Later reads
+ *  of the same odd sequence by the thread don't wait again.
+ */
+uint32_t qhasharr_read_begin(qhasharr_t *tbl)
+{
+    // the write sequence of the last writer this thread took for dead
+    static __thread uint32_t *stuck_seqp = NULL;
+    static __thread uint32_t stuck_seq = 0;
+
+    uint32_t *seqp = _get_seq(tbl);
+    if (NULL == seqp) return 0;
+
+    uint32_t seq = __atomic_load_n(seqp, __ATOMIC_ACQUIRE);
+    if (0 == (seq & 1)) return seq;
+    if (stuck_seqp == seqp && stuck_seq == seq) return seq;
+
+    int spins;
+    for (spins = 0; spins < _Q_HASHARR_READ_SPINS; spins++)
+    {
+        seq = __atomic_load_n(seqp, __ATOMIC_ACQUIRE);
+        if (0 == (seq & 1)) return seq;
+    }
+
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do
+    {
+        struct timespec nap = {0, _Q_HASHARR_READ_NAP_NS};
+        nanosleep(&nap, NULL);
+        seq = __atomic_load_n(seqp, __ATOMIC_ACQUIRE);
+        if (0 == (seq & 1)) return seq;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while ((now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000
+            < _Q_HASHARR_READ_WAIT_MS);
+
+    stuck_seqp = seqp;
+    stuck_seq = seq;
+    return seq;
+}
+
+/**
+ * Check whether a lock-free read must be retried.
+ *
+ * @param tbl       qhasharr_t container pointer.
+ * @param seq       snapshot returned by qhasharr_read_begin()
+ *
+ * @return true if the table was modified during the read, otherwise false
+ */
+bool qhasharr_read_retry(qhasharr_t *tbl, uint32_t seq)
+{
+    uint32_t *seqp = _get_seq(tbl);
+    if (NULL == seqp) return false;
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return seq != __atomic_load_n(seqp, __ATOMIC_RELAXED);
+}
+
+/**
+ * Check whether the last writer left the table in the middle of a write.
+ *
+ * @param tbl       qhasharr_t container pointer.
+ *
+ * @return true if the write sequence is odd, false if it's even or the
+ *  table has none
+ */
+bool qhasharr_write_interrupted(qhasharr_t *tbl)
+{
+    uint32_t *seqp = _get_seq(tbl);
+    return NULL != seqp && (__atomic_load_n(seqp, __ATOMIC_ACQUIRE) & 1);
+}
+
+/**
+ * Copy the table src into dst of the same layout and size. Readers of dst
+ * retry the reads while it's copied, and a sequence got from dst before
+ * never matches it again.
+ *
+ * @param dst       qhasharr_t container pointer copied into.
+ * @param src       qhasharr_t container pointer.
+ * @param memsize   size of the memory of both tables.
+ */
+void qhasharr_copy(qhasharr_t *dst, qhasharr_t *src, size_t memsize)
+{
+    if (NULL == _get_seq(dst) || NULL == _get_seq(src))
+    {
+        memcpy(dst, src, memsize);
+        return;
+    }
+
+    uint32_t seq = __atomic_load_n(&dst->seq, __ATOMIC_RELAXED) | 1;
+    __atomic_store_n(&dst->seq, seq, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    size_t off = offsetof(qhasharr_t, seq);
+    size_t end = off + sizeof(dst->seq);
+    memcpy(dst, src, off);
+    memcpy((char *)dst + end, (const char *)src + end, memsize - end);
+
+    __atomic_store_n(&dst->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Move the write sequence of a table taking the place of prev past the one
+ * of prev, so a sequence got from prev never matches tbl.
+ *
+ * @param tbl       qhasharr_t container pointer, not read by anyone yet.
+ * @param prev      qhasharr_t container pointer replaced by tbl.
+ */
+void qhasharr_seq_follow(qhasharr_t *tbl, qhasharr_t *prev)
+{
+    uint32_t *seqp = _get_seq(tbl);
+    uint32_t *prevp = _get_seq(prev);
+    if (NULL == seqp || NULL == prevp) return;
+
+    *seqp = (__atomic_load_n(prevp, __ATOMIC_ACQUIRE) + 2) & ~1u;
+}
+
+/**
+ * Finds an object with given name and returns as
+ * string type.
+ *
+ * @param tbl       qhasharr_t container pointer.
+ * @param key       key string
+ *
+ * @return string pointer if successful, otherwise(not found) returns NULL
+ * @retval errno will be set in error condition.
+ *  - ENOENT    : No such key found.
+ *  - EINVAL    : Invalid argument.
+ *  - ENOMEM    : Memory allocation failed.
+ *
+ * @note
+ * returned object must be freed after done using.
+ */
+char *qhasharr_getstr(qhasharr_t *tbl, const char *key, size_t key_size)
+{
+    return (char *)qhasharr_get(tbl, key, key_size, NULL);
+}
+
+/**
+ * Finds an object with given name and returns as integer type.
+ *
+ * @param tbl       qhasharr_t container pointer.
+ * @param key       key string
+ *
+ * @return value integer if successful, otherwise(not found) returns 0
+ * @retval errno will be set in error condition.
+ *  - ENOENT    : No such key found.
+ *  - EINVAL    : Invalid argument.
+ *  - ENOMEM    : Memory allocation failed.
+ */
+int64_t qhasharr_getint(qhasharr_t *tbl, const char *key, size_t key_size)
+{
+    int64_t num = 0;
+    char *str = qhasharr_getstr(tbl, key, key_size);
+    if (str != NULL)
+    {
+        num = atoll(str);
+        free(str);
+        str = NULL;
+    }
+
+    return num;
+}
+
+/**
+ * Get next element.
+ *
+ * @param tbl       qhasharr_t container pointer.
+ * @param idx       cursor, 0 to start from the first element. It's
+ *                  tbl->maxslots at the end of table.
  *
  * @return key name string if successful, otherwise(end of table) returns NULL
  * @retval errno will be set in error condition.
@@ -541,7 +1246,10 @@ int64_t qhasharr_getint(qhasharr_t *tbl, const char *key, size_t key_size)
  * @note
  *  Please be aware a key name will be returned with truncated length
  *  because key name is truncated when it put into the table if it's length is
- *  longer than _Q_HASHARR_KEYSIZE.
+ *  longer than _Q_HASHARR_KEYSIZE, unless it's kept whole in the heap.
+ *  Tables keeping a directory of objects go through the objects only, so
+ *  the cost is proportional to the number of objects rather than slots.
+ *  Each caller keeps its own cursor.
  */
 bool qhasharr_getnext(qhasharr_t *tbl, qnobj_t *obj, int *idx)
 {
@@ -553,16 +1261,28 @@ bool qhasharr_getnext(qhasharr_t *tbl, qnobj_t *obj, int *idx)
 
     qhasharr_slot_t *_tbl_slots = NULL;
     qhasharr_init(tbl, &_tbl_slots);
+    unsigned char *ctrl = _get_ctrl(tbl);
+    int *dir = _get_dir(tbl);
 
+    int tries = 0;
     for (; *idx < tbl->maxslots; (*idx)++)
     {
-        if (_tbl_slots[*idx].count == 0 || _tbl_slots[*idx].count == -2)
+        // the cursor is a position of the directory if there is one
+        if (dir != NULL && *idx >= tbl->dirnum) break;
+        int slot = (dir != NULL) ? dir[*idx] : *idx;
+        if (slot < 0 || slot >= tbl->maxslots) continue;
+
+        // skip slots keeping no key without touching them
+        if (ctrl != NULL && (ctrl[slot] & 0x80)) continue;
+
+        uint32_t seq = qhasharr_read_begin(tbl);
+        if (_tbl_slots[slot].count == 0 || _tbl_slots[slot].count == -2)
         {
             continue;
         }
 
-        size_t keylen = _tbl_slots[*idx].data.pair.keylen;
-        if (keylen > _Q_HASHARR_KEYSIZE) keylen = _Q_HASHARR_KEYSIZE;
+        size_t keylen = 0;
+        const char *key = _slot_key(tbl, &_tbl_slots[slot], &keylen);
 
         obj->name = (char *)malloc(keylen);
         if (obj->name == NULL)
@@ -570,10 +1290,27 @@ bool qhasharr_getnext(qhasharr_t *tbl, qnobj_t *obj, int *idx)
             errno = ENOMEM;
             return false;
         }
-        memcpy(obj->name, _tbl_slots[*idx].data.pair.key, keylen);
+        memcpy(obj->name, key, keylen);
         obj->name_size = keylen;
 
-        obj->data = _get_data(tbl, *idx, &obj->data_size);
+        obj->data = _get_data(tbl, slot, &obj->data_size);
+
+        if (qhasharr_read_retry(tbl, seq))
+        {
+            // torn read, read this slot again
+            free(obj->name);
+            free(obj->data);
+            obj->name = NULL;
+            obj->data = NULL;
+            if (++tries >= _Q_HASHARR_READ_RETRIES)
+            {
+                errno = EAGAIN;
+                return false;
+            }
+            (*idx)--;
+            continue;
+        }
+
         if (obj->data == NULL)
         {
             free(obj->name);
@@ -586,25 +1323,33 @@ bool qhasharr_getnext(qhasharr_t *tbl, qnobj_t *obj, int *idx)
         return true;
     }
 
+    *idx = tbl->maxslots;
     errno = ENOENT;
     return false;
 }
 
 /**
- * Remove an object from this table.
+ * qhasharr->getnext_stat(): Get the placement of next key in this table.
  *
  * @param tbl       qhasharr_t container pointer.
- * @param key       key string
+ * @param stat      placement of the key
+ * @param idx       cursor, 0 to start from the first slot. It's
+ *                  tbl->maxslots at the end of table.
  *
- * @return true if successful, otherwise(not found) returns false
+ * @return true if successful, otherwise(end of table) returns false
  * @retval errno will be set in error condition.
- *  - ENOENT    : No such key found.
+ *  - ENOENT    : No next key.
  *  - EINVAL    : Invald argument.
- *  - EFAULT        : Unexpected error. Data structure is not constant.
+ *  - EAGAIN    : The table kept changing while reading.
+ *
+ * @note
+ *  Slots are gone through one by one whether or not the table keeps a
+ *  directory, nothing is copied. Each key is read consistently, while keys
+ *  written between two calls may be missed or seen twice.
  */
-bool qhasharr_remove(qhasharr_t *tbl, const char *key, size_t key_size)
+bool qhasharr_getnext_stat(qhasharr_t *tbl, qhasharr_key_stat_t *stat, int *idx)
 {
-    if (NULL == tbl || NULL == key)
+    if (NULL == tbl || NULL == stat || NULL == idx)
     {
         errno = EINVAL;
         return false;
@@ -612,79 +1357,168 @@ bool qhasharr_remove(qhasharr_t *tbl, const char *key, size_t key_size)
 
     qhasharr_slot_t *_tbl_slots = NULL;
     qhasharr_init(tbl, &_tbl_slots);
+    unsigned char *ctrl = _get_ctrl(tbl);
+    int maxslots = tbl->maxslots;
 
-    if (tbl->maxslots == 0)
+    int tries = 0;
+    for (; *idx < maxslots; (*idx)++)
     {
-        return false;  
-    }
+        int slot = *idx;
+        if (ctrl != NULL && (ctrl[slot] & 0x80)) continue;
 
-    // get hash integer
-    unsigned int hash = qhashmurmur3_32(key, key_size) % tbl->maxslots;
+        uint32_t seq = qhasharr_read_begin(tbl);
+        if (_tbl_slots[slot].count == 0 || _tbl_slots[slot].count == -2)
+        {
+            continue;
+        }
 
-    int idx = _get_idx(tbl, key, key_size, hash);
-    if (idx < 0)
-    {
-        errno = ENOENT;
-        return false;
-    }
+        memset(stat, 0, sizeof(qhasharr_key_stat_t));
+        stat->idx = slot;
+        stat->home = (int)(_tbl_slots[slot].hash % (uint32_t)maxslots);
+        stat->distance = (slot - stat->home + maxslots) % maxslots;
+        stat->collisions = _tbl_slots[stat->home].count;
+        stat->keylen = _tbl_slots[slot].data.pair.keylen;
+        stat->keytype = _tbl_slots[slot].data.pair.key[0];
 
-    if (_tbl_slots[idx].count == 1)
-    {
-        // just remove
-        _remove_data(tbl, idx);
-    }
-    else if (_tbl_slots[idx].count > 1)     // leading slot and has dup
-    {
-        // find dup
-        int idx2;
-        for (idx2 = idx + 1; ; idx2++)
+        if (_Q_HASHARR_SIZE_HEAP == _tbl_slots[slot].size)
         {
-            if (idx2 >= tbl->maxslots) idx2 = 0;
-            if (idx2 == idx)
+            struct _Q_HASHARR_HEAP_REF ref;
+            memcpy(&ref, _tbl_slots[slot].data.pair.value, sizeof(ref));
+            stat->inheap = true;
+            stat->valsize = ref.size;
+        }
+        else
+        {
+            int newidx;
+            stat->valsize = _tbl_slots[slot].size;
+            for (newidx = _tbl_slots[slot].link; newidx >= 0 && newidx < maxslots
+                    && stat->extslots < maxslots; newidx = _tbl_slots[newidx].link)
             {
-                errno = EFAULT;
-                return false;
+                stat->extslots++;
+                stat->valsize += _tbl_slots[newidx].size;
             }
-            if (_tbl_slots[idx2].count == -1 && _tbl_slots[idx2].hash == hash)
+        }
+
+        if (qhasharr_read_retry(tbl, seq))
+        {
+            // torn read, read this slot again
+            if (++tries >= _Q_HASHARR_READ_RETRIES)
             {
-                break;
+                errno = EAGAIN;
+                return false;
             }
+            (*idx)--;
+            continue;
         }
 
-        // move to leading slot
-        int backupcount = _tbl_slots[idx].count;
-
-        _remove_data(tbl, idx); // remove leading data
+        *idx += 1;
+        return true;
+    }
 
-        _copy_slot(tbl, idx, idx2); // copy slot
-        _remove_slot(tbl, idx2); // remove moved slot
+    *idx = maxslots;
+    errno = ENOENT;
+    return false;
+}
 
-        _tbl_slots[idx].count = backupcount - 1; // adjust collision counter
-        if (_tbl_slots[idx].link != -1)
-        {
-            _tbl_slots[_tbl_slots[idx].link].hash = idx;
-        }
-    }
-    else if (_tbl_slots[idx].count == -1)   // in case of -1. used for collision resolution
+/**
+ * Remove an object from this table.
+ *
+ * @param tbl       qhasharr_t container pointer.
+ * @param key       key string
+ *
+ * @return true if successful, otherwise(not found) returns false
+ * @retval errno will be set in error condition.
+ *  - ENOENT    : No such key found.
+ *  - EINVAL    : Invald argument.
+ *  - EFAULT        : Unexpected error. Data structure is not constant.
+ */
+bool qhasharr_remove(qhasharr_t *tbl, const char *key, size_t key_size)
+{
+    if (NULL == tbl || NULL == key)
     {
-          // decrease counter from leading slot
-          if (_tbl_slots[ _tbl_slots[idx].hash ].count <= 1)
-          {
-              errno = EFAULT;
-              return false;
-          }
-          _tbl_slots[ _tbl_slots[idx].hash ].count--;
-
-          // remove data
-          _remove_data(tbl, idx);
+        errno = EINVAL;
+        return false;
     }
-    else 
+
+    _seq_write_begin(tbl);
+    bool ret = _remove(tbl, key, key_size);
+    _seq_write_end(tbl);
+
+    return ret;
+}
+
+/**
+ * Remove an object chosen by the CLOCK (second chance) policy.
+ *
+ * @param tbl       qhasharr_t container pointer.
+ * @param refs      reference bytes, one per slot, set by readers at the slot
+ *                  the object starts at. NULL if objects are not referenced.
+ * @param hand      clock hand, the slot to sweep from
+ * @param pinned    objects are never removed if it returns true. NULL if
+ *                  any object can be removed. It's given the value too, as
+ *                  keys longer than _Q_HASHARR_KEYSIZE may be cut in slots.
+ *
+ * @return true if successful, otherwise returns false
+ * @retval errno will be set in error condition.
+ *  - ENOENT    : No object can be removed.
+ *  - EINVAL    : Invald argument.
+ *  - EFAULT    : Unexpected error. Data structure is not constant.
+ *
+ * @note
+ *  The reference byte of an object is cleared when the hand passes it, the
+ *  object is removed if it's not referenced again before the next pass.
+ */
+bool qhasharr_evict(qhasharr_t *tbl, volatile unsigned char *refs, int *hand,
+        bool (*pinned)(const char *key, size_t key_size, const void *value, size_t val_size))
+{
+    if (NULL == tbl || NULL == hand)
     {
-        errno = ENOENT;
+        errno = EINVAL;
         return false;
     }
 
-    return true;
+    qhasharr_slot_t *_tbl_slots = NULL;
+    qhasharr_init(tbl, &_tbl_slots);
+
+    int maxslots = tbl->maxslots;
+    int next = (*hand < 0 || *hand >= maxslots) ? 0 : *hand;
+
+    // two passes at most, the first one may only clear the references
+    int swept;
+    for (swept = 0; swept < 2 * maxslots; swept++)
+    {
+        int idx = next;
+        if (++next >= maxslots) next = 0;
+
+        if (_tbl_slots[idx].count == 0 || _tbl_slots[idx].count == -2) continue;
+
+        if (refs != NULL && refs[idx] != 0)
+        {
+            refs[idx] = 0;
+            continue;
+        }
+
+        if (pinned != NULL)
+        {
+            size_t keylen = 0, val_size = 0;
+            const char *key = _slot_key(tbl, &_tbl_slots[idx], &keylen);
+            void *value = _get_data(tbl, idx, &val_size);
+            bool kept = pinned(key, keylen, value, val_size);
+            free(value);
+            if (kept) continue;
+        }
+
+        _seq_write_begin(tbl);
+        bool ret = _remove_idx(tbl, idx);
+        _seq_write_end(tbl);
+
+        *hand = next;
+        return ret;
+    }
+
+    *hand = next;
+    errno = ENOENT;
+    return false;
 }
 
 /**
@@ -715,20 +1549,274 @@ void qhasharr_clear(qhasharr_t *tbl)
 {
     if (NULL == tbl)
         return;
-    if (tbl->usedslots == 0) return;
+
+    // also leaves the write sequence of an interrupted writer
+    _seq_write_begin(tbl);
+
+    // deleted marks are left even if no slot is used
+    unsigned char *ctrl = _get_ctrl(tbl);
+    if (ctrl != NULL)
+    {
+        memset(ctrl, _Q_HASHARR_CTRL_EMPTY, tbl->maxslots + _Q_HASHARR_GROUP);
+    }
+    if (_get_dir(tbl) != NULL) tbl->dirnum = 0;
+
+    if (tbl->usedslots != 0)
+    {
+        qhasharr_slot_t *_tbl_slots = NULL;
+        qhasharr_init(tbl, &_tbl_slots);
+
+        tbl->usedslots = 0;
+        tbl->num = 0;
+
+        // clear memory
+        memset((void *)_tbl_slots,
+               '\0',
+               (tbl->maxslots * sizeof(qhasharr_slot_t)));
+    }
+    _heap_reset(tbl);
+    _seq_write_end(tbl);
+}
+
+#ifndef _DOXYGEN_SKIP
+
+// write sequence of tbl, NULL for the header of QHASHARR_FORMAT_LINEAR
+static uint32_t *_get_seq(qhasharr_t *tbl)
+{
+    return (NULL == _get_ctrl(tbl)) ? NULL : &tbl->seq;
+}
+
+// enter a write sequence. an odd sequence left by an interrupted writer stays odd
+static void _seq_write_begin(qhasharr_t *tbl)
+{
+    uint32_t *seqp = _get_seq(tbl);
+    if (NULL == seqp) return;
+
+    // the odd sequence of an interrupted writer moves on too, readers
+    // reading it best-effort must retry
+    __atomic_store_n(seqp, (*seqp | 1) + (*seqp & 1) * 2, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+// leave a write sequence, readers started before will retry
+static void _seq_write_end(qhasharr_t *tbl)
+{
+    uint32_t *seqp = _get_seq(tbl);
+    if (NULL == seqp) return;
+
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(seqp, *seqp + 1, __ATOMIC_RELAXED);
+}
+
+// put data, caller must be in a write sequence
+static bool _put(qhasharr_t *tbl, const char *key, size_t key_size, const void *value, size_t val_size)
+{
+    qhasharr_slot_t *_tbl_slots = NULL;
+    qhasharr_init(tbl, &_tbl_slots);
+    
+    if (tbl->maxslots == 0)
+    {
+        return false;  
+    }
+    // check full
+    if (tbl->usedslots >= tbl->maxslots)
+    {
+        errno = ENOBUFS;
+        return false;
+    }
+
+    // get hash integer
+    uint64_t fprint = 0;
+    uint32_t keyhash = _key_hash(tbl, key, key_size, &fprint);
+    unsigned int hash = keyhash % tbl->maxslots;
+
+    // check, is slot empty
+    if (_tbl_slots[hash].count == 0)   // empty slot
+    {
+        // put data
+        if (_put_data(tbl, hash, hash, keyhash, fprint, key, key_size, value, val_size, 1) == false)
+        {
+            return false;
+        }
+    }
+    else if (_tbl_slots[hash].count > 0)     // same key or hash collision
+    {
+        // check same key;
+        int idx = _get_idx(tbl, key, key_size, hash, keyhash, fprint);
+        if (idx >= 0)   // same key
+        {
+            // remove and recall
+            if (!_remove(tbl, key, key_size))
+                return false;
+            return _put(tbl, key, key_size, value, val_size);
+        }
+        else     // no same key, just hash collision
+        {
+            // find empty slot
+            int idx = _find_empty(tbl, hash);
+            if (idx < 0)
+            {
+                errno = ENOBUFS;
+                return false;
+            }
+
+            // put data. -1 is used for collision resolution (idx != hash);
+            if (_put_data(tbl, idx, hash, keyhash, fprint, key, key_size, value, val_size, -1) == false)
+            {
+                return false;
+            }
+
+            // increase counter from leading slot
+            _tbl_slots[hash].count++;
+
+            //      key, idx, hash, tbl->usedslots);
+        }
+    }
+    else
+    {
+        // in case of -1 or -2, move it. -1 used for collision resolution,
+        // -2 used for oversized value data.
+
+        // find empty slot
+        int idx = _find_empty(tbl, hash + 1);
+        if (idx < 0)
+        {
+            errno = ENOBUFS;
+            return false;
+        }
+
+        // move dup slot to empty
+        _copy_slot(tbl, idx, hash);
+
+        _remove_slot(tbl, hash);
+
+        // in case of -2, adjust link of mother
+        if (_tbl_slots[idx].count == -2)
+        {
+            _tbl_slots[ _tbl_slots[idx].hash ].link = idx;
+            if (_tbl_slots[idx].link != -1)
+            {
+                _tbl_slots[ _tbl_slots[idx].link ].hash = idx;
+            }
+        }
+        else if (_tbl_slots[idx].count == -1)
+        {
+            if (_tbl_slots[idx].link != -1)
+            {
+                _tbl_slots[ _tbl_slots[idx].link ].hash = idx;
+            }
+        }
+
+        // store data
+        if (_put_data(tbl, hash, hash, keyhash, fprint, key, key_size, value, val_size, 1) == false)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// slots a value takes at most, values in the heap take fewer
+static int _slots_needed(size_t val_size)
+{
+    if (val_size <= _Q_HASHARR_VALUESIZE) return 1;
+    return 1 + (val_size - _Q_HASHARR_VALUESIZE + sizeof(union _slot_data) - 1) / sizeof(union _slot_data);
+}
+
+// remove data, caller must be in a write sequence
+static bool _remove(qhasharr_t *tbl, const char *key, size_t key_size)
+{
+    qhasharr_slot_t *_tbl_slots = NULL;
+    qhasharr_init(tbl, &_tbl_slots);
+
+    if (tbl->maxslots == 0)
+    {
+        return false;  
+    }
+
+    // get hash integer
+    uint64_t fprint = 0;
+    uint32_t keyhash = _key_hash(tbl, key, key_size, &fprint);
+    unsigned int hash = keyhash % tbl->maxslots;
+
+    int idx = _get_idx(tbl, key, key_size, hash, keyhash, fprint);
+    if (idx < 0)
+    {
+        errno = ENOENT;
+        return false;
+    }
+
+    return _remove_idx(tbl, idx);
+}
+
+// remove the object starting at slot idx
+static bool _remove_idx(qhasharr_t *tbl, int idx)
+{
     qhasharr_slot_t *_tbl_slots = NULL;
     qhasharr_init(tbl, &_tbl_slots);
 
-    tbl->usedslots = 0;
-    tbl->num = 0;
+    // home slot of the object
+    unsigned int hash = _tbl_slots[idx].hash;
+
+    if (_tbl_slots[idx].count == 1)
+    {
+        // just remove
+        _remove_data(tbl, idx);
+    }
+    else if (_tbl_slots[idx].count > 1)     // leading slot and has dup
+    {
+        // find dup
+        int idx2;
+        for (idx2 = idx + 1; ; idx2++)
+        {
+            if (idx2 >= tbl->maxslots) idx2 = 0;
+            if (idx2 == idx)
+            {
+                errno = EFAULT;
+                return false;
+            }
+            if (_tbl_slots[idx2].count == -1 && _tbl_slots[idx2].hash == hash)
+            {
+                break;
+            }
+        }
+
+        // move to leading slot
+        int backupcount = _tbl_slots[idx].count;
 
-    // clear memory
-    memset((void *)_tbl_slots,
-           '\0',
-           (tbl->maxslots * sizeof(qhasharr_slot_t)));
-}
+        _remove_data(tbl, idx); // remove leading data
 
-#ifndef _DOXYGEN_SKIP
+        _copy_slot(tbl, idx, idx2); // copy slot
+        _remove_slot(tbl, idx2); // remove moved slot
+
+        _tbl_slots[idx].count = backupcount - 1; // adjust collision counter
+        if (_tbl_slots[idx].link != -1)
+        {
+            _tbl_slots[_tbl_slots[idx].link].hash = idx;
+        }
+    }
+    else if (_tbl_slots[idx].count == -1)   // in case of -1. used for collision resolution
+    {
+          // decrease counter from leading slot
+          if (_tbl_slots[ _tbl_slots[idx].hash ].count <= 1)
+          {
+              errno = EFAULT;
+              return false;
+          }
+          _tbl_slots[ _tbl_slots[idx].hash ].count--;
+
+          // remove data
+          _remove_data(tbl, idx);
+    }
+    else 
+    {
+        errno = ENOENT;
+        return false;
+    }
+
+    return true;
+}
 
 // find empty slot : return empty slow number, otherwise returns -1.
 static int _find_empty(qhasharr_t *tbl, int startidx)
@@ -754,10 +1842,13 @@ static int _find_empty(qhasharr_t *tbl, int startidx)
     return -1;
 }
 
-static int _get_idx(qhasharr_t *tbl, const char *key, size_t key_size, unsigned int hash)
+static int _get_idx(qhasharr_t *tbl, const char *key, size_t key_size, unsigned int hash, uint32_t keyhash, uint64_t fprint)
 {
     if (NULL == tbl || NULL == key)
         return -1;
+    if (NULL != _get_ctrl(tbl))
+        return _get_idx_group(tbl, key, key_size, hash, keyhash, fprint);
+
     qhasharr_slot_t *_tbl_slots = NULL;
     qhasharr_init(tbl, &_tbl_slots);
 
@@ -773,30 +1864,9 @@ static int _get_idx(qhasharr_t *tbl, const char *key, size_t key_size, unsigned
                 // same hash
                 count++;
 
-                // first check key length
-                if (key_size == _tbl_slots[idx].data.pair.keylen)
+                if (_same_key(tbl, &_tbl_slots[idx], key, key_size, fprint))
                 {
-                    if (key_size <= _Q_HASHARR_KEYSIZE)
-                    {
-                        // original key is stored
-                        if (!memcmp(key, _tbl_slots[idx].data.pair.key, key_size))
-                        {
-                            return idx;
-                        }
-                    }
-                    else
-                    {
-                        // key is truncated, compare MD5 also.
-                        unsigned char keymd5[16];
-                        qhashmd5(key, key_size, keymd5);
-                        if (!memcmp(key, _tbl_slots[idx].data.pair.key,
-                                    _Q_HASHARR_KEYSIZE) &&
-                                !memcmp(keymd5, _tbl_slots[idx].data.pair.keymd5,
-                                        16))
-                        {
-                            return idx;
-                        }
-                    }
+                    return idx;
                 }
             }
 
@@ -814,6 +1884,272 @@ static int _get_idx(qhasharr_t *tbl, const char *key, size_t key_size, unsigned
     return -1;
 }
 
+// hashes of the key, taken from hkey if it's prepared for the format of tbl.
+// The md5 of a long key is returned if it's prepared, otherwise NULL
+static const unsigned char *_key_hashes(qhasharr_t *tbl, const char *key, size_t key_size,
+        const qhasharr_key_t *hkey, uint32_t *keyhash, uint64_t *fprint)
+{
+    int format = qhasharr_format(tbl);
+    if (NULL == hkey || hkey->format != format)
+    {
+        *keyhash = _key_hash(tbl, key, key_size, fprint);
+        return NULL;
+    }
+
+    *keyhash = hkey->keyhash;
+    *fprint = hkey->fprint;
+    return (QHASHARR_FORMAT_FPRINT != format && key_size > _Q_HASHARR_KEYSIZE) ? hkey->keymd5 : NULL;
+}
+
+// slot keeping the key, the slot it was found at last is checked first
+static int _get_idx_hint(qhasharr_t *tbl, const char *key, size_t key_size, const qhasharr_key_t *hkey,
+        unsigned int hash, uint32_t keyhash, uint64_t fprint, const unsigned char *keymd5)
+{
+    int hint = (NULL == hkey) ? -1 : __atomic_load_n(&hkey->hint, __ATOMIC_RELAXED);
+    if (hint >= 0 && hint < tbl->maxslots)
+    {
+        qhasharr_slot_t *_tbl_slots = NULL;
+        qhasharr_init(tbl, &_tbl_slots);
+        qhasharr_slot_t *slot = &_tbl_slots[hint];
+
+        if (slot->hash == hash && (slot->count > 0 || slot->count == -1))
+        {
+            // a truncated key is compared by the md5 prepared
+            bool same = (NULL != keymd5)
+                ? (key_size == slot->data.pair.keylen
+                        && !memcmp(key, slot->data.pair.key, _Q_HASHARR_KEYSIZE)
+                        && !memcmp(keymd5, slot->data.pair.keymd5, 16))
+                : _same_key(tbl, slot, key, key_size, fprint);
+            if (same) return hint;
+        }
+    }
+
+    return _get_idx(tbl, key, key_size, hash, keyhash, fprint);
+}
+
+// probe the control bytes from the home slot a group at a time
+static int _get_idx_group(qhasharr_t *tbl, const char *key, size_t key_size, unsigned int hash, uint32_t keyhash, uint64_t fprint)
+{
+    qhasharr_slot_t *_tbl_slots = NULL;
+    qhasharr_init(tbl, &_tbl_slots);
+    unsigned char *ctrl = _get_ctrl(tbl);
+    unsigned char tag = _Q_HASHARR_TAG(keyhash);
+    int maxslots = tbl->maxslots;
+
+    unsigned int pos = hash;
+    int probed;
+    for (probed = 0; probed < maxslots; probed += _Q_HASHARR_GROUP)
+    {
+        uint32_t match = _group_match(ctrl + pos, tag);
+        uint32_t empty = _group_match(ctrl + pos, _Q_HASHARR_CTRL_EMPTY);
+
+        // the last group may wrap around to the slots probed already
+        if (maxslots - probed < _Q_HASHARR_GROUP)
+        {
+            uint32_t left = (1u << (maxslots - probed)) - 1;
+            match &= left;
+            empty &= left;
+        }
+
+        // no key is kept after an empty slot
+        if (empty) match &= (empty & (0u - empty)) - 1;
+
+        while (match)
+        {
+            unsigned int idx = pos + __builtin_ctz(match);
+            if (idx >= (unsigned int)maxslots) idx -= maxslots;
+            match &= match - 1;
+
+            if (_tbl_slots[idx].hash == hash
+                    && (_tbl_slots[idx].count > 0 || _tbl_slots[idx].count == -1)
+                    && _same_key(tbl, &_tbl_slots[idx], key, key_size, fprint))
+            {
+                return idx;
+            }
+        }
+
+        if (empty) break;
+
+        pos = (pos + _Q_HASHARR_GROUP) % maxslots;
+    }
+
+    return -1;
+}
+
+// hash of the key, QHASHARR_FORMAT_FPRINT tables take the slot and the tag
+// from the fingerprint so a key is hashed once
+static uint32_t _key_hash(qhasharr_t *tbl, const char *key, size_t key_size, uint64_t *fprint)
+{
+    if (QHASHARR_FORMAT_FPRINT != qhasharr_format(tbl))
+    {
+        *fprint = 0;
+        return qhashmurmur3_32(key, key_size);
+    }
+
+    *fprint = qhashxxh64(key, key_size, 0);
+    return (uint32_t)(*fprint ^ (*fprint >> 32));
+}
+
+static bool _same_key(qhasharr_t *tbl, qhasharr_slot_t *slot, const char *key, size_t key_size, uint64_t fprint)
+{
+    // first check key length
+    if (key_size != slot->data.pair.keylen) return false;
+
+    if (QHASHARR_FORMAT_FPRINT == qhasharr_format(tbl))
+    {
+        struct _Q_HASHARR_KEY_FPRINT keyfp;
+        memcpy(&keyfp, slot->data.pair.keymd5, sizeof(keyfp));
+        if (keyfp.fprint != fprint) return false;
+
+        // the whole key is compared if it's kept in the heap
+        size_t stored = 0;
+        const char *stored_key = _slot_key(tbl, slot, &stored);
+        return !memcmp(key, stored_key, stored);
+    }
+
+    if (key_size <= _Q_HASHARR_KEYSIZE)
+    {
+        // original key is stored
+        return !memcmp(key, slot->data.pair.key, key_size);
+    }
+
+    // key is truncated, compare MD5 also.
+    unsigned char keymd5[16];
+    qhashmd5(key, key_size, keymd5);
+    return !memcmp(key, slot->data.pair.key, _Q_HASHARR_KEYSIZE) &&
+           !memcmp(keymd5, slot->data.pair.keymd5, 16);
+}
+
+// key kept by a slot, it's truncated unless the heap keeps the whole key
+static const char *_slot_key(qhasharr_t *tbl, qhasharr_slot_t *slot, size_t *key_size)
+{
+    size_t keylen = slot->data.pair.keylen;
+
+    if (keylen > _Q_HASHARR_KEYSIZE && QHASHARR_FORMAT_FPRINT == qhasharr_format(tbl))
+    {
+        struct _Q_HASHARR_KEY_FPRINT keyfp;
+        memcpy(&keyfp, slot->data.pair.keymd5, sizeof(keyfp));
+
+        const char *key = (keyfp.offset != 0) ? (const char *)_heap_block(tbl, keyfp.offset, keylen) : NULL;
+        if (key != NULL)
+        {
+            *key_size = keylen;
+            return key;
+        }
+    }
+
+    *key_size = (keylen <= _Q_HASHARR_KEYSIZE) ? keylen : _Q_HASHARR_KEYSIZE;
+    return slot->data.pair.key;
+}
+
+// bit i is set if control byte i of the group equals to ctrl
+static uint32_t _group_match(const unsigned char *group, unsigned char ctrl)
+{
+#ifdef __SSE2__
+    __m128i bytes = _mm_loadu_si128((const __m128i *)group);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8((char)ctrl)));
+#else
+    uint32_t match = 0;
+    int i;
+    for (i = 0; i < _Q_HASHARR_GROUP; i++)
+    {
+        if (group[i] == ctrl) match |= (1u << i);
+    }
+    return match;
+#endif
+}
+
+// control bytes and the mirror of the first group, aligned for the slots
+static size_t _ctrl_size(int maxslots)
+{
+    size_t size = maxslots + _Q_HASHARR_GROUP;
+    return (size + 7) & ~(size_t)7;
+}
+
+static unsigned char *_get_ctrl(qhasharr_t *tbl)
+{
+    if (tbl->maxslots <= 0 || _Q_HASHARR_MAGIC != tbl->magic) return NULL;
+
+    return (unsigned char *)tbl + tbl->ctrloff;
+}
+
+static void _set_ctrl(qhasharr_t *tbl, int idx, unsigned char ctrl)
+{
+    unsigned char *ctrls = _get_ctrl(tbl);
+    if (NULL == ctrls) return;
+
+    ctrls[idx] = ctrl;
+
+    // a group loaded from the tail reads the mirror
+    int mirror;
+    for (mirror = idx; mirror < _Q_HASHARR_GROUP; mirror += tbl->maxslots)
+    {
+        ctrls[tbl->maxslots + mirror] = ctrl;
+    }
+}
+
+// a freed slot is marked deleted while a probe may go across it
+static void _free_ctrl(qhasharr_t *tbl, int idx)
+{
+    unsigned char *ctrls = _get_ctrl(tbl);
+    if (NULL == ctrls) return;
+
+    int next = (idx + 1) % tbl->maxslots;
+    if (ctrls[next] != _Q_HASHARR_CTRL_EMPTY)
+    {
+        _set_ctrl(tbl, idx, _Q_HASHARR_CTRL_DELETED);
+        return;
+    }
+
+    // no probe stops after an empty slot, so deleted ones before are empty too
+    int count;
+    for (count = 0; count < tbl->maxslots; count++)
+    {
+        _set_ctrl(tbl, idx, _Q_HASHARR_CTRL_EMPTY);
+
+        idx = (idx + tbl->maxslots - 1) % tbl->maxslots;
+        if (ctrls[idx] != _Q_HASHARR_CTRL_DELETED) break;
+    }
+}
+
+// slots objects start at, and the position of each slot in them
+static size_t _dir_size(int maxslots)
+{
+    return sizeof(int) * 2 * maxslots;
+}
+
+static int *_get_dir(qhasharr_t *tbl)
+{
+    if (NULL == _get_ctrl(tbl) || tbl->ctrloff < sizeof(qhasharr_t) || 0 == tbl->diroff) return NULL;
+
+    return (int *)((char *)tbl + tbl->diroff);
+}
+
+// an object starts at slot idx
+static void _dir_add(qhasharr_t *tbl, int idx)
+{
+    int *dir = _get_dir(tbl);
+    if (NULL == dir || tbl->dirnum >= tbl->maxslots) return;
+
+    dir[tbl->dirnum] = idx;
+    dir[tbl->maxslots + idx] = tbl->dirnum;
+    tbl->dirnum++;
+}
+
+// no object starts at slot idx any more, the last one takes its position
+static void _dir_del(qhasharr_t *tbl, int idx)
+{
+    int *dir = _get_dir(tbl);
+    if (NULL == dir || tbl->dirnum <= 0) return;
+
+    int pos = dir[tbl->maxslots + idx];
+    if (pos < 0 || pos >= tbl->dirnum || dir[pos] != idx) return;
+
+    int last = dir[--tbl->dirnum];
+    dir[pos] = last;
+    dir[tbl->maxslots + last] = pos;
+}
+
 static void *_get_data(qhasharr_t *tbl, int idx, size_t *size)
 {
     if (idx < 0)
@@ -828,8 +2164,32 @@ static void *_get_data(qhasharr_t *tbl, int idx, size_t *size)
     qhasharr_init(tbl, &_tbl_slots);
     int loop_count = 0;
 
+    // value kept in the heap is read at once
+    if (_Q_HASHARR_SIZE_HEAP == _tbl_slots[idx].size)
+    {
+        const void *heapval = _heap_value(tbl, &_tbl_slots[idx], &valsize);
+        if (NULL == heapval) return NULL;
+
+        void *value = malloc(valsize > 0 ? valsize : 1);
+        if (value == NULL)
+        {
+            errno = ENOMEM;
+            return NULL;
+        }
+        memcpy(value, heapval, valsize);
+
+        if (size != NULL) *size = valsize;
+        return value;
+    }
+
     for (newidx = idx, valsize = 0; newidx != -1 ; newidx = _tbl_slots[newidx].link)
     {
+        // the link may be overwritten by a concurrent writer
+        if (newidx < 0 || newidx >= tbl->maxslots)
+        {
+            errno = EFAULT;
+            return NULL;
+        }
         valsize += _tbl_slots[newidx].size;
         if (_tbl_slots[newidx].link == -1) break;
 
@@ -853,8 +2213,15 @@ static void *_get_data(qhasharr_t *tbl, int idx, size_t *size)
     loop_count = 0;
     for (newidx = idx, vp = value; (size_t)(vp - value) < valsize && newidx != -1; newidx = _tbl_slots[newidx].link)
     {
+        if (newidx < 0 || newidx >= tbl->maxslots)
+        {
+            free(value);
+            errno = EFAULT;
+            return NULL;
+        }
+
         uint8_t vsize = _tbl_slots[newidx].size;
-        if ((size_t)(vp - value + vsize) > valsize)
+        if ((size_t)(vp - value + vsize) > valsize || vsize > sizeof(union _slot_data))
         {
             // if the size is larger than valsize, then the value is wrong, but this may not enough
             free(value);
@@ -892,9 +2259,9 @@ static void *_get_data(qhasharr_t *tbl, int idx, size_t *size)
     return value;
 }
 
-static bool _put_data(qhasharr_t *tbl, int idx, unsigned int hash,
-                      const char *key, size_t key_size, const void *value, size_t val_size,
-                      int count)
+static bool _put_data(qhasharr_t *tbl, int idx, unsigned int hash, uint32_t keyhash,
+                      uint64_t fprint, const char *key, size_t key_size,
+                      const void *value, size_t val_size, int count)
 {
     size_t tmp_size = 0;
     qhasharr_slot_t *_tbl_slots = NULL;
@@ -907,17 +2274,46 @@ static bool _put_data(qhasharr_t *tbl, int idx, unsigned int hash,
         return false;
     }
 
-    unsigned char keymd5[16];
-    qhashmd5(key, key_size, keymd5);
-
     // store key
     _tbl_slots[idx].count = count;
     _tbl_slots[idx].hash = hash;
+    _dir_add(tbl, idx);
     tmp_size = (key_size <= _Q_HASHARR_KEYSIZE) ? key_size : _Q_HASHARR_KEYSIZE;
     memcpy(_tbl_slots[idx].data.pair.key, key, tmp_size);
-    memcpy((char *)_tbl_slots[idx].data.pair.keymd5, (char *)keymd5, 16);
+    if (QHASHARR_FORMAT_FPRINT == qhasharr_format(tbl))
+    {
+        // a truncated key is kept whole in the heap if there is room
+        struct _Q_HASHARR_KEY_FPRINT keyfp = {fprint, 0};
+        if (key_size > _Q_HASHARR_KEYSIZE) keyfp.offset = _heap_alloc(tbl, key_size);
+        if (keyfp.offset != 0)
+            memcpy((char *)_get_heap(tbl) + keyfp.offset + _Q_HASHARR_BLOCK_HDRSIZE, key, key_size);
+        memcpy(_tbl_slots[idx].data.pair.keymd5, &keyfp, sizeof(keyfp));
+    }
+    else
+    {
+        unsigned char keymd5[16];
+        qhashmd5(key, key_size, keymd5);
+        memcpy((char *)_tbl_slots[idx].data.pair.keymd5, (char *)keymd5, 16);
+    }
     _tbl_slots[idx].data.pair.keylen = key_size;
     _tbl_slots[idx].link = -1;
+    _set_ctrl(tbl, idx, _Q_HASHARR_TAG(keyhash));
+
+    // store value larger than a slot in the heap, or in linked slots if it's full
+    uint64_t offset = (val_size > _Q_HASHARR_VALUESIZE) ? _heap_alloc(tbl, val_size) : 0;
+    if (offset != 0)
+    {
+        struct _Q_HASHARR_HEAP_REF ref = {offset, val_size};
+        char *block = (char *)_get_heap(tbl) + offset;
+
+        memcpy(block + _Q_HASHARR_BLOCK_HDRSIZE, value, val_size);
+        memcpy(_tbl_slots[idx].data.pair.value, &ref, sizeof(ref));
+        _tbl_slots[idx].size = _Q_HASHARR_SIZE_HEAP;
+
+        tbl->num++;
+        tbl->usedslots++;
+        return true;
+    }
 
     // store value
     int newidx;
@@ -942,6 +2338,7 @@ static bool _put_data(qhasharr_t *tbl, int idx, unsigned int hash,
             _tbl_slots[tmpidx].hash = newidx;   // prev link
             _tbl_slots[tmpidx].link = -1;       // end block mark
             _tbl_slots[tmpidx].size = 0;
+            _set_ctrl(tbl, tmpidx, _Q_HASHARR_CTRL_EXT);
 
             _tbl_slots[newidx].link = tmpidx;   // link chain
 
@@ -1002,6 +2399,10 @@ static bool _copy_slot(qhasharr_t *tbl, int idx1, int idx2)
     memcpy((void *)(&_tbl_slots[idx1]), (void *)(&_tbl_slots[idx2]),
            sizeof(qhasharr_slot_t));
 
+    unsigned char *ctrl = _get_ctrl(tbl);
+    if (ctrl != NULL) _set_ctrl(tbl, idx1, ctrl[idx2]);
+    if (_tbl_slots[idx1].count != -2) _dir_add(tbl, idx1);
+
     // increase used slot counter
     tbl->usedslots++;
 
@@ -1019,7 +2420,9 @@ static bool _remove_slot(qhasharr_t *tbl, int idx)
         return false;
     }
 
+    if (_tbl_slots[idx].count != -2) _dir_del(tbl, idx);
     _tbl_slots[idx].count = 0;
+    _free_ctrl(tbl, idx);
     // decrease used slot counter
     tbl->usedslots--;
 
@@ -1038,6 +2441,20 @@ static bool _remove_data(qhasharr_t *tbl, int idx)
         return false;
     }
 
+    if (_Q_HASHARR_SIZE_HEAP == _tbl_slots[idx].size)
+    {
+        struct _Q_HASHARR_HEAP_REF ref;
+        memcpy(&ref, _tbl_slots[idx].data.pair.value, sizeof(ref));
+        _heap_free(tbl, ref.offset);
+    }
+    if (_tbl_slots[idx].data.pair.keylen > _Q_HASHARR_KEYSIZE
+            && QHASHARR_FORMAT_FPRINT == qhasharr_format(tbl))
+    {
+        struct _Q_HASHARR_KEY_FPRINT keyfp;
+        memcpy(&keyfp, _tbl_slots[idx].data.pair.keymd5, sizeof(keyfp));
+        if (keyfp.offset != 0) _heap_free(tbl, keyfp.offset);
+    }
+
     while (true)
     {
         int link = _tbl_slots[idx].link;
@@ -1064,4 +2481,166 @@ static bool _remove_data(qhasharr_t *tbl, int idx)
     return true;
 }
 
+// heap region of the given size, with the heap header in front
+static size_t _heap_size(size_t heapsize)
+{
+    if (0 == heapsize) return 0;
+
+    size_t minsize = sizeof(struct _Q_HASHARR_HEAP) + ((size_t)1 << _Q_HASHARR_HEAP_MINORDER);
+    return _Q_HASHARR_ALIGN(heapsize < minsize ? minsize : heapsize);
+}
+
+static struct _Q_HASHARR_HEAP *_get_heap(qhasharr_t *tbl)
+{
+    if (NULL == _get_ctrl(tbl) || tbl->ctrloff < offsetof(qhasharr_t, diroff) || 0 == tbl->heapoff) return NULL;
+
+    return (struct _Q_HASHARR_HEAP *)((char *)tbl + tbl->heapoff);
+}
+
+// make all blocks free, the largest aligned blocks are carved from the heap
+static void _heap_reset(qhasharr_t *tbl)
+{
+    struct _Q_HASHARR_HEAP *heap = _get_heap(tbl);
+    if (NULL == heap) return;
+
+    memset(heap, 0, sizeof(struct _Q_HASHARR_HEAP));
+    heap->base = _Q_HASHARR_ALIGN(sizeof(struct _Q_HASHARR_HEAP));
+    heap->size = tbl->heapsize;
+
+    uint64_t pos = 0, size = heap->size - heap->base;
+    while (size - pos >= ((uint64_t)1 << _Q_HASHARR_HEAP_MINORDER))
+    {
+        uint32_t order = _Q_HASHARR_HEAP_ORDERS - 1;
+        while (order > 0 && ((pos & ((((uint64_t)1 << _Q_HASHARR_HEAP_MINORDER) << order) - 1)) != 0
+                    || pos + (((uint64_t)1 << _Q_HASHARR_HEAP_MINORDER) << order) > size))
+        {
+            order--;
+        }
+        _heap_push(heap, heap->base + pos, order);
+        pos += ((uint64_t)1 << _Q_HASHARR_HEAP_MINORDER) << order;
+    }
+}
+
+// allocate a block for value of size, returns offset of the block from the heap, or 0
+static uint64_t _heap_alloc(qhasharr_t *tbl, size_t size)
+{
+    struct _Q_HASHARR_HEAP *heap = _get_heap(tbl);
+    if (NULL == heap) return 0;
+
+    uint32_t order = 0;
+    while (order < _Q_HASHARR_HEAP_ORDERS
+            && (((uint64_t)1 << _Q_HASHARR_HEAP_MINORDER) << order) < size + _Q_HASHARR_BLOCK_HDRSIZE)
+    {
+        order++;
+    }
+
+    uint32_t found = order;
+    while (found < _Q_HASHARR_HEAP_ORDERS && 0 == heap->freelist[found]) found++;
+    if (found >= _Q_HASHARR_HEAP_ORDERS) return 0;
+
+    uint64_t offset = heap->freelist[found] - 1;
+    _heap_unlink(heap, offset);
+
+    // split it, the upper halves are free
+    while (found > order)
+    {
+        found--;
+        _heap_push(heap, offset + (((uint64_t)1 << _Q_HASHARR_HEAP_MINORDER) << found), found);
+    }
+
+    struct _Q_HASHARR_BLOCK *block = (struct _Q_HASHARR_BLOCK *)((char *)heap + offset);
+    block->state = _Q_HASHARR_BLOCK_USED;
+    block->order = order;
+    block->size = size;
+
+    heap->used += ((uint64_t)1 << _Q_HASHARR_HEAP_MINORDER) << order;
+    heap->values++;
+    return offset;
+}
+
+// free a block and merge it with its free buddies
+static void _heap_free(qhasharr_t *tbl, uint64_t offset)
+{
+    struct _Q_HASHARR_HEAP *heap = _get_heap(tbl);
+    if (NULL == heap) return;
+
+    struct _Q_HASHARR_BLOCK *block = (struct _Q_HASHARR_BLOCK *)((char *)heap + offset);
+    if (_Q_HASHARR_BLOCK_USED != block->state) return;
+
+    uint32_t order = block->order;
+    heap->used -= ((uint64_t)1 << _Q_HASHARR_HEAP_MINORDER) << order;
+    heap->values--;
+
+    while (order + 1 < _Q_HASHARR_HEAP_ORDERS)
+    {
+        uint64_t blocksize = ((uint64_t)1 << _Q_HASHARR_HEAP_MINORDER) << order;
+        uint64_t buddy = heap->base + ((offset - heap->base) ^ blocksize);
+        if (buddy + blocksize > heap->size) break;
+
+        struct _Q_HASHARR_BLOCK *bblock = (struct _Q_HASHARR_BLOCK *)((char *)heap + buddy);
+        if (_Q_HASHARR_BLOCK_FREE != bblock->state || bblock->order != order) break;
+
+        _heap_unlink(heap, buddy);
+        if (buddy < offset) offset = buddy;
+        order++;
+    }
+
+    _heap_push(heap, offset, order);
+}
+
+static void _heap_push(struct _Q_HASHARR_HEAP *heap, uint64_t offset, uint32_t order)
+{
+    struct _Q_HASHARR_BLOCK *block = (struct _Q_HASHARR_BLOCK *)((char *)heap + offset);
+    block->state = _Q_HASHARR_BLOCK_FREE;
+    block->order = order;
+    block->size = 0;
+    block->prev = 0;
+    block->next = heap->freelist[order];
+    if (block->next != 0)
+    {
+        ((struct _Q_HASHARR_BLOCK *)((char *)heap + block->next - 1))->prev = offset + 1;
+    }
+    heap->freelist[order] = offset + 1;
+}
+
+static void _heap_unlink(struct _Q_HASHARR_HEAP *heap, uint64_t offset)
+{
+    struct _Q_HASHARR_BLOCK *block = (struct _Q_HASHARR_BLOCK *)((char *)heap + offset);
+    if (block->prev != 0)
+        ((struct _Q_HASHARR_BLOCK *)((char *)heap + block->prev - 1))->next = block->next;
+    else
+        heap->freelist[block->order] = block->next;
+    if (block->next != 0)
+        ((struct _Q_HASHARR_BLOCK *)((char *)heap + block->next - 1))->prev = block->prev;
+
+    block->state = _Q_HASHARR_BLOCK_USED;
+}
+
+// value of a slot kept in the heap, checked against the bounds of the heap
+static const void *_heap_value(qhasharr_t *tbl, qhasharr_slot_t *slot, size_t *size)
+{
+    struct _Q_HASHARR_HEAP_REF ref;
+    memcpy(&ref, slot->data.pair.value, sizeof(ref));
+
+    const void *value = _heap_block(tbl, ref.offset, ref.size);
+    if (value != NULL && size != NULL) *size = ref.size;
+    return value;
+}
+
+// data of size in the block at offset, checked against the bounds of the heap
+static const void *_heap_block(qhasharr_t *tbl, uint64_t offset, size_t size)
+{
+    struct _Q_HASHARR_HEAP *heap = _get_heap(tbl);
+
+    if (NULL == heap || offset < heap->base
+            || offset + _Q_HASHARR_BLOCK_HDRSIZE > tbl->heapsize
+            || size > tbl->heapsize - offset - _Q_HASHARR_BLOCK_HDRSIZE)
+    {
+        errno = EFAULT;
+        return NULL;
+    }
+
+    return (char *)heap + offset + _Q_HASHARR_BLOCK_HDRSIZE;
+}
+
 #endif /* _DOXYGEN_SKIP */
@@ -137,26 +137,58 @@ struct qhnobj_s
 #define _Q_HASHARR_KEYSIZE (32)    /*!< knob for maximum key size. */
 #define _Q_HASHARR_VALUESIZE (96)  /*!< knob for maximum data size in a slot. */
 
+/* table layouts */
+#define QHASHARR_FORMAT_LINEAR (0) /*!< slots are probed one by one */
+#define QHASHARR_FORMAT_GROUP (1)  /*!< control bytes are probed a group at a time */
+#define QHASHARR_FORMAT_FPRINT (2) /*!< group layout, keys are matched by a 64-bit fingerprint */
+
 /* types */
 typedef struct qhasharr_s qhasharr_t;
 typedef struct qhasharr_slot_s qhasharr_slot_t;
+typedef struct qhasharr_heap_stat_s qhasharr_heap_stat_t;
+typedef struct qhasharr_key_stat_s qhasharr_key_stat_t;
+typedef struct qhasharr_op_s qhasharr_op_t;
+typedef struct qhasharr_key_s qhasharr_key_t;
 
 /* public functions */
 extern qhasharr_t *qhasharr(void *memory, size_t memsize);
+extern qhasharr_t *qhasharr_fmt(void *memory, size_t memsize, int format);
 extern size_t qhasharr_calculate_memsize(int max);
+extern size_t qhasharr_calculate_memsize_fmt(int max, int format);
+extern int qhasharr_format(qhasharr_t *tbl);
+extern size_t qhasharr_calculate_memsize_heap(int max, int format, size_t heapsize);
+extern qhasharr_t *qhasharr_fmt_heap(void *memory, size_t memsize, int format, size_t heapsize);
+extern bool qhasharr_heap_stat(qhasharr_t *tbl, qhasharr_heap_stat_t *stat);
 extern int qhasharr_init(qhasharr_t *tbl, qhasharr_slot_t **_tbl_slots);
 
 /* capsulated member functions */
 extern bool qhasharr_put(qhasharr_t *tbl, const char *key, size_t key_size, const void *value, size_t val_size);
+extern bool qhasharr_put_batch(qhasharr_t *tbl, const qhasharr_op_t *ops, int nops);
 extern bool qhasharr_putstr(qhasharr_t *tbl, const char *key, const char *str);
 extern bool qhasharr_putint(qhasharr_t *tbl, const char *key, int64_t num);
 extern bool qhasharr_exist(qhasharr_t *tbl, const char *key, size_t key_size);
 extern void *qhasharr_get(qhasharr_t *tbl, const char *key, size_t key_size, size_t *val_size);
+extern void *qhasharr_get_idx(qhasharr_t *tbl, const char *key, size_t key_size, size_t *val_size, int *idx);
+extern const void *qhasharr_get_ref(qhasharr_t *tbl, const char *key, size_t key_size, size_t *val_size, uint32_t *seq);
+extern const void *qhasharr_get_ref_idx(qhasharr_t *tbl, const char *key, size_t key_size, size_t *val_size, uint32_t *seq, int *idx);
+extern bool qhasharr_prepare(qhasharr_t *tbl, const char *key, size_t key_size, qhasharr_key_t *hkey);
+extern void qhasharr_prefetch(qhasharr_t *tbl, const qhasharr_key_t *hkey);
+extern void *qhasharr_get_key(qhasharr_t *tbl, const char *key, size_t key_size, qhasharr_key_t *hkey, size_t *val_size, int *idx);
+extern const void *qhasharr_get_ref_key(qhasharr_t *tbl, const char *key, size_t key_size, qhasharr_key_t *hkey, size_t *val_size, uint32_t *seq, int *idx);
 extern char *qhasharr_getstr(qhasharr_t *tbl, const char *key);
 extern int64_t qhasharr_getint(qhasharr_t *tbl, const char *key);
 extern bool qhasharr_getnext(qhasharr_t *tbl, qnobj_t *obj, int *idx);
+extern bool qhasharr_getnext_stat(qhasharr_t *tbl, qhasharr_key_stat_t *stat, int *idx);
+extern uint32_t qhasharr_read_begin(qhasharr_t *tbl);
+extern bool qhasharr_read_retry(qhasharr_t *tbl, uint32_t seq);
+extern bool qhasharr_write_interrupted(qhasharr_t *tbl);
+extern bool qhasharr_check_layout(qhasharr_t *tbl, size_t memsize);
+extern void qhasharr_copy(qhasharr_t *dst, qhasharr_t *src, size_t memsize);
+extern void qhasharr_seq_follow(qhasharr_t *tbl, qhasharr_t *prev);
 
 extern bool qhasharr_remove(qhasharr_t *tbl, const char *key, size_t key_size);
+extern bool qhasharr_evict(qhasharr_t *tbl, volatile unsigned char *refs, int *hand,
+        bool (*pinned)(const char *key, size_t key_size, const void *value, size_t val_size));
 
 extern int  qhasharr_size(qhasharr_t *tbl, int *maxslots, int *usedslots);
 extern void qhasharr_clear(qhasharr_t *tbl);
@@ -195,6 +227,57 @@ struct qhasharr_slot_s
     union _slot_data data;
 };
 
+/**
+ * qhasharr value heap occupancy
+ */
+struct qhasharr_heap_stat_s
+{
+    size_t size;        /*!< bytes managed by the heap */
+    size_t used;        /*!< bytes of allocated blocks */
+    size_t values;      /*!< number of values and keys kept in the heap */
+    size_t freeblocks;  /*!< number of free blocks */
+    size_t maxfree;     /*!< size of the largest free block */
+};
+
+/**
+ * qhasharr placement of a key
+ */
+struct qhasharr_key_stat_s
+{
+    int idx;            /*!< slot keeping the key */
+    int home;           /*!< slot the key hashes to */
+    int distance;       /*!< slots between the home slot and the key */
+    int collisions;     /*!< keys hashing to the home slot */
+    int extslots;       /*!< extension blocks linked from the key */
+    bool inheap;        /*!< value kept in the value heap */
+    char keytype;       /*!< first byte of the key */
+    size_t keylen;      /*!< original key length */
+    size_t valsize;     /*!< value size */
+};
+
+/**
+ * qhasharr write of a batch
+ */
+struct qhasharr_op_s
+{
+    const char *key;
+    size_t key_size;
+    const void *value;  /*!< NULL to remove the key */
+    size_t val_size;
+};
+
+/**
+ * qhasharr key prepared for getting it repeatedly
+ */
+struct qhasharr_key_s
+{
+    int format;                 /*!< format of the table the hashes are for */
+    uint32_t keyhash;           /*!< hash of the key */
+    uint64_t fprint;            /*!< fingerprint of the key, QHASHARR_FORMAT_FPRINT only */
+    unsigned char keymd5[16];   /*!< md5 of a key longer than _Q_HASHARR_KEYSIZE */
+    int hint;                   /*!< slot the key was found at last, -1 if none */
+};
+
 /**
  * qhasharr container
  */
@@ -204,6 +287,17 @@ struct qhasharr_s
     int maxslots;       /*!< number of maximum slots */
     int usedslots;      /*!< number of used slots */
     int num;            /*!< number of stored keys */
+
+    /* QHASHARR_FORMAT_LINEAR tables keep slot 0 from here, as ever */
+    uint32_t magic;     /*!< _Q_HASHARR_MAGIC if the fields below are kept */
+    uint32_t format;    /*!< table layout */
+    uint32_t seq;       /*!< write sequence, odd while a writer is in progress */
+    uint32_t ctrloff;   /*!< offset of control bytes from the table */
+    uint32_t slotoff;   /*!< offset of slots from the table */
+    uint64_t heapoff;   /*!< offset of value heap from the table, 0 if no heap */
+    uint64_t heapsize;  /*!< size of value heap */
+    uint32_t diroff;    /*!< offset of the directory of objects from the table, 0 if none */
+    int dirnum;         /*!< number of objects in the directory */
     char slots[];       /*!< data area pointer */
 };
 
@@ -214,6 +308,7 @@ struct qhasharr_s
 /* qhash.c */
 extern bool qhashmd5(const void *data, size_t nbytes, void *retbuf);
 extern uint32_t qhashmurmur3_32(const void *data, size_t nbytes);
+extern uint64_t qhashxxh64(const void *data, size_t nbytes, uint64_t seed);
 
 /**
  * translate the binary of md5 into the string of md5
@@ -52,6 +52,17 @@ int init_qconf_batch_nodes(qconf_batch_nodes *bnodes);
  */
 int destroy_qconf_batch_nodes(qconf_batch_nodes *bnodes);
 
+/**
+ * Destroy the array got by qconf_get_batch_conf_packed with the buffer
+ * allocated, all nodes are freed at once
+ *
+ * @param bnodes: the array for keeping batch nodes
+ *
+ * @return QCONF_Ok: if success
+ *         QCONF_ERR_PARAM: if nodes is null
+ */
+int destroy_packed_qconf_batch_nodes(qconf_batch_nodes *bnodes);
+
 #ifdef __cplusplus
 }
 #endif
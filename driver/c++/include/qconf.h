@@ -28,6 +28,95 @@ typedef struct
 } string_vector_t;
 #endif
 
+/**
+ * The view of one conf, it points into the share memory if possible
+ */
+typedef struct qconf_conf_view
+{
+    const char *data;       // the value, not terminated by '\0'
+    size_t len;             // the length of value
+    unsigned int version;   // private, version of share memory when data was got
+    char *buf;              // private, copy of value if it can't be pointed to
+    size_t buf_len;         // private, the capacity of buf
+} qconf_conf_view;
+
+/**
+ * The view of the services of one path, it points into the share memory if possible
+ */
+typedef struct qconf_hosts_view
+{
+    int count;              // the count of services
+    const char *data;       // private, the kept services
+    size_t len;             // private, the length of data
+    unsigned int version;   // private, version of share memory when data was got
+    char *buf;              // private, copy of data if it can't be pointed to
+    size_t buf_len;         // private, the capacity of buf
+} qconf_hosts_view;
+
+/**
+ * A path prepared for getting its conf or services repeatedly, see qconf_prepare
+ */
+#define QCONF_KEY_CONF          0       // the conf of path
+#define QCONF_KEY_ALLHOST       1       // the services of path
+
+typedef struct qconf_key_s qconf_key_t;
+
+/**
+ * The version of a conf or the services of one path
+ */
+typedef struct qconf_data_version
+{
+    long long mzxid;            // zxid of the last change of the node, 0 if unknown
+    long long pzxid;            // zxid of the last change of the children, 0 if unknown
+    unsigned int counter;       // times the value changed in share memory, 0 if unknown
+    unsigned char digest[8];    // digest of the value, the value is the same if it's the same
+} qconf_data_version;
+
+/**
+ * A write of the agent read from the change journal of share memory
+ */
+#define QCONF_CHANGE_SET        's'     // the value of the key is set
+#define QCONF_CHANGE_REMOVE     'r'     // the key is removed
+#define QCONF_CHANGE_CLEAR      'c'     // every key is removed, hash is 0
+
+typedef struct qconf_change
+{
+    unsigned long long seq;     // position of the write in the journal
+    unsigned int hash;          // hash of the key, see qconf_get_conf_hash
+    char type;                  // QCONF_CHANGE_SET, QCONF_CHANGE_REMOVE or QCONF_CHANGE_CLEAR
+} qconf_change;
+
+/**
+ * Counters of the cache of values in the process, see qconf_enable_cache
+ */
+typedef struct qconf_cache_stats
+{
+    unsigned long long hits;        // gets served by the cache
+    unsigned long long misses;      // gets gone to share memory
+    unsigned long long stales;      // values cached found changed in share memory
+    unsigned long long evictions;   // values dropped for the bound of memory
+    unsigned long long entries;     // values cached
+    unsigned long long bytes;       // memory of the values cached
+} qconf_cache_stats;
+
+/**
+ * The context of asynchronous gets, and a get completed, see qconf_async_get
+ */
+typedef struct qconf_async_s qconf_async_t;
+
+typedef struct qconf_async_result
+{
+    int ret;                    // QCONF_OK if got, QCONF_ERR_NOT_FOUND if it's not on zookeeper,
+                                // QCONF_ERR_SHM_TIMEOUT if the deadline passed, others if failed
+    int type;                   // QCONF_KEY_CONF or QCONF_KEY_ALLHOST
+    const char *value;          // the conf of QCONF_KEY_CONF, terminated by '\0'
+    size_t len;                 // the length of value
+    string_vector_t nodes;      // the services of QCONF_KEY_ALLHOST
+    void *data;                 // the data passed to qconf_async_get
+} qconf_async_result;
+
+typedef void (*qconf_async_cb)(const qconf_async_result *result);
+
 /**
  * Init qconf environment
  * @Note: the function should be called before using qconf
@@ -143,6 +232,28 @@ int qconf_get_allhost(const char *path, string_vector_t *nodes, const char *idc)
 int qconf_get_host(const char *path, char *buf, unsigned int buf_len, const char *idc);
 
 
+/**
+ * Synchronize get the values of several keys, those kept in one share memory
+ * table (the default one or a namespace) as of one moment. So the values
+ * published together by a gray release are got all or none only if all of
+ * its paths are kept in the same table
+ * @Note: only share memory of shared_memory_format 1 or 2 keeps the moment
+ *        of writes, the values are got one by one from the one of format 0
+ *
+ * @param paths: the keys of the values
+ * @param count: the number of paths
+ * @param bufs: the buffers for keeping the values, one for each path
+ * @param buf_lens: the lengths of bufs
+ * @param rets: the result of each path, same as qconf_get_conf
+ * @param idc: the place to get values;
+ *             NULL is default value
+ *
+ * @return QCONF_OK: if every value is got
+ *         QCONF_ERR_PARAM: if any of paths or bufs is null
+ *         other failed, the first failure in rets
+ */
+int qconf_get_confs(const char **paths, int count, char **bufs, const unsigned int *buf_lens, int *rets, const char *idc);
+
 /**
  * Asynchronize get the value of key which is path
  *
@@ -243,6 +354,470 @@ int qconf_get_batch_keys_native(const char *path, string_vector_t *nodes, const
  */
 int qconf_aget_batch_keys_native(const char *path, string_vector_t *nodes, const char *idc);
 
+/**
+ * Init the view for keeping conf
+ * @Note: the function should be called before calling qconf_get_conf_view
+ *
+ * @param view: the view for keeping conf
+ *
+ * @return QCONF_Ok: if success
+ *         QCONF_ERR_PARAM: if view is null
+ */
+int init_qconf_conf_view(qconf_conf_view *view);
+
+/**
+ * Destroy the view for keeping conf
+ * @Note: the function should be called after the last use of the view
+ *
+ * @param view: the view for keeping conf
+ *
+ * @return QCONF_Ok: if success
+ *         QCONF_ERR_PARAM: if view is null
+ */
+int destroy_qconf_conf_view(qconf_conf_view *view);
+
+/**
+ * Synchronize get the value of key which is path without copying it
+ * @Note: view->data points into the share memory, which may be changed by agent at
+ *        any time, call qconf_check_conf_view after using the value, and get
+ *        it again if the check failed
+ *
+ * @param path: the key of the value
+ * @param view: the view for keeping the value
+ * @param idc: the place to get value;
+ *             NULL is default value
+ *
+ * @return QCONF_OK: if success
+ *         QCONF_ERR_NOT_FOUND: if the key not exists
+ *         QCONF_ERR_OTHER: other failed
+ */
+int qconf_get_conf_view(const char *path, qconf_conf_view *view, const char *idc);
+
+/**
+ * Asynchronize get the value of key which is path without copying it
+ *
+ * @param path: the key of the value
+ * @param view: the view for keeping the value
+ * @param idc: the place to get value;
+ *             NULL is default value
+ *
+ * @return QCONF_OK: if success
+ *         QCONF_ERR_NOT_FOUND: if the key not exists
+ *         QCONF_ERR_OTHER: other failed
+ */
+int qconf_aget_conf_view(const char *path, qconf_conf_view *view, const char *idc);
+
+/**
+ * Check whether the value of view is still the one got before
+ *
+ * @param view: the view got by qconf_get_conf_view
+ *
+ * @return QCONF_OK: if the value is still valid
+ *         QCONF_ERR_SHM_CHANGED: if the share memory changed, get the value again
+ *         QCONF_ERR_PARAM: if view is null or keeps no value
+ */
+int qconf_check_conf_view(const qconf_conf_view *view);
+
+/**
+ * Init the view for keeping services
+ * @Note: the function should be called before calling qconf_get_allhost_view
+ *
+ * @param view: the view for keeping services
+ *
+ * @return QCONF_Ok: if success
+ *         QCONF_ERR_PARAM: if view is null
+ */
+int init_qconf_hosts_view(qconf_hosts_view *view);
+
+/**
+ * Destroy the view for keeping services
+ * @Note: the function should be called after the last use of the view
+ *
+ * @param view: the view for keeping services
+ *
+ * @return QCONF_Ok: if success
+ *         QCONF_ERR_PARAM: if view is null
+ */
+int destroy_qconf_hosts_view(qconf_hosts_view *view);
+
+/**
+ * Synchronize get all available services of path without copying them
+ * @Note: the services may point into the share memory, which may be changed by
+ *        agent at any time, call qconf_check_hosts_view after using them, and
+ *        get them again if the check failed
+ *
+ * @param path: the key of the services
+ * @param view: the view for keeping the services
+ * @param idc: the place to get services;
+ *             NULL is default value
+ *
+ * @return QCONF_OK: if success
+ *         QCONF_ERR_NOT_FOUND: if the key not exists
+ *         QCONF_ERR_OTHER: other failed
+ */
+int qconf_get_allhost_view(const char *path, qconf_hosts_view *view, const char *idc);
+
+/**
+ * Asynchronize get all available services of path without copying them
+ *
+ * @param path: the key of the services
+ * @param view: the view for keeping the services
+ * @param idc: the place to get services;
+ *             NULL is default value
+ *
+ * @return QCONF_OK: if success
+ *         QCONF_ERR_NOT_FOUND: if the key not exists
+ *         QCONF_ERR_OTHER: other failed
+ */
+int qconf_aget_allhost_view(const char *path, qconf_hosts_view *view, const char *idc);
+
+/**
+ * Reference service i of view, in 0 to view->count - 1
+ *
+ * @param view: the view got by qconf_get_allhost_view
+ * @param i: the index of the service
+ * @param host: point to the service, not terminated by '\0'
+ * @param len: the length of the service
+ *
+ * @return QCONF_OK: if success
+ *         QCONF_ERR_PARAM: if view keeps no services or i is out of range
+ *         QCONF_ERR_OTHER: other failed
+ */
+int qconf_hosts_view_at(const qconf_hosts_view *view, int i, const char **host, size_t *len);
+
+/**
+ * Check whether the services of view are still the ones got before
+ *
+ * @param view: the view got by qconf_get_allhost_view
+ *
+ * @return QCONF_OK: if the services are still valid
+ *         QCONF_ERR_SHM_CHANGED: if the share memory changed, get them again
+ *         QCONF_ERR_PARAM: if view is null or keeps no services
+ */
+int qconf_check_hosts_view(const qconf_hosts_view *view);
+
+/**
+ * Get the version of the conf of path without copying the conf
+ *
+ * @param path: the key of the conf
+ * @param version: the version of the conf
+ * @param idc: the place to get conf;
+ *             NULL is default value
+ *
+ * @return QCONF_OK: if success
+ *         QCONF_ERR_NOT_FOUND: if the key not exists
+ *         QCONF_ERR_OTHER: other failed
+ */
+int qconf_get_conf_version(const char *path, qconf_data_version *version, const char *idc);
+
+/**
+ * Get the version of the services of path without copying the services
+ *
+ * @param path: the key of the services
+ * @param version: the version of the services
+ * @param idc: the place to get services;
+ *             NULL is default value
+ *
+ * @return QCONF_OK: if success
+ *         QCONF_ERR_NOT_FOUND: if the key not exists
+ *         QCONF_ERR_OTHER: other failed
+ */
+int qconf_get_allhost_version(const char *path, qconf_data_version *version, const char *idc);
+
+/**
+ * Synchronize get the conf of path only if it's changed since known
+ *
+ * @param path: the key of the conf
+ * @param known: the version got before, NULL to get the conf anyway
+ * @param buf: the buffer for keeping the conf
+ * @param buf_len: the length of buf
+ * @param version: the version of the conf got, or of known if it's not changed
+ * @param idc: the place to get conf;
+ *             NULL is default value
+ *
+ * @return QCONF_OK: if the conf is changed and kept in buf
+ *         QCONF_ERR_SAME_VALUE: if the conf is not changed, buf is not touched
+ *         QCONF_ERR_NOT_FOUND: if the key not exists
+ *         QCONF_ERR_OTHER: other failed
+ */
+int qconf_get_conf_if_changed(const char *path, const qconf_data_version *known, char *buf, unsigned int buf_len, qconf_data_version *version, const char *idc);
+
+/**
+ * Synchronize get all services of path only if they're changed since known
+ *
+ * @param path: the key of the services
+ * @param known: the version got before, NULL to get the services anyway
+ * @param nodes: the array for keeping all the services
+ * @param version: the version of the services got, or of known if they're not changed
+ * @param idc: the place to get services;
+ *             NULL is default value
+ *
+ * @return QCONF_OK: if the services are changed and kept in nodes
+ *         QCONF_ERR_SAME_VALUE: if the services are not changed, nodes is not touched
+ *         QCONF_ERR_NOT_FOUND: if the key not exists
+ *         QCONF_ERR_OTHER: other failed
+ */
+int qconf_get_allhost_if_changed(const char *path, const qconf_data_version *known, string_vector_t *nodes, qconf_data_version *version, const char *idc);
+
+/**
+ * Block until the conf of path changes from known, the agent wakes the
+ * caller up once it writes the conf, there is no polling
+ *
+ * @param path: the key of the conf
+ * @param known: the version got before, NULL to wait until the conf exists
+ * @param timeout_ms: how long to wait at most in milliseconds
+ * @param version: the version of the conf changed
+ * @param idc: the place to get conf;
+ *             NULL is default value
+ *
+ * @return QCONF_OK: if the conf is changed, get it with qconf_get_conf then
+ *         QCONF_ERR_SAME_VALUE: if the conf is not changed till timeout
+ *         QCONF_ERR_NOT_FOUND: if the key not exists till timeout
+ *         QCONF_ERR_OTHER: other failed
+ */
+int qconf_wait_change(const char *path, const qconf_data_version *known, int timeout_ms, qconf_data_version *version, const char *idc);
+
+/**
+ * Block until the services of path change from known
+ *
+ * @return: same as qconf_wait_change
+ */
+int qconf_wait_allhost_change(const char *path, const qconf_data_version *known, int timeout_ms, qconf_data_version *version, const char *idc);
+
+/**
+ * Get the cursor of the newest change of share memory, the changes after it
+ * are got by qconf_get_changes
+ *
+ * @param cursor: the cursor got
+ *
+ * @return QCONF_OK: if success
+ *         QCONF_ERR_OTHER: if the agent keeps no change journal
+ */
+int qconf_get_changes_cursor(unsigned long long *cursor);
+
+/**
+ * Get the changes of share memory after cursor, caches drop exactly the
+ * keys changed instead of getting everything again
+ *
+ * @param cursor: the cursor got before, it's moved past the changes got
+ * @param changes: the array for keeping the changes
+ * @param count: the size of changes, set to the number of changes got
+ *
+ * @return QCONF_OK: if success, there is no more change if count is not full
+ *         QCONF_ERR_SHM_OVERRUN: if changes after cursor are lost, drop
+ *                                everything cached, cursor is the newest then
+ *         QCONF_ERR_OTHER: other failed
+ */
+int qconf_get_changes(unsigned long long *cursor, qconf_change *changes, int *count);
+
+/**
+ * Get the hash of the conf, services or batch keys of path in the changes
+ *
+ * @param path: the key
+ * @param idc: the place to get them;
+ *             NULL is default value
+ * @param hash: the hash got
+ *
+ * @return QCONF_OK: if success
+ *         QCONF_ERR_OTHER: other failed
+ */
+int qconf_get_conf_hash(const char *path, const char *idc, unsigned int *hash);
+int qconf_get_allhost_hash(const char *path, const char *idc, unsigned int *hash);
+int qconf_get_batch_keys_hash(const char *path, const char *idc, unsigned int *hash);
+
+/**
+ * Get the paths cached in share memory which are path or under it, paths
+ * not got by any client yet are not cached
+ * @Note: the paths kept in nodes should be freed by destroy_string_vector
+ *
+ * @param path: the prefix of the paths, "/a" takes "/a/b" but not "/ab"
+ * @param nodes: the array for keeping the paths, sorted
+ * @param idc: the place to get paths;
+ *             NULL is default value
+ *
+ * @return QCONF_OK: if success
+ *         QCONF_ERR_SHM_INDEX_FULL: if some paths cached are not got since
+ *                                   the index of the agent is full
+ *         QCONF_ERR_OTHER: other failed
+ */
+int qconf_get_cached_paths(const char *path, string_vector_t *nodes, const char *idc);
+
+/**
+ * Prepare path for getting it repeatedly. The path is normalized, the key of
+ * it in share memory is built and hashed once, and the place the key is found
+ * at is remembered, so getting it again costs one probe while it stays there
+ * @Note: the local idc is looked up once here when idc is NULL, the key may be
+ *        used by several threads at once, it should be freed by destroy_qconf_key
+ *
+ * @param path: the key of the conf or services
+ * @param idc: the place to get them;
+ *             NULL is default value
+ * @param type: QCONF_KEY_CONF or QCONF_KEY_ALLHOST
+ * @param key: the key prepared
+ *
+ * @return QCONF_OK: if success
+ *         QCONF_ERR_PARAM: if path or key is null or type is unknown
+ *         QCONF_ERR_OTHER: other failed
+ */
+int qconf_prepare(const char *path, const char *idc, int type, qconf_key_t **key);
+
+/**
+ * Free the key prepared by qconf_prepare
+ *
+ * @return QCONF_OK: if success
+ *         QCONF_ERR_PARAM: if key is null
+ */
+int destroy_qconf_key(qconf_key_t *key);
+
+/**
+ * Synchronize get the conf of a key prepared with QCONF_KEY_CONF
+ *
+ * @param key: the key prepared
+ * @param buf: the buffer for keeping the conf
+ * @param buf_len: the length of buf
+ *
+ * @return: same as qconf_get_conf, QCONF_ERR_PARAM if key is not of QCONF_KEY_CONF
+ */
+int qconf_get_prepared(qconf_key_t *key, char *buf, unsigned int buf_len);
+
+/**
+ * Synchronize get the conf of a key prepared with QCONF_KEY_CONF without
+ * copying it, see qconf_get_conf_view
+ *
+ * @return: same as qconf_get_conf_view, QCONF_ERR_PARAM if key is not of QCONF_KEY_CONF
+ */
+int qconf_get_prepared_view(qconf_key_t *key, qconf_conf_view *view);
+
+/**
+ * Synchronize get all services of a key prepared with QCONF_KEY_ALLHOST
+ *
+ * @param key: the key prepared
+ * @param nodes: the array for keeping all the services
+ *
+ * @return: same as qconf_get_allhost, QCONF_ERR_PARAM if key is not of QCONF_KEY_ALLHOST
+ */
+int qconf_get_prepared_allhost(qconf_key_t *key, string_vector_t *nodes);
+
+/**
+ * Cache the values got in the process, a value is served again while the
+ * agent has not written its key since. Each thread keeps a few values of its
+ * own in front of the ones shared by all threads
+ * @Note: it's disabled by default, the agent should be of this version
+ *
+ * @param max_bytes: the bound of memory of the values shared, 0 disables
+ *                   the cache and drops the values cached
+ *
+ * @return QCONF_OK: if success
+ */
+int qconf_enable_cache(size_t max_bytes);
+
+/**
+ * Get the counters of the cache, summed over the threads
+ *
+ * @return QCONF_OK: if success
+ *         QCONF_ERR_PARAM: if stats is null
+ */
+int qconf_get_cache_stats(qconf_cache_stats *stats);
+
+/**
+ * Synchronize get all services, the keys of children nodes or the children
+ * nodes packed into one buffer, instead of allocating each of them
+ * @Note: when buf is NULL one buffer is allocated for the result, it should be
+ *        freed by destroy_packed_string_vector or destroy_packed_qconf_batch_nodes
+ *        at once; otherwise the result is packed into buf and it's freed along
+ *        with buf. nodes or bnodes is overwritten, not destroyed
+ *
+ * @param path: the key of the services or batch conf
+ * @param nodes: the array for keeping the services or keys
+ * @param bnodes: the array for keeping the children nodes
+ * @param buf: the buffer to pack into, NULL to allocate one
+ * @param buf_len: the capacity of buf, and the bytes used once packed;
+ *                 it may be NULL when buf is NULL
+ * @param idc: the place to get them;
+ *             NULL is default value
+ *
+ * @return: same as qconf_get_allhost, qconf_get_batch_keys or qconf_get_batch_conf
+ *          QCONF_ERR_BUF_NOT_ENOUGH: if buf is not enough, the size needed is
+ *                                    kept in buf_len
+ */
+int qconf_get_allhost_packed(const char *path, string_vector_t *nodes, char *buf, size_t *buf_len, const char *idc);
+int qconf_get_batch_keys_packed(const char *path, string_vector_t *nodes, char *buf, size_t *buf_len, const char *idc);
+int qconf_get_batch_conf_packed(const char *path, qconf_batch_nodes *bnodes, char *buf, size_t *buf_len, const char *idc);
+
+/**
+ * Free the array got by qconf_get_allhost_packed or qconf_get_batch_keys_packed
+ * with the buffer allocated, all services or keys are freed at once
+ *
+ * @return QCONF_OK: if success
+ *         QCONF_ERR_PARAM: if nodes is null
+ */
+int destroy_packed_string_vector(string_vector_t *nodes);
+
+/**
+ * Create or destroy the context of asynchronous gets, the gets of it not
+ * completed yet are dropped once it's destroyed
+ *
+ * @return QCONF_OK: if success
+ *         QCONF_ERR_PARAM: if async is null
+ *         QCONF_ERR_OTHER: if the eventfd is not created
+ */
+int qconf_async_create(qconf_async_t **async);
+int qconf_async_destroy(qconf_async_t *async);
+
+/**
+ * Get the eventfd of the context, it's readable while there are gets
+ * completed not polled yet. Add it to the event loop, and call
+ * qconf_async_poll or qconf_async_dispatch once it's readable
+ *
+ * @return: the eventfd, -1 if async is null
+ */
+int qconf_async_fd(const qconf_async_t *async);
+
+/**
+ * Get the conf or all services of path without blocking. The get is completed
+ * at once if the value is in share memory, otherwise the agent is asked for it
+ * and a thread of the driver completes the get once the agent sets it, finds
+ * it absent or timeout_ms passes
+ * @Note: the context may be used by one thread at a time
+ *
+ * @param async: the context the get is completed in
+ * @param path: the key of the conf or services
+ * @param idc: the place to get them;
+ *             NULL is default value
+ * @param type: QCONF_KEY_CONF or QCONF_KEY_ALLHOST
+ * @param timeout_ms: the deadline of the get from now on
+ * @param cb: called with the result by qconf_async_dispatch, it may be NULL
+ * @param data: kept in the result
+ *
+ * @return QCONF_OK: if the get is completed or waited for
+ *         QCONF_ERR_PARAM: if async or path is null or type is unknown
+ *         QCONF_ERR_MSGFULL: if the agent is asked too much, try it later
+ *         QCONF_ERR_OTHER: other failed
+ */
+int qconf_async_get(qconf_async_t *async, const char *path, const char *idc, int type, int timeout_ms, qconf_async_cb cb, void *data);
+
+/**
+ * Get the results of the gets completed, at most *count of them
+ * @Note: the values and services of the results are freed by the next call of
+ *        qconf_async_poll or qconf_async_destroy
+ *
+ * @param results: the array for keeping the results
+ * @param count: the size of results, and the count of results got
+ *
+ * @return QCONF_OK: if success
+ *         QCONF_ERR_PARAM: if any parameter is null
+ */
+int qconf_async_poll(qconf_async_t *async, qconf_async_result *results, int *count);
+
+/**
+ * Call back each get completed with its result, the ones without callback
+ * are dropped. The result is freed after its callback returns
+ *
+ * @return QCONF_OK: if success
+ *         QCONF_ERR_PARAM: if async is null
+ */
+int qconf_async_dispatch(qconf_async_t *async);
+
 /**
  * Get the qconf version
  * @Note: it must not change the return string
@@ -38,6 +38,7 @@
 #define QCONF_ERR_MSGSND                    43
 #define QCONF_ERR_MSGRCV                    44
 #define QCONF_ERR_MSGIDRM                   45
+#define QCONF_ERR_MSGFULL                   46
 
 // error of hostname
 #define QCONF_ERR_HOSTNAME                  71
@@ -49,6 +50,18 @@
 // error, failed to operate message queue
 #define QCONF_ERR_SEND_MSG_FAILED           91
 
+// error, share memory changed since the value was referenced
+#define QCONF_ERR_SHM_CHANGED               204
+
+// error, the value is not set by agent before the deadline
+#define QCONF_ERR_SHM_TIMEOUT               207
+
+// error, changes of share memory were lost before they were got
+#define QCONF_ERR_SHM_OVERRUN               208
+
+// error, some paths cached are not listed since the index of them is full
+#define QCONF_ERR_SHM_INDEX_FULL            209
+
 //  operation if there is no value in share memory
 #define QCONF_WAIT                          0
 #define QCONF_NOWAIT                        1
@@ -0,0 +1,60 @@
+#ifndef QCONF_VIEW_H
+#define QCONF_VIEW_H
+
+#include <stddef.h>
+
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+
+#include "qconf.h"
+
+namespace qconf
+{
+
+/**
+ * Guard of qconf_conf_view, the value is got without copying if possible
+ *
+ * Usage:
+ *     qconf::ConfView view;
+ *     if (QCONF_OK == view.get("/demo/conf") && use(view.value()) && view.valid())
+ *         ...
+ *
+ * @Note: the value may point into the share memory, call valid() after using it,
+ *        and get it again if valid() is false
+ */
+class ConfView
+{
+public:
+    ConfView() { init_qconf_conf_view(&view_); }
+    ~ConfView() { destroy_qconf_conf_view(&view_); }
+
+    int get(const char *path, const char *idc = NULL)
+    {
+        return qconf_get_conf_view(path, &view_, idc);
+    }
+
+    int aget(const char *path, const char *idc = NULL)
+    {
+        return qconf_aget_conf_view(path, &view_, idc);
+    }
+
+    const char *data() const { return view_.data; }
+    size_t size() const { return view_.len; }
+
+    bool valid() const { return QCONF_OK == qconf_check_conf_view(&view_); }
+
+#if __cplusplus >= 201703L
+    std::string_view value() const { return std::string_view(view_.data, view_.len); }
+#endif
+
+private:
+    ConfView(const ConfView &);
+    ConfView &operator=(const ConfView &);
+
+    qconf_conf_view view_;
+};
+
+}
+
+#endif
@@ -6,9 +6,14 @@
 #include <sys/poll.h>
 #include <sys/time.h>
 #include <sys/shm.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
 #include <errno.h>
+#include <pthread.h>
+#include <time.h>
 
 #include <iostream>
+#include <list>
 #include <vector>
 #include <string>
 
@@ -17,20 +22,158 @@
 #include "qconf_msg.h"
 #include "qconf_errno.h"
 #include "qconf_format.h"
+#include "qconf_snapshot.h"
+#include "qconf_cache.h"
 #include "driver_api.h"
 
 using namespace std;
 
 static qhasharr_t *_qconf_hashtbl  = NULL;
 static key_t _qconf_hashtbl_key    = QCONF_DEFAULT_SHM_KEY;
+// entries got are marked here, so the agent evicts the ones not in use
+static qconf_shm_refs_t *_qconf_hashtbl_refs = NULL;
+
+// the table in use is published in the control segment by the agent, tables
+// replaced are retired since values may be referenced in them
+static qconf_shm_ctrl_t *_qconf_shm_ctrl = NULL;
+static key_t _qconf_shm_ctrl_key   = QCONF_DEFAULT_SHM_CTRL_KEY;
+static uint32_t _qconf_hashtbl_gen = 0;
+static pthread_mutex_t _qconf_shm_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// clients block on the generation words for writes of the agent, they poll
+// the table if the agent keeps none
+static qconf_shm_gens_t *_qconf_shm_gens = NULL;
+static key_t _qconf_shm_gens_key   = QCONF_DEFAULT_SHM_GENS_KEY;
+
+// writes of the agent are recorded here for clients to tail
+static qconf_shm_journal_t *_qconf_shm_journal = NULL;
+static key_t _qconf_shm_journal_key = QCONF_DEFAULT_SHM_JOURNAL_KEY;
+
+// tables of the namespaces published by the agent, paths of no namespace are
+// kept in _qconf_hashtbl. They're replaced as a whole, the tables of the same
+// segments are taken over and the others retired
+typedef struct qconf_ns_tbls_s
+{
+    vector<qconf_shm_ns_entry_t> entries;
+    vector<qhasharr_t*> tbls;
+    vector<qconf_shm_refs_t*> refs;
+    vector<int> shmids;                 // -1 if the table is not taken over
+} qconf_ns_tbls_t;
+static qconf_shm_ns_t *_qconf_shm_ns = NULL;
+static key_t _qconf_shm_ns_key     = QCONF_DEFAULT_SHM_NS_KEY;
+
+// sorted paths of all tables, kept by the agent for listing them
+static qconf_shm_index_t *_qconf_shm_index = NULL;
+static key_t _qconf_shm_index_key  = QCONF_DEFAULT_SHM_INDEX_KEY;
+static uint32_t _qconf_shm_ns_gen  = 0;
+static qconf_ns_tbls_t *_qconf_ns_tbls = NULL;
+
+// replicas of the default table on NUMA nodes, reads go to the one of the
+// node the thread runs on. They're replaced as a whole and the ones replaced
+// are retired, since values may be referenced in them
+typedef struct qconf_replica_tbls_s
+{
+    key_t shmkey;                       // key of the table replicated
+    qhasharr_t *tbls[QCONF_SHM_REPLICA_MAX];
+} qconf_replica_tbls_t;
+static qconf_shm_replicas_t *_qconf_shm_replicas = NULL;
+static key_t _qconf_shm_replicas_key = QCONF_DEFAULT_SHM_REPLICAS_KEY;
+static uint32_t _qconf_replicas_gen = 0;
+static qconf_replica_tbls_t *_qconf_replica_tbls = NULL;
+// the node of a thread is looked up again after this many reads
+#define QCONF_NUMA_NODE_TTL 1024
+static __thread int _qconf_numa_node = 0;
+static __thread int _qconf_numa_node_ttl = 0;
+
+// attachments replaced are detached once they're retired this long, readers
+// still in them and values referenced in them are done by then
+#define QCONF_SHM_RETIRE_S 10
+
+typedef struct qconf_shm_retired_s
+{
+    time_t expire;
+    vector<qhasharr_t*> tbls;
+    vector<qconf_shm_refs_t*> refs;
+    qconf_ns_tbls_t *ns_tbls;
+    qconf_replica_tbls_t *replica_tbls;
+} qconf_shm_retired_t;
+static list<qconf_shm_retired_t> _qconf_shm_retired;
+static time_t _qconf_shm_reap_time = 0;        // the first retired expires, 0 if none
+
+// snapshot of the tables written by the agent, keys not written since it's
+// taken are read from it. The keys written are told by the journal, the
+// snapshot is not read once the journal loses writes or the tables are cleared.
+// The lock keeps the mapping, readers tail the journal one at a time under
+// the tail mutex and mark the keys written in the bits of their hashes
+#define QCONF_SNAPSHOT_CHANGED_BITS (1 << 16)
+static pthread_rwlock_t _qconf_snapshot_lock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_mutex_t _qconf_snapshot_tail_mutex = PTHREAD_MUTEX_INITIALIZER;
+static qconf_snapshot_t _qconf_snapshot = {NULL, 0, NULL, NULL, NULL};
+static ino_t _qconf_snapshot_ino   = 0;
+static uint64_t _qconf_snapshot_cursor = 0;     // journal is tailed up to here
+static bool _qconf_snapshot_usable = false;     // mapped and no write is lost since
+static uint64_t _qconf_snapshot_changed[QCONF_SNAPSHOT_CHANGED_BITS / 64];
+static time_t _qconf_snapshot_checked = 0;      // the file is checked once a second
+
+// QCONF_WAIT gets wait as long as the polling they replace
+#define QCONF_WAIT_TIMEOUT_MS (QCONF_MAX_GET_TIMES * 5)
 
 static int _qconf_msqid            = QCONF_INVALID_SEM_ID;
 static key_t _qconf_msqid_key      = QCONF_DEFAULT_MSG_QUEUE_KEY;
 
+// asynchronous gets waited for, the waiter thread of the process completes
+// them. It blocks on the word bumped with any key until the first deadline,
+// but polls this often if the agent keeps no generation words
+#define QCONF_ASYNC_POLL_MS 5
+// a submitter wakes the waiter for a nearer deadline, the wake is missed if
+// it comes before the waiter blocks, so the waiter blocks this long at most
+#define QCONF_ASYNC_WAIT_MS 100
+
+typedef struct qconf_async_req_s
+{
+    qconf_async_s *async;
+    qconf_key_s key;
+    struct timespec deadline;
+    void (*cb)(const struct qconf_async_result *result);
+    void *data;
+} qconf_async_req_t;
+
+static pthread_mutex_t _qconf_async_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _qconf_async_cond = PTHREAD_COND_INITIALIZER;
+static list<qconf_async_req_t*> _qconf_async_reqs;
+static bool _qconf_async_waiter = false;
+static struct timespec _qconf_async_until = {0, 0};  // the waiter blocks until, zero if it doesn't
+
 static int init_shm(); 
+static int attach_shm();
+static void attach_shm_ns();
+static void attach_shm_replicas();
+static void retire_shm(qconf_shm_retired_t &retired);
+static void reap_shm(time_t now);
+static int current_node();
+static qhasharr_t *tbl_of(const char *tblkey, size_t tblkey_len, qconf_shm_refs_t *&refs);
+static qhasharr_t *tbl_of(const string &tblkey, qconf_shm_refs_t *&refs);
+static int get_batch(const vector<string> &tblkeys, vector<string> &tblvals, vector<int> &rets);
+static int snapshot_get(const string &tblkey, string &tblval);
+static void snapshot_check();
+static bool snapshot_tail();
 static int init_msg();
 static int send_msg_to_agent(int msqid, const string &idc, const string &path, char data_type);
+static int send_keys_to_agent(int msqid, const vector<string> &tblkeys);
+static int get_packed_vectorval(const string &path, char dtype, string_vector_t &nodes, char *buf, size_t &buf_len, const string &idc, int flags);
+static int unpack_vectorval(const string &tblval, char dtype, string_vector_t &nodes, char *buf, size_t &buf_len);
+static bool async_probe(qconf_async_req_t *req, const struct timespec *now);
+static void async_complete(qconf_async_req_t *req, int ret, const string &tblval);
+static void *async_wait(void *arg);
+static bool time_before(const struct timespec &a, const struct timespec &b);
+static int get_missing(const vector<string> &tblkeys, vector<string> &tblvals, vector<int> &rets, int flags);
 static int qconf_get_(const string &path, string &tblval, char dtype, const string &idc, int flags);
+static int get_tblval(const string &tblkey, string &tblval, uint32_t &gen);
+static int get_localidc(string &idc);
+static int wait_tblkey(const string &tblkey, uint32_t gen, const struct timespec &deadline);
+static void get_deadline(int timeout_ms, struct timespec &deadline);
+static int get_tblkey_ref(char dtype, const char *path, size_t path_len, const char *idc, char *tblkey, size_t &tblkey_len);
+static bool tblkey_absent(const string &tblkey);
 
 
 int init_qconf_env()
@@ -44,21 +187,419 @@ int init_qconf_env()
 }
 
 static int init_shm()
+{
+    if (NULL != _qconf_hashtbl
+            && (NULL == _qconf_shm_ctrl || _qconf_hashtbl_gen == _qconf_shm_ctrl->generation)
+            && (NULL == _qconf_shm_ns || _qconf_shm_ns_gen == _qconf_shm_ns->generation)
+            && (NULL == _qconf_shm_replicas || _qconf_replicas_gen == _qconf_shm_replicas->generation)
+            && (0 == __atomic_load_n(&_qconf_shm_reap_time, __ATOMIC_RELAXED)
+                || time(NULL) < __atomic_load_n(&_qconf_shm_reap_time, __ATOMIC_RELAXED)))
+        return QCONF_OK;
+
+    pthread_mutex_lock(&_qconf_shm_mutex);
+    int ret = attach_shm();
+    reap_shm(time(NULL));
+    pthread_mutex_unlock(&_qconf_shm_mutex);
+
+    return ret;
+}
+
+/**
+ * Attach the table published in the control segment, or the default one if
+ * the agent publishes nothing
+ */
+static int attach_shm()
 {
     int ret = QCONF_OK;
 
-    if (NULL != _qconf_hashtbl) return ret;
+    // an agent without the control segment keeps the default table
+    if (NULL == _qconf_shm_ctrl && NULL == _qconf_hashtbl)
+        init_shm_ctrl(_qconf_shm_ctrl, _qconf_shm_ctrl_key, 0444, SHM_RDONLY);
+    if (NULL == _qconf_shm_gens)
+        init_shm_gens(_qconf_shm_gens, _qconf_shm_gens_key);
+    if (NULL == _qconf_shm_journal)
+        init_shm_journal(_qconf_shm_journal, _qconf_shm_journal_key);
+    if (NULL == _qconf_shm_index)
+        init_shm_index(_qconf_shm_index, _qconf_shm_index_key);
+    attach_shm_ns();
+
+    key_t shmkey = _qconf_hashtbl_key;
+    uint32_t generation = _qconf_hashtbl_gen;
+    if (NULL != _qconf_shm_ctrl)
+    {
+        ret = shm_ctrl_get(_qconf_shm_ctrl, shmkey, generation);
+        // keep reading the table attached until the agent finishes publishing
+        if (QCONF_OK != ret) return (NULL != _qconf_hashtbl) ? QCONF_OK : ret;
+    }
+    if (NULL != _qconf_hashtbl && shmkey == _qconf_hashtbl_key && generation == _qconf_hashtbl_gen)
+    {
+        attach_shm_replicas();
+        return QCONF_OK;
+    }
 
-    ret = init_hash_tbl(_qconf_hashtbl, _qconf_hashtbl_key, 0444, SHM_RDONLY);
+    qhasharr_t *tbl = NULL;
+    ret = init_hash_tbl(tbl, shmkey, 0444, SHM_RDONLY);
     if (QCONF_OK != ret)
     {
-        LOG_FATAL_ERR("Failed to init hash table! key:%#x", _qconf_hashtbl_key);
-        return ret; 
+        LOG_FATAL_ERR("Failed to init hash table! key:%#x", shmkey);
+        return (NULL != _qconf_hashtbl) ? QCONF_OK : ret;
+    }
+
+    qconf_shm_refs_t *refs = NULL;
+    init_hash_tbl_refs(refs, shmkey);
+
+    qconf_shm_retired_t retired = qconf_shm_retired_t();
+    if (NULL != _qconf_hashtbl) retired.tbls.push_back(_qconf_hashtbl);
+    if (NULL != _qconf_hashtbl_refs) retired.refs.push_back(_qconf_hashtbl_refs);
+
+    _qconf_hashtbl_refs = refs;
+    _qconf_hashtbl = tbl;
+    _qconf_hashtbl_key = shmkey;
+    _qconf_hashtbl_gen = generation;
+    attach_shm_replicas();
+    // entries cached mark the slots of the tables replaced
+    qconf_cache_clear();
+    retire_shm(retired);
+
+    return ret;
+}
+
+/**
+ * Keep the attachments replaced until readers are done with them, the caller
+ * holds _qconf_shm_mutex
+ */
+static void retire_shm(qconf_shm_retired_t &retired)
+{
+    if (retired.tbls.empty() && retired.refs.empty()
+            && NULL == retired.ns_tbls && NULL == retired.replica_tbls)
+        return;
+
+    retired.expire = time(NULL) + QCONF_SHM_RETIRE_S;
+    _qconf_shm_retired.push_back(retired);
+    if (0 == _qconf_shm_reap_time)
+        __atomic_store_n(&_qconf_shm_reap_time, retired.expire, __ATOMIC_RELAXED);
+}
+
+/**
+ * Detach the attachments retired before now, the caller holds _qconf_shm_mutex
+ */
+static void reap_shm(time_t now)
+{
+    while (!_qconf_shm_retired.empty() && _qconf_shm_retired.front().expire <= now)
+    {
+        qconf_shm_retired_t &retired = _qconf_shm_retired.front();
+        for (size_t i = 0; i < retired.tbls.size(); i++)
+            detach_hash_tbl(retired.tbls[i]);
+        for (size_t i = 0; i < retired.refs.size(); i++)
+            detach_hash_tbl_refs(retired.refs[i]);
+        delete retired.ns_tbls;
+        delete retired.replica_tbls;
+        _qconf_shm_retired.pop_front();
+    }
+
+    time_t reap_time = _qconf_shm_retired.empty() ? 0 : _qconf_shm_retired.front().expire;
+    __atomic_store_n(&_qconf_shm_reap_time, reap_time, __ATOMIC_RELAXED);
+}
+
+/**
+ * Attach the tables of namespaces once the agent publishes them again, an
+ * agent without the directory keeps every path in the default table
+ */
+static void attach_shm_ns()
+{
+    if (NULL == _qconf_shm_ns && NULL == _qconf_hashtbl)
+        init_shm_ns(_qconf_shm_ns, _qconf_shm_ns_key);
+    if (NULL == _qconf_shm_ns) return;
+
+    uint32_t generation = 0;
+    vector<qconf_shm_ns_entry_t> entries;
+    if (QCONF_OK != shm_ns_get(_qconf_shm_ns, entries, generation)) return;
+    if (NULL != _qconf_ns_tbls && generation == _qconf_shm_ns_gen) return;
+
+    qconf_ns_tbls_t *old_tbls = _qconf_ns_tbls;
+    vector<bool> taken((NULL == old_tbls) ? 0 : old_tbls->tbls.size(), false);
+    qconf_ns_tbls_t *ns_tbls = new qconf_ns_tbls_t;
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        // the segment of the key is the same one if its id is
+        int shmid = shmget(entries[i].shmkey, 0, 0);
+        size_t j = 0;
+        while (j < taken.size() && (taken[j] || -1 == shmid || shmid != old_tbls->shmids[j]
+                    || entries[i].shmkey != old_tbls->entries[j].shmkey))
+            j++;
+        if (j < taken.size())
+        {
+            taken[j] = true;
+            ns_tbls->entries.push_back(entries[i]);
+            ns_tbls->tbls.push_back(old_tbls->tbls[j]);
+            ns_tbls->refs.push_back(old_tbls->refs[j]);
+            ns_tbls->shmids.push_back(shmid);
+            continue;
+        }
+
+        qhasharr_t *tbl = NULL;
+        if (QCONF_OK != init_hash_tbl(tbl, entries[i].shmkey, 0444, SHM_RDONLY))
+        {
+            LOG_FATAL_ERR("Failed to init hash table of namespace:%s key:%#x",
+                    entries[i].name, entries[i].shmkey);
+            continue;
+        }
+        qconf_shm_refs_t *refs = NULL;
+        init_hash_tbl_refs(refs, entries[i].shmkey);
+
+        ns_tbls->entries.push_back(entries[i]);
+        ns_tbls->tbls.push_back(tbl);
+        ns_tbls->refs.push_back(refs);
+        ns_tbls->shmids.push_back(shmid);
+    }
+
+    qconf_shm_retired_t retired = qconf_shm_retired_t();
+    retired.ns_tbls = old_tbls;
+    for (size_t j = 0; j < taken.size(); j++)
+    {
+        if (taken[j]) continue;
+        retired.tbls.push_back(old_tbls->tbls[j]);
+        if (NULL != old_tbls->refs[j]) retired.refs.push_back(old_tbls->refs[j]);
+    }
+
+    _qconf_ns_tbls = ns_tbls;
+    _qconf_shm_ns_gen = generation;
+    qconf_cache_clear();
+    retire_shm(retired);
+}
+
+/**
+ * Attach the replicas of the default table once the agent publishes them
+ * again, an agent keeping no replicas is read from the table itself
+ */
+static void attach_shm_replicas()
+{
+    if (NULL == _qconf_shm_replicas)
+        init_shm_replicas(_qconf_shm_replicas, _qconf_shm_replicas_key);
+    if (NULL == _qconf_shm_replicas) return;
+
+    uint32_t generation = _qconf_shm_replicas->generation;
+    if (generation & 1) return;
+    if (NULL != _qconf_replica_tbls && generation == _qconf_replicas_gen
+            && _qconf_replica_tbls->shmkey == _qconf_hashtbl_key)
+        return;
+
+    qconf_replica_tbls_t *replica_tbls = new qconf_replica_tbls_t;
+    replica_tbls->shmkey = _qconf_hashtbl_key;
+    for (int node = 0; node < QCONF_SHM_REPLICA_MAX; node++)
+    {
+        replica_tbls->tbls[node] = NULL;
+
+        key_t replica_key = QCONF_INVALID_KEY;
+        uint32_t replica_gen = 0;
+        int ret = (0 == node) ? QCONF_ERR_NOT_FOUND
+            : shm_replicas_get(_qconf_shm_replicas, _qconf_hashtbl_key, node, replica_key, replica_gen);
+        if (QCONF_ERR_SHM_CHANGED == ret || (QCONF_OK == ret && replica_gen != generation))
+        {
+            // try again on the next read, nobody reads the ones attached yet
+            for (int n = 1; n < node; n++)
+                detach_hash_tbl(replica_tbls->tbls[n]);
+            delete replica_tbls;
+            return;
+        }
+        if (QCONF_OK != ret) continue;
+
+        if (QCONF_OK != init_hash_tbl(replica_tbls->tbls[node], replica_key, 0444, SHM_RDONLY))
+        {
+            LOG_FATAL_ERR("Failed to init replica of hash table on numa node:%d key:%#x", node, replica_key);
+            replica_tbls->tbls[node] = NULL;
+        }
+    }
+
+    qconf_shm_retired_t retired = qconf_shm_retired_t();
+    retired.replica_tbls = _qconf_replica_tbls;
+    for (int node = 0; NULL != retired.replica_tbls && node < QCONF_SHM_REPLICA_MAX; node++)
+    {
+        if (NULL != retired.replica_tbls->tbls[node]) retired.tbls.push_back(retired.replica_tbls->tbls[node]);
+    }
+
+    _qconf_replica_tbls = replica_tbls;
+    _qconf_replicas_gen = generation;
+    retire_shm(retired);
+}
+
+static int current_node()
+{
+    if (--_qconf_numa_node_ttl < 0)
+    {
+        _qconf_numa_node = qconf_numa_node();
+        _qconf_numa_node_ttl = QCONF_NUMA_NODE_TTL;
+    }
+    return _qconf_numa_node;
+}
+
+/**
+ * Table keeping tblkey, the one of its namespace or the default one. Replicas
+ * keep the same slots as the default table, so its refs are marked for them
+ */
+static qhasharr_t *tbl_of(const char *tblkey, size_t tblkey_len, qconf_shm_refs_t *&refs)
+{
+    const qconf_ns_tbls_t *ns_tbls = _qconf_ns_tbls;
+    int index = (NULL == ns_tbls) ? -1 : shm_ns_route(ns_tbls->entries, tblkey, tblkey_len);
+    if (index < 0)
+    {
+        refs = _qconf_hashtbl_refs;
+        const qconf_replica_tbls_t *replica_tbls = _qconf_replica_tbls;
+        if (NULL == replica_tbls || replica_tbls->shmkey != _qconf_hashtbl_key) return _qconf_hashtbl;
+
+        qhasharr_t *replica = replica_tbls->tbls[current_node() % QCONF_SHM_REPLICA_MAX];
+        return (NULL != replica) ? replica : _qconf_hashtbl;
+    }
+    refs = ns_tbls->refs[index];
+    return ns_tbls->tbls[index];
+}
+
+static qhasharr_t *tbl_of(const string &tblkey, qconf_shm_refs_t *&refs)
+{
+    return tbl_of(tblkey.data(), tblkey.size(), refs);
+}
+
+/**
+ * Get the values of tblkeys, the ones of one table as of one moment
+ */
+static int get_batch(const vector<string> &tblkeys, vector<string> &tblvals, vector<int> &rets)
+{
+    vector<qhasharr_t*> tbls(tblkeys.size());
+    vector<qconf_shm_refs_t*> refs(tblkeys.size());
+    bool one_tbl = true;
+    for (size_t i = 0; i < tblkeys.size(); i++)
+    {
+        tbls[i] = tbl_of(tblkeys[i], refs[i]);
+        if (tbls[i] != tbls[0]) one_tbl = false;
+    }
+    if (tblkeys.empty()) return hash_tbl_get_batch(_qconf_hashtbl, tblkeys, tblvals, rets, _qconf_hashtbl_refs);
+    if (one_tbl) return hash_tbl_get_batch(tbls[0], tblkeys, tblvals, rets, refs[0]);
+
+    tblvals.assign(tblkeys.size(), string());
+    rets.assign(tblkeys.size(), QCONF_ERR_NOT_FOUND);
+    vector<bool> done(tblkeys.size(), false);
+    for (size_t i = 0; i < tblkeys.size(); i++)
+    {
+        if (done[i]) continue;
+
+        vector<size_t> idxs;
+        vector<string> keys, vals;
+        vector<int> key_rets;
+        for (size_t j = i; j < tblkeys.size(); j++)
+        {
+            if (tbls[j] != tbls[i]) continue;
+            idxs.push_back(j);
+            keys.push_back(tblkeys[j]);
+            done[j] = true;
+        }
+
+        int ret = hash_tbl_get_batch(tbls[i], keys, vals, key_rets, refs[i]);
+        if (QCONF_OK != ret) return ret;
+        for (size_t k = 0; k < idxs.size(); k++)
+        {
+            tblvals[idxs[k]].swap(vals[k]);
+            rets[idxs[k]] = key_rets[k];
+        }
     }
+    return QCONF_OK;
+}
 
+/**
+ * Get the value of tblkey from the snapshot if it's not written since
+ */
+static int snapshot_get(const string &tblkey, string &tblval)
+{
+    if (NULL == _qconf_shm_journal) return QCONF_ERR_NOT_FOUND;
+    snapshot_check();
+    if (!__atomic_load_n(&_qconf_snapshot_usable, __ATOMIC_ACQUIRE)) return QCONF_ERR_NOT_FOUND;
+
+    int ret = QCONF_ERR_NOT_FOUND;
+    uint32_t hash = qhashmurmur3_32(tblkey.data(), tblkey.size()) % QCONF_SNAPSHOT_CHANGED_BITS;
+    pthread_rwlock_rdlock(&_qconf_snapshot_lock);
+    // writes another thread is tailing may be of tblkey, it's read from the table then
+    bool tailed = (shm_journal_head(_qconf_shm_journal) == __atomic_load_n(&_qconf_snapshot_cursor, __ATOMIC_ACQUIRE))
+        || snapshot_tail();
+    if (tailed && __atomic_load_n(&_qconf_snapshot_usable, __ATOMIC_ACQUIRE)
+            && 0 == (__atomic_load_n(&_qconf_snapshot_changed[hash / 64], __ATOMIC_RELAXED) & (1ULL << (hash % 64))))
+    {
+        const char *val = NULL;
+        size_t val_len = 0;
+        ret = qconf_snapshot_get(_qconf_snapshot, tblkey.data(), tblkey.size(), val, val_len);
+        if (QCONF_OK == ret) tblval.assign(val, val_len);
+    }
+    pthread_rwlock_unlock(&_qconf_snapshot_lock);
     return ret;
 }
 
+/**
+ * Map the snapshot again once the agent renames a new one into place
+ */
+static void snapshot_check()
+{
+    time_t now = time(NULL);
+    time_t checked = _qconf_snapshot_checked;
+    if (now == checked || !__sync_bool_compare_and_swap(&_qconf_snapshot_checked, checked, now)) return;
+
+    struct stat st;
+    bool exists = (0 == stat(QCONF_DEFAULT_SNAPSHOT_PATH, &st));
+    if (exists && NULL != _qconf_snapshot.base && st.st_ino == _qconf_snapshot_ino) return;
+    if (!exists && NULL == _qconf_snapshot.base) return;
+
+    qconf_snapshot_t snap;
+    memset(&snap, 0, sizeof(snap));
+    if (exists && QCONF_OK != qconf_snapshot_open(snap, QCONF_DEFAULT_SNAPSHOT_PATH))
+        LOG_ERR("Failed to open snapshot:%s", QCONF_DEFAULT_SNAPSHOT_PATH);
+
+    pthread_rwlock_wrlock(&_qconf_snapshot_lock);
+    __atomic_store_n(&_qconf_snapshot_usable, false, __ATOMIC_RELEASE);
+    qconf_snapshot_close(_qconf_snapshot);
+    _qconf_snapshot = snap;
+    _qconf_snapshot_ino = exists ? st.st_ino : 0;
+    _qconf_snapshot_cursor = (NULL != snap.base) ? snap.hdr->generation : 0;
+    memset(_qconf_snapshot_changed, 0, sizeof(_qconf_snapshot_changed));
+    if (NULL != snap.base)
+    {
+        __atomic_store_n(&_qconf_snapshot_usable, true, __ATOMIC_RELEASE);
+        snapshot_tail();
+    }
+    pthread_rwlock_unlock(&_qconf_snapshot_lock);
+}
+
+/**
+ * Mark the keys written since the snapshot, the caller holds the lock of it.
+ * Returns false if another thread is tailing the journal
+ */
+static bool snapshot_tail()
+{
+    if (0 != pthread_mutex_trylock(&_qconf_snapshot_tail_mutex)) return false;
+
+    qconf_shm_journal_rec_t recs[256];
+    int nrecs = 256;
+    uint64_t cursor = _qconf_snapshot_cursor;
+    bool usable = __atomic_load_n(&_qconf_snapshot_usable, __ATOMIC_RELAXED);
+    while (usable && 256 == nrecs)
+    {
+        int ret = shm_journal_tail(_qconf_shm_journal, cursor, recs, 256, nrecs);
+        if (QCONF_OK != ret) usable = false;
+        for (int i = 0; i < nrecs && usable; i++)
+        {
+            if (QCONF_JOURNAL_CLEAR == recs[i].type)
+            {
+                usable = false;
+                break;
+            }
+            uint32_t hash = recs[i].keyhash % QCONF_SNAPSHOT_CHANGED_BITS;
+            __atomic_fetch_or(&_qconf_snapshot_changed[hash / 64], 1ULL << (hash % 64), __ATOMIC_RELAXED);
+        }
+        // the keys are marked before readers see the cursor past them
+        if (!usable) __atomic_store_n(&_qconf_snapshot_usable, false, __ATOMIC_RELEASE);
+        __atomic_store_n(&_qconf_snapshot_cursor, cursor, __ATOMIC_RELEASE);
+    }
+
+    pthread_mutex_unlock(&_qconf_snapshot_tail_mutex);
+    return true;
+}
+
 static int init_msg()
 {
     int ret = QCONF_OK;
@@ -91,12 +632,17 @@ int qconf_get_children(const string &path, string_vector_t &nodes, const string
     return ret;
 }
 
+int qconf_get_children_val(const string &path, string &tblval, const string &idc, int flags)
+{
+    if (path.empty()) return QCONF_ERR_PARAM;
+
+    return qconf_get_(path, tblval, QCONF_DATA_TYPE_SERVICE, idc, flags);
+}
+
 int qconf_get_batchnode(const string &path, qconf_batch_nodes &bnodes, const string &idc, int flags)
 {
     if (path.empty()) return QCONF_ERR_PARAM;
 
-    string buf;
-    string child_path;
     int ret = QCONF_OK;
     string_vector_t nodes;
 
@@ -112,6 +658,21 @@ int qconf_get_batchnode(const string &path, qconf_batch_nodes &bnodes, const str
             return ret;
         }
 
+        // children are got together, with one message for the missing ones
+        vector<string> child_paths(nodes.count), bufs;
+        vector<int> rets;
+        for (int i = 0; i < nodes.count; i++)
+            child_paths[i] = path + "/" + nodes.data[i];
+
+        ret = qconf_get_multi(child_paths, bufs, rets, idc, flags);
+        if (QCONF_OK != ret)
+        {
+            LOG_ERR("Failed to call qconf_get_multi! ret:%d", ret);
+            free_string_vector(nodes, nodes.count);
+            bnodes.count = 0;
+            return ret;
+        }
+
         bnodes.nodes = (qconf_node*) calloc(bnodes.count, sizeof(qconf_node));
         if (NULL == bnodes.nodes)
         {
@@ -123,31 +684,18 @@ int qconf_get_batchnode(const string &path, qconf_batch_nodes &bnodes, const str
 
         for (int i = 0; i < nodes.count; i++)
         {
-            child_path = path + "/" + nodes.data[i];
-
-            ret = qconf_get(child_path, buf, idc, flags);
-            if (QCONF_OK == ret)
+            bnodes.nodes[i].value = strndup(bufs[i].c_str(), bufs[i].size() + 1);
+            if (NULL == bnodes.nodes[i].value)
             {
-                bnodes.nodes[i].value = strndup(buf.c_str(), buf.size() + 1);
-                if (NULL == bnodes.nodes[i].value)
-                {
-                    LOG_ERR("Failed to strdup value of path:%s! errno:%d",
-                            child_path.c_str(), errno);
-                    free_string_vector(nodes, nodes.count);
-                    free_qconf_batch_nodes(&bnodes, i);
-                    return QCONF_ERR_MEM;
-                }
-
-                bnodes.nodes[i].key = nodes.data[i];
-                nodes.data[i] = NULL;
-            }
-            else
-            {
-                LOG_ERR("Failed to call qconf_get! ret:%d", ret);
+                LOG_ERR("Failed to strdup value of path:%s! errno:%d",
+                        child_paths[i].c_str(), errno);
                 free_string_vector(nodes, nodes.count);
                 free_qconf_batch_nodes(&bnodes, i);
-                return ret;
+                return QCONF_ERR_MEM;
             }
+
+            bnodes.nodes[i].key = nodes.data[i];
+            nodes.data[i] = NULL;
         }
 
         free_string_vector(nodes, 0);
@@ -174,6 +722,135 @@ int qconf_get_batchnode_keys(const string &path, string_vector_t &nodes, const s
     return ret;
 }
 
+int qconf_get_children_packed(const string &path, string_vector_t &nodes, char *buf, size_t &buf_len, const string &idc, int flags)
+{
+    return get_packed_vectorval(path, QCONF_DATA_TYPE_SERVICE, nodes, buf, buf_len, idc, flags);
+}
+
+int qconf_get_batchnode_keys_packed(const string &path, string_vector_t &nodes, char *buf, size_t &buf_len, const string &idc, int flags)
+{
+    return get_packed_vectorval(path, QCONF_DATA_TYPE_BATCH_NODE, nodes, buf, buf_len, idc, flags);
+}
+
+static int get_packed_vectorval(const string &path, char dtype, string_vector_t &nodes, char *buf, size_t &buf_len, const string &idc, int flags)
+{
+    if (path.empty()) return QCONF_ERR_PARAM;
+
+    string tblval;
+    int ret = qconf_get_(path, tblval, dtype, idc, flags);
+    if (QCONF_OK != ret) return ret;
+
+    return unpack_vectorval(tblval, dtype, nodes, buf, buf_len);
+}
+
+/**
+ * Get the nodes of tblval packed into buf, or into one allocation if buf is NULL
+ */
+static int unpack_vectorval(const string &tblval, char dtype, string_vector_t &nodes, char *buf, size_t &buf_len)
+{
+    int (*unpack)(const string&, string_vector_t&, char*, size_t&) =
+        (QCONF_DATA_TYPE_SERVICE == dtype) ? tblval_to_packed_chdnodeval : tblval_to_packed_batchnodeval;
+    if (NULL != buf) return unpack(tblval, nodes, buf, buf_len);
+
+    // the size is got first, then the nodes are packed into one allocation
+    size_t need = 0;
+    int ret = unpack(tblval, nodes, NULL, need);
+    if (QCONF_ERR_BUF_NOT_ENOUGH != ret)
+    {
+        buf_len = need;
+        return ret;
+    }
+
+    char *own = (char*)malloc(need);
+    if (NULL == own)
+    {
+        LOG_ERR("Failed to malloc packed nodes! errno:%d", errno);
+        return QCONF_ERR_MEM;
+    }
+    // malloc aligns own, so the array is at its head and freeing it frees all
+    buf_len = need;
+    ret = unpack(tblval, nodes, own, buf_len);
+    if (QCONF_OK != ret) free(own);
+    return ret;
+}
+
+int qconf_get_batchnode_packed(const string &path, qconf_batch_nodes &bnodes, char *buf, size_t &buf_len, const string &idc, int flags)
+{
+    if (path.empty()) return QCONF_ERR_PARAM;
+
+    string_vector_t keys;
+    size_t keys_len = 0;
+    memset(&keys, 0, sizeof(string_vector_t));
+    int ret = qconf_get_batchnode_keys_packed(path, keys, NULL, keys_len, idc, flags);
+    if (QCONF_OK != ret) return ret;
+
+    if (0 == keys.count)
+    {
+        bnodes.count = 0;
+        bnodes.nodes = NULL;
+        buf_len = 0;
+        return ret;
+    }
+
+    vector<string> child_paths(keys.count), vals;
+    vector<size_t> key_lens(keys.count);
+    vector<int> rets;
+    size_t need = QCONF_PACKED_ALIGN_SLACK + keys.count * sizeof(qconf_node);
+    for (int i = 0; i < keys.count; i++)
+    {
+        key_lens[i] = strlen(keys.data[i]);
+        child_paths[i] = path + "/" + keys.data[i];
+        need += key_lens[i] + 1;
+    }
+
+    ret = qconf_get_multi(child_paths, vals, rets, idc, flags);
+    if (QCONF_OK != ret)
+    {
+        LOG_ERR("Failed to call qconf_get_multi! ret:%d", ret);
+        free(keys.data);
+        return ret;
+    }
+    for (int i = 0; i < keys.count; i++)
+        need += vals[i].size() + 1;
+
+    if (NULL == buf)
+    {
+        buf = (char*)malloc(need);
+        if (NULL == buf)
+        {
+            LOG_ERR("Failed to malloc packed batch nodes! errno:%d", errno);
+            free(keys.data);
+            return QCONF_ERR_MEM;
+        }
+    }
+    else if (buf_len < need)
+    {
+        buf_len = need;
+        free(keys.data);
+        return QCONF_ERR_BUF_NOT_ENOUGH;
+    }
+
+    qconf_node *nodes = (qconf_node*)qconf_packed_align(buf);
+    char *dest = (char*)(nodes + keys.count);
+    for (int i = 0; i < keys.count; i++)
+    {
+        memcpy(dest, keys.data[i], key_lens[i] + 1);
+        nodes[i].key = dest;
+        dest += key_lens[i] + 1;
+
+        memcpy(dest, vals[i].data(), vals[i].size());
+        dest[vals[i].size()] = '\0';
+        nodes[i].value = dest;
+        dest += vals[i].size() + 1;
+    }
+
+    bnodes.count = keys.count;
+    bnodes.nodes = nodes;
+    buf_len = dest - buf;
+    free(keys.data);
+    return QCONF_OK;
+}
+
 /**
  * Get child nodes from hash table(share memory)
  */
@@ -190,19 +867,17 @@ int qconf_get(const string &path, string &buf, const string &idc, int flags)
     return ret;
 }
 
-static int qconf_get_(const string &path, string &tblval, char dtype, const string &idc, int flags)
+int qconf_get_multi(const vector<string> &paths, vector<string> &bufs, vector<int> &rets, const string &idc, int flags)
 {
-    int count = 0;
-    string tblkey;
-    int ret = QCONF_OK;
+    if (paths.empty()) return QCONF_ERR_PARAM;
 
-    ret = init_qconf_env();
+    int ret = init_qconf_env();
     if (QCONF_OK != ret) return ret;
 
     string tmp_idc(idc);
     if (idc.empty())
     {
-        ret = qconf_get_localidc(_qconf_hashtbl, tmp_idc);
+        ret = get_localidc(tmp_idc);
         if (QCONF_OK != ret)
         {
             LOG_ERR("Failed to get local idc! ret:%d", ret);
@@ -210,47 +885,824 @@ static int qconf_get_(const string &path, string &tblval, char dtype, const stri
         }
     }
 
-    ret = serialize_to_tblkey(dtype, tmp_idc, path, tblkey);
+    vector<string> tblkeys(paths.size()), tblvals;
+    for (size_t i = 0; i < paths.size(); i++)
+    {
+        if (paths[i].empty()) return QCONF_ERR_PARAM;
+        ret = serialize_to_tblkey(QCONF_DATA_TYPE_NODE, tmp_idc, paths[i], tblkeys[i]);
+        if (QCONF_OK != ret) return ret;
+    }
+
+    ret = get_batch(tblkeys, tblvals, rets);
     if (QCONF_OK != ret) return ret;
 
-    // get value from tbl
-    ret = hash_tbl_get(_qconf_hashtbl, tblkey, tblval);
-    if (QCONF_OK == ret) return ret;
+    ret = get_missing(tblkeys, tblvals, rets, flags);
+    if (QCONF_OK != ret) return ret;
 
-    // Not get batch keys from share memory, then send message to agent
-    int ret_snd = send_msg_to_agent(_qconf_msqid, tmp_idc, path, dtype);
-    if (QCONF_OK != ret_snd)
+    bufs.resize(paths.size());
+    for (size_t i = 0; i < paths.size(); i++)
     {
-        LOG_ERR("Failed to send message to agent, ret:%d", ret_snd);
-        return ret_snd;
+        if (QCONF_OK == rets[i]) rets[i] = tblval_to_nodeval(tblvals[i], bufs[i]);
+        if (QCONF_OK == ret) ret = rets[i];
     }
+    return ret;
+}
 
-    // If not wait, then return directly
-    if (QCONF_NOWAIT == flags) return ret;
-
-    while (count < QCONF_MAX_GET_TIMES)
+/**
+ * Ask the agent for the tblkeys not found at once, and wait until it sets
+ * or finds absent each of them unless flags is QCONF_NOWAIT. All of them are
+ * got again as of one moment once any is set
+ */
+static int get_missing(const vector<string> &tblkeys, vector<string> &tblvals, vector<int> &rets, int flags)
+{
+    vector<string> missing;
+    for (size_t i = 0; i < tblkeys.size(); i++)
     {
-        usleep(5000);
-        count++;
-        
-        ret = hash_tbl_get(_qconf_hashtbl, tblkey, tblval);
-        if (QCONF_OK == ret)
-        {
-            LOG_ERR("Wait time:%d*5ms, type:%c, idc:%s, path:%s", 
-                    count, dtype, tmp_idc.c_str(), path.c_str());
-            return ret;
-        }
+        // the agent has found it absent on zookeeper lately, no need to ask again
+        if (QCONF_ERR_NOT_FOUND == rets[i] && !tblkey_absent(tblkeys[i]))
+            missing.push_back(tblkeys[i]);
     }
+    if (missing.empty()) return QCONF_OK;
 
-    if (count >= QCONF_MAX_GET_TIMES)
+    int ret = send_keys_to_agent(_qconf_msqid, missing);
+    if (QCONF_OK != ret)
     {
-        LOG_FATAL_ERR("Failed to get value! wait time:%d*5ms, type:%c, idc:%s, path:%s, ret:%d",
-                count, dtype, tmp_idc.c_str(), path.c_str(), ret);
+        LOG_ERR("Failed to send message to agent, ret:%d", ret);
+        return ret;
     }
+    if (QCONF_NOWAIT == flags) return QCONF_OK;
+
+    struct timespec deadline;
+    get_deadline(QCONF_WAIT_TIMEOUT_MS, deadline);
+
+    size_t done = 0;
+    while (done < missing.size())
+    {
+        const string &tblkey = missing[done];
+        uint32_t gen = shm_gens_get(_qconf_shm_gens, tblkey.data(), tblkey.size());
+        string tblval;
+        qconf_shm_refs_t *refs = NULL;
+        if (QCONF_OK == hash_tbl_get(tbl_of(tblkey, refs), tblkey, tblval) || tblkey_absent(tblkey))
+        {
+            done++;
+            continue;
+        }
+
+        if (QCONF_ERR_SHM_TIMEOUT == wait_tblkey(tblkey, gen, deadline))
+        {
+            LOG_FATAL_ERR("Failed to get values! wait time:%dms, keys missing:%zd",
+                    QCONF_WAIT_TIMEOUT_MS, missing.size() - done);
+            break;
+        }
+        // the agent may resize the table while setting the value
+        init_shm();
+    }
+    if (0 == done) return QCONF_OK;
+
+    return get_batch(tblkeys, tblvals, rets);
+}
+
+static int qconf_get_(const string &path, string &tblval, char dtype, const string &idc, int flags)
+{
+    string tblkey;
+    int ret = QCONF_OK;
+
+    ret = init_qconf_env();
+    if (QCONF_OK != ret) return ret;
+
+    string tmp_idc(idc);
+    if (idc.empty())
+    {
+        ret = get_localidc(tmp_idc);
+        if (QCONF_OK != ret)
+        {
+            LOG_ERR("Failed to get local idc! ret:%d", ret);
+            return ret;
+        }
+    }
+
+    ret = serialize_to_tblkey(dtype, tmp_idc, path, tblkey);
+    if (QCONF_OK != ret) return ret;
+
+    uint32_t gen = 0;
+    ret = get_tblval(tblkey, tblval, gen);
+    if (QCONF_OK == ret) return ret;
+
+    // the agent has found it absent on zookeeper lately, no need to ask again
+    if (tblkey_absent(tblkey)) return QCONF_ERR_NOT_FOUND;
+
+    // Not get batch keys from share memory, then send message to agent
+    int ret_snd = send_msg_to_agent(_qconf_msqid, tmp_idc, path, dtype);
+    if (QCONF_OK != ret_snd)
+    {
+        LOG_ERR("Failed to send message to agent, ret:%d", ret_snd);
+        return ret_snd;
+    }
+
+    // If not wait, then return directly
+    if (QCONF_NOWAIT == flags) return ret;
+
+    struct timespec start, deadline;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    get_deadline(QCONF_WAIT_TIMEOUT_MS, deadline);
+
+    int ret_wait = QCONF_OK;
+    while (QCONF_ERR_SHM_TIMEOUT != ret_wait)
+    {
+        ret_wait = wait_tblkey(tblkey, gen, deadline);
+
+        // the agent may resize the table while setting the value
+        init_shm();
+        ret = get_tblval(tblkey, tblval, gen);
+        if (QCONF_OK == ret)
+        {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            LOG_ERR("Wait time:%ldms, type:%c, idc:%s, path:%s",
+                    (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000,
+                    dtype, tmp_idc.c_str(), path.c_str());
+            return ret;
+        }
+
+        // no need to wait any more once the agent finds it absent
+        if (tblkey_absent(tblkey)) return QCONF_ERR_NOT_FOUND;
+    }
+
+    LOG_FATAL_ERR("Failed to get value! wait time:%dms, type:%c, idc:%s, path:%s, ret:%d",
+            QCONF_WAIT_TIMEOUT_MS, dtype, tmp_idc.c_str(), path.c_str(), ret);
+
+    return ret;
+}
+
+/**
+ * Whether the agent marks tblkey absent and the mark is not expired
+ */
+static bool tblkey_absent(const string &tblkey)
+{
+    string absent_key, tblval;
+    if (QCONF_OK != serialize_to_absent_tblkey(tblkey, absent_key)) return false;
+
+    qconf_shm_refs_t *refs = NULL;
+    if (QCONF_OK != hash_tbl_get(tbl_of(absent_key, refs), absent_key, tblval)) return false;
+
+    int64_t expire = 0;
+    if (QCONF_OK != tblval_to_absentval(tblval, expire)) return false;
+    return expire > (int64_t)time(NULL);
+}
+
+/**
+ * Get the value of tblkey from the cache, the snapshot or the table, the
+ * ones got from share memory are cached. gen is set to the generation of
+ * tblkey got before reading it
+ */
+static int get_tblval(const string &tblkey, string &tblval, uint32_t &gen)
+{
+    if (QCONF_OK == qconf_cache_get(tblkey, tblval)) return QCONF_OK;
+
+    gen = shm_gens_get(_qconf_shm_gens, tblkey.data(), tblkey.size());
+
+    // keys not written since the snapshot are read from it
+    qconf_shm_refs_t *refs = NULL;
+    qhasharr_key_t hkey;
+    hkey.hint = -1;
+    int ret = snapshot_get(tblkey, tblval);
+    if (QCONF_OK != ret)
+    {
+        qhasharr_t *tbl = tbl_of(tblkey, refs);
+        // the slot found is kept in hkey for the cache to mark
+        bool prepared = qconf_cache_enabled() && QCONF_OK == hash_tbl_prepare(tbl, tblkey.data(), tblkey.size(), hkey);
+        ret = hash_tbl_get(tbl, tblkey, tblval, refs, prepared ? &hkey : NULL);
+    }
+    if (QCONF_OK != ret) return ret;
+
+    qconf_cache_put(tblkey, tblval, shm_gens_word(_qconf_shm_gens, tblkey.data(), tblkey.size()), gen, refs, hkey.hint);
+    return ret;
+}
+
+/**
+ * Get the local idc kept by the agent, it's cached as other keys
+ */
+static int get_localidc(string &idc)
+{
+    string tblkey, tblval;
+    int ret = serialize_to_tblkey(QCONF_DATA_TYPE_LOCAL_IDC, "", "", tblkey);
+    if (QCONF_OK != ret) return ret;
+
+    uint32_t gen = 0;
+    ret = get_tblval(tblkey, tblval, gen);
+    if (QCONF_OK != ret) return ret;
+
+    return tblval_to_localidc(tblval, idc);
+}
+
+/**
+ * Block until the agent writes something beside tblkey since gen was got,
+ * or poll a while if the agent keeps no generation words
+ */
+static int wait_tblkey(const string &tblkey, uint32_t gen, const struct timespec &deadline)
+{
+    if (NULL != _qconf_shm_gens)
+        return shm_gens_wait(_qconf_shm_gens, tblkey.data(), tblkey.size(), gen, deadline);
+
+    usleep(5000);
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec > deadline.tv_sec || (now.tv_sec == deadline.tv_sec && now.tv_nsec >= deadline.tv_nsec))
+        return QCONF_ERR_SHM_TIMEOUT;
+    return QCONF_OK;
+}
+
+static void get_deadline(int timeout_ms, struct timespec &deadline)
+{
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+}
+
+int qconf_get_ref(const char *path, size_t path_len, const char *&val, size_t &val_len, uint32_t &version, const char *idc)
+{
+    if (NULL == path || 0 == path_len) return QCONF_ERR_PARAM;
+
+    int ret = init_qconf_env();
+    if (QCONF_OK != ret) return ret;
+
+    char tblkey[QCONF_TBLKEY_MAX_LEN];
+    size_t tblkey_len = 0;
+    ret = get_tblkey_ref(QCONF_DATA_TYPE_NODE, path, path_len, idc, tblkey, tblkey_len);
+    if (QCONF_OK != ret) return ret;
+
+    qconf_shm_refs_t *refs = NULL;
+    qhasharr_t *tbl = tbl_of(tblkey, tblkey_len, refs);
+
+    for (int count = 0; count < QCONF_MAX_READ_TIMES; count++)
+    {
+        const char *tblval = NULL;
+        size_t tblval_len = 0;
+
+        ret = hash_tbl_get_ref(tbl, tblkey, tblkey_len, tblval, tblval_len, version, refs);
+        if (QCONF_OK != ret) return ret;
+
+        ret = tblval_to_nodeval(tblval, tblval_len, val, val_len);
+        if (QCONF_OK == ret) return ret;
+
+        // data format is broken only if it stays the same
+        if (QCONF_OK == hash_tbl_check_ref(tbl, version)) return ret;
+    }
+
+    return QCONF_ERR_SHM_CHANGED;
+}
+
+int qconf_prepare_key(const string &path, char dtype, const string &idc, qconf_key_s &key)
+{
+    if (path.empty()) return QCONF_ERR_PARAM;
+
+    int ret = init_qconf_env();
+    if (QCONF_OK != ret) return ret;
+
+    string tmp_idc(idc);
+    if (idc.empty())
+    {
+        ret = qconf_get_localidc(_qconf_hashtbl, tmp_idc);
+        if (QCONF_OK != ret)
+        {
+            LOG_ERR("Failed to get local idc! ret:%d", ret);
+            return ret;
+        }
+    }
+
+    ret = serialize_to_tblkey(dtype, tmp_idc, path, key.tblkey);
+    if (QCONF_OK != ret) return ret;
+    key.dtype = dtype;
+    key.path = path;
+    key.idc = tmp_idc;
+
+    qconf_shm_refs_t *refs = NULL;
+    return hash_tbl_prepare(tbl_of(key.tblkey, refs), key.tblkey.data(), key.tblkey.size(), key.hkey);
+}
+
+int qconf_get_key(qconf_key_s &key, string &tblval, int flags)
+{
+    int ret = init_qconf_env();
+    if (QCONF_OK != ret) return ret;
+
+    qconf_shm_refs_t *refs = NULL;
+    ret = hash_tbl_get(tbl_of(key.tblkey, refs), key.tblkey, tblval, refs, &key.hkey);
+    if (QCONF_OK == ret) return ret;
+
+    // not cached yet, got as the path is
+    return qconf_get_(key.path, tblval, key.dtype, key.idc, flags);
+}
+
+int qconf_get_key_children(qconf_key_s &key, string_vector_t &nodes, int flags)
+{
+    if (QCONF_DATA_TYPE_SERVICE != key.dtype) return QCONF_ERR_PARAM;
+
+    string tblval;
+    int ret = qconf_get_key(key, tblval, flags);
+    if (QCONF_OK != ret) return ret;
+
+    return tblval_to_chdnodeval(tblval, nodes);
+}
+
+int qconf_get_key_ref(qconf_key_s &key, const char *&val, size_t &val_len, uint32_t &version)
+{
+    if (QCONF_DATA_TYPE_NODE != key.dtype) return QCONF_ERR_PARAM;
+
+    int ret = init_qconf_env();
+    if (QCONF_OK != ret) return ret;
+
+    qconf_shm_refs_t *refs = NULL;
+    qhasharr_t *tbl = tbl_of(key.tblkey, refs);
+
+    for (int count = 0; count < QCONF_MAX_READ_TIMES; count++)
+    {
+        const char *tblval = NULL;
+        size_t tblval_len = 0;
+
+        ret = hash_tbl_get_ref(tbl, key.tblkey.data(), key.tblkey.size(), tblval, tblval_len, version, refs, &key.hkey);
+        if (QCONF_OK != ret) return ret;
+
+        ret = tblval_to_nodeval(tblval, tblval_len, val, val_len);
+        if (QCONF_OK == ret) return ret;
+
+        // data format is broken only if it stays the same
+        if (QCONF_OK == hash_tbl_check_ref(tbl, version)) return ret;
+    }
+
+    return QCONF_ERR_SHM_CHANGED;
+}
+
+int qconf_get_children_ref(const char *path, size_t path_len, const char *&tblval, size_t &tblval_len, uint32_t &version, const char *idc)
+{
+    if (NULL == path || 0 == path_len) return QCONF_ERR_PARAM;
+
+    int ret = init_qconf_env();
+    if (QCONF_OK != ret) return ret;
+
+    char tblkey[QCONF_TBLKEY_MAX_LEN];
+    size_t tblkey_len = 0;
+    ret = get_tblkey_ref(QCONF_DATA_TYPE_SERVICE, path, path_len, idc, tblkey, tblkey_len);
+    if (QCONF_OK != ret) return ret;
+
+    qconf_shm_refs_t *refs = NULL;
+    qhasharr_t *tbl = tbl_of(tblkey, tblkey_len, refs);
+
+    for (int count = 0; count < QCONF_MAX_READ_TIMES; count++)
+    {
+        int nodes_count = 0;
+
+        ret = hash_tbl_get_ref(tbl, tblkey, tblkey_len, tblval, tblval_len, version, refs);
+        if (QCONF_OK != ret) return ret;
+
+        ret = tblval_to_chdnodecount(tblval, tblval_len, nodes_count);
+        if (QCONF_OK == ret) return ret;
+
+        // data format is broken only if it stays the same
+        if (QCONF_OK == hash_tbl_check_ref(tbl, version)) return ret;
+    }
+
+    return QCONF_ERR_SHM_CHANGED;
+}
+
+int qconf_get_stamp(const string &path, char dtype, qconf_stamp_t &stamp, const string &idc, int flags)
+{
+    if (path.empty()) return QCONF_ERR_PARAM;
+
+    int ret = init_qconf_env();
+    if (QCONF_OK != ret) return ret;
+
+    string tmp_idc(idc);
+    if (idc.empty())
+    {
+        ret = qconf_get_localidc(_qconf_hashtbl, tmp_idc);
+        if (QCONF_OK != ret)
+        {
+            LOG_ERR("Failed to get local idc! ret:%d", ret);
+            return ret;
+        }
+    }
+
+    string tblkey;
+    ret = serialize_to_tblkey(dtype, tmp_idc, path, tblkey);
+    if (QCONF_OK != ret) return ret;
+
+    qconf_shm_refs_t *refs = NULL;
+    ret = hash_tbl_get_stamp(tbl_of(tblkey, refs), tblkey, stamp, refs);
+    if (QCONF_OK == ret) return ret;
+
+    // older agent keeps no stamp, digest the value as agent does
+    string tblval;
+    ret = qconf_get_(path, tblval, dtype, tmp_idc, flags);
+    if (QCONF_OK != ret) return ret;
+
+    char digest[QCONF_MD5_INT_LEN] = {0};
+    qhashmd5(tblval.data(), tblval.size(), digest);
+
+    memset(&stamp, 0, sizeof(qconf_stamp_t));
+    memcpy(stamp.digest, digest, QCONF_STAMP_DIGEST_LEN);
+    return QCONF_OK;
+}
+
+int qconf_wait_stamp(const string &path, char dtype, const qconf_stamp_t *known, qconf_stamp_t &stamp, const string &idc, int timeout_ms)
+{
+    if (path.empty() || timeout_ms < 0) return QCONF_ERR_PARAM;
+
+    int ret = init_qconf_env();
+    if (QCONF_OK != ret) return ret;
+
+    string tmp_idc(idc);
+    if (idc.empty())
+    {
+        ret = qconf_get_localidc(_qconf_hashtbl, tmp_idc);
+        if (QCONF_OK != ret)
+        {
+            LOG_ERR("Failed to get local idc! ret:%d", ret);
+            return ret;
+        }
+    }
+
+    string tblkey;
+    ret = serialize_to_tblkey(dtype, tmp_idc, path, tblkey);
+    if (QCONF_OK != ret) return ret;
+
+    struct timespec deadline;
+    get_deadline(timeout_ms, deadline);
+    while (true)
+    {
+        uint32_t gen = shm_gens_get(_qconf_shm_gens, tblkey.data(), tblkey.size());
+        ret = qconf_get_stamp(path, dtype, stamp, tmp_idc, QCONF_NOWAIT);
+        if (QCONF_OK == ret)
+        {
+            if (NULL == known || 0 != memcmp(known->digest, stamp.digest, QCONF_STAMP_DIGEST_LEN))
+                return ret;
+            ret = QCONF_ERR_SAME_VALUE;
+        }
+        else if (QCONF_ERR_NOT_FOUND != ret)
+        {
+            return ret;
+        }
+
+        if (QCONF_ERR_SHM_TIMEOUT == wait_tblkey(tblkey, gen, deadline)) return ret;
+    }
+}
+
+int qconf_journal_head(uint64_t &cursor)
+{
+    int ret = init_qconf_env();
+    if (QCONF_OK != ret) return ret;
+    if (NULL == _qconf_shm_journal) return QCONF_ERR_OTHER;
+
+    cursor = shm_journal_head(_qconf_shm_journal);
+    return QCONF_OK;
+}
+
+int qconf_journal_tail(uint64_t &cursor, qconf_shm_journal_rec_t *recs, int max_recs, int &nrecs)
+{
+    nrecs = 0;
+    int ret = init_qconf_env();
+    if (QCONF_OK != ret) return ret;
+    if (NULL == _qconf_shm_journal) return QCONF_ERR_OTHER;
+
+    return shm_journal_tail(_qconf_shm_journal, cursor, recs, max_recs, nrecs);
+}
+
+int qconf_journal_keyhash(const string &path, char dtype, const string &idc, uint32_t &hash)
+{
+    if (path.empty()) return QCONF_ERR_PARAM;
+
+    int ret = init_qconf_env();
+    if (QCONF_OK != ret) return ret;
+
+    string tmp_idc(idc);
+    if (idc.empty())
+    {
+        ret = qconf_get_localidc(_qconf_hashtbl, tmp_idc);
+        if (QCONF_OK != ret)
+        {
+            LOG_ERR("Failed to get local idc! ret:%d", ret);
+            return ret;
+        }
+    }
+
+    string tblkey;
+    ret = serialize_to_tblkey(dtype, tmp_idc, path, tblkey);
+    if (QCONF_OK != ret) return ret;
+
+    hash = qhashmurmur3_32(tblkey.data(), tblkey.size());
+    return QCONF_OK;
+}
+
+int qconf_list_paths(const string &path, vector<qconf_shm_index_item_t> &items, const string &idc)
+{
+    if (path.empty()) return QCONF_ERR_PARAM;
+
+    int ret = init_qconf_env();
+    if (QCONF_OK != ret) return ret;
+    if (NULL == _qconf_shm_index) return QCONF_ERR_OTHER;
+
+    string tmp_idc(idc);
+    if (idc.empty())
+    {
+        ret = qconf_get_localidc(_qconf_hashtbl, tmp_idc);
+        if (QCONF_OK != ret)
+        {
+            LOG_ERR("Failed to get local idc! ret:%d", ret);
+            return ret;
+        }
+    }
+
+    return shm_index_list(_qconf_shm_index, tmp_idc, path, items);
+}
+
+int qconf_check_ref(const void *ref, uint32_t version)
+{
+    // the table referenced is the one starting nearest below ref
+    qhasharr_t *tbl = _qconf_hashtbl;
+    const char *start = ((const char*)tbl <= (const char*)ref) ? (const char*)tbl : NULL;
+    const qconf_ns_tbls_t *ns_tbls = _qconf_ns_tbls;
+    for (size_t i = 0; NULL != ns_tbls && i < ns_tbls->tbls.size(); i++)
+    {
+        const char *ns_start = (const char*)ns_tbls->tbls[i];
+        if (ns_start > (const char*)ref || (NULL != start && ns_start < start)) continue;
+        tbl = ns_tbls->tbls[i];
+        start = ns_start;
+    }
+    const qconf_replica_tbls_t *replica_tbls = _qconf_replica_tbls;
+    for (int node = 0; NULL != replica_tbls && node < QCONF_SHM_REPLICA_MAX; node++)
+    {
+        const char *replica_start = (const char*)replica_tbls->tbls[node];
+        if (NULL == replica_start || replica_start > (const char*)ref || (NULL != start && replica_start < start)) continue;
+        tbl = replica_tbls->tbls[node];
+        start = replica_start;
+    }
+    return hash_tbl_check_ref(tbl, version);
+}
+
+/**
+ * Format tblkey into buffer, the local idc is referenced in place
+ */
+static int get_tblkey_ref(char dtype, const char *path, size_t path_len, const char *idc, char *tblkey, size_t &tblkey_len)
+{
+    if (NULL != idc)
+        return serialize_to_tblkey(dtype, idc, strlen(idc), path, path_len, tblkey, tblkey_len);
+
+    int ret = QCONF_OK;
+    uint32_t version = 0;
+    for (int count = 0; count < QCONF_MAX_READ_TIMES; count++)
+    {
+        const char *tblval = NULL, *local_idc = NULL;
+        size_t tblval_len = 0, local_idc_len = 0;
+
+        ret = hash_tbl_get_ref(_qconf_hashtbl, QCONF_KEY_TYPE_LOCAL_IDC, sizeof(QCONF_KEY_TYPE_LOCAL_IDC) - 1,
+                tblval, tblval_len, version);
+        if (QCONF_OK == ret) ret = tblval_to_localidc(tblval, tblval_len, local_idc, local_idc_len);
+        if (QCONF_OK == ret) ret = serialize_to_tblkey(dtype, local_idc, local_idc_len, path, path_len, tblkey, tblkey_len);
+        if (QCONF_OK == hash_tbl_check_ref(_qconf_hashtbl, version)) break;
+    }
+    if (QCONF_OK == ret) return ret;
+
+    // local idc is not contiguous in share memory, copy it
+    string tmp_idc;
+    ret = qconf_get_localidc(_qconf_hashtbl, tmp_idc);
+    if (QCONF_OK != ret)
+    {
+        LOG_ERR("Failed to get local idc! ret:%d", ret);
+        return ret;
+    }
+
+    return serialize_to_tblkey(dtype, tmp_idc.data(), tmp_idc.size(), path, path_len, tblkey, tblkey_len);
+}
+
+int qconf_async_init(qconf_async_s &async)
+{
+    async.efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (-1 == async.efd)
+    {
+        LOG_ERR("Failed to create eventfd! errno:%d", errno);
+        return QCONF_ERR_OTHER;
+    }
+    return QCONF_OK;
+}
+
+void qconf_async_close(qconf_async_s &async)
+{
+    pthread_mutex_lock(&_qconf_async_mutex);
+    list<qconf_async_req_t*>::iterator it = _qconf_async_reqs.begin();
+    while (it != _qconf_async_reqs.end())
+    {
+        if (&async != (*it)->async)
+        {
+            ++it;
+            continue;
+        }
+        delete *it;
+        it = _qconf_async_reqs.erase(it);
+    }
+    for (size_t i = 0; i < async.done.size(); i++)
+        free(async.done[i].nodes.data);
+    async.done.clear();
+    pthread_mutex_unlock(&_qconf_async_mutex);
+
+    if (-1 != async.efd) close(async.efd);
+    async.efd = -1;
+}
+
+int qconf_async_submit(qconf_async_s &async, const string &path, char dtype, const string &idc, int timeout_ms,
+        void (*cb)(const struct qconf_async_result *result), void *data)
+{
+    if (path.empty() || timeout_ms < 0) return QCONF_ERR_PARAM;
+
+    int ret = init_qconf_env();
+    if (QCONF_OK != ret) return ret;
+
+    qconf_async_req_t *req = new qconf_async_req_t;
+    req->async = &async;
+    req->cb = cb;
+    req->data = data;
+    ret = qconf_prepare_key(path, dtype, idc, req->key);
+    if (QCONF_OK != ret)
+    {
+        delete req;
+        return ret;
+    }
+    get_deadline(timeout_ms, req->deadline);
+
+    pthread_mutex_lock(&_qconf_async_mutex);
+    // completed at once if it's there or known absent
+    bool done = async_probe(req, NULL);
+    pthread_mutex_unlock(&_qconf_async_mutex);
+    if (done) return QCONF_OK;
+
+    // tried once, a full queue is returned instead of waiting for the agent
+    ret = send_msg(_qconf_msqid, req->key.tblkey, 1);
+
+    pthread_mutex_lock(&_qconf_async_mutex);
+    if (QCONF_OK == ret && !_qconf_async_waiter)
+    {
+        pthread_t tid;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        if (0 == pthread_create(&tid, &attr, async_wait, NULL))
+            _qconf_async_waiter = true;
+        else
+            ret = QCONF_ERR_OTHER;
+        pthread_attr_destroy(&attr);
+    }
+
+    if (QCONF_OK == ret)
+    {
+        _qconf_async_reqs.push_back(req);
+        pthread_cond_signal(&_qconf_async_cond);
+        if (time_before(req->deadline, _qconf_async_until))
+            shm_gens_wake_any(_qconf_shm_gens);
+    }
+    else
+    {
+        LOG_ERR("Failed to wait for path:%s asynchronously, ret:%d", path.c_str(), ret);
+        delete req;
+    }
+    pthread_mutex_unlock(&_qconf_async_mutex);
 
     return ret;
 }
 
+void qconf_async_take(qconf_async_s &async, vector<qconf_async_done_s> &done, size_t max)
+{
+    uint64_t count = 0;
+
+    pthread_mutex_lock(&_qconf_async_mutex);
+    if (-1 == read(async.efd, &count, sizeof(count)) && EAGAIN != errno)
+        LOG_ERR("Failed to read eventfd! errno:%d", errno);
+
+    size_t n = (max < async.done.size()) ? max : async.done.size();
+    done.insert(done.end(), async.done.begin(), async.done.begin() + n);
+    async.done.erase(async.done.begin(), async.done.begin() + n);
+
+    // still readable for the ones left
+    count = 1;
+    if (!async.done.empty() && -1 == write(async.efd, &count, sizeof(count)))
+        LOG_ERR("Failed to write eventfd! errno:%d", errno);
+    pthread_mutex_unlock(&_qconf_async_mutex);
+}
+
+/**
+ * Complete req if its key is got or found absent, or its deadline is before
+ * now, the caller holds _qconf_async_mutex
+ */
+static bool async_probe(qconf_async_req_t *req, const struct timespec *now)
+{
+    string tblval;
+    uint32_t gen = 0;
+    int ret = get_tblval(req->key.tblkey, tblval, gen);
+    if (QCONF_ERR_NOT_FOUND == ret)
+    {
+        if (tblkey_absent(req->key.tblkey))
+            ret = QCONF_ERR_NOT_FOUND;
+        else if (NULL != now && !time_before(*now, req->deadline))
+            ret = QCONF_ERR_SHM_TIMEOUT;
+        else
+            return false;
+    }
+
+    async_complete(req, ret, tblval);
+    return true;
+}
+
+/**
+ * Queue req in the gets completed of its context and free it, the caller
+ * holds _qconf_async_mutex
+ */
+static void async_complete(qconf_async_req_t *req, int ret, const string &tblval)
+{
+    qconf_async_s &async = *req->async;
+    async.done.push_back(qconf_async_done_s());
+
+    qconf_async_done_s &done = async.done.back();
+    done.ret = ret;
+    done.dtype = req->key.dtype;
+    done.nodes.count = 0;
+    done.nodes.data = NULL;
+    done.cb = req->cb;
+    done.data = req->data;
+    if (QCONF_OK == ret)
+    {
+        size_t len = 0;
+        if (QCONF_DATA_TYPE_NODE == done.dtype)
+            done.ret = tblval_to_nodeval(tblval, done.value);
+        else
+            done.ret = unpack_vectorval(tblval, done.dtype, done.nodes, NULL, len);
+    }
+
+    uint64_t count = 1;
+    if (-1 == write(async.efd, &count, sizeof(count)))
+        LOG_ERR("Failed to write eventfd! errno:%d", errno);
+    delete req;
+}
+
+/**
+ * The waiter thread, it checks the gets waited for whenever the agent writes
+ * any key or the first deadline passes
+ */
+static void *async_wait(void *arg)
+{
+    pthread_mutex_lock(&_qconf_async_mutex);
+    while (true)
+    {
+        while (_qconf_async_reqs.empty())
+            pthread_cond_wait(&_qconf_async_cond, &_qconf_async_mutex);
+
+        // the agent may resize the table while setting the values
+        init_shm();
+        // read before the keys, so no write after them is missed
+        qconf_shm_gens_t *gens = _qconf_shm_gens;
+        uint32_t gen = shm_gens_get_any(gens);
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        const qconf_async_req_t *first = NULL;
+        list<qconf_async_req_t*>::iterator it = _qconf_async_reqs.begin();
+        while (it != _qconf_async_reqs.end())
+        {
+            if (async_probe(*it, &now))
+            {
+                it = _qconf_async_reqs.erase(it);
+                continue;
+            }
+            if (NULL == first || time_before((*it)->deadline, first->deadline)) first = *it;
+            ++it;
+        }
+        if (NULL == first) continue;
+
+        struct timespec deadline;
+        get_deadline((NULL == gens) ? QCONF_ASYNC_POLL_MS : QCONF_ASYNC_WAIT_MS, deadline);
+        if (time_before(first->deadline, deadline)) deadline = first->deadline;
+
+        _qconf_async_until = deadline;
+        pthread_mutex_unlock(&_qconf_async_mutex);
+        if (NULL != gens)
+            shm_gens_wait_any(gens, gen, deadline);
+        else
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+        pthread_mutex_lock(&_qconf_async_mutex);
+        _qconf_async_until.tv_sec = 0;
+        _qconf_async_until.tv_nsec = 0;
+    }
+
+    return NULL;
+}
+
+static bool time_before(const struct timespec &a, const struct timespec &b)
+{
+    return a.tv_sec < b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_nsec < b.tv_nsec);
+}
+
 static int send_msg_to_agent(int msqid, const string &idc, const string &path, char data_type)
 {
     string tblkey;
@@ -259,3 +1711,22 @@ static int send_msg_to_agent(int msqid, const string &idc, const string &path, c
     int ret = send_msg(msqid, tblkey);
     return ret;
 }
+
+static int send_keys_to_agent(int msqid, const vector<string> &tblkeys)
+{
+    // agents of older versions know a single key only, they publish no
+    // generation words either as the words came before batched messages
+    int ret = QCONF_OK;
+    if (1 == tblkeys.size() || NULL == _qconf_shm_gens)
+    {
+        for (size_t i = 0; QCONF_OK == ret && i < tblkeys.size(); i++)
+            ret = send_msg(msqid, tblkeys[i]);
+        return ret;
+    }
+
+    vector<string> msgs;
+    ret = tblkeys_to_msgs(tblkeys, msgs);
+    for (size_t i = 0; QCONF_OK == ret && i < msgs.size(); i++)
+        ret = send_msg(msqid, msgs[i]);
+    return ret;
+}
@@ -5,12 +5,15 @@
 extern "C" {
 #endif
 
+#include <stdint.h>
 #include <stdbool.h>
 
 #include <string>
+#include <vector>
 
 #include "qconf_common.h"
 #include "driver_common.h"
+#include "qlibc/qlibc.h"
 
 // zookeeper event type constants
 #define CREATED_EVENT_DEF            1
@@ -47,6 +50,20 @@ int init_qconf_env();
  */
 int qconf_get(const std::string &path, std::string &buf, const std::string &idc, int flags);
 
+/**
+ * get the values of several paths as of one moment, nodes published by
+ * the agent together are got all or none. It holds within one table of
+ * share memory, and only if the agent creates it in format 1 or 2
+ *
+ * @param bufs: the values got, one for each path
+ * @param rets: the result of each path, same as qconf_get
+ *
+ * @return: if every value is got, return QCONF_OK
+ *          if the share memory keeps changing, return QCONF_ERR_SHM_CHANGED
+ *          other failed, the first failure in rets
+ */
+int qconf_get_multi(const std::vector<std::string> &paths, std::vector<std::string> &bufs, std::vector<int> &rets, const std::string &idc, int flags);
+
 /**
  * get the available services of path
  *
@@ -72,6 +89,25 @@ int qconf_get(const std::string &path, std::string &buf, const std::string &idc,
  */
 int qconf_get_children(const std::string &path, string_vector_t &nodes, const std::string &idc, int flags);
 
+/**
+ * get the value of service path as it's kept in the share memory, children
+ * nodes are got from it by tblval_to_chdnode
+ *
+ * @return: same as qconf_get_children
+ */
+int qconf_get_children_val(const std::string &path, std::string &tblval, const std::string &idc, int flags);
+
+/**
+ * reference the value of service path in the share memory without copying it
+ *
+ * @param tblval: point to the value inside the share memory
+ * @param version: version of the share memory when the value was referenced,
+ *                 call qconf_check_ref with it after using the value
+ *
+ * @return: same as qconf_get_ref
+ */
+int qconf_get_children_ref(const char *path, size_t path_len, const char *&tblval, size_t &tblval_len, uint32_t &version, const char *idc);
+
 /**
  * get the children nodes of path including node's key and node's value
  *
@@ -109,6 +145,228 @@ int qconf_get_batchnode(const std::string &path, qconf_batch_nodes &bnodes, cons
  */
 int qconf_get_batchnode_keys(const std::string &path, string_vector_t &nodes, const std::string &idc, int flags);
 
+/**
+ * get the children services, the keys of children nodes or the children
+ * nodes of path packed into one buffer, see tblval_to_packed_chdnodeval
+ *
+ * @param buf: the buffer to pack into, if it's NULL one is allocated and
+ *             kept at the head of the result, it's freed at once by free
+ * @param buf_len: the capacity of buf, and the bytes used once packed
+ *
+ * @return: same as qconf_get_children
+ *          if buf is not NULL and it's not enough, return QCONF_ERR_BUF_NOT_ENOUGH
+ *          with the size needed kept in buf_len
+ */
+int qconf_get_children_packed(const std::string &path, string_vector_t &nodes, char *buf, size_t &buf_len, const std::string &idc, int flags);
+int qconf_get_batchnode_keys_packed(const std::string &path, string_vector_t &nodes, char *buf, size_t &buf_len, const std::string &idc, int flags);
+int qconf_get_batchnode_packed(const std::string &path, qconf_batch_nodes &bnodes, char *buf, size_t &buf_len, const std::string &idc, int flags);
+
+/**
+ * reference the value of path in the share memory without copying it
+ *
+ * @param path: the path like '/a/b/c' that kept in the zookeeper
+ * @param path_len: the length of path
+ * @param val: point to the value inside the share memory
+ * @param val_len: the length of value
+ * @param version: version of the share memory when the value was referenced,
+ *                 call qconf_check_ref with it after using the value, which
+ *                 is to be done in 10 seconds: share memory replaced by the
+ *                 agent is detached then
+ * @param idc:  the place to get the value, NULL for local idc
+ *
+ * @return: if success, return QCONF_OK
+ *          if the value is not kept contiguous in the share memory, return QCONF_ERR_SHM_SPLIT
+ *          if the value is not in the share memory, return QCONF_ERR_NOT_FOUND, agent is not notified
+ *          if path is NULL, return QCONF_ERR_PARAM
+ *          other failed, return QCONF_ERR_OTHER
+ */
+int qconf_get_ref(const char *path, size_t path_len, const char *&val, size_t &val_len, uint32_t &version, const char *idc);
+
+/**
+ * check whether the value referenced by qconf_get_ref is still valid
+ *
+ * @param ref: the value returned by qconf_get_ref, it tells the table of it
+ * @param version: the version returned by qconf_get_ref
+ *
+ * @return: if the value is not changed, return QCONF_OK
+ *          if the share memory changed since then, return QCONF_ERR_SHM_CHANGED
+ */
+int qconf_check_ref(const void *ref, uint32_t version);
+
+/**
+ * path prepared by qconf_prepare_key, the tblkey is built and hashed once and
+ * the slot it's found at is remembered
+ */
+struct qconf_key_s
+{
+    char dtype;
+    std::string path;           // path normalized
+    std::string idc;            // idc of tblkey, the local idc is looked up once
+    std::string tblkey;
+    qhasharr_key_t hkey;
+};
+
+/**
+ * prepare path for getting it repeatedly by qconf_get_key
+ *
+ * @param dtype: QCONF_DATA_TYPE_NODE or QCONF_DATA_TYPE_SERVICE
+ * @param idc:  the place to get the value, empty for local idc
+ *
+ * @return: if success, return QCONF_OK
+ *          if get idc failed, return QCONF_ERR_GET_IDC
+ *          other failed, return QCONF_ERR_OTHER
+ */
+int qconf_prepare_key(const std::string &path, char dtype, const std::string &idc, struct qconf_key_s &key);
+
+/**
+ * get the value of a prepared key as it's kept in the share memory, the slot
+ * it was found at last is checked first
+ *
+ * @return: same as qconf_get
+ */
+int qconf_get_key(struct qconf_key_s &key, std::string &tblval, int flags);
+
+/**
+ * Get child nodes of a key prepared by qconf_prepare_key
+ *
+ * @return: same as qconf_get_children
+ */
+int qconf_get_key_children(struct qconf_key_s &key, string_vector_t &nodes, int flags);
+
+/**
+ * reference the value of a prepared key of QCONF_DATA_TYPE_NODE in the share
+ * memory without copying it
+ *
+ * @return: same as qconf_get_ref
+ */
+int qconf_get_key_ref(struct qconf_key_s &key, const char *&val, size_t &val_len, uint32_t &version);
+
+/**
+ * get the version stamp of the value of path
+ *
+ * @param dtype: QCONF_DATA_TYPE_NODE or QCONF_DATA_TYPE_SERVICE
+ * @param stamp: the stamp kept by agent beside the value, only the digest is
+ *               set if agent keeps none, it's the md5 of the value then
+ * @param flags: same as qconf_get
+ *
+ * @return: same as qconf_get
+ */
+int qconf_get_stamp(const std::string &path, char dtype, struct qconf_stamp_s &stamp, const std::string &idc, int flags);
+
+/**
+ * wait until the value of path changes from the one of known
+ *
+ * @param known: the stamp got before, NULL to wait until the value is got
+ * @param stamp: the stamp of the value changed
+ * @param timeout_ms: how long to wait at most
+ *
+ * @return: if the value changes, return QCONF_OK
+ *          if the value stays the one of known till timeout, return QCONF_ERR_SAME_VALUE
+ *          if the value is not got till timeout, return QCONF_ERR_NOT_FOUND
+ *          other failed, same as qconf_get_stamp
+ */
+int qconf_wait_stamp(const std::string &path, char dtype, const struct qconf_stamp_s *known, struct qconf_stamp_s &stamp, const std::string &idc, int timeout_ms);
+
+/**
+ * get the position of the newest write in the change journal of the share
+ * memory, tailing from it gets the writes from now on
+ *
+ * @return: if success, return QCONF_OK
+ *          if the agent keeps no journal, return QCONF_ERR_OTHER
+ */
+int qconf_journal_head(uint64_t &cursor);
+
+/**
+ * tail the change journal from cursor, cursor is moved past the records got
+ *
+ * @param recs: the place to keep the records
+ * @param max_recs: the number of records recs keeps at most
+ * @param nrecs: the number of records got
+ *
+ * @return: if success, return QCONF_OK
+ *          if records after cursor were rewritten before they were got, return
+ *          QCONF_ERR_SHM_OVERRUN, cursor is moved to the newest write then
+ *          if the agent keeps no journal, return QCONF_ERR_OTHER
+ */
+int qconf_journal_tail(uint64_t &cursor, struct qconf_shm_journal_rec_s *recs, int max_recs, int &nrecs);
+
+/**
+ * get the hash the journal records for the writes of path
+ */
+int qconf_journal_keyhash(const std::string &path, char dtype, const std::string &idc, uint32_t &hash);
+
+/**
+ * get the paths kept in the share memory which are path or under it
+ *
+ * @param items: the paths got, sorted
+ * @param idc:  the place to get the paths
+ *
+ * @return: if success, return QCONF_OK
+ *          if some paths were dropped by the index of the agent once it was
+ *          full, return QCONF_ERR_SHM_INDEX_FULL, the others are still got
+ *          if the agent keeps no index, return QCONF_ERR_OTHER
+ */
+int qconf_list_paths(const std::string &path, std::vector<struct qconf_shm_index_item_s> &items, const std::string &idc);
+
+/**
+ * a get completed asynchronously, see qconf_async_submit
+ */
+struct qconf_async_result;
+
+struct qconf_async_done_s
+{
+    int ret;                    // QCONF_OK, QCONF_ERR_NOT_FOUND if it's absent,
+                                // QCONF_ERR_SHM_TIMEOUT if the deadline passed
+    char dtype;                 // QCONF_DATA_TYPE_NODE or QCONF_DATA_TYPE_SERVICE
+    std::string value;          // the conf of QCONF_DATA_TYPE_NODE
+    string_vector_t nodes;      // the services of QCONF_DATA_TYPE_SERVICE, packed
+    void (*cb)(const struct qconf_async_result *result);
+    void *data;
+};
+
+/**
+ * context of asynchronous gets, its eventfd is readable while it keeps gets
+ * completed and not taken yet
+ */
+struct qconf_async_s
+{
+    int efd;
+    std::vector<struct qconf_async_done_s> done;    // completed, not taken yet
+    std::vector<struct qconf_async_done_s> taken;   // taken by the last poll, kept until the next one
+};
+
+/**
+ * init or close the context of asynchronous gets, the gets of it still
+ * waited for are dropped once it's closed
+ *
+ * @return: if success, return QCONF_OK
+ *          if the eventfd is not created, return QCONF_ERR_OTHER
+ */
+int qconf_async_init(struct qconf_async_s &async);
+void qconf_async_close(struct qconf_async_s &async);
+
+/**
+ * get path without waiting for it. It's completed at once if it's in the
+ * share memory or the agent has found it absent; otherwise the agent is
+ * asked for it, and the waiter thread of the process completes it once the
+ * agent sets it or the deadline passes
+ *
+ * @param dtype: QCONF_DATA_TYPE_NODE or QCONF_DATA_TYPE_SERVICE
+ * @param timeout_ms: the deadline of the get from now on
+ *
+ * @return: if the get is completed or waited for, return QCONF_OK
+ *          if get idc failed, return QCONF_ERR_GET_IDC
+ *          if the message is not sent to agent, return the error of it,
+ *          QCONF_ERR_MSGFULL if the queue is full as it's not waited for
+ */
+int qconf_async_submit(struct qconf_async_s &async, const std::string &path, char dtype, const std::string &idc, int timeout_ms,
+        void (*cb)(const struct qconf_async_result *result), void *data);
+
+/**
+ * take at most max gets completed, the eventfd stays readable if any is left
+ */
+void qconf_async_take(struct qconf_async_s &async, std::vector<struct qconf_async_done_s> &done, size_t max);
+
 #ifdef __cplusplus
 }
 #endif
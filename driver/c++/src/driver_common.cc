@@ -23,6 +23,18 @@ int destroy_qconf_batch_nodes(qconf_batch_nodes *bnodes)
     return QCONF_OK;
 }
 
+int destroy_packed_qconf_batch_nodes(qconf_batch_nodes *bnodes)
+{
+    if (NULL == bnodes) return QCONF_ERR_PARAM;
+
+    // the keys and values are packed behind the array
+    free(bnodes->nodes);
+    bnodes->nodes = NULL;
+    bnodes->count = 0;
+
+    return QCONF_OK;
+}
+
 void free_qconf_batch_nodes(qconf_batch_nodes *bnodes, size_t free_size)
 {
     if (NULL == bnodes) return;
@@ -1,15 +1,21 @@
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
 #include <string.h>
 #include <unistd.h>
 #include <zookeeper.h>
 
 #include <string>
+#include <vector>
 
 #include "qconf.h"
 #include "qconf_log.h"
 #include "driver_api.h"
 #include "qconf_errno.h"
+#include "qconf_format.h"
+#include "qconf_shm.h"
+#include "qconf_cache.h"
 #include "driver_common.h"
 
 using namespace std;
@@ -19,11 +25,22 @@ static int qconf_get_batch_keys_native_(const char *path, string_vector_t *nodes
 #endif
 
 static int get_node_path(const string &path, string &real_path);
+static int get_node_path(const char *path, char *real_path, size_t real_path_size, size_t &real_path_len);
+static int trim_node_path(const char *path, size_t path_len, const char *&start_pos, size_t &deal_path_len);
+static int qconf_get_conf_view_(const char *path, qconf_conf_view *view, const char *idc, int flags);
 static int qconf_get_conf_(const char *path, char *buf, size_t buf_len, const char *idc, int flags);
 static int qconf_get_batch_conf_(const char *path, qconf_batch_nodes *bnodes, const char *idc, int flags);
 static int qconf_get_batch_keys_(const char *path, string_vector_t *nodes, const char *idc, int flags);
 static int qconf_get_allhost_(const char *path, string_vector_t *nodes, const char *idc, int flags);
+static int qconf_get_allhost_view_(const char *path, qconf_hosts_view *view, const char *idc, int flags);
 static int qconf_get_host_(const char *path, char *buf, size_t buf_len, const char *idc, int flags);
+static int qconf_get_version_(const char *path, char dtype, qconf_data_version *version, const char *idc);
+static int qconf_wait_change_(const char *path, char dtype, const qconf_data_version *known, int timeout_ms, qconf_data_version *version, const char *idc);
+static int qconf_get_change_hash_(const char *path, char dtype, const char *idc, unsigned int *hash);
+static int copy_to_conf_view(const string &val, qconf_conf_view *view);
+static int qconf_get_packed_(const char *path, char dtype, string_vector_t *nodes, qconf_batch_nodes *bnodes, char *buf, size_t *buf_len, const char *idc);
+static void async_to_result(const qconf_async_done_s &done, qconf_async_result &result);
+static void async_free(vector<qconf_async_done_s> &done);
 
 int qconf_init()
 {
@@ -55,11 +72,65 @@ int destroy_string_vector(string_vector_t *nodes)
     return QCONF_OK;
 }
 
+int destroy_packed_string_vector(string_vector_t *nodes)
+{
+    if (NULL == nodes) return QCONF_ERR_PARAM;
+
+    // the services are packed behind the array
+    free(nodes->data);
+
+    nodes->count = 0;
+    nodes->data = NULL;
+    return QCONF_OK;
+}
+
 int qconf_get_conf(const char *path, char *buf, unsigned int buf_len, const char *idc)
 {
     return qconf_get_conf_(path, buf, buf_len, idc, QCONF_WAIT);
 }
 
+int qconf_get_confs(const char **paths, int count, char **bufs, const unsigned int *buf_lens, int *rets, const char *idc)
+{
+    if (NULL == paths || count <= 0 || NULL == bufs || NULL == buf_lens || NULL == rets)
+        return QCONF_ERR_PARAM;
+
+    string tmp_idc;
+    vector<string> real_paths(count), tmp_bufs;
+    vector<int> tmp_rets;
+    for (int i = 0; i < count; i++)
+    {
+        if (NULL == paths[i] || '\0' == *paths[i] || NULL == bufs[i]) return QCONF_ERR_PARAM;
+        int ret = get_node_path(string(paths[i]), real_paths[i]);
+        if (QCONF_OK != ret) return ret;
+    }
+
+    if (NULL != idc) tmp_idc.assign(idc);
+
+    int ret = qconf_get_multi(real_paths, tmp_bufs, tmp_rets, tmp_idc, QCONF_WAIT);
+    // per path results are kept only once all of them are got together
+    if ((int)tmp_bufs.size() != count) return ret;
+
+    ret = QCONF_OK;
+    for (int i = 0; i < count; i++)
+    {
+        rets[i] = tmp_rets[i];
+        if (QCONF_OK == rets[i] && tmp_bufs[i].size() >= buf_lens[i])
+        {
+            LOG_ERR("buf is not enough! value len:%zd, buf len:%u",
+                    tmp_bufs[i].size(), buf_lens[i]);
+            rets[i] = QCONF_ERR_BUF_NOT_ENOUGH;
+        }
+        if (QCONF_OK == rets[i])
+        {
+            memcpy(bufs[i], tmp_bufs[i].data(), tmp_bufs[i].size());
+            bufs[i][tmp_bufs[i].size()] = '\0';
+        }
+        if (QCONF_OK == ret) ret = rets[i];
+    }
+
+    return ret;
+}
+
 int qconf_aget_conf(const char *path, char *buf, unsigned int buf_len, const char *idc)
 {
     return qconf_get_conf_(path, buf, buf_len, idc, QCONF_NOWAIT);
@@ -117,6 +188,432 @@ int qconf_aget_host(const char *path, char *buf, unsigned int buf_len, const cha
     return qconf_get_host_(path, buf, buf_len, idc, QCONF_NOWAIT);
 }
 
+int init_qconf_conf_view(qconf_conf_view *view)
+{
+    if (NULL == view) return QCONF_ERR_PARAM;
+
+    memset((void*)view, 0, sizeof(qconf_conf_view));
+    return QCONF_OK;
+}
+
+int destroy_qconf_conf_view(qconf_conf_view *view)
+{
+    if (NULL == view) return QCONF_ERR_PARAM;
+
+    free(view->buf);
+    memset((void*)view, 0, sizeof(qconf_conf_view));
+    return QCONF_OK;
+}
+
+int qconf_get_conf_view(const char *path, qconf_conf_view *view, const char *idc)
+{
+    return qconf_get_conf_view_(path, view, idc, QCONF_WAIT);
+}
+
+int qconf_aget_conf_view(const char *path, qconf_conf_view *view, const char *idc)
+{
+    return qconf_get_conf_view_(path, view, idc, QCONF_NOWAIT);
+}
+
+int qconf_check_conf_view(const qconf_conf_view *view)
+{
+    if (NULL == view || NULL == view->data) return QCONF_ERR_PARAM;
+
+    // the copy is owned by view, it never changes
+    if (view->data == view->buf) return QCONF_OK;
+
+    return qconf_check_ref(view->data, view->version);
+}
+
+int init_qconf_hosts_view(qconf_hosts_view *view)
+{
+    if (NULL == view) return QCONF_ERR_PARAM;
+
+    memset((void*)view, 0, sizeof(qconf_hosts_view));
+    return QCONF_OK;
+}
+
+int destroy_qconf_hosts_view(qconf_hosts_view *view)
+{
+    if (NULL == view) return QCONF_ERR_PARAM;
+
+    free(view->buf);
+    memset((void*)view, 0, sizeof(qconf_hosts_view));
+    return QCONF_OK;
+}
+
+int qconf_get_allhost_view(const char *path, qconf_hosts_view *view, const char *idc)
+{
+    return qconf_get_allhost_view_(path, view, idc, QCONF_WAIT);
+}
+
+int qconf_aget_allhost_view(const char *path, qconf_hosts_view *view, const char *idc)
+{
+    return qconf_get_allhost_view_(path, view, idc, QCONF_NOWAIT);
+}
+
+int qconf_hosts_view_at(const qconf_hosts_view *view, int i, const char **host, size_t *len)
+{
+    if (NULL == view || NULL == view->data || NULL == host || NULL == len)
+        return QCONF_ERR_PARAM;
+    if (i < 0 || i >= view->count) return QCONF_ERR_PARAM;
+
+    const char *node = NULL;
+    size_t node_len = 0;
+    int ret = tblval_to_chdnode(view->data, view->len, i, node, node_len);
+    if (QCONF_OK != ret) return QCONF_ERR_OTHER;
+
+    *host = node;
+    *len = node_len;
+    return QCONF_OK;
+}
+
+int qconf_check_hosts_view(const qconf_hosts_view *view)
+{
+    if (NULL == view || NULL == view->data) return QCONF_ERR_PARAM;
+
+    // the copy is owned by view, it never changes
+    if (view->data == view->buf) return QCONF_OK;
+
+    return qconf_check_ref(view->data, view->version);
+}
+
+int qconf_get_conf_version(const char *path, qconf_data_version *version, const char *idc)
+{
+    return qconf_get_version_(path, QCONF_DATA_TYPE_NODE, version, idc);
+}
+
+int qconf_get_allhost_version(const char *path, qconf_data_version *version, const char *idc)
+{
+    return qconf_get_version_(path, QCONF_DATA_TYPE_SERVICE, version, idc);
+}
+
+int qconf_get_conf_if_changed(const char *path, const qconf_data_version *known, char *buf, unsigned int buf_len, qconf_data_version *version, const char *idc)
+{
+    if (NULL == buf) return QCONF_ERR_PARAM;
+
+    int ret = qconf_get_version_(path, QCONF_DATA_TYPE_NODE, version, idc);
+    if (QCONF_OK != ret) return ret;
+
+    if (NULL != known && 0 == memcmp(known->digest, version->digest, sizeof(version->digest)))
+        return QCONF_ERR_SAME_VALUE;
+
+    // the conf may change again after the version is got, then it's got
+    // again next time
+    return qconf_get_conf_(path, buf, buf_len, idc, QCONF_WAIT);
+}
+
+int qconf_get_allhost_if_changed(const char *path, const qconf_data_version *known, string_vector_t *nodes, qconf_data_version *version, const char *idc)
+{
+    if (NULL == nodes) return QCONF_ERR_PARAM;
+
+    int ret = qconf_get_version_(path, QCONF_DATA_TYPE_SERVICE, version, idc);
+    if (QCONF_OK != ret) return ret;
+
+    if (NULL != known && 0 == memcmp(known->digest, version->digest, sizeof(version->digest)))
+        return QCONF_ERR_SAME_VALUE;
+
+    return qconf_get_allhost_(path, nodes, idc, QCONF_WAIT);
+}
+
+int qconf_wait_change(const char *path, const qconf_data_version *known, int timeout_ms, qconf_data_version *version, const char *idc)
+{
+    return qconf_wait_change_(path, QCONF_DATA_TYPE_NODE, known, timeout_ms, version, idc);
+}
+
+int qconf_wait_allhost_change(const char *path, const qconf_data_version *known, int timeout_ms, qconf_data_version *version, const char *idc)
+{
+    return qconf_wait_change_(path, QCONF_DATA_TYPE_SERVICE, known, timeout_ms, version, idc);
+}
+
+int qconf_get_changes_cursor(unsigned long long *cursor)
+{
+    if (NULL == cursor) return QCONF_ERR_PARAM;
+
+    uint64_t head = 0;
+    int ret = qconf_journal_head(head);
+    if (QCONF_OK != ret) return ret;
+
+    *cursor = head;
+    return ret;
+}
+
+int qconf_get_changes(unsigned long long *cursor, qconf_change *changes, int *count)
+{
+    if (NULL == cursor || NULL == changes || NULL == count || *count <= 0)
+        return QCONF_ERR_PARAM;
+
+    vector<qconf_shm_journal_rec_t> recs(*count);
+    uint64_t tmp_cursor = *cursor;
+    int nrecs = 0;
+    int ret = qconf_journal_tail(tmp_cursor, &recs[0], *count, nrecs);
+    *cursor = tmp_cursor;
+    *count = nrecs;
+    if (QCONF_OK != ret) return ret;
+
+    for (int i = 0; i < nrecs; i++)
+    {
+        changes[i].seq = recs[i].seq;
+        changes[i].hash = recs[i].keyhash;
+        changes[i].type = recs[i].type;
+    }
+    return ret;
+}
+
+int qconf_get_conf_hash(const char *path, const char *idc, unsigned int *hash)
+{
+    return qconf_get_change_hash_(path, QCONF_DATA_TYPE_NODE, idc, hash);
+}
+
+int qconf_get_allhost_hash(const char *path, const char *idc, unsigned int *hash)
+{
+    return qconf_get_change_hash_(path, QCONF_DATA_TYPE_SERVICE, idc, hash);
+}
+
+int qconf_get_batch_keys_hash(const char *path, const char *idc, unsigned int *hash)
+{
+    return qconf_get_change_hash_(path, QCONF_DATA_TYPE_BATCH_NODE, idc, hash);
+}
+
+int qconf_prepare(const char *path, const char *idc, int type, qconf_key_t **key)
+{
+    if (NULL == path || '\0' == *path || NULL == key)
+        return QCONF_ERR_PARAM;
+
+    char dtype = QCONF_DATA_TYPE_NODE;
+    if (QCONF_KEY_ALLHOST == type)
+        dtype = QCONF_DATA_TYPE_SERVICE;
+    else if (QCONF_KEY_CONF != type)
+        return QCONF_ERR_PARAM;
+
+    string real_path;
+    string tmp_idc;
+    int ret = get_node_path(string(path), real_path);
+    if (QCONF_OK != ret) return ret;
+
+    if (NULL != idc) tmp_idc.assign(idc);
+
+    qconf_key_t *tmp_key = new qconf_key_t;
+    ret = qconf_prepare_key(real_path, dtype, tmp_idc, *tmp_key);
+    if (QCONF_OK != ret)
+    {
+        LOG_ERR("Failed to prepare key! ret:%d, path:%s", ret, path);
+        delete tmp_key;
+        return ret;
+    }
+
+    *key = tmp_key;
+    return ret;
+}
+
+int destroy_qconf_key(qconf_key_t *key)
+{
+    if (NULL == key) return QCONF_ERR_PARAM;
+
+    delete key;
+    return QCONF_OK;
+}
+
+int qconf_get_prepared(qconf_key_t *key, char *buf, unsigned int buf_len)
+{
+    if (NULL == key || NULL == buf || QCONF_DATA_TYPE_NODE != key->dtype)
+        return QCONF_ERR_PARAM;
+
+    string tblval;
+    int ret = qconf_get_key(*key, tblval, QCONF_WAIT);
+    if (QCONF_OK != ret) return ret;
+
+    const char *val = NULL;
+    size_t val_len = 0;
+    ret = tblval_to_nodeval(tblval.data(), tblval.size(), val, val_len);
+    if (QCONF_OK != ret) return ret;
+
+    if (val_len >= buf_len)
+    {
+        LOG_ERR("buf is not enough! value len:%zd, buf len:%u", val_len, buf_len);
+        return QCONF_ERR_BUF_NOT_ENOUGH;
+    }
+
+    memcpy(buf, val, val_len);
+    buf[val_len] = '\0';
+
+    return ret;
+}
+
+int qconf_get_prepared_view(qconf_key_t *key, qconf_conf_view *view)
+{
+    if (NULL == key || NULL == view || QCONF_DATA_TYPE_NODE != key->dtype)
+        return QCONF_ERR_PARAM;
+
+    uint32_t version = 0;
+    view->data = NULL;
+    view->len = 0;
+
+    int ret = qconf_get_key_ref(*key, view->data, view->len, version);
+    if (QCONF_OK == ret)
+    {
+        view->version = version;
+        return ret;
+    }
+    if (QCONF_ERR_NOT_FOUND != ret && QCONF_ERR_SHM_SPLIT != ret && QCONF_ERR_SHM_CHANGED != ret)
+        return ret;
+
+    // value is not in one piece of share memory or not cached yet, copy it
+    string tblval, tmp_buf;
+    ret = qconf_get_key(*key, tblval, QCONF_WAIT);
+    if (QCONF_OK == ret) ret = tblval_to_nodeval(tblval, tmp_buf);
+    if (QCONF_OK != ret)
+    {
+        view->data = NULL;
+        view->len = 0;
+        return ret;
+    }
+
+    return copy_to_conf_view(tmp_buf, view);
+}
+
+int qconf_get_prepared_allhost(qconf_key_t *key, string_vector_t *nodes)
+{
+    if (NULL == key || NULL == nodes || QCONF_DATA_TYPE_SERVICE != key->dtype)
+        return QCONF_ERR_PARAM;
+
+    if (0 != nodes->count) destroy_string_vector(nodes);
+
+    int ret = qconf_get_key_children(*key, *nodes, QCONF_WAIT);
+    if (QCONF_OK != ret)
+    {
+        LOG_ERR("Failed to get children services! ret:%d", ret);
+        return ret;
+    }
+
+    return ret;
+}
+
+int qconf_enable_cache(size_t max_bytes)
+{
+    qconf_cache_set_max(max_bytes);
+    return QCONF_OK;
+}
+
+int qconf_get_cache_stats(qconf_cache_stats *stats)
+{
+    if (NULL == stats) return QCONF_ERR_PARAM;
+
+    qconf_cache_stat_t stat;
+    qconf_cache_get_stat(stat);
+    stats->hits = stat.hits;
+    stats->misses = stat.misses;
+    stats->stales = stat.stales;
+    stats->evictions = stat.evictions;
+    stats->entries = stat.entries;
+    stats->bytes = stat.bytes;
+    return QCONF_OK;
+}
+
+int qconf_get_allhost_packed(const char *path, string_vector_t *nodes, char *buf, size_t *buf_len, const char *idc)
+{
+    if (NULL == nodes) return QCONF_ERR_PARAM;
+    return qconf_get_packed_(path, QCONF_DATA_TYPE_SERVICE, nodes, NULL, buf, buf_len, idc);
+}
+
+int qconf_get_batch_keys_packed(const char *path, string_vector_t *nodes, char *buf, size_t *buf_len, const char *idc)
+{
+    if (NULL == nodes) return QCONF_ERR_PARAM;
+    return qconf_get_packed_(path, QCONF_DATA_TYPE_BATCH_NODE, nodes, NULL, buf, buf_len, idc);
+}
+
+int qconf_get_batch_conf_packed(const char *path, qconf_batch_nodes *bnodes, char *buf, size_t *buf_len, const char *idc)
+{
+    if (NULL == bnodes) return QCONF_ERR_PARAM;
+    return qconf_get_packed_(path, QCONF_DATA_TYPE_NODE, NULL, bnodes, buf, buf_len, idc);
+}
+
+int qconf_async_create(qconf_async_t **async)
+{
+    if (NULL == async) return QCONF_ERR_PARAM;
+
+    qconf_async_t *tmp_async = new qconf_async_t;
+    int ret = qconf_async_init(*tmp_async);
+    if (QCONF_OK != ret)
+    {
+        delete tmp_async;
+        return ret;
+    }
+
+    *async = tmp_async;
+    return ret;
+}
+
+int qconf_async_destroy(qconf_async_t *async)
+{
+    if (NULL == async) return QCONF_ERR_PARAM;
+
+    qconf_async_close(*async);
+    async_free(async->taken);
+    delete async;
+    return QCONF_OK;
+}
+
+int qconf_async_fd(const qconf_async_t *async)
+{
+    return (NULL == async) ? -1 : async->efd;
+}
+
+int qconf_async_get(qconf_async_t *async, const char *path, const char *idc, int type, int timeout_ms, qconf_async_cb cb, void *data)
+{
+    if (NULL == async || NULL == path || '\0' == *path)
+        return QCONF_ERR_PARAM;
+
+    char dtype = QCONF_DATA_TYPE_NODE;
+    if (QCONF_KEY_ALLHOST == type)
+        dtype = QCONF_DATA_TYPE_SERVICE;
+    else if (QCONF_KEY_CONF != type)
+        return QCONF_ERR_PARAM;
+
+    string real_path;
+    string tmp_idc;
+    int ret = get_node_path(string(path), real_path);
+    if (QCONF_OK != ret) return ret;
+
+    if (NULL != idc) tmp_idc.assign(idc);
+
+    return qconf_async_submit(*async, real_path, dtype, tmp_idc, timeout_ms, cb, data);
+}
+
+int qconf_async_poll(qconf_async_t *async, qconf_async_result *results, int *count)
+{
+    if (NULL == async || NULL == results || NULL == count || *count < 0)
+        return QCONF_ERR_PARAM;
+
+    async_free(async->taken);
+    qconf_async_take(*async, async->taken, *count);
+    for (size_t i = 0; i < async->taken.size(); i++)
+        async_to_result(async->taken[i], results[i]);
+
+    *count = async->taken.size();
+    return QCONF_OK;
+}
+
+int qconf_async_dispatch(qconf_async_t *async)
+{
+    if (NULL == async) return QCONF_ERR_PARAM;
+
+    // callbacks may get again through async, nothing is locked while they run
+    vector<qconf_async_done_s> done;
+    qconf_async_take(*async, done, (size_t)-1);
+    for (size_t i = 0; i < done.size(); i++)
+    {
+        if (NULL == done[i].cb) continue;
+
+        qconf_async_result result;
+        async_to_result(done[i], result);
+        done[i].cb(&result);
+    }
+
+    async_free(done);
+    return QCONF_OK;
+}
+
 const char* qconf_version()
 {
     return QCONF_DRIVER_CC_VERSION;
@@ -128,35 +625,166 @@ static int qconf_get_host_(const char *path, char *buf, size_t buf_len, const ch
         return QCONF_ERR_PARAM;
 
     int ret = QCONF_OK;
-    string_vector_t nodes;
+    qconf_hosts_view view;
 
-    init_string_vector(&nodes);
-    ret = qconf_get_allhost_(path, &nodes, idc, flags); 
-    if (QCONF_OK != ret)
+    init_qconf_hosts_view(&view);
+    for (int count = 0; count < QCONF_MAX_READ_TIMES; count++)
     {
-        LOG_ERR("Failed to call get_allhost_! ret:%d", ret);
-        return ret;
+        ret = qconf_get_allhost_view_(path, &view, idc, flags);
+        if (QCONF_OK != ret)
+        {
+            LOG_ERR("Failed to call get_allhost_view_! ret:%d", ret);
+            break;
+        }
+
+        if (0 == view.count)
+        {
+            buf[0] = '\0';
+            break;
+        }
+
+        // pick the host straight from the index kept with the services
+        const char *host = NULL;
+        size_t host_len = 0;
+        unsigned int r = rand() % view.count;
+        ret = qconf_hosts_view_at(&view, r, &host, &host_len);
+        if (QCONF_OK == ret)
+        {
+            if (host_len >= buf_len)
+            {
+                ret = QCONF_ERR_BUF_NOT_ENOUGH;
+            }
+            else
+            {
+                memcpy(buf, host, host_len);
+                buf[host_len] = '\0';
+            }
+        }
+
+        if (QCONF_OK == qconf_check_hosts_view(&view)) break;
+        ret = QCONF_ERR_SHM_CHANGED;
     }
+    destroy_qconf_hosts_view(&view);
+
+    return ret;
+}
+
+static int qconf_get_version_(const char *path, char dtype, qconf_data_version *version, const char *idc)
+{
+    if (NULL == path || '\0' == *path || NULL == version)
+        return QCONF_ERR_PARAM;
+
+    string tmp_idc;
+    string real_path;
+    qconf_stamp_t stamp;
+
+    int ret = get_node_path(string(path), real_path);
+    if (QCONF_OK != ret) return ret;
+
+    if (NULL != idc) tmp_idc.assign(idc);
+
+    ret = qconf_get_stamp(real_path, dtype, stamp, tmp_idc, QCONF_WAIT);
+    if (QCONF_OK != ret) return ret;
+
+    version->mzxid = stamp.mzxid;
+    version->pzxid = stamp.pzxid;
+    version->counter = stamp.counter;
+    memcpy(version->digest, stamp.digest, sizeof(version->digest));
+
+    return ret;
+}
+
+static int qconf_wait_change_(const char *path, char dtype, const qconf_data_version *known, int timeout_ms, qconf_data_version *version, const char *idc)
+{
+    if (NULL == path || '\0' == *path || NULL == version)
+        return QCONF_ERR_PARAM;
 
-    if (0 == nodes.count)
+    string tmp_idc;
+    string real_path;
+    qconf_stamp_t known_stamp, stamp;
+
+    int ret = get_node_path(string(path), real_path);
+    if (QCONF_OK != ret) return ret;
+
+    if (NULL != idc) tmp_idc.assign(idc);
+
+    // only the digest is compared
+    if (NULL != known)
     {
-        buf[0] = '\0';
-        return ret;
+        memset(&known_stamp, 0, sizeof(qconf_stamp_t));
+        memcpy(known_stamp.digest, known->digest, sizeof(known->digest));
     }
 
-    unsigned int r = rand() % nodes.count;
-    size_t node_len = strlen(nodes.data[r]);
-    if (node_len >= buf_len)
+    ret = qconf_wait_stamp(real_path, dtype, (NULL != known) ? &known_stamp : NULL, stamp, tmp_idc, timeout_ms);
+    if (QCONF_OK != ret) return ret;
+
+    version->mzxid = stamp.mzxid;
+    version->pzxid = stamp.pzxid;
+    version->counter = stamp.counter;
+    memcpy(version->digest, stamp.digest, sizeof(version->digest));
+
+    return ret;
+}
+
+int qconf_get_cached_paths(const char *path, string_vector_t *nodes, const char *idc)
+{
+    if (NULL == path || '\0' == *path || NULL == nodes)
+        return QCONF_ERR_PARAM;
+
+    string tmp_idc;
+    string real_path;
+    vector<qconf_shm_index_item_t> items;
+
+    int ret = get_node_path(string(path), real_path);
+    if (QCONF_OK != ret) return ret;
+
+    if (NULL != idc) tmp_idc.assign(idc);
+
+    ret = qconf_list_paths(real_path, items, tmp_idc);
+    if (QCONF_OK != ret && QCONF_ERR_SHM_INDEX_FULL != ret) return ret;
+
+    if (0 != nodes->count) destroy_string_vector(nodes);
+    if (items.empty()) return ret;
+
+    nodes->data = (char**)calloc(items.size(), sizeof(char*));
+    if (NULL == nodes->data) return QCONF_ERR_MEM;
+    for (size_t i = 0; i < items.size(); i++)
     {
-        destroy_string_vector(&nodes);
-        return QCONF_ERR_BUF_NOT_ENOUGH;
+        // paths are got the way they're asked for
+        string &item_path = items[i].path;
+#ifdef QCONF_INTERNAL
+        item_path.erase(0, QCONF_PREFIX_LEN - 1);
+#endif
+        nodes->data[i] = (char*)calloc(item_path.size() + 1, sizeof(char));
+        if (NULL == nodes->data[i])
+        {
+            destroy_string_vector(nodes);
+            return QCONF_ERR_MEM;
+        }
+        memcpy(nodes->data[i], item_path.data(), item_path.size());
+        nodes->count++;
     }
+    return ret;
+}
+
+static int qconf_get_change_hash_(const char *path, char dtype, const char *idc, unsigned int *hash)
+{
+    if (NULL == path || '\0' == *path || NULL == hash)
+        return QCONF_ERR_PARAM;
 
-    memcpy(buf, nodes.data[r], node_len);
-    buf[node_len] = '\0';
+    string tmp_idc;
+    string real_path;
+    uint32_t tmp_hash = 0;
+
+    int ret = get_node_path(string(path), real_path);
+    if (QCONF_OK != ret) return ret;
 
-    destroy_string_vector(&nodes);
+    if (NULL != idc) tmp_idc.assign(idc);
+
+    ret = qconf_journal_keyhash(real_path, dtype, tmp_idc, tmp_hash);
+    if (QCONF_OK != ret) return ret;
 
+    *hash = tmp_hash;
     return ret;
 }
 
@@ -187,6 +815,71 @@ static int qconf_get_allhost_(const char *path, string_vector_t *nodes, const ch
     return ret;
 }
 
+static int qconf_get_allhost_view_(const char *path, qconf_hosts_view *view, const char *idc, int flags)
+{
+    if (NULL == path || '\0' == *path || NULL == view)
+        return QCONF_ERR_PARAM;
+
+    char real_path[QCONF_PATH_BUF_LEN];
+    size_t real_path_len = 0;
+    uint32_t version = 0;
+    int ret = QCONF_OK;
+
+    ret = get_node_path(path, real_path, sizeof(real_path), real_path_len);
+    if (QCONF_OK != ret) return ret;
+
+    view->data = NULL;
+    view->len = 0;
+    view->count = 0;
+
+    ret = qconf_get_children_ref(real_path, real_path_len, view->data, view->len, version, idc);
+    if (QCONF_OK == ret)
+    {
+        view->version = version;
+        return tblval_to_chdnodecount(view->data, view->len, view->count);
+    }
+    if (QCONF_ERR_NOT_FOUND != ret && QCONF_ERR_SHM_SPLIT != ret && QCONF_ERR_SHM_CHANGED != ret)
+        return ret;
+
+    // services are not in one piece of share memory or not cached yet, copy them
+    string tmp_buf;
+    string tmp_idc;
+
+    if (NULL != idc) tmp_idc.assign(idc);
+
+    ret = qconf_get_children_val(string(real_path, real_path_len), tmp_buf, tmp_idc, flags);
+    if (QCONF_OK == ret) ret = tblval_to_chdnodecount(tmp_buf.data(), tmp_buf.size(), view->count);
+    if (QCONF_OK != ret)
+    {
+        view->data = NULL;
+        view->len = 0;
+        view->count = 0;
+        return ret;
+    }
+
+    if (tmp_buf.size() > view->buf_len || NULL == view->buf)
+    {
+        size_t new_len = tmp_buf.size() > 0 ? tmp_buf.size() : 1;
+        char *new_buf = (char*)realloc(view->buf, new_len);
+        if (NULL == new_buf)
+        {
+            LOG_ERR("Failed to malloc view buf! len:%zd, errno:%d", new_len, errno);
+            view->data = NULL;
+            view->len = 0;
+            view->count = 0;
+            return QCONF_ERR_MEM;
+        }
+        view->buf = new_buf;
+        view->buf_len = new_len;
+    }
+
+    memcpy(view->buf, tmp_buf.data(), tmp_buf.size());
+    view->data = view->buf;
+    view->len = tmp_buf.size();
+
+    return ret;
+}
+
 static int qconf_get_conf_(const char *path, char *buf, size_t buf_len, const char *idc, int flags)
 {
     if (NULL == path || '\0' == *path || NULL == buf)
@@ -218,6 +911,75 @@ static int qconf_get_conf_(const char *path, char *buf, size_t buf_len, const ch
     return ret;
 }
 
+static int qconf_get_conf_view_(const char *path, qconf_conf_view *view, const char *idc, int flags)
+{
+    if (NULL == path || '\0' == *path || NULL == view)
+        return QCONF_ERR_PARAM;
+
+    char real_path[QCONF_PATH_BUF_LEN];
+    size_t real_path_len = 0;
+    uint32_t version = 0;
+    int ret = QCONF_OK;
+
+    ret = get_node_path(path, real_path, sizeof(real_path), real_path_len);
+    if (QCONF_OK != ret) return ret;
+
+    view->data = NULL;
+    view->len = 0;
+
+    ret = qconf_get_ref(real_path, real_path_len, view->data, view->len, version, idc);
+    if (QCONF_OK == ret)
+    {
+        view->version = version;
+        return ret;
+    }
+    if (QCONF_ERR_NOT_FOUND != ret && QCONF_ERR_SHM_SPLIT != ret && QCONF_ERR_SHM_CHANGED != ret)
+        return ret;
+
+    // value is not in one piece of share memory or not cached yet, copy it
+    string tmp_buf;
+    string tmp_idc;
+
+    if (NULL != idc) tmp_idc.assign(idc);
+
+    ret = qconf_get(string(real_path, real_path_len), tmp_buf, tmp_idc, flags);
+    if (QCONF_OK != ret)
+    {
+        view->data = NULL;
+        view->len = 0;
+        return ret;
+    }
+
+    return copy_to_conf_view(tmp_buf, view);
+}
+
+/**
+ * Keep a copy of val in view, for values which can't be pointed to
+ */
+static int copy_to_conf_view(const string &val, qconf_conf_view *view)
+{
+    if (val.size() > view->buf_len || NULL == view->buf)
+    {
+        size_t new_len = val.size() > 0 ? val.size() : 1;
+        char *new_buf = (char*)realloc(view->buf, new_len);
+        if (NULL == new_buf)
+        {
+            LOG_ERR("Failed to malloc view buf! len:%zd, errno:%d", new_len, errno);
+            view->data = NULL;
+            view->len = 0;
+            return QCONF_ERR_MEM;
+        }
+        view->buf = new_buf;
+        view->buf_len = new_len;
+    }
+
+    memcpy(view->buf, val.data(), val.size());
+    view->data = view->buf;
+    view->len = val.size();
+
+    return QCONF_OK;
+}
+
 static int qconf_get_batch_conf_(const char *path, qconf_batch_nodes *bnodes, const char *idc, int flags)
 {
     if (NULL == path || '\0' == *path || NULL == bnodes)
@@ -245,6 +1007,58 @@ static int qconf_get_batch_conf_(const char *path, qconf_batch_nodes *bnodes, co
     return ret;
 }
 
+static int qconf_get_packed_(const char *path, char dtype, string_vector_t *nodes, qconf_batch_nodes *bnodes, char *buf, size_t *buf_len, const char *idc)
+{
+    if (NULL == path || '\0' == *path || (NULL != buf && NULL == buf_len))
+        return QCONF_ERR_PARAM;
+
+    string tmp_idc;
+    string real_path;
+
+    int ret = get_node_path(string(path), real_path);
+    if (QCONF_OK != ret) return ret;
+
+    if (NULL != idc) tmp_idc.assign(idc);
+
+    size_t len = (NULL == buf) ? 0 : *buf_len;
+    switch (dtype)
+    {
+        case QCONF_DATA_TYPE_SERVICE:
+            ret = qconf_get_children_packed(real_path, *nodes, buf, len, tmp_idc, QCONF_WAIT);
+            break;
+        case QCONF_DATA_TYPE_BATCH_NODE:
+            ret = qconf_get_batchnode_keys_packed(real_path, *nodes, buf, len, tmp_idc, QCONF_WAIT);
+            break;
+        default:
+            ret = qconf_get_batchnode_packed(real_path, *bnodes, buf, len, tmp_idc, QCONF_WAIT);
+            break;
+    }
+    if (NULL != buf_len) *buf_len = len;
+
+    if (QCONF_OK != ret && QCONF_ERR_BUF_NOT_ENOUGH != ret)
+        LOG_ERR("Failed to get packed nodes! ret:%d", ret);
+    return ret;
+}
+
+static void async_to_result(const qconf_async_done_s &done, qconf_async_result &result)
+{
+    result.ret = done.ret;
+    result.type = (QCONF_DATA_TYPE_SERVICE == done.dtype) ? QCONF_KEY_ALLHOST : QCONF_KEY_CONF;
+    result.value = done.value.c_str();
+    result.len = done.value.size();
+    result.nodes.count = done.nodes.count;
+    result.nodes.data = done.nodes.data;
+    result.data = done.data;
+}
+
+static void async_free(vector<qconf_async_done_s> &done)
+{
+    // the services of each are packed in one allocation
+    for (size_t i = 0; i < done.size(); i++)
+        free(done[i].nodes.data);
+    done.clear();
+}
+
 static int qconf_get_batch_keys_(const char *path, string_vector_t *nodes, const char *idc, int flags)
 {
     if (NULL == path || '\0' == *path || NULL == nodes)
@@ -300,13 +1114,61 @@ static int get_node_path(const string &path, string &real_path)
 {
     if (0 == path.size()) return QCONF_ERR_PARAM;
 
-    char delim = '/';
     size_t deal_path_len = 0;
-    const char *end_pos = NULL;
     const char *start_pos = NULL;
 
-    start_pos = path.data();
-    end_pos = path.data() + path.size() - 1;
+    int ret = trim_node_path(path.data(), path.size(), start_pos, deal_path_len);
+    if (QCONF_OK != ret) return ret;
+
+#ifdef QCONF_INTERNAL
+    real_path.assign(QCONF_PREFIX);
+    real_path.append(start_pos, deal_path_len);
+#else
+    real_path.assign(1, '/');
+    real_path.append(start_pos, deal_path_len);
+#endif
+   
+    return QCONF_OK;
+}
+
+static int get_node_path(const char *path, char *real_path, size_t real_path_size, size_t &real_path_len)
+{
+    size_t deal_path_len = 0;
+    const char *start_pos = NULL;
+
+    int ret = trim_node_path(path, strlen(path), start_pos, deal_path_len);
+    if (QCONF_OK != ret) return ret;
+
+#ifdef QCONF_INTERNAL
+    const char *prefix = QCONF_PREFIX;
+    size_t prefix_len = QCONF_PREFIX_LEN;
+#else
+    const char *prefix = "/";
+    size_t prefix_len = 1;
+#endif
+
+    if (prefix_len + deal_path_len > real_path_size)
+    {
+        LOG_ERR("path is too long! path len:%zd", deal_path_len);
+        return QCONF_ERR_BUF_NOT_ENOUGH;
+    }
+
+    memcpy(real_path, prefix, prefix_len);
+    memcpy(real_path + prefix_len, start_pos, deal_path_len);
+    real_path_len = prefix_len + deal_path_len;
+
+    return QCONF_OK;
+}
+
+static int trim_node_path(const char *path, size_t path_len, const char *&start_pos, size_t &deal_path_len)
+{
+    if (0 == path_len) return QCONF_ERR_PARAM;
+
+    char delim = '/';
+    const char *end_pos = NULL;
+
+    start_pos = path;
+    end_pos = path + path_len - 1;
 
     while (*start_pos == delim && start_pos <= end_pos)
     {
@@ -319,19 +1181,11 @@ static int get_node_path(const string &path, string &real_path)
     
     if (start_pos > end_pos)
     {
-        LOG_ERR("path:%s is not right", path.c_str());
+        LOG_ERR("path:%.*s is not right", (int)path_len, path);
         return QCONF_ERR_PARAM;
     }
 
     deal_path_len = end_pos + 1 - start_pos;
 
-#ifdef QCONF_INTERNAL
-    real_path.assign(QCONF_PREFIX);
-    real_path.append(start_pos, deal_path_len);
-#else
-    real_path.assign(1, delim);
-    real_path.append(start_pos, deal_path_len);
-#endif
-   
     return QCONF_OK;
 }
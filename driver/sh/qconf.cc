@@ -13,6 +13,8 @@ using namespace std;
 #define CMD_GET_ALLHOST         "get_allhost"
 #define CMD_GET_BATCH_CONF      "get_batch_conf"
 #define CMD_GET_BATCH_KEYS      "get_batch_keys"
+#define CMD_GET_CHANGES         "get_changes"
+#define CMD_GET_HASH            "get_hash"
 #define CMD_VERSION             "version"
 
 #define QCONF_SHELL_VERSION     "1.2.2"
@@ -26,11 +28,15 @@ void show_usage()
     printf("                get_host        : get one service\n");
     printf("                get_allhost     : get all services available\n");
     printf("                get_batch_keys  : get all children keys\n");
+    printf("                get_changes     : get changes of share memory after the cursor given as key,\n");
+    printf("                                  'now' for the newest one; the cursor to go on is printed last\n");
+    printf("                get_hash        : get the hash of the configure value in changes\n");
     printf("       key    : the path of your configure items\n");
     printf("       idc    : query from current idc if be omitted\n");
     printf("example: \n");
     printf("       qconf get_conf \"demo/conf\"\n");
     printf("       qconf get_conf \"demo/conf\" \"corp\" \n");
+    printf("       qconf get_changes now\n");
 }
 
 int main(int argc, char *argv[])
@@ -136,6 +142,61 @@ int main(int argc, char *argv[])
         destroy_string_vector(&bnodes_key);
         return ret;
     }
+    else if (!strcmp(command, CMD_GET_CHANGES))
+    {
+        // Get changes of share memory
+        unsigned long long cursor = 0;
+        if (!strcmp(path, "now"))
+        {
+            ret = qconf_get_changes_cursor(&cursor);
+            if (QCONF_OK != ret)
+            {
+                printf("[ERROR]Failed to get changes cursor! ret:%d\n", ret);
+                return ret;
+            }
+        }
+        else
+        {
+            cursor = strtoull(path, NULL, 10);
+        }
+
+        qconf_change changes[256];
+        int count = 0;
+        do
+        {
+            count = sizeof(changes) / sizeof(changes[0]);
+            ret = qconf_get_changes(&cursor, changes, &count);
+            if (QCONF_ERR_SHM_OVERRUN == ret)
+            {
+                printf("[ERROR]Changes are lost, get everything again!\n");
+                break;
+            }
+            if (QCONF_OK != ret)
+            {
+                printf("[ERROR]Failed to get changes! ret:%d\n", ret);
+                return ret;
+            }
+            for (int i = 0; i < count; i++)
+            {
+                printf("%llu %c %u\n", changes[i].seq, changes[i].type, changes[i].hash);
+            }
+        } while (count == (int)(sizeof(changes) / sizeof(changes[0])));
+        printf("cursor:%llu\n", cursor);
+        return ret;
+    }
+    else if (!strcmp(command, CMD_GET_HASH))
+    {
+        // Get the hash of the conf in changes
+        unsigned int hash = 0;
+        ret = qconf_get_conf_hash(path, idc, &hash);
+        if (QCONF_OK != ret)
+        {
+            printf("[ERROR]Failed to get hash! ret:%d\n", ret);
+            return ret;
+        }
+        printf("%u\n", hash);
+        return ret;
+    }
     else
     {
         show_usage();
@@ -0,0 +1,288 @@
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/shm.h>
+
+#include "qconf_common.h"
+#include "qconf_shm.h"
+
+using namespace std;
+
+#define QCONF_SHMSTAT_VERSION   "1.2.2"
+#define QCONF_SHMSTAT_BUCKETS   34
+#define QCONF_CACHE_LINE        64
+// slots covered by one group of control bytes
+#define QCONF_SHMSTAT_GROUP     16
+
+/**
+ * Placement of the keys of one table, counted in log2 buckets: bucket 0 is
+ * for 0 and bucket k for [2^(k-1), 2^k)
+ */
+typedef struct table_stat_s
+{
+    string name;
+    key_t shmkey;
+    int format;
+    int max_slots;
+    int used_slots;
+    uint64_t keys;
+    uint64_t heap_values;
+    uint64_t probes_sum;
+    uint64_t lines_sum;
+    uint64_t max_probes;
+    uint64_t max_chain;
+    vector<uint64_t> probes;            // slots probed to find a key
+    vector<uint64_t> collisions;        // keys hashing to one home slot
+    vector<uint64_t> chains;            // extension blocks of a value
+    vector< vector<uint64_t> > sizes;   // value sizes per data type
+} table_stat_t;
+
+static const char _data_types[] = {
+    QCONF_DATA_TYPE_NODE, QCONF_DATA_TYPE_SERVICE, QCONF_DATA_TYPE_BATCH_NODE,
+    QCONF_DATA_TYPE_ZK_HOST, QCONF_DATA_TYPE_LOCAL_IDC, QCONF_DATA_TYPE_ABSENT, 0};
+static const char *_data_type_names[] = {
+    "node", "service", "batch", "zk_host", "local_idc", "absent", "other"};
+#define QCONF_SHMSTAT_TYPES (int)(sizeof(_data_types) / sizeof(_data_types[0]))
+
+static int bucket_of(uint64_t v)
+{
+    int b = 0;
+    for (; v > 0 && b < QCONF_SHMSTAT_BUCKETS - 1; v >>= 1) b++;
+    return b;
+}
+
+static string bucket_name(int b)
+{
+    char buf[64];
+    if (b <= 1)
+        snprintf(buf, sizeof(buf), "%d", b);
+    else if (b == QCONF_SHMSTAT_BUCKETS - 1)
+        snprintf(buf, sizeof(buf), "%llu+", 1ULL << (b - 1));
+    else
+        snprintf(buf, sizeof(buf), "%llu-%llu", 1ULL << (b - 1), (1ULL << b) - 1);
+    return buf;
+}
+
+static int type_of(char keytype)
+{
+    int t = 0;
+    for (; t < QCONF_SHMSTAT_TYPES - 1 && _data_types[t] != keytype; t++);
+    return t;
+}
+
+static const char *format_name(int format)
+{
+    switch (format)
+    {
+        case QHASHARR_FORMAT_GROUP: return "group";
+        case QHASHARR_FORMAT_FPRINT: return "fprint";
+        default: return "linear";
+    }
+}
+
+/**
+ * Cache lines a read of the key touches: the slots or the groups of control
+ * bytes probed, the slot of the key and the blocks its value is kept in
+ */
+static uint64_t read_lines(int format, const qhasharr_key_stat_t &stat)
+{
+    uint64_t slot_lines = (sizeof(qhasharr_slot_t) + QCONF_CACHE_LINE - 1) / QCONF_CACHE_LINE;
+    uint64_t lines = (QHASHARR_FORMAT_LINEAR == format)
+        ? (uint64_t)(stat.distance + 1) * slot_lines
+        : (uint64_t)(stat.distance / QCONF_SHMSTAT_GROUP + 1) + slot_lines;
+    lines += (uint64_t)stat.extslots * slot_lines;
+    if (stat.inheap) lines += (stat.valsize + QCONF_CACHE_LINE - 1) / QCONF_CACHE_LINE;
+    return lines;
+}
+
+static int collect_stat(qhasharr_t *tbl, table_stat_t &st)
+{
+    st.format = qhasharr_format(tbl);
+    hash_tbl_get_count(tbl, st.max_slots, st.used_slots);
+    st.keys = st.heap_values = st.probes_sum = st.lines_sum = st.max_probes = st.max_chain = 0;
+    st.probes.assign(QCONF_SHMSTAT_BUCKETS, 0);
+    st.collisions.assign(QCONF_SHMSTAT_BUCKETS, 0);
+    st.chains.assign(QCONF_SHMSTAT_BUCKETS, 0);
+    st.sizes.assign(QCONF_SHMSTAT_TYPES, vector<uint64_t>(QCONF_SHMSTAT_BUCKETS, 0));
+
+    qhasharr_key_stat_t stat;
+    int idx = 0;
+    int ret = QCONF_OK;
+    while (QCONF_OK == (ret = hash_tbl_getnext_stat(tbl, stat, idx)))
+    {
+        // slots from the home slot up to the key a lookup steps over
+        uint64_t probes = stat.distance + 1;
+        st.keys++;
+        st.probes_sum += probes;
+        st.lines_sum += read_lines(st.format, stat);
+        if (probes > st.max_probes) st.max_probes = probes;
+        if ((uint64_t)stat.extslots > st.max_chain) st.max_chain = stat.extslots;
+        if (stat.inheap) st.heap_values++;
+
+        st.probes[bucket_of(probes)]++;
+        st.chains[bucket_of(stat.extslots)]++;
+        st.sizes[type_of(stat.keytype)][bucket_of(stat.valsize)]++;
+        if (stat.idx == stat.home && stat.collisions > 0)
+            st.collisions[bucket_of(stat.collisions)]++;
+    }
+    return (QCONF_ERR_TBL_END == ret) ? QCONF_OK : ret;
+}
+
+static void print_hist(const char *title, const vector<uint64_t> &hist)
+{
+    uint64_t total = 0;
+    for (size_t b = 0; b < hist.size(); b++) total += hist[b];
+    printf("  %s:\n", title);
+    for (size_t b = 0; b < hist.size(); b++)
+    {
+        if (0 == hist[b]) continue;
+        printf("    %-16s %10llu  %6.2f%%\n", bucket_name(b).c_str(),
+                (unsigned long long)hist[b], 100.0 * hist[b] / total);
+    }
+}
+
+static void print_human(const table_stat_t &st)
+{
+    double load = st.max_slots > 0 ? (double)st.used_slots / st.max_slots : 0;
+    printf("table %s (shmkey 0x%x, format %s)\n", st.name.c_str(), (unsigned)st.shmkey, format_name(st.format));
+    printf("  slots           : %d used of %d, load factor %.4f\n", st.used_slots, st.max_slots, load);
+    printf("  keys            : %llu, %llu of them with the value in the heap\n",
+            (unsigned long long)st.keys, (unsigned long long)st.heap_values);
+    if (0 == st.keys)
+    {
+        printf("\n");
+        return;
+    }
+    printf("  probes per read : %.2f on average, %llu at most\n",
+            (double)st.probes_sum / st.keys, (unsigned long long)st.max_probes);
+    printf("  read cost       : %.2f cache lines on average\n", (double)st.lines_sum / st.keys);
+    print_hist("slots probed per key", st.probes);
+    print_hist("keys per home slot", st.collisions);
+    print_hist("extension blocks per value", st.chains);
+    printf("  value sizes in bytes:\n");
+    for (int t = 0; t < QCONF_SHMSTAT_TYPES; t++)
+    {
+        for (int b = 0; b < QCONF_SHMSTAT_BUCKETS; b++)
+        {
+            if (0 == st.sizes[t][b]) continue;
+            printf("    %-10s %-16s %10llu\n", _data_type_names[t], bucket_name(b).c_str(),
+                    (unsigned long long)st.sizes[t][b]);
+        }
+    }
+    printf("\n");
+}
+
+static void print_hist_machine(const string &prefix, const vector<uint64_t> &hist)
+{
+    for (size_t b = 0; b < hist.size(); b++)
+    {
+        if (0 == hist[b]) continue;
+        printf("%s.%s=%llu\n", prefix.c_str(), bucket_name(b).c_str(), (unsigned long long)hist[b]);
+    }
+}
+
+/**
+ * One "name=value" line per figure, the name is prefixed by the table
+ */
+static void print_machine(const table_stat_t &st)
+{
+    const char *n = st.name.c_str();
+    printf("%s.shmkey=0x%x\n", n, (unsigned)st.shmkey);
+    printf("%s.format=%s\n", n, format_name(st.format));
+    printf("%s.max_slots=%d\n", n, st.max_slots);
+    printf("%s.used_slots=%d\n", n, st.used_slots);
+    printf("%s.load_factor=%.4f\n", n, st.max_slots > 0 ? (double)st.used_slots / st.max_slots : 0);
+    printf("%s.keys=%llu\n", n, (unsigned long long)st.keys);
+    printf("%s.heap_values=%llu\n", n, (unsigned long long)st.heap_values);
+    printf("%s.probes_avg=%.4f\n", n, st.keys > 0 ? (double)st.probes_sum / st.keys : 0);
+    printf("%s.probes_max=%llu\n", n, (unsigned long long)st.max_probes);
+    printf("%s.chain_max=%llu\n", n, (unsigned long long)st.max_chain);
+    printf("%s.read_lines_avg=%.4f\n", n, st.keys > 0 ? (double)st.lines_sum / st.keys : 0);
+    print_hist_machine(st.name + ".probes", st.probes);
+    print_hist_machine(st.name + ".collisions", st.collisions);
+    print_hist_machine(st.name + ".chains", st.chains);
+    for (int t = 0; t < QCONF_SHMSTAT_TYPES; t++)
+        print_hist_machine(st.name + ".value_size." + _data_type_names[t], st.sizes[t]);
+}
+
+static int stat_table(const string &name, key_t shmkey, bool machine)
+{
+    qhasharr_t *tbl = NULL;
+    int ret = init_hash_tbl(tbl, shmkey, 0444, SHM_RDONLY);
+    if (QCONF_OK != ret)
+    {
+        fprintf(stderr, "[ERROR] Failed to attach table %s of shmkey 0x%x! ret:%d\n", name.c_str(), (unsigned)shmkey, ret);
+        return ret;
+    }
+
+    table_stat_t st;
+    st.name = name;
+    st.shmkey = shmkey;
+    ret = collect_stat(tbl, st);
+    detach_hash_tbl(tbl);
+    if (QCONF_OK != ret)
+    {
+        fprintf(stderr, "[ERROR] Failed to go through table %s! ret:%d\n", name.c_str(), ret);
+        return ret;
+    }
+
+    if (machine)
+        print_machine(st);
+    else
+        print_human(st);
+    return QCONF_OK;
+}
+
+static void show_usage()
+{
+    printf("usage: qconf_shmstat [-m | version]\n");
+    printf("       report how the keys of the share memory tables are placed: load factor,\n");
+    printf("       slots probed per read, keys per home slot, extension blocks per value,\n");
+    printf("       value sizes per data type and estimated cache lines per read\n");
+    printf("       -m     : print one name=value line per figure\n");
+}
+
+int main(int argc, char *argv[])
+{
+    bool machine = false;
+    if (argc == 2 && !strcmp(argv[1], "-m"))
+    {
+        machine = true;
+    }
+    else if (argc == 2 && !strcmp(argv[1], "version"))
+    {
+        printf("Version : %s\n", QCONF_SHMSTAT_VERSION);
+        return QCONF_OK;
+    }
+    else if (argc != 1)
+    {
+        show_usage();
+        return QCONF_ERR_PARAM;
+    }
+
+    // the table in use is published in the control segment by the agent
+    key_t shmkey = QCONF_DEFAULT_SHM_KEY;
+    uint32_t generation = 0;
+    qconf_shm_ctrl_t *ctrl = NULL;
+    if (QCONF_OK == init_shm_ctrl(ctrl, QCONF_DEFAULT_SHM_CTRL_KEY, 0444, SHM_RDONLY))
+        shm_ctrl_get(ctrl, shmkey, generation);
+
+    int ret = stat_table("default", shmkey, machine);
+    if (QCONF_OK != ret) return ret;
+
+    qconf_shm_ns_t *ns = NULL;
+    vector<qconf_shm_ns_entry_t> entries;
+    if (QCONF_OK == init_shm_ns(ns, QCONF_DEFAULT_SHM_NS_KEY))
+    {
+        shm_ns_get(ns, entries, generation);
+        detach_shm_ns(ns);
+    }
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        int ns_ret = stat_table(entries[i].name, entries[i].shmkey, machine);
+        if (QCONF_OK != ns_ret) ret = ns_ret;
+    }
+    return ret;
+}
@@ -0,0 +1,208 @@
+#include <poll.h>
+#include <time.h>
+#include <sys/shm.h>
+#include <sys/msg.h>
+
+#include <string>
+
+#include "gtest/gtest.h"
+#include "qconf.h"
+#include "qconf_shm.h"
+#include "qconf_msg.h"
+#include "qconf_format.h"
+
+using namespace std;
+
+extern int maxSlotsNum;
+extern int shmFormat;
+
+// Unit test case for the asynchronous gets of driver_api.cc
+
+// Related test environment set up:
+// the driver attaches the segments of the default keys, they're made here as
+// the agent makes them, and the values are set here as the agent sets them
+class Test_qconf_async : public ::testing::Test
+{
+protected:
+    static qhasharr_t *tbl;
+    static qconf_shm_gens_t *gens;
+    static int msqid;
+
+    static void SetUpTestCase()
+    {
+        maxSlotsNum = 1024;
+        shmFormat = QHASHARR_FORMAT_FPRINT;
+        create_hash_tbl(tbl, QCONF_DEFAULT_SHM_KEY, 0644);
+        create_shm_gens(gens, QCONF_DEFAULT_SHM_GENS_KEY, QCONF_SHM_GENS_NUM, 0644);
+        create_msg_queue(QCONF_DEFAULT_MSG_QUEUE_KEY, msqid);
+    }
+
+    static void TearDownTestCase()
+    {
+        detach_shm_gens(gens);
+        EXPECT_EQ(0, shmctl(shmget(QCONF_DEFAULT_SHM_GENS_KEY, 0, 0), IPC_RMID, NULL));
+        EXPECT_EQ(0, shmctl(shmget(QCONF_DEFAULT_SHM_KEY, 0, 0), IPC_RMID, NULL));
+        EXPECT_EQ(0, msgctl(msqid, IPC_RMID, NULL));
+        gens = NULL;
+        tbl = NULL;
+    }
+
+    virtual void SetUp()
+    {
+        async = NULL;
+        ASSERT_EQ(QCONF_OK, qconf_async_create(&async));
+    }
+
+    virtual void TearDown()
+    {
+        qconf_async_destroy(async);
+        hash_tbl_clear(tbl);
+
+        qconf_msgbuf msgbuf;
+        while (-1 != msgrcv(msqid, &msgbuf, QCONF_MAX_MSG_LEN, QCONF_MSG_TYPE, IPC_NOWAIT)) {}
+    }
+
+    // set the conf of path as the agent does
+    void set_conf(const string &path, const string &value)
+    {
+        string tblkey, tblval;
+        serialize_to_tblkey(QCONF_DATA_TYPE_NODE, "test", path, tblkey);
+        nodeval_to_tblval(tblkey, value, tblval);
+        ASSERT_EQ(QCONF_OK, hash_tbl_set(tbl, tblkey, tblval));
+    }
+
+    // the milliseconds waited for the eventfd to be readable, -1 if it's not
+    int wait_readable(int timeout_ms)
+    {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        struct pollfd pfd = {qconf_async_fd(async), POLLIN, 0};
+        if (1 != poll(&pfd, 1, timeout_ms)) return -1;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        return (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+    }
+
+    qconf_async_t *async;
+};
+
+qhasharr_t *Test_qconf_async::tbl = NULL;
+qconf_shm_gens_t *Test_qconf_async::gens = NULL;
+int Test_qconf_async::msqid = -1;
+
+static int _called = 0;
+static string _called_value;
+
+static void async_called(const qconf_async_result *result)
+{
+    _called++;
+    _called_value.assign(result->value, result->len);
+}
+
+/**
+ *==============================================================================================
+ * Begin_Test_for function: int qconf_async_get(qconf_async_t *async, const char *path, const char *idc, int type, int timeout_ms, qconf_async_cb cb, void *data)
+ *                          int qconf_async_poll(qconf_async_t *async, qconf_async_result *results, int *count)
+ *                          int qconf_async_dispatch(qconf_async_t *async)
+ * =============================================================================================
+ */
+
+// Test for qconf_async_get: a conf in share memory is completed at once
+TEST_F(Test_qconf_async, qconf_async_get_completed_at_once)
+{
+    int data = 0;
+    set_conf("/async/at_once", "value");
+
+    EXPECT_EQ(QCONF_OK, qconf_async_get(async, "/async/at_once", "test", QCONF_KEY_CONF, 1000, NULL, &data));
+    EXPECT_LE(0, wait_readable(0));
+
+    qconf_async_result results[4];
+    int count = 4;
+    EXPECT_EQ(QCONF_OK, qconf_async_poll(async, results, &count));
+    ASSERT_EQ(1, count);
+    EXPECT_EQ(QCONF_OK, results[0].ret);
+    EXPECT_EQ(QCONF_KEY_CONF, results[0].type);
+    EXPECT_EQ(string("value"), string(results[0].value, results[0].len));
+    EXPECT_EQ(&data, results[0].data);
+    EXPECT_EQ(-1, wait_readable(0));
+
+    // nothing is asked from the agent
+    qconf_msgbuf msgbuf;
+    EXPECT_EQ(-1, msgrcv(msqid, &msgbuf, QCONF_MAX_MSG_LEN, QCONF_MSG_TYPE, IPC_NOWAIT));
+}
+
+// Test for qconf_async_get: a conf missing is asked from the agent and completed once it's set
+TEST_F(Test_qconf_async, qconf_async_get_completed_once_set)
+{
+    EXPECT_EQ(QCONF_OK, qconf_async_get(async, "/async/set_later", "test", QCONF_KEY_CONF, 5000, NULL, NULL));
+
+    string tblkey;
+    serialize_to_tblkey(QCONF_DATA_TYPE_NODE, "test", "/async/set_later", tblkey);
+    qconf_msgbuf msgbuf;
+    ssize_t len = msgrcv(msqid, &msgbuf, QCONF_MAX_MSG_LEN, QCONF_MSG_TYPE, IPC_NOWAIT);
+    ASSERT_EQ((ssize_t)tblkey.size(), len);
+    EXPECT_EQ(tblkey, string(msgbuf.mtext, len));
+    EXPECT_EQ(-1, wait_readable(20));
+
+    set_conf("/async/set_later", "later");
+    int waited = wait_readable(1000);
+    EXPECT_LE(0, waited);
+    EXPECT_GT(1000, waited);
+
+    qconf_async_result results[4];
+    int count = 4;
+    EXPECT_EQ(QCONF_OK, qconf_async_poll(async, results, &count));
+    ASSERT_EQ(1, count);
+    EXPECT_EQ(QCONF_OK, results[0].ret);
+    EXPECT_EQ(string("later"), string(results[0].value, results[0].len));
+}
+
+// Test for qconf_async_dispatch: the get not due first is completed once its conf is set
+TEST_F(Test_qconf_async, qconf_async_dispatch_any_key_set)
+{
+    int data = 0;
+    _called = 0;
+    EXPECT_EQ(QCONF_OK, qconf_async_get(async, "/async/due_first", "test", QCONF_KEY_CONF, 3000, async_called, NULL));
+    EXPECT_EQ(QCONF_OK, qconf_async_get(async, "/async/due_later", "test", QCONF_KEY_CONF, 5000, async_called, &data));
+    EXPECT_EQ(-1, wait_readable(20));
+
+    set_conf("/async/due_later", "later");
+    int waited = wait_readable(1000);
+    EXPECT_LE(0, waited);
+    EXPECT_GT(1000, waited);
+
+    EXPECT_EQ(QCONF_OK, qconf_async_dispatch(async));
+    EXPECT_EQ(1, _called);
+    EXPECT_EQ(string("later"), _called_value);
+    EXPECT_EQ(-1, wait_readable(0));
+}
+
+// Test for qconf_async_get: the get is completed with QCONF_ERR_SHM_TIMEOUT once its deadline passes
+TEST_F(Test_qconf_async, qconf_async_get_deadline_passed)
+{
+    int data = 0;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    EXPECT_EQ(QCONF_OK, qconf_async_get(async, "/async/never_set", "test", QCONF_KEY_CONF, 5000, NULL, NULL));
+    EXPECT_EQ(QCONF_OK, qconf_async_get(async, "/async/never_set_either", "test", QCONF_KEY_CONF, 50, NULL, &data));
+    EXPECT_LE(0, wait_readable(1000));
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    long waited = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+    EXPECT_LE(50, waited);
+    EXPECT_GT(1000, waited);
+
+    qconf_async_result results[4];
+    int count = 4;
+    EXPECT_EQ(QCONF_OK, qconf_async_poll(async, results, &count));
+    ASSERT_EQ(1, count);
+    EXPECT_EQ(QCONF_ERR_SHM_TIMEOUT, results[0].ret);
+    EXPECT_EQ(&data, results[0].data);
+}
+
+// Test for qconf_async_get: wrong parameters
+TEST_F(Test_qconf_async, qconf_async_get_wrong_param)
+{
+    EXPECT_EQ(QCONF_ERR_PARAM, qconf_async_get(NULL, "/async/param", "test", QCONF_KEY_CONF, 1000, NULL, NULL));
+    EXPECT_EQ(QCONF_ERR_PARAM, qconf_async_get(async, NULL, "test", QCONF_KEY_CONF, 1000, NULL, NULL));
+    EXPECT_EQ(QCONF_ERR_PARAM, qconf_async_get(async, "/async/param", "test", -1, 1000, NULL, NULL));
+    EXPECT_EQ(QCONF_ERR_PARAM, qconf_async_get(async, "/async/param", "test", QCONF_KEY_CONF, -1, NULL, NULL));
+}
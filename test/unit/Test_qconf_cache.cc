@@ -0,0 +1,115 @@
+#include <stdio.h>
+
+#include <string>
+#include "gtest/gtest.h"
+#include "qconf_common.h"
+#include "qconf_cache.h"
+
+using namespace std;
+
+
+// Unit test case for qconf_cache.cc
+
+// Related test environment set up:
+class Test_qconf_cache : public ::testing::Test
+{
+protected:
+    virtual void SetUp()
+    {
+        word = 0;
+        qconf_cache_set_max(1024 * 1024);
+        qconf_cache_get_stat(before);
+    }
+
+    virtual void TearDown()
+    {
+        qconf_cache_set_max(0);
+    }
+
+    volatile uint32_t word;
+    qconf_cache_stat_t before;
+};
+
+/**
+ *==============================================================================================
+ * Begin_Test_for function: int qconf_cache_get(const string &tblkey, string &tblval)
+ *                          void qconf_cache_put(const string &tblkey, const string &tblval, const volatile uint32_t *word, uint32_t gen, qconf_shm_refs_t *refs, int idx)
+ * =============================================================================================
+ */
+
+// Test for qconf_cache_get: the value put is got until its word moves
+TEST_F(Test_qconf_cache, qconf_cache_get_until_changed)
+{
+    string tblval;
+    EXPECT_EQ(QCONF_ERR_NOT_FOUND, qconf_cache_get("key", tblval));
+
+    qconf_cache_put("key", "value", &word, 0, NULL, -1);
+    for (int i = 0; i < 3; i++)
+    {
+        ASSERT_EQ(QCONF_OK, qconf_cache_get("key", tblval));
+        EXPECT_EQ("value", tblval);
+    }
+
+    word++;
+    EXPECT_EQ(QCONF_ERR_NOT_FOUND, qconf_cache_get("key", tblval));
+
+    qconf_cache_stat_t stat;
+    qconf_cache_get_stat(stat);
+    EXPECT_EQ(3u, stat.hits - before.hits);
+    EXPECT_EQ(2u, stat.misses - before.misses);
+    EXPECT_EQ(1u, stat.stales - before.stales);
+    EXPECT_EQ(1u, stat.entries);
+}
+
+// Test for qconf_cache_put: a value whose word moved since gen is not kept
+TEST_F(Test_qconf_cache, qconf_cache_put_changed)
+{
+    string tblval;
+    word = 2;
+    qconf_cache_put("key", "value", &word, 1, NULL, -1);
+    EXPECT_EQ(QCONF_ERR_NOT_FOUND, qconf_cache_get("key", tblval));
+
+    qconf_cache_put("key", "value", &word, 2, NULL, -1);
+    qconf_cache_put("key", "new", &word, 2, NULL, -1);
+    ASSERT_EQ(QCONF_OK, qconf_cache_get("key", tblval));
+    EXPECT_EQ("new", tblval);
+}
+
+// Test for qconf_cache_put: entries are evicted within the bound of memory
+TEST_F(Test_qconf_cache, qconf_cache_put_bounded)
+{
+    qconf_cache_set_max(16 * 1024);
+    string val(512, 'v');
+    for (int i = 0; i < 100; i++)
+    {
+        char key[32];
+        snprintf(key, sizeof(key), "key_%d", i);
+        qconf_cache_put(key, val, &word, 0, NULL, -1);
+    }
+
+    qconf_cache_stat_t stat;
+    qconf_cache_get_stat(stat);
+    EXPECT_LE(stat.bytes, 16u * 1024);
+    EXPECT_GT(stat.entries, 0u);
+    EXPECT_EQ(100u, stat.entries + stat.evictions - before.evictions);
+
+    string tblval;
+    EXPECT_EQ(QCONF_OK, qconf_cache_get("key_99", tblval));
+    EXPECT_EQ(QCONF_ERR_NOT_FOUND, qconf_cache_get("key_0", tblval));
+}
+
+// Test for qconf_cache_get: nothing is kept while the cache is disabled or after clear
+TEST_F(Test_qconf_cache, qconf_cache_get_disabled)
+{
+    string tblval;
+    qconf_cache_put("key", "value", &word, 0, NULL, -1);
+    ASSERT_EQ(QCONF_OK, qconf_cache_get("key", tblval));
+
+    qconf_cache_clear();
+    EXPECT_EQ(QCONF_ERR_NOT_FOUND, qconf_cache_get("key", tblval));
+
+    qconf_cache_set_max(0);
+    qconf_cache_put("key", "value", &word, 0, NULL, -1);
+    EXPECT_EQ(QCONF_ERR_NOT_FOUND, qconf_cache_get("key", tblval));
+    EXPECT_FALSE(qconf_cache_enabled());
+}
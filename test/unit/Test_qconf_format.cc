@@ -1,3 +1,5 @@
+#include <stdio.h>
+
 #include <string>
 #include <vector>
 #include "gtest/gtest.h"
@@ -101,6 +103,38 @@ TEST_F(Test_qconf_format, serialize_to_tblkey_data_type_local_idc)
     EXPECT_EQ(QCONF_OK, retCode);
     //cout << tblkey << endl;
 }
+
+// Test for serialize_to_tblkey: idc too long for its size field
+TEST_F(Test_qconf_format, serialize_to_tblkey_idc_too_long)
+{
+    string idc(256, 'i'), tblkey;
+
+    EXPECT_EQ(QCONF_ERR_PARAM, serialize_to_tblkey(QCONF_DATA_TYPE_NODE, idc, "/qconf/demo", tblkey));
+    EXPECT_TRUE(tblkey.empty());
+    idc.resize(255);
+    EXPECT_EQ(QCONF_OK, serialize_to_tblkey(QCONF_DATA_TYPE_NODE, idc, "/qconf/demo", tblkey));
+}
+
+// Test for serialize_to_tblkey: buffer version is the same as string version
+TEST_F(Test_qconf_format, serialize_to_tblkey_buffer)
+{
+    string tblkey;
+    char tblkey_buf[QCONF_TBLKEY_MAX_LEN];
+    size_t tblkey_len = 0;
+
+    serialize_to_tblkey(QCONF_DATA_TYPE_NODE, "corp", "/qconf/demo", tblkey);
+    EXPECT_EQ(QCONF_OK, serialize_to_tblkey(QCONF_DATA_TYPE_NODE, "corp", 4, "/qconf/demo", 11, tblkey_buf, tblkey_len));
+    EXPECT_EQ(tblkey, string(tblkey_buf, tblkey_len));
+}
+
+// Test for serialize_to_tblkey: buffer version with wrong data type
+TEST_F(Test_qconf_format, serialize_to_tblkey_buffer_data_type_error)
+{
+    char tblkey_buf[QCONF_TBLKEY_MAX_LEN];
+    size_t tblkey_len = 0;
+
+    EXPECT_EQ(QCONF_ERR_DATA_TYPE, serialize_to_tblkey('z', "corp", 4, "/qconf/demo", 11, tblkey_buf, tblkey_len));
+}
 /**
   * End_Test_for function: int serialize_to_tblkey(char data_type, const string &idc, const string &path, string &tblkey)
   *================================================================================================================================
@@ -245,6 +279,28 @@ TEST_F(Test_qconf_format, convert_from_localidc_and_tblval)
     EXPECT_STREQ("test", idc_out.data());
 }
 
+// Test for convert from tblval to localidc and nodeval in place
+// int tblval_to_localidc(const char *tblval, size_t tblval_len, const char *&idc, size_t &idc_len)
+// int tblval_to_nodeval(const char *tblval, size_t tblval_len, const char *&nodeval, size_t &nodeval_len)
+TEST_F(Test_qconf_format, convert_from_tblval_in_place)
+{
+    string tblkey, tblval;
+    const char *out = NULL;
+    size_t out_len = 0;
+
+    serialize_to_tblkey(QCONF_DATA_TYPE_LOCAL_IDC, "", "", tblkey);
+    localidc_to_tblval(tblkey, "test", tblval);
+    EXPECT_EQ(QCONF_OK, tblval_to_localidc(tblval.data(), tblval.size(), out, out_len));
+    EXPECT_EQ("test", string(out, out_len));
+
+    serialize_to_tblkey(QCONF_DATA_TYPE_NODE, "test", "/qconf/demo", tblkey);
+    nodeval_to_tblval(tblkey, "value", tblval);
+    EXPECT_EQ(QCONF_OK, tblval_to_nodeval(tblval.data(), tblval.size(), out, out_len));
+    EXPECT_EQ("value", string(out, out_len));
+
+    EXPECT_EQ(QCONF_ERR_DATA_FORMAT, tblval_to_nodeval(tblval.data(), 2, out, out_len));
+}
+
 // Test for convert between localidc and tblval
 TEST_F(Test_qconf_format, convert_from_localidc_and_tblval_invalid_tblkey)
 {
@@ -402,6 +458,119 @@ TEST_F(Test_qconf_format, convert_from_chdnodeval_and_tblval1)
     free_string_vector(nodes_out, nodes_out.count);
 }
 
+// Test for get one chdnode from tblval by its index
+// int tblval_to_chdnodecount(const char *tblval, size_t tblval_len, int &count)
+// int tblval_to_chdnode(const char *tblval, size_t tblval_len, int i, const char *&node, size_t &node_len)
+TEST_F(Test_qconf_format, convert_from_tblval_to_chdnode)
+{
+    int retCode = 0;
+    int count = 0;
+    const char *node = NULL;
+    size_t node_len = 0;
+    string tblkey, tblval;
+
+    retCode = serialize_to_tblkey(QCONF_DATA_TYPE_SERVICE, "test", "/qconf/demo", tblkey);
+    EXPECT_EQ(QCONF_OK, retCode);
+
+    chdnodeval_to_tblval(tblkey, nodes, tblval, status);
+    retCode = tblval_to_chdnodecount(tblval.data(), tblval.size(), count);
+    EXPECT_EQ(QCONF_OK, retCode);
+
+    vector<string> up_nodes;
+    for (int i = 0; i < nodes.count; ++i)
+    {
+        if (STATUS_UP == status[i]) up_nodes.push_back(nodes.data[i]);
+    }
+    EXPECT_EQ((int)up_nodes.size(), count);
+
+    // value written by older agent has no index after the key
+    string legacy_tblval(tblval, 0, tblval.size() - (count + 1) * QCONF_HOST_OFFSET_LEN);
+    for (int i = 0; i < count; ++i)
+    {
+        retCode = tblval_to_chdnode(tblval.data(), tblval.size(), i, node, node_len);
+        EXPECT_EQ(QCONF_OK, retCode);
+        EXPECT_EQ(up_nodes[i], string(node, node_len));
+
+        retCode = tblval_to_chdnode(legacy_tblval.data(), legacy_tblval.size(), i, node, node_len);
+        EXPECT_EQ(QCONF_OK, retCode);
+        EXPECT_EQ(up_nodes[i], string(node, node_len));
+    }
+
+    retCode = tblval_to_chdnode(tblval.data(), tblval.size(), count, node, node_len);
+    EXPECT_EQ(QCONF_ERR_PARAM, retCode);
+}
+
+// Test for get chdnodes from tblval packed into one buffer
+// int tblval_to_packed_chdnodeval(const string &tblval, string_vector_t &nodes, char *buf, size_t &buf_len)
+TEST_F(Test_qconf_format, convert_from_tblval_to_packed_chdnodeval)
+{
+    string tblkey, tblval;
+    string_vector_t nodes_out, packed_out;
+    memset(&nodes_out, 0, sizeof(nodes_out));
+    memset(&packed_out, 0, sizeof(packed_out));
+
+    EXPECT_EQ(QCONF_OK, serialize_to_tblkey(QCONF_DATA_TYPE_SERVICE, "test", "/qconf/demo", tblkey));
+    chdnodeval_to_tblval(tblkey, nodes, tblval, status);
+    EXPECT_EQ(QCONF_OK, tblval_to_chdnodeval(tblval, nodes_out));
+
+    size_t need = 0;
+    EXPECT_EQ(QCONF_ERR_BUF_NOT_ENOUGH, tblval_to_packed_chdnodeval(tblval, packed_out, NULL, need));
+    EXPECT_GT(need, nodes_out.count * sizeof(char*));
+
+    // the buffer needs not be aligned
+    vector<char> buf(need + 1);
+    size_t buf_len = need - 1;
+    EXPECT_EQ(QCONF_ERR_BUF_NOT_ENOUGH, tblval_to_packed_chdnodeval(tblval, packed_out, &buf[1], buf_len));
+    EXPECT_EQ(need, buf_len);
+    EXPECT_EQ(QCONF_OK, tblval_to_packed_chdnodeval(tblval, packed_out, &buf[1], buf_len));
+    EXPECT_LE(buf_len, need);
+
+    ASSERT_EQ(nodes_out.count, packed_out.count);
+    for (int i = 0; i < packed_out.count; ++i)
+    {
+        EXPECT_STREQ(nodes_out.data[i], packed_out.data[i]);
+        EXPECT_GE(packed_out.data[i], &buf[1]);
+        EXPECT_LT(packed_out.data[i], &buf[1] + buf_len);
+    }
+
+    // not a service
+    buf_len = need;
+    EXPECT_EQ(QCONF_ERR_DATA_FORMAT, tblval_to_packed_batchnodeval(tblval, packed_out, &buf[1], buf_len));
+
+    free_string_vector(nodes_out, nodes_out.count);
+}
+
+// Test for convert between stamp and the value kept in share memory
+// int stamp_to_tblval(const qconf_stamp_t &stamp, string &tblval)
+// int tblval_to_stamp(const char *tblval, size_t &tblval_len, qconf_stamp_t *stamp)
+TEST_F(Test_qconf_format, convert_from_stamp_and_tblval)
+{
+    int retCode = 0;
+    string tblval("demo_value");
+    qconf_stamp_t stamp, stamp_out;
+    stamp.mzxid = 0x100000002LL;
+    stamp.pzxid = 3;
+    stamp.counter = 4;
+    memcpy(stamp.digest, "digest!!", QCONF_STAMP_DIGEST_LEN);
+
+    retCode = stamp_to_tblval(stamp, tblval);
+    EXPECT_EQ(QCONF_OK, retCode);
+    EXPECT_EQ(strlen("demo_value") + QCONF_STAMP_LEN, tblval.size());
+
+    size_t tblval_len = tblval.size();
+    retCode = tblval_to_stamp(tblval.data(), tblval_len, &stamp_out);
+    EXPECT_EQ(QCONF_OK, retCode);
+    EXPECT_EQ(strlen("demo_value"), tblval_len);
+    EXPECT_EQ(stamp.mzxid, stamp_out.mzxid);
+    EXPECT_EQ(stamp.pzxid, stamp_out.pzxid);
+    EXPECT_EQ(stamp.counter, stamp_out.counter);
+    EXPECT_EQ(0, memcmp(stamp.digest, stamp_out.digest, QCONF_STAMP_DIGEST_LEN));
+
+    tblval_len = QCONF_STAMP_LEN - 1;
+    retCode = tblval_to_stamp(tblval.data(), tblval_len, NULL);
+    EXPECT_EQ(QCONF_ERR_DATA_FORMAT, retCode);
+}
+
 // Test for convert between batchnodeval and tbleval
 // int batchnodeval_to_tblval(const string &key, const string_vector_t &nodes, string &tblval)
 // int tblval_to_batchnodeval(const string &tblval, string_vector_t &nodes)
@@ -520,6 +689,57 @@ TEST_F(Test_qconf_format, serialize_to_idc_host)
     EXPECT_STREQ("test", idc.data());
     EXPECT_STREQ("1.1.1.1:2181", host.data());
 }
+
+// Test for convert between the expire time of an absent key and tblval
+TEST_F(Test_qconf_format, convert_from_absentval_and_tblval)
+{
+    string tblkey, absent_key, tblval, key_out;
+    int64_t expire = 0;
+
+    EXPECT_EQ(QCONF_OK, serialize_to_tblkey(QCONF_DATA_TYPE_NODE, "test", "/qconf/demo", tblkey));
+    EXPECT_EQ(QCONF_OK, serialize_to_absent_tblkey(tblkey, absent_key));
+    EXPECT_EQ(QCONF_DATA_TYPE_ABSENT, get_data_type(absent_key));
+    EXPECT_EQ(tblkey, absent_key.substr(1));
+
+    absentval_to_tblval(absent_key, 1500000000, tblval);
+    EXPECT_EQ(QCONF_OK, tblval_to_absentval(tblval, expire, key_out));
+    EXPECT_EQ(1500000000, expire);
+    EXPECT_EQ(absent_key, key_out);
+
+    // only keys of users' data are marked absent
+    EXPECT_EQ(QCONF_ERR_DATA_TYPE, serialize_to_absent_tblkey(QCONF_KEY_TYPE_LOCAL_IDC, absent_key));
+    nodeval_to_tblval(tblkey, "value", tblval);
+    EXPECT_EQ(QCONF_ERR_DATA_FORMAT, tblval_to_absentval(tblval, expire));
+}
+
+// Test for convert between tblkeys and messages to the agent
+TEST_F(Test_qconf_format, convert_from_tblkeys_and_msgs)
+{
+    vector<string> tblkeys, msgs, keys_out, all_out;
+    for (int i = 0; i < 200; i++)
+    {
+        char path[64];
+        snprintf(path, sizeof(path), "/qconf/demo/batch/node_%d", i);
+        string tblkey;
+        EXPECT_EQ(QCONF_OK, serialize_to_tblkey(QCONF_DATA_TYPE_NODE, "test", path, tblkey));
+        tblkeys.push_back(tblkey);
+    }
+
+    EXPECT_EQ(QCONF_OK, tblkeys_to_msgs(tblkeys, msgs));
+    EXPECT_GT(msgs.size(), 1u);
+    for (size_t i = 0; i < msgs.size(); i++)
+    {
+        EXPECT_LT(msgs[i].size(), (size_t)QCONF_MAX_MSG_LEN);
+        EXPECT_EQ(QCONF_OK, msg_to_tblkeys(msgs[i], keys_out));
+        all_out.insert(all_out.end(), keys_out.begin(), keys_out.end());
+    }
+    EXPECT_TRUE(tblkeys == all_out);
+
+    // a single key message is not one of many
+    EXPECT_EQ(QCONF_ERR_DATA_TYPE, msg_to_tblkeys(tblkeys[0], keys_out));
+    tblkeys.push_back(string());
+    EXPECT_EQ(QCONF_ERR_PARAM, tblkeys_to_msgs(tblkeys, msgs));
+}
 /**
   * End_Test between tblval and other val
   *==================================================================================================================================
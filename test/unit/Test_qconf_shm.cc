@@ -1,6 +1,10 @@
 #include <sys/shm.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <string.h>
 
 #include <string>
+#include <vector>
 
 #include "gtest/gtest.h"
 #include "qconf_shm.h"
@@ -12,6 +16,11 @@
 
 using namespace std;
 
+extern int maxSlotsNum;
+extern size_t shmHeapSize;
+extern int shmFormat;
+extern int shmBackend;
+
 // unit test case for qconf_shm.cc
 
 // Related test environment set up and tear down
@@ -23,6 +32,9 @@ protected:
     static const key_t shmkey = 0x1010ac02;
     static void SetUpTestCase()
     {
+        // tables are created with the slots and format of the agent's configuration
+        maxSlotsNum = MAX_SLOT_COUNT;
+        shmFormat = QHASHARR_FORMAT_FPRINT;
         create_hash_tbl(tbl, shmkey, 0666);
     }
     virtual void SetUp()
@@ -202,6 +214,287 @@ TEST_F(Test_qconf_shm, create_hash_tbl_common)
     EXPECT_EQ(0, shmctl(shmid, IPC_RMID, NULL));
 }
 
+// Test for create_hash_tbl: table is created with the group layout
+TEST_F(Test_qconf_shm, create_hash_tbl_group_format)
+{
+    int retCode = 0;
+    key_t shmkey = 0x1010ac03;
+    qhasharr_t *tbl = NULL;
+    int old_slots_num = maxSlotsNum;
+
+    maxSlotsNum = 100;
+    shmFormat = QHASHARR_FORMAT_GROUP;
+    retCode = create_hash_tbl(tbl, shmkey, 0666);
+    maxSlotsNum = old_slots_num;
+    shmFormat = QHASHARR_FORMAT_FPRINT;
+    ASSERT_EQ(QCONF_OK, retCode);
+    EXPECT_EQ(QHASHARR_FORMAT_GROUP, qhasharr_format(tbl));
+    EXPECT_EQ(100, tbl->maxslots);
+
+    shmdt(tbl);
+    EXPECT_EQ(0, shmctl(shmget(shmkey, 0, 0666), IPC_RMID, NULL));
+}
+
+// Test for create_hash_tbl: table is created with the fingerprint layout by default
+TEST_F(Test_qconf_shm, create_hash_tbl_fprint_format)
+{
+    int retCode = 0;
+    key_t shmkey = 0x1010ac03;
+    qhasharr_t *tbl = NULL;
+    int old_slots_num = maxSlotsNum;
+
+    maxSlotsNum = 100;
+    retCode = create_hash_tbl(tbl, shmkey, 0666);
+    maxSlotsNum = old_slots_num;
+    ASSERT_EQ(QCONF_OK, retCode);
+    EXPECT_EQ(QHASHARR_FORMAT_FPRINT, qhasharr_format(tbl));
+
+    string key, val("value"), out;
+    serialize_to_tblkey(QCONF_DATA_TYPE_NODE, "corp", "/qconf/demo/a/long/path/of/the/node", key);
+    EXPECT_EQ(QCONF_OK, hash_tbl_set(tbl, key, val));
+    EXPECT_EQ(QCONF_OK, hash_tbl_get(tbl, key, out));
+    EXPECT_EQ(val, out);
+
+    shmdt(tbl);
+    EXPECT_EQ(0, shmctl(shmget(shmkey, 0, 0666), IPC_RMID, NULL));
+}
+
+// Test for create_hash_tbl: table is created with a value heap
+TEST_F(Test_qconf_shm, create_hash_tbl_with_heap)
+{
+    int retCode = 0;
+    key_t shmkey = 0x1010ac03;
+    qhasharr_t *tbl = NULL;
+    int old_slots_num = maxSlotsNum;
+
+    maxSlotsNum = 100;
+    shmHeapSize = 1024 * 1024;
+    retCode = create_hash_tbl(tbl, shmkey, 0666);
+    maxSlotsNum = old_slots_num;
+    shmHeapSize = 0;
+    ASSERT_EQ(QCONF_OK, retCode);
+    EXPECT_EQ(100, tbl->maxslots);
+
+    string key("large"), val(10000, 'v'), out;
+    EXPECT_EQ(QCONF_OK, hash_tbl_set(tbl, key, val));
+    EXPECT_EQ(QCONF_OK, hash_tbl_get(tbl, key, out));
+    EXPECT_EQ(val, out);
+
+    qhasharr_heap_stat_t stat;
+    EXPECT_EQ(QCONF_OK, hash_tbl_get_heap_stat(tbl, stat));
+    EXPECT_EQ(1u, stat.values);
+    EXPECT_EQ(QCONF_ERR_PARAM, hash_tbl_get_heap_stat(NULL, stat));
+
+    shmdt(tbl);
+    EXPECT_EQ(0, shmctl(shmget(shmkey, 0, 0666), IPC_RMID, NULL));
+}
+
+// Test for create_hash_tbl: table is created as a POSIX object
+TEST_F(Test_qconf_shm, create_hash_tbl_posix_backend)
+{
+    int retCode = 0;
+    key_t shmkey = 0x1010ac07;
+    qhasharr_t *tbl = NULL, *rdtbl = NULL;
+    int old_slots_num = maxSlotsNum;
+
+    maxSlotsNum = 100;
+    shmBackend = QCONF_SHM_BACKEND_POSIX;
+    retCode = create_hash_tbl(tbl, shmkey, 0666);
+    maxSlotsNum = old_slots_num;
+    shmBackend = QCONF_SHM_BACKEND_SYSV;
+    ASSERT_EQ(QCONF_OK, retCode);
+    EXPECT_EQ(100, tbl->maxslots);
+    EXPECT_EQ(-1, shmget(shmkey, 0, 0666));
+
+    string key, val("value"), out;
+    serialize_to_tblkey(QCONF_DATA_TYPE_NODE, "corp", "/qconf/demo/posix", key);
+    EXPECT_EQ(QCONF_OK, hash_tbl_set(tbl, key, val));
+
+    // readers find the object by the key
+    ASSERT_EQ(QCONF_OK, init_hash_tbl(rdtbl, shmkey, 0444, SHM_RDONLY));
+    EXPECT_NE(tbl, rdtbl);
+    EXPECT_EQ(QCONF_OK, hash_tbl_get(rdtbl, key, out));
+    EXPECT_EQ(val, out);
+
+    // the object is kept when the agent creates it again with sysv
+    qhasharr_t *tbl2 = NULL;
+    EXPECT_EQ(QCONF_OK, create_hash_tbl(tbl2, shmkey, 0666));
+    EXPECT_EQ(-1, shmget(shmkey, 0, 0666));
+    EXPECT_EQ(QCONF_OK, hash_tbl_get(tbl2, key, out));
+
+    detach_hash_tbl(tbl2);
+    detach_hash_tbl(rdtbl);
+    detach_hash_tbl(tbl);
+    EXPECT_EQ(QCONF_OK, remove_hash_tbl(shmkey, 0666));
+    EXPECT_EQ(QCONF_ERR_SHMGET, init_hash_tbl(rdtbl, shmkey, 0444, SHM_RDONLY));
+    EXPECT_EQ(QCONF_ERR_NOT_FOUND, remove_hash_tbl(shmkey, 0666));
+}
+
+static void resize_node(int i, int len, string &tblkey, string &tblval)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/qconf/demo/resize/node%d", i);
+    serialize_to_tblkey(QCONF_DATA_TYPE_NODE, "corp", path, tblkey);
+    nodeval_to_tblval(tblkey, string(len, 'v'), tblval);
+}
+
+// Test for hash_tbl_resize: entries are moved into a larger table published in ctrl
+TEST_F(Test_qconf_shm, hash_tbl_resize_grow)
+{
+    key_t ctrlkey = 0x1010ac05, basekey = 0x1010ac06, shmkey = 0;
+    uint32_t generation = 0;
+    qconf_shm_ctrl_t *ctrl = NULL;
+    qhasharr_t *tbl = NULL;
+    int old_slots_num = maxSlotsNum;
+
+    ASSERT_EQ(QCONF_OK, create_shm_ctrl(ctrl, ctrlkey, basekey, 0666));
+    ASSERT_EQ(QCONF_OK, shm_ctrl_get(ctrl, shmkey, generation));
+    EXPECT_EQ(basekey, shmkey);
+    EXPECT_EQ(0u, generation);
+
+    maxSlotsNum = 30;
+    ASSERT_EQ(QCONF_OK, create_hash_tbl(tbl, shmkey, 0666));
+    maxSlotsNum = old_slots_num;
+    qhasharr_t *old_tbl = tbl;
+
+    string tblkey, tblval, out;
+    for (int i = 0; i < 10; i++)
+    {
+        resize_node(i, i * 10, tblkey, tblval);
+        EXPECT_EQ(QCONF_OK, hash_tbl_set(tbl, tblkey, tblval));
+    }
+
+    EXPECT_EQ(QCONF_OK, hash_tbl_resize(tbl, ctrl, 200, 0666));
+    EXPECT_NE(old_tbl, tbl);
+    EXPECT_EQ(200, tbl->maxslots);
+    EXPECT_EQ(QCONF_OK, shm_ctrl_get(ctrl, shmkey, generation));
+    EXPECT_EQ(basekey + 1, shmkey);
+    EXPECT_EQ(2u, generation);
+
+    for (int i = 0; i < 10; i++)
+    {
+        resize_node(i, i * 10, tblkey, tblval);
+        EXPECT_EQ(QCONF_OK, hash_tbl_get(tbl, tblkey, out));
+        EXPECT_EQ(tblval, out);
+    }
+
+    // writes through the replaced table go to the new one
+    resize_node(10, 10, tblkey, tblval);
+    EXPECT_EQ(QCONF_OK, hash_tbl_set(old_tbl, tblkey, tblval));
+    EXPECT_EQ(QCONF_OK, hash_tbl_get(tbl, tblkey, out));
+    EXPECT_EQ(tblval, out);
+    EXPECT_FALSE(hash_tbl_exist(old_tbl, tblkey));
+
+    // the replaced table is removed once detached
+    EXPECT_EQ(-1, shmget(basekey, 0, 0666));
+
+    // resizing again takes the base key back
+    EXPECT_EQ(QCONF_OK, hash_tbl_resize(old_tbl, ctrl, 100, 0666));
+    EXPECT_EQ(100, old_tbl->maxslots);
+    EXPECT_EQ(QCONF_OK, shm_ctrl_get(ctrl, shmkey, generation));
+    EXPECT_EQ(basekey, shmkey);
+    EXPECT_EQ(QCONF_OK, hash_tbl_get(old_tbl, tblkey, out));
+    EXPECT_EQ(tblval, out);
+
+    shmdt(old_tbl);
+    shmdt(ctrl);
+    EXPECT_EQ(0, shmctl(shmget(basekey, 0, 0666), IPC_RMID, NULL));
+    EXPECT_EQ(0, shmctl(shmget(ctrlkey, 0, 0666), IPC_RMID, NULL));
+}
+
+// Test for hash_tbl_resize: the table is kept if the entries don't fit
+TEST_F(Test_qconf_shm, hash_tbl_resize_too_small)
+{
+    key_t ctrlkey = 0x1010ac05, basekey = 0x1010ac06, shmkey = 0;
+    uint32_t generation = 0;
+    qconf_shm_ctrl_t *ctrl = NULL;
+    qhasharr_t *tbl = NULL;
+    int old_slots_num = maxSlotsNum;
+
+    ASSERT_EQ(QCONF_OK, create_shm_ctrl(ctrl, ctrlkey, basekey, 0666));
+    maxSlotsNum = 50;
+    ASSERT_EQ(QCONF_OK, create_hash_tbl(tbl, basekey, 0666));
+    maxSlotsNum = old_slots_num;
+    qhasharr_t *old_tbl = tbl;
+
+    string tblkey, tblval;
+    for (int i = 0; i < 20; i++)
+    {
+        resize_node(i, 10, tblkey, tblval);
+        EXPECT_EQ(QCONF_OK, hash_tbl_set(tbl, tblkey, tblval));
+    }
+
+    EXPECT_EQ(QCONF_ERR_SHM_RESIZE, hash_tbl_resize(tbl, ctrl, 10, 0666));
+    EXPECT_EQ(old_tbl, tbl);
+    EXPECT_EQ(QCONF_OK, shm_ctrl_get(ctrl, shmkey, generation));
+    EXPECT_EQ(basekey, shmkey);
+    EXPECT_EQ(0u, generation);
+    EXPECT_EQ(-1, shmget(basekey + 1, 0, 0666));
+    resize_node(20, 10, tblkey, tblval);
+    EXPECT_EQ(QCONF_OK, hash_tbl_set(tbl, tblkey, tblval));
+
+    EXPECT_EQ(QCONF_ERR_PARAM, hash_tbl_resize(tbl, NULL, 100, 0666));
+    EXPECT_EQ(QCONF_ERR_SHMINIT, shm_ctrl_get((qconf_shm_ctrl_t*)tbl, shmkey, generation));
+
+    shmdt(tbl);
+    shmdt(ctrl);
+    EXPECT_EQ(0, shmctl(shmget(basekey, 0, 0666), IPC_RMID, NULL));
+    EXPECT_EQ(0, shmctl(shmget(ctrlkey, 0, 0666), IPC_RMID, NULL));
+}
+
+// Test for hash_tbl_set: entries clients get are kept when the table is full
+TEST_F(Test_qconf_shm, hash_tbl_set_evict_unreferenced)
+{
+    key_t shmkey = 0x1010ac08;
+    qhasharr_t *tbl = NULL;
+    qconf_shm_refs_t *refs = NULL;
+    int old_slots_num = maxSlotsNum;
+
+    maxSlotsNum = 40;
+    ASSERT_EQ(QCONF_OK, create_hash_tbl(tbl, shmkey, 0666));
+    maxSlotsNum = old_slots_num;
+    ASSERT_EQ(QCONF_OK, init_hash_tbl_refs(refs, shmkey));
+    EXPECT_EQ(40, refs->nrefs);
+
+    string local_idc;
+    EXPECT_EQ(QCONF_OK, qconf_update_localidc(tbl, "corp"));
+
+    string tblkey, tblval, out;
+    for (int i = 0; i < 19; i++)
+    {
+        resize_node(i, 10, tblkey, tblval);
+        EXPECT_EQ(QCONF_OK, hash_tbl_set(tbl, tblkey, tblval));
+    }
+
+    // clients keep getting the first 5 entries, the table is full after 5
+    // more entries
+    for (int i = 19; i < 34; i++)
+    {
+        string hotkey, hotval;
+        for (int j = 0; j < 5; j++)
+        {
+            resize_node(j, 10, hotkey, hotval);
+            EXPECT_EQ(QCONF_OK, hash_tbl_get(tbl, hotkey, out, refs));
+        }
+
+        resize_node(i, 10, tblkey, tblval);
+        EXPECT_EQ(QCONF_OK, hash_tbl_set(tbl, tblkey, tblval));
+    }
+
+    for (int i = 0; i < 5; i++)
+    {
+        resize_node(i, 10, tblkey, tblval);
+        EXPECT_EQ(QCONF_OK, hash_tbl_get(tbl, tblkey, out));
+    }
+    EXPECT_EQ(QCONF_OK, qconf_get_localidc(tbl, local_idc));
+    EXPECT_EQ("corp", local_idc);
+
+    shmdt(refs);
+    detach_hash_tbl(tbl);
+    EXPECT_EQ(QCONF_OK, remove_hash_tbl(shmkey, 0666));
+    EXPECT_EQ(QCONF_ERR_SHMGET, init_hash_tbl_refs(refs, shmkey));
+}
+
 // Test for create_hash_tbl: already_exist
 TEST_F(Test_qconf_shm, create_hash_tbl_already_exist)
 {
@@ -1521,3 +1814,729 @@ TEST_F(Test_qconf_shm, hash_tbl_getnext_type_mix)
   * End_Test_for function: int hash_tbl_getnext(qhasharr_t *tbl, string &tblkey, string &tblval, int &idx)
   *==============================================================================================================
   */
+
+/**
+  *======================================================================================================================
+  * Begin_Test_for function: int hash_tbl_get_ref(qhasharr_t *tbl, const char *key, size_t key_len,
+  *                                               const char *&val, size_t &val_len, uint32_t &version)
+  *                          int hash_tbl_check_ref(qhasharr_t *tbl, uint32_t version)
+  */
+// Test for hash_tbl_get_ref: key not exists
+TEST_F(Test_qconf_shm, hash_tbl_get_ref_key_not_exists)
+{
+    const char *val = NULL;
+    size_t val_len = 0;
+    uint32_t version = 0;
+    string tblkey;
+    serialize_to_tblkey(QCONF_DATA_TYPE_NODE, "corp", "/demo/node", tblkey);
+
+    EXPECT_EQ(QCONF_ERR_NOT_FOUND, hash_tbl_get_ref(tbl, tblkey.data(), tblkey.size(), val, val_len, version));
+}
+
+// Test for hash_tbl_get_ref: value kept in one slot
+TEST_F(Test_qconf_shm, hash_tbl_get_ref_one_slot)
+{
+    const char *val = NULL, *nodeval = NULL;
+    size_t val_len = 0, nodeval_len = 0;
+    uint32_t version = 0;
+    string tblkey, tblval;
+    serialize_to_tblkey(QCONF_DATA_TYPE_NODE, "corp", "/demo/node", tblkey);
+    nodeval_to_tblval(tblkey, "value", tblval);
+    EXPECT_EQ(QCONF_OK, hash_tbl_set(tbl, tblkey, tblval));
+
+    EXPECT_EQ(QCONF_OK, hash_tbl_get_ref(tbl, tblkey.data(), tblkey.size(), val, val_len, version));
+    EXPECT_EQ(QCONF_OK, tblval_to_nodeval(val, val_len, nodeval, nodeval_len));
+    EXPECT_EQ("value", string(nodeval, nodeval_len));
+    EXPECT_EQ(QCONF_OK, hash_tbl_check_ref(tbl, version));
+}
+
+// Test for hash_tbl_get_ref: value spans several slots
+TEST_F(Test_qconf_shm, hash_tbl_get_ref_several_slots)
+{
+    const char *val = NULL;
+    size_t val_len = 0;
+    uint32_t version = 0;
+    string tblkey, tblval;
+    serialize_to_tblkey(QCONF_DATA_TYPE_NODE, "corp", "/demo/node", tblkey);
+    nodeval_to_tblval(tblkey, string(500, 'a'), tblval);
+    EXPECT_EQ(QCONF_OK, hash_tbl_set(tbl, tblkey, tblval));
+
+    EXPECT_EQ(QCONF_ERR_SHM_SPLIT, hash_tbl_get_ref(tbl, tblkey.data(), tblkey.size(), val, val_len, version));
+}
+
+// Test for hash_tbl_check_ref: value changed after referenced
+TEST_F(Test_qconf_shm, hash_tbl_check_ref_value_changed)
+{
+    const char *val = NULL;
+    size_t val_len = 0;
+    uint32_t version = 0;
+    string tblkey, tblval;
+    serialize_to_tblkey(QCONF_DATA_TYPE_NODE, "corp", "/demo/node", tblkey);
+    nodeval_to_tblval(tblkey, "value", tblval);
+    EXPECT_EQ(QCONF_OK, hash_tbl_set(tbl, tblkey, tblval));
+
+    EXPECT_EQ(QCONF_OK, hash_tbl_get_ref(tbl, tblkey.data(), tblkey.size(), val, val_len, version));
+    nodeval_to_tblval(tblkey, "value2", tblval);
+    EXPECT_EQ(QCONF_OK, hash_tbl_set(tbl, tblkey, tblval));
+    EXPECT_EQ(QCONF_ERR_SHM_CHANGED, hash_tbl_check_ref(tbl, version));
+}
+
+// Test for hash_tbl_get_stamp: users' data is stamped by hash_tbl_set
+TEST_F(Test_qconf_shm, hash_tbl_get_stamp_set)
+{
+    qconf_stamp_t stamp;
+    string tblkey, tblval, out;
+    serialize_to_tblkey(QCONF_DATA_TYPE_NODE, "corp", "/demo/node", tblkey);
+    EXPECT_EQ(QCONF_ERR_NOT_FOUND, hash_tbl_get_stamp(tbl, tblkey, stamp));
+
+    nodeval_to_tblval(tblkey, "value", tblval);
+    EXPECT_EQ(QCONF_OK, hash_tbl_set(tbl, tblkey, tblval, 100, 101));
+    EXPECT_EQ(QCONF_OK, hash_tbl_get(tbl, tblkey, out));
+    EXPECT_EQ(tblval, out);
+    EXPECT_EQ(QCONF_OK, hash_tbl_get_stamp(tbl, tblkey, stamp));
+    EXPECT_EQ(100, stamp.mzxid);
+    EXPECT_EQ(101, stamp.pzxid);
+    EXPECT_EQ(1u, stamp.counter);
+    qconf_stamp_t first = stamp;
+
+    // same value is found by the digest, the zxid moves on
+    EXPECT_EQ(QCONF_ERR_SAME_VALUE, hash_tbl_set(tbl, tblkey, tblval, 100, 101));
+    EXPECT_EQ(QCONF_ERR_SAME_VALUE, hash_tbl_set(tbl, tblkey, tblval, 102, 101));
+    EXPECT_EQ(QCONF_OK, hash_tbl_get_stamp(tbl, tblkey, stamp));
+    EXPECT_EQ(102, stamp.mzxid);
+    EXPECT_EQ(1u, stamp.counter);
+    EXPECT_EQ(0, memcmp(first.digest, stamp.digest, QCONF_STAMP_DIGEST_LEN));
+
+    nodeval_to_tblval(tblkey, "value2", tblval);
+    EXPECT_EQ(QCONF_OK, hash_tbl_set(tbl, tblkey, tblval, 103, 101));
+    EXPECT_EQ(QCONF_OK, hash_tbl_get_stamp(tbl, tblkey, stamp));
+    EXPECT_EQ(103, stamp.mzxid);
+    EXPECT_EQ(2u, stamp.counter);
+    EXPECT_NE(0, memcmp(first.digest, stamp.digest, QCONF_STAMP_DIGEST_LEN));
+
+    // data of qconf itself is not stamped
+    EXPECT_EQ(QCONF_OK, qconf_update_localidc(tbl, "corp"));
+    serialize_to_tblkey(QCONF_DATA_TYPE_LOCAL_IDC, "", "", tblkey);
+    EXPECT_EQ(QCONF_ERR_NOT_FOUND, hash_tbl_get_stamp(tbl, tblkey, stamp));
+}
+
+// Test for hash_tbl_set_batch: entries are written at once and read as of one moment
+TEST_F(Test_qconf_shm, hash_tbl_set_batch_get_batch)
+{
+    vector<string> keys(3), vals;
+    vector<int> rets;
+    string tblval, out;
+    serialize_to_tblkey(QCONF_DATA_TYPE_NODE, "corp", "/db/host", keys[0]);
+    serialize_to_tblkey(QCONF_DATA_TYPE_NODE, "corp", "/db/password", keys[1]);
+    serialize_to_tblkey(QCONF_DATA_TYPE_NODE, "corp", "/db/old", keys[2]);
+    nodeval_to_tblval(keys[2], "old", tblval);
+    EXPECT_EQ(QCONF_OK, hash_tbl_set(tbl, keys[2], tblval));
+    nodeval_to_tblval(keys[0], "10.0.0.1", tblval);
+    EXPECT_EQ(QCONF_OK, hash_tbl_set(tbl, keys[0], tblval, 10, 10));
+
+    vector<qconf_tbl_entry_t> entries(3);
+    for (int i = 0; i < 3; i++)
+    {
+        entries[i].key = keys[i];
+        entries[i].mzxid = entries[i].pzxid = 0;
+        entries[i].remove = false;
+        entries[i].ret = QCONF_OK;
+    }
+    nodeval_to_tblval(keys[0], "10.0.0.1", entries[0].val);
+    nodeval_to_tblval(keys[1], "secret", entries[1].val);
+    entries[2].remove = true;
+    EXPECT_EQ(QCONF_OK, hash_tbl_set_batch(tbl, entries));
+    EXPECT_EQ(QCONF_ERR_SAME_VALUE, entries[0].ret);
+    EXPECT_EQ(QCONF_OK, entries[1].ret);
+    EXPECT_EQ(QCONF_OK, entries[2].ret);
+
+    EXPECT_EQ(QCONF_OK, hash_tbl_get_batch(tbl, keys, vals, rets));
+    ASSERT_EQ(3u, rets.size());
+    EXPECT_EQ(QCONF_OK, rets[0]);
+    EXPECT_EQ(entries[0].val, vals[0]);
+    EXPECT_EQ(QCONF_OK, rets[1]);
+    EXPECT_EQ(entries[1].val, vals[1]);
+    EXPECT_EQ(QCONF_ERR_NOT_FOUND, rets[2]);
+
+    // entries are stamped as hash_tbl_set does
+    qconf_stamp_t stamp;
+    EXPECT_EQ(QCONF_OK, hash_tbl_get_stamp(tbl, keys[1], stamp));
+    EXPECT_EQ(1u, stamp.counter);
+
+    // nothing to write
+    EXPECT_EQ(QCONF_OK, hash_tbl_set_batch(tbl, entries));
+    EXPECT_EQ(QCONF_ERR_SAME_VALUE, entries[1].ret);
+    EXPECT_EQ(QCONF_ERR_SAME_VALUE, entries[2].ret);
+}
+
+// Test for shm_journal_tail: writes are recorded in order and lost ones are found
+TEST_F(Test_qconf_shm, shm_journal_tail_set_remove)
+{
+    key_t journalkey = 0x1010ac0b;
+    qconf_shm_journal_t *journal = NULL, *client_journal = NULL;
+    EXPECT_EQ(QCONF_ERR_SHMGET, init_shm_journal(client_journal, journalkey));
+    ASSERT_EQ(QCONF_OK, create_shm_journal(journal, journalkey, 4, 0666));
+    ASSERT_EQ(QCONF_OK, init_shm_journal(client_journal, journalkey));
+    uint64_t cursor = shm_journal_head(client_journal);
+
+    string tblkey, tblval;
+    serialize_to_tblkey(QCONF_DATA_TYPE_NODE, "corp", "/demo/journal", tblkey);
+    nodeval_to_tblval(tblkey, "value", tblval);
+    EXPECT_EQ(QCONF_OK, hash_tbl_set(tbl, tblkey, tblval));
+    EXPECT_EQ(QCONF_ERR_SAME_VALUE, hash_tbl_set(tbl, tblkey, tblval));
+    EXPECT_EQ(QCONF_OK, hash_tbl_remove(tbl, tblkey));
+
+    qconf_shm_journal_rec_t recs[4];
+    int nrecs = 0;
+    EXPECT_EQ(QCONF_OK, shm_journal_tail(client_journal, cursor, recs, 4, nrecs));
+    ASSERT_EQ(2, nrecs);
+    EXPECT_EQ(QCONF_JOURNAL_SET, recs[0].type);
+    EXPECT_EQ(QCONF_DATA_TYPE_NODE, recs[0].dtype);
+    EXPECT_EQ(qhashmurmur3_32(tblkey.data(), tblkey.size()), recs[0].keyhash);
+    EXPECT_EQ(QCONF_JOURNAL_REMOVE, recs[1].type);
+    EXPECT_EQ(recs[0].seq + 1, recs[1].seq);
+    EXPECT_EQ(recs[1].seq + 1, cursor);
+
+    EXPECT_EQ(QCONF_OK, shm_journal_tail(client_journal, cursor, recs, 4, nrecs));
+    EXPECT_EQ(0, nrecs);
+
+    // the ring wraps past the cursor
+    uint64_t old_cursor = cursor;
+    for (int i = 0; i < 3; i++)
+    {
+        EXPECT_EQ(QCONF_OK, hash_tbl_set(tbl, tblkey, tblval));
+        EXPECT_EQ(QCONF_OK, hash_tbl_remove(tbl, tblkey));
+    }
+    EXPECT_EQ(QCONF_ERR_SHM_OVERRUN, shm_journal_tail(client_journal, cursor, recs, 4, nrecs));
+    EXPECT_EQ(old_cursor + 6, cursor);
+
+    hash_tbl_clear(tbl);
+    EXPECT_EQ(QCONF_OK, shm_journal_tail(client_journal, cursor, recs, 4, nrecs));
+    ASSERT_EQ(1, nrecs);
+    EXPECT_EQ(QCONF_JOURNAL_CLEAR, recs[0].type);
+
+    detach_shm_journal(client_journal);
+    detach_shm_journal(journal);
+    EXPECT_EQ(0, shmctl(shmget(journalkey, 0, 0666), IPC_RMID, NULL));
+}
+
+// Test for shm_ns_route: paths go to the namespace of their longest prefix
+TEST_F(Test_qconf_shm, shm_ns_route_longest_prefix)
+{
+    vector<qconf_shm_ns_entry_t> entries(3);
+    memset(&entries[0], 0, entries.size() * sizeof(qconf_shm_ns_entry_t));
+    strcpy(entries[0].prefix, "/search");
+    strcpy(entries[1].prefix, "/search/index");
+    strcpy(entries[2].prefix, "/ads/");
+
+    const char *paths[] = {"/search", "/search/a", "/search/index/b", "/searchx", "/ads/x", "/ads", "/other"};
+    int indexes[] = {0, 0, 1, -1, 2, -1, -1};
+    string tblkey, absent_key;
+    for (size_t i = 0; i < sizeof(indexes) / sizeof(indexes[0]); i++)
+    {
+        serialize_to_tblkey(QCONF_DATA_TYPE_NODE, "corp", paths[i], tblkey);
+        EXPECT_EQ(indexes[i], shm_ns_route(entries, tblkey.data(), tblkey.size())) << paths[i];
+        serialize_to_absent_tblkey(tblkey, absent_key);
+        EXPECT_EQ(indexes[i], shm_ns_route(entries, absent_key.data(), absent_key.size())) << paths[i];
+    }
+
+    serialize_to_tblkey(QCONF_DATA_TYPE_SERVICE, "corp", "/search/index/b", tblkey);
+    EXPECT_EQ(1, shm_ns_route(entries, tblkey.data(), tblkey.size()));
+    serialize_to_tblkey(QCONF_DATA_TYPE_LOCAL_IDC, "", "", tblkey);
+    EXPECT_EQ(-1, shm_ns_route(entries, tblkey.data(), tblkey.size()));
+    serialize_to_tblkey(QCONF_DATA_TYPE_NODE, "corp", "/search", tblkey);
+    EXPECT_EQ(-1, shm_ns_route(entries, tblkey.data(), tblkey.size() - 1));
+}
+
+// Test for shm_ns_get: namespaces published are got as they are
+TEST_F(Test_qconf_shm, shm_ns_publish_get)
+{
+    key_t nskey = 0x1010ac0c;
+    qconf_shm_ns_t *ns = NULL, *client_ns = NULL;
+    EXPECT_EQ(QCONF_ERR_SHMGET, init_shm_ns(client_ns, nskey));
+    ASSERT_EQ(QCONF_OK, create_shm_ns(ns, nskey, 0666));
+    ASSERT_EQ(QCONF_OK, init_shm_ns(client_ns, nskey));
+
+    vector<qconf_shm_ns_entry_t> entries(1), got;
+    memset(&entries[0], 0, sizeof(qconf_shm_ns_entry_t));
+    strcpy(entries[0].name, "search");
+    strcpy(entries[0].prefix, "/search");
+    entries[0].shmkey = 0x1010ac0d;
+    entries[0].max_slots = 16;
+    entries[0].evict = QCONF_SHM_EVICT_NONE;
+    EXPECT_EQ(QCONF_OK, shm_ns_publish(ns, entries));
+
+    uint32_t generation = 0;
+    EXPECT_EQ(QCONF_OK, shm_ns_get(client_ns, got, generation));
+    ASSERT_EQ(1u, got.size());
+    EXPECT_EQ(0u, generation & 1);
+    EXPECT_STREQ("search", got[0].name);
+    EXPECT_STREQ("/search", got[0].prefix);
+    EXPECT_EQ(0x1010ac0d, got[0].shmkey);
+    EXPECT_EQ(QCONF_SHM_EVICT_NONE, got[0].evict);
+
+    uint32_t old_generation = generation;
+    EXPECT_EQ(QCONF_OK, shm_ns_publish(ns, vector<qconf_shm_ns_entry_t>()));
+    EXPECT_EQ(QCONF_OK, shm_ns_get(client_ns, got, generation));
+    EXPECT_EQ(0u, got.size());
+    EXPECT_EQ(old_generation + 2, generation);
+
+    detach_shm_ns(client_ns);
+    detach_shm_ns(ns);
+    EXPECT_EQ(0, shmctl(shmget(nskey, 0, 0666), IPC_RMID, NULL));
+}
+
+// Test for create_hash_tbl: a table of a namespace not evicting fails writes once it's full
+TEST_F(Test_qconf_shm, create_hash_tbl_evict_none)
+{
+    key_t nskey = 0x1010ac0d;
+    qhasharr_t *ns_tbl = NULL;
+    ASSERT_EQ(QCONF_OK, create_hash_tbl(ns_tbl, nskey, 0666, 4, QCONF_SHM_EVICT_NONE));
+    EXPECT_EQ(4, ns_tbl->maxslots);
+
+    int ret = QCONF_OK;
+    int count = 0;
+    string tblkey, tblval;
+    for (; count < 16 && QCONF_OK == ret; count++)
+    {
+        char path[32];
+        snprintf(path, sizeof(path), "/search/%d", count);
+        serialize_to_tblkey(QCONF_DATA_TYPE_NODE, "corp", path, tblkey);
+        nodeval_to_tblval(tblkey, "value", tblval);
+        ret = hash_tbl_set(ns_tbl, tblkey, tblval);
+    }
+    EXPECT_EQ(QCONF_ERR_TBL_SET, ret);
+    EXPECT_LT(1, count);
+
+    // the default table of the fixture still evicts
+    for (int i = 0; i < 16; i++)
+    {
+        char path[32];
+        snprintf(path, sizeof(path), "/other/%d", i);
+        serialize_to_tblkey(QCONF_DATA_TYPE_NODE, "corp", path, tblkey);
+        nodeval_to_tblval(tblkey, "value", tblval);
+        EXPECT_EQ(QCONF_OK, hash_tbl_set(tbl, tblkey, tblval));
+    }
+
+    detach_hash_tbl(ns_tbl);
+    EXPECT_EQ(QCONF_OK, remove_hash_tbl(nskey, 0666));
+}
+
+// Test for hash_tbl_set_batch: a batch larger than the table evicts nothing
+TEST_F(Test_qconf_shm, hash_tbl_set_batch_larger_than_tbl)
+{
+    key_t nskey = 0x1010ac13;
+    qhasharr_t *ns_tbl = NULL;
+    ASSERT_EQ(QCONF_OK, create_hash_tbl(ns_tbl, nskey, 0666, 16, QCONF_SHM_EVICT_LRU));
+
+    string tblkey, tblval;
+    for (int i = 0; i < 6; i++)
+    {
+        char path[32];
+        snprintf(path, sizeof(path), "/live/%d", i);
+        serialize_to_tblkey(QCONF_DATA_TYPE_NODE, "corp", path, tblkey);
+        nodeval_to_tblval(tblkey, "value", tblval);
+        ASSERT_EQ(QCONF_OK, hash_tbl_set(ns_tbl, tblkey, tblval));
+    }
+
+    vector<qconf_tbl_entry_t> entries(20);
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        char path[32];
+        snprintf(path, sizeof(path), "/batch/%d", (int)i);
+        serialize_to_tblkey(QCONF_DATA_TYPE_NODE, "corp", path, entries[i].key);
+        nodeval_to_tblval(entries[i].key, "value", entries[i].val);
+        entries[i].mzxid = entries[i].pzxid = 0;
+        entries[i].remove = false;
+        entries[i].ret = QCONF_OK;
+    }
+    EXPECT_EQ(QCONF_ERR_TBL_SET, hash_tbl_set_batch(ns_tbl, entries));
+
+    int max_slots = 0, used_slots = 0;
+    hash_tbl_get_count(ns_tbl, max_slots, used_slots);
+    EXPECT_EQ(16, max_slots);
+    EXPECT_EQ(6, used_slots);
+
+    detach_hash_tbl(ns_tbl);
+    EXPECT_EQ(QCONF_OK, remove_hash_tbl(nskey, 0666));
+}
+
+// Test for shm_index_list: paths written are listed by idc and prefix of whole nodes
+TEST_F(Test_qconf_shm, shm_index_list_prefix)
+{
+    key_t indexkey = 0x1010ac0e;
+    qconf_shm_index_t *index = NULL, *client_index = NULL;
+    EXPECT_EQ(QCONF_ERR_SHMGET, init_shm_index(client_index, indexkey));
+    ASSERT_EQ(QCONF_OK, create_shm_index(index, indexkey, 64, 0666));
+    ASSERT_EQ(QCONF_OK, init_shm_index(client_index, indexkey));
+
+    const char *paths[] = {"/app/foo/b", "/app/foo", "/app/foo-x", "/app/foo/a", "/app/foobar", "/other"};
+    string tblkey, tblval;
+    for (size_t i = 0; i < sizeof(paths) / sizeof(paths[0]); i++)
+    {
+        serialize_to_tblkey(QCONF_DATA_TYPE_NODE, "corp", paths[i], tblkey);
+        nodeval_to_tblval(tblkey, "value", tblval);
+        EXPECT_EQ(QCONF_OK, hash_tbl_set(tbl, tblkey, tblval));
+    }
+    string_vector_t nodes;
+    memset(&nodes, 0, sizeof(nodes));
+    serialize_to_tblkey(QCONF_DATA_TYPE_SERVICE, "corp", "/app/foo/a", tblkey);
+    chdnodeval_to_tblval(tblkey, nodes, tblval, vector<char>());
+    EXPECT_EQ(QCONF_OK, hash_tbl_set(tbl, tblkey, tblval));
+    serialize_to_tblkey(QCONF_DATA_TYPE_NODE, "test", "/app/foo/c", tblkey);
+    nodeval_to_tblval(tblkey, "value", tblval);
+    EXPECT_EQ(QCONF_OK, hash_tbl_set(tbl, tblkey, tblval));
+
+    vector<qconf_shm_index_item_t> items;
+    EXPECT_EQ(QCONF_OK, shm_index_list(client_index, "corp", "/app/foo", items));
+    ASSERT_EQ(3u, items.size());
+    EXPECT_EQ("/app/foo", items[0].path);
+    EXPECT_EQ("/app/foo/a", items[1].path);
+    EXPECT_EQ(QCONF_SHM_INDEX_NODE | QCONF_SHM_INDEX_SERVICE, items[1].types);
+    EXPECT_EQ("/app/foo/b", items[2].path);
+    EXPECT_EQ(QCONF_SHM_INDEX_NODE, items[2].types);
+
+    EXPECT_EQ(QCONF_OK, shm_index_list(client_index, "corp", "/app/foo/", items));
+    EXPECT_EQ(2u, items.size());
+    EXPECT_EQ(QCONF_OK, shm_index_list(client_index, "corp", "/ap", items));
+    EXPECT_EQ(0u, items.size());
+
+    // every idc
+    EXPECT_EQ(QCONF_OK, shm_index_list(client_index, "", "/app/foo", items));
+    ASSERT_EQ(4u, items.size());
+    EXPECT_EQ("test", items[3].idc);
+    EXPECT_EQ("/app/foo/c", items[3].path);
+    EXPECT_EQ(QCONF_OK, shm_index_list(client_index, "", "", items));
+    EXPECT_EQ(7u, items.size());
+
+    // the path goes once all of its data is removed
+    serialize_to_tblkey(QCONF_DATA_TYPE_NODE, "corp", "/app/foo/a", tblkey);
+    EXPECT_EQ(QCONF_OK, hash_tbl_remove(tbl, tblkey));
+    EXPECT_EQ(QCONF_OK, shm_index_list(client_index, "corp", "/app/foo/a", items));
+    ASSERT_EQ(1u, items.size());
+    EXPECT_EQ(QCONF_SHM_INDEX_SERVICE, items[0].types);
+    serialize_to_tblkey(QCONF_DATA_TYPE_SERVICE, "corp", "/app/foo/a", tblkey);
+    EXPECT_EQ(QCONF_OK, hash_tbl_remove(tbl, tblkey));
+    EXPECT_EQ(QCONF_OK, shm_index_list(client_index, "corp", "/app/foo/a", items));
+    EXPECT_EQ(0u, items.size());
+
+    hash_tbl_clear(tbl);
+    EXPECT_EQ(QCONF_OK, shm_index_list(client_index, "", "", items));
+    EXPECT_EQ(0u, items.size());
+
+    detach_shm_index(client_index);
+    detach_shm_index(index);
+    EXPECT_EQ(0, shmctl(shmget(indexkey, 0, 0666), IPC_RMID, NULL));
+}
+
+// Test for shm_index_list: long paths evicted from a linear table go from the index and bump their words
+TEST_F(Test_qconf_shm, shm_index_list_evicted_long_keys)
+{
+    key_t nskey = 0x1010ac14, indexkey = 0x1010ac0e, genskey = 0x1010ac15;
+    qhasharr_t *ns_tbl = NULL;
+    qconf_shm_index_t *index = NULL;
+    qconf_shm_gens_t *gens = NULL;
+    shmFormat = QHASHARR_FORMAT_LINEAR;
+    ASSERT_EQ(QCONF_OK, create_hash_tbl(ns_tbl, nskey, 0666, 8, QCONF_SHM_EVICT_LRU));
+    shmFormat = QHASHARR_FORMAT_FPRINT;
+    ASSERT_EQ(QCONF_OK, create_shm_index(index, indexkey, 64, 0666));
+    ASSERT_EQ(QCONF_OK, create_shm_gens(gens, genskey, 64, 0644));
+
+    string tblkey, tblval, first;
+    uint32_t gen = 0;
+    for (int i = 0; i < 20; i++)
+    {
+        char path[64];
+        snprintf(path, sizeof(path), "/demo/evict/a/path/longer/than/a/slot/%d", i);
+        serialize_to_tblkey(QCONF_DATA_TYPE_NODE, "corp", path, tblkey);
+        ASSERT_LT((size_t)_Q_HASHARR_KEYSIZE, tblkey.size());
+        nodeval_to_tblval(tblkey, "value", tblval);
+        ASSERT_EQ(QCONF_OK, hash_tbl_set(ns_tbl, tblkey, tblval));
+        if (0 == i)
+        {
+            first = tblkey;
+            gen = shm_gens_get(gens, first.data(), first.size());
+        }
+    }
+
+    vector<qconf_shm_index_item_t> items;
+    EXPECT_EQ(QCONF_OK, shm_index_list(index, "corp", "/demo/evict", items));
+    EXPECT_EQ((size_t)qhasharr_size(ns_tbl, NULL, NULL), items.size());
+    EXPECT_FALSE(hash_tbl_exist(ns_tbl, first));
+    EXPECT_NE(gen, shm_gens_get(gens, first.data(), first.size()));
+
+    detach_shm_gens(gens);
+    EXPECT_EQ(0, shmctl(shmget(genskey, 0, 0), IPC_RMID, NULL));
+    detach_shm_index(index);
+    EXPECT_EQ(0, shmctl(shmget(indexkey, 0, 0666), IPC_RMID, NULL));
+    detach_hash_tbl(ns_tbl);
+    EXPECT_EQ(QCONF_OK, remove_hash_tbl(nskey, 0666));
+}
+
+// Test for create_shm_index: paths of the table are indexed, the ones beyond the size are dropped
+TEST_F(Test_qconf_shm, shm_index_add_tbl_full)
+{
+    key_t indexkey = 0x1010ac0e;
+    string tblkey, tblval;
+    for (int i = 0; i < 8; i++)
+    {
+        char path[32];
+        snprintf(path, sizeof(path), "/demo/index/%d", i);
+        serialize_to_tblkey(QCONF_DATA_TYPE_NODE, "corp", path, tblkey);
+        nodeval_to_tblval(tblkey, "value", tblval);
+        EXPECT_EQ(QCONF_OK, hash_tbl_set(tbl, tblkey, tblval));
+    }
+
+    qconf_shm_index_t *index = NULL;
+    ASSERT_EQ(QCONF_OK, create_shm_index(index, indexkey, 4, 0666));
+    EXPECT_EQ(QCONF_OK, shm_index_add_tbl(tbl));
+
+    vector<qconf_shm_index_item_t> items;
+    EXPECT_EQ(QCONF_ERR_SHM_INDEX_FULL, shm_index_list(index, "corp", "/demo", items));
+    EXPECT_EQ(4u, items.size());
+
+    // room is made by removes
+    for (int i = 0; i < 8; i++)
+    {
+        char path[32];
+        snprintf(path, sizeof(path), "/demo/index/%d", i);
+        serialize_to_tblkey(QCONF_DATA_TYPE_NODE, "corp", path, tblkey);
+        EXPECT_EQ(QCONF_OK, hash_tbl_remove(tbl, tblkey));
+    }
+    serialize_to_tblkey(QCONF_DATA_TYPE_NODE, "corp", "/demo/index/new", tblkey);
+    nodeval_to_tblval(tblkey, "value", tblval);
+    EXPECT_EQ(QCONF_OK, hash_tbl_set(tbl, tblkey, tblval));
+    EXPECT_EQ(QCONF_ERR_SHM_INDEX_FULL, shm_index_list(index, "corp", "/demo", items));
+    ASSERT_EQ(1u, items.size());
+    EXPECT_EQ("/demo/index/new", items[0].path);
+
+    // records removed are reclaimed once the pool is full
+    string long_path("/demo/long/");
+    long_path.append(60, 'x');
+    for (int i = 0; i < 20; i++)
+    {
+        serialize_to_tblkey(QCONF_DATA_TYPE_NODE, "corp", long_path, tblkey);
+        nodeval_to_tblval(tblkey, "value", tblval);
+        EXPECT_EQ(QCONF_OK, hash_tbl_set(tbl, tblkey, tblval));
+        EXPECT_EQ(QCONF_OK, hash_tbl_remove(tbl, tblkey));
+    }
+    EXPECT_EQ(QCONF_OK, hash_tbl_set(tbl, tblkey, tblval));
+    EXPECT_EQ(QCONF_ERR_SHM_INDEX_FULL, shm_index_list(index, "corp", "/demo", items));
+    ASSERT_EQ(2u, items.size());
+    EXPECT_EQ("/demo/index/new", items[0].path);
+    EXPECT_EQ(long_path, items[1].path);
+
+    detach_shm_index(index);
+    EXPECT_EQ(0, shmctl(shmget(indexkey, 0, 0666), IPC_RMID, NULL));
+}
+
+struct set_value_arg
+{
+    qhasharr_t *tbl;
+    string tblkey;
+};
+
+static void *set_value_later(void *arg)
+{
+    set_value_arg *set_arg = (set_value_arg *)arg;
+    string tblval;
+
+    usleep(50000);
+    nodeval_to_tblval(set_arg->tblkey, "value3", tblval);
+    hash_tbl_set(set_arg->tbl, set_arg->tblkey, tblval);
+    return NULL;
+}
+
+// Test for shm_gens_wait: writes bump the generation of the key and wake the waiters
+TEST_F(Test_qconf_shm, shm_gens_wait_set)
+{
+    key_t genskey = 0x1010ac0a;
+    qconf_shm_gens_t *gens = NULL, *client_gens = NULL;
+    EXPECT_EQ(QCONF_ERR_SHMGET, init_shm_gens(client_gens, genskey));
+    ASSERT_EQ(QCONF_OK, create_shm_gens(gens, genskey, 64, 0644));
+    ASSERT_EQ(QCONF_OK, init_shm_gens(client_gens, genskey));
+    EXPECT_EQ(64u, client_gens->ngens);
+
+    string tblkey, tblval;
+    serialize_to_tblkey(QCONF_DATA_TYPE_NODE, "corp", "/demo/wait", tblkey);
+    uint32_t gen = shm_gens_get(client_gens, tblkey.data(), tblkey.size());
+    nodeval_to_tblval(tblkey, "value", tblval);
+    EXPECT_EQ(QCONF_OK, hash_tbl_set(tbl, tblkey, tblval));
+    EXPECT_EQ(gen + 1, shm_gens_get(client_gens, tblkey.data(), tblkey.size()));
+
+    // the same value writes nothing, removing bumps it again
+    gen++;
+    EXPECT_EQ(QCONF_ERR_SAME_VALUE, hash_tbl_set(tbl, tblkey, tblval));
+    EXPECT_EQ(gen, shm_gens_get(client_gens, tblkey.data(), tblkey.size()));
+    EXPECT_EQ(QCONF_OK, hash_tbl_remove(tbl, tblkey));
+    EXPECT_EQ(gen + 1, shm_gens_get(client_gens, tblkey.data(), tblkey.size()));
+
+    // moved already
+    struct timespec deadline, start, end;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += 5;
+    EXPECT_EQ(QCONF_OK, shm_gens_wait(client_gens, tblkey.data(), tblkey.size(), gen, deadline));
+
+    // nobody writes
+    gen++;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_nsec += 20000000;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    EXPECT_EQ(QCONF_ERR_SHM_TIMEOUT, shm_gens_wait(client_gens, tblkey.data(), tblkey.size(), gen, deadline));
+    EXPECT_EQ(QCONF_ERR_SHM_TIMEOUT, shm_gens_wait(client_gens, tblkey.data(), tblkey.size(), gen, deadline));
+
+    // woken up by the writer long before the deadline
+    pthread_t writer;
+    set_value_arg set_arg = {tbl, tblkey};
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    deadline = start;
+    deadline.tv_sec += 5;
+    ASSERT_EQ(0, pthread_create(&writer, NULL, set_value_later, &set_arg));
+    while (gen == shm_gens_get(client_gens, tblkey.data(), tblkey.size()))
+        shm_gens_wait(client_gens, tblkey.data(), tblkey.size(), gen, deadline);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    pthread_join(writer, NULL);
+    EXPECT_GT(2, end.tv_sec - start.tv_sec);
+
+    detach_shm_gens(client_gens);
+    detach_shm_gens(gens);
+    EXPECT_EQ(0, shmctl(shmget(genskey, 0, 0), IPC_RMID, NULL));
+}
+
+// Test for init_shm_gens: the number of words is checked against the segment
+TEST_F(Test_qconf_shm, init_shm_gens_ngens_out_of_segment)
+{
+    key_t genskey = 0x1010ac11;
+    qconf_shm_gens_t *gens = NULL, *client_gens = NULL;
+    ASSERT_EQ(QCONF_OK, create_shm_gens(gens, genskey, 64, 0644));
+
+    gens->ngens = 1 << 30;
+    EXPECT_EQ(QCONF_ERR_SHMINIT, init_shm_gens(client_gens, genskey));
+    gens->ngens = 65;
+    EXPECT_EQ(QCONF_ERR_SHMINIT, init_shm_gens(client_gens, genskey));
+    gens->ngens = 0;
+    EXPECT_EQ(QCONF_ERR_SHMINIT, init_shm_gens(client_gens, genskey));
+    detach_shm_gens(gens);
+
+    // created again rather than reused
+    ASSERT_EQ(QCONF_OK, create_shm_gens(gens, genskey, 64, 0644));
+    EXPECT_EQ(64u, gens->ngens);
+    ASSERT_EQ(QCONF_OK, init_shm_gens(client_gens, genskey));
+    detach_shm_gens(client_gens);
+    detach_shm_gens(gens);
+    EXPECT_EQ(0, shmctl(shmget(genskey, 0, 0), IPC_RMID, NULL));
+}
+
+// Test for create_shm_gens: words left writable by others are created again
+TEST_F(Test_qconf_shm, create_shm_gens_other_mode)
+{
+    key_t genskey = 0x1010ac12;
+    qconf_shm_gens_t *gens = NULL;
+    ASSERT_EQ(QCONF_OK, create_shm_gens(gens, genskey, 64, 0666));
+    detach_shm_gens(gens);
+
+    ASSERT_EQ(QCONF_OK, create_shm_gens(gens, genskey, 64, 0644));
+    struct shmid_ds ds;
+    ASSERT_EQ(0, shmctl(shmget(genskey, 0, 0), IPC_STAT, &ds));
+    EXPECT_EQ(0644u, ds.shm_perm.mode & 0777);
+    detach_shm_gens(gens);
+    EXPECT_EQ(0, shmctl(shmget(genskey, 0, 0), IPC_RMID, NULL));
+}
+
+// Test for hash_tbl_replicate: replicas keep the same entries as the table through writes and evictions
+TEST_F(Test_qconf_shm, hash_tbl_replicate_writes)
+{
+    key_t shmkey = 0x1010ac0f;
+    key_t replicaskey = 0x1010ac10;
+    qhasharr_t *primary = NULL;
+    qconf_shm_replicas_t *replicas = NULL, *client_replicas = NULL;
+    ASSERT_EQ(QCONF_OK, create_hash_tbl(primary, shmkey, 0666, 16, QCONF_SHM_EVICT_LRU));
+    ASSERT_EQ(QCONF_OK, create_shm_replicas(replicas, replicaskey, 0666));
+    ASSERT_EQ(QCONF_OK, init_shm_replicas(client_replicas, replicaskey));
+
+    string tblkey, tblval, got;
+    serialize_to_tblkey(QCONF_DATA_TYPE_NODE, "corp", "/replica/before", tblkey);
+    nodeval_to_tblval(tblkey, "copied", tblval);
+    ASSERT_EQ(QCONF_OK, hash_tbl_set(primary, tblkey, tblval));
+
+    // pages of nodes the machine has not are left where they are
+    ASSERT_EQ(QCONF_OK, hash_tbl_replicate(primary, shmkey, replicas, 2, 0666));
+
+    key_t replica_key = QCONF_INVALID_KEY;
+    uint32_t generation = 0;
+    EXPECT_EQ(QCONF_OK, shm_replicas_get(client_replicas, shmkey, 0, replica_key, generation));
+    EXPECT_EQ(shmkey, replica_key);
+    EXPECT_EQ(0u, generation & 1);
+    ASSERT_EQ(QCONF_OK, shm_replicas_get(client_replicas, shmkey, 1, replica_key, generation));
+    EXPECT_NE(shmkey, replica_key);
+    EXPECT_EQ(QCONF_ERR_NOT_FOUND, shm_replicas_get(client_replicas, shmkey, 2, replica_key, generation));
+    EXPECT_EQ(QCONF_ERR_NOT_FOUND, shm_replicas_get(client_replicas, shmkey + 1, 1, replica_key, generation));
+
+    qhasharr_t *replica = NULL;
+    ASSERT_EQ(QCONF_OK, init_hash_tbl(replica, replica_key, 0444, SHM_RDONLY));
+    EXPECT_EQ(QCONF_OK, hash_tbl_get(replica, tblkey, got));
+    EXPECT_EQ(tblval, got);
+
+    // more keys than slots, older ones are evicted from both
+    vector<string> tblkeys;
+    for (int i = 0; i < 40; i++)
+    {
+        char path[32], val[32];
+        snprintf(path, sizeof(path), "/replica/%d", i);
+        snprintf(val, sizeof(val), "value_%d", i);
+        serialize_to_tblkey(QCONF_DATA_TYPE_NODE, "corp", path, tblkey);
+        nodeval_to_tblval(tblkey, val, tblval);
+        EXPECT_EQ(QCONF_OK, hash_tbl_set(primary, tblkey, tblval));
+        tblkeys.push_back(tblkey);
+    }
+    EXPECT_EQ(QCONF_OK, hash_tbl_remove(primary, tblkeys.back()));
+
+    vector<qconf_tbl_entry_t> entries(2);
+    for (int i = 0; i < 2; i++)
+    {
+        entries[i].key = tblkeys[38 + i];
+        entries[i].mzxid = entries[i].pzxid = 0;
+        entries[i].remove = (0 == i);
+        entries[i].ret = QCONF_OK;
+    }
+    nodeval_to_tblval(tblkeys[39], "batch", entries[1].val);
+    EXPECT_EQ(QCONF_OK, hash_tbl_set_batch(primary, entries));
+
+    EXPECT_EQ(primary->num, replica->num);
+    EXPECT_EQ(primary->usedslots, replica->usedslots);
+    for (size_t i = 0; i < tblkeys.size(); i++)
+    {
+        string primary_val;
+        int ret = hash_tbl_get(primary, tblkeys[i], primary_val);
+        EXPECT_EQ(ret, hash_tbl_get(replica, tblkeys[i], got)) << i;
+        if (QCONF_OK == ret)
+        {
+            EXPECT_EQ(primary_val, got) << i;
+        }
+    }
+
+    hash_tbl_clear(primary);
+    EXPECT_EQ(0, replica->num);
+
+    // published alone, the replica is dropped
+    EXPECT_EQ(QCONF_OK, hash_tbl_replicate(primary, shmkey, replicas, 1, 0666));
+    EXPECT_EQ(QCONF_ERR_NOT_FOUND, shm_replicas_get(client_replicas, shmkey, 1, replica_key, generation));
+    EXPECT_EQ(-1, shmget(replica_key, 0, 0666));
+
+    detach_hash_tbl(replica);
+    detach_hash_tbl(primary);
+    detach_shm_replicas(client_replicas);
+    detach_shm_replicas(replicas);
+    EXPECT_EQ(QCONF_OK, remove_hash_tbl(shmkey, 0666));
+    EXPECT_EQ(0, shmctl(shmget(replicaskey, 0, 0666), IPC_RMID, NULL));
+}
+
+/**
+  * End_Test_for function: int hash_tbl_get_ref(qhasharr_t *tbl, const char *key, size_t key_len,
+  *                                             const char *&val, size_t &val_len, uint32_t &version)
+  *==============================================================================================================
+  */
@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <unistd.h>
+
+#include <map>
+#include <string>
+#include "gtest/gtest.h"
+#include "qconf_format.h"
+#include "qconf_snapshot.h"
+
+using namespace std;
+
+
+// Unit test case for qconf_snapshot.cc
+
+// Related test environment set up:
+class Test_qconf_snapshot : public ::testing::Test
+{
+protected:
+    virtual void SetUp()
+    {
+        snprintf(path, sizeof(path), "/tmp/qconf_test_snapshot.%d", getpid());
+        memset(&snap, 0, sizeof(snap));
+    }
+
+    virtual void TearDown()
+    {
+        qconf_snapshot_close(snap);
+        unlink(path);
+    }
+
+    char path[128];
+    qconf_snapshot_t snap;
+};
+
+/**
+ *==============================================================================================
+ * Begin_Test_for function: int qconf_snapshot_write(const string &path, const map<string, string> &entries, uint64_t generation)
+ *                          int qconf_snapshot_get(const qconf_snapshot_t &snap, const char *key, size_t key_len, const char *&val, size_t &val_len)
+ * =============================================================================================
+ */
+
+// Test for qconf_snapshot_get: every key written is got, others are not found
+TEST_F(Test_qconf_snapshot, qconf_snapshot_get_all_keys)
+{
+    map<string, string> entries;
+    for (int i = 0; i < 5000; i++)
+    {
+        char path_buf[64], val_buf[64];
+        string tblkey;
+        snprintf(path_buf, sizeof(path_buf), "/demo/snapshot/%d", i);
+        snprintf(val_buf, sizeof(val_buf), "value_%d", i);
+        serialize_to_tblkey(QCONF_DATA_TYPE_NODE, "corp", path_buf, tblkey);
+        entries[tblkey] = val_buf;
+    }
+    ASSERT_EQ(QCONF_OK, qconf_snapshot_write(path, entries, 42));
+    ASSERT_EQ(QCONF_OK, qconf_snapshot_open(snap, path));
+    EXPECT_EQ(42u, snap.hdr->generation);
+    EXPECT_EQ(5000u, snap.hdr->nkeys);
+
+    const char *val = NULL;
+    size_t val_len = 0;
+    for (map<string, string>::const_iterator it = entries.begin(); it != entries.end(); ++it)
+    {
+        ASSERT_EQ(QCONF_OK, qconf_snapshot_get(snap, it->first.data(), it->first.size(), val, val_len));
+        EXPECT_EQ(it->second, string(val, val_len));
+    }
+
+    string tblkey;
+    serialize_to_tblkey(QCONF_DATA_TYPE_NODE, "corp", "/demo/snapshot/5000", tblkey);
+    EXPECT_EQ(QCONF_ERR_NOT_FOUND, qconf_snapshot_get(snap, tblkey.data(), tblkey.size(), val, val_len));
+    serialize_to_tblkey(QCONF_DATA_TYPE_SERVICE, "corp", "/demo/snapshot/1", tblkey);
+    EXPECT_EQ(QCONF_ERR_NOT_FOUND, qconf_snapshot_get(snap, tblkey.data(), tblkey.size(), val, val_len));
+}
+
+// Test for qconf_snapshot_get: nothing is found in an empty snapshot
+TEST_F(Test_qconf_snapshot, qconf_snapshot_get_empty)
+{
+    map<string, string> entries;
+    ASSERT_EQ(QCONF_OK, qconf_snapshot_write(path, entries, 0));
+    ASSERT_EQ(QCONF_OK, qconf_snapshot_open(snap, path));
+
+    const char *val = NULL;
+    size_t val_len = 0;
+    EXPECT_EQ(QCONF_ERR_NOT_FOUND, qconf_snapshot_get(snap, "key", 3, val, val_len));
+}
+
+// Test for qconf_snapshot_write: the file written replaces the one mapped without changing it
+TEST_F(Test_qconf_snapshot, qconf_snapshot_write_replace)
+{
+    map<string, string> entries;
+    entries["key"] = "old";
+    ASSERT_EQ(QCONF_OK, qconf_snapshot_write(path, entries, 1));
+    ASSERT_EQ(QCONF_OK, qconf_snapshot_open(snap, path));
+
+    entries["key"] = "new";
+    ASSERT_EQ(QCONF_OK, qconf_snapshot_write(path, entries, 2));
+
+    const char *val = NULL;
+    size_t val_len = 0;
+    ASSERT_EQ(QCONF_OK, qconf_snapshot_get(snap, "key", 3, val, val_len));
+    EXPECT_EQ("old", string(val, val_len));
+
+    qconf_snapshot_t new_snap;
+    ASSERT_EQ(QCONF_OK, qconf_snapshot_open(new_snap, path));
+    ASSERT_EQ(QCONF_OK, qconf_snapshot_get(new_snap, "key", 3, val, val_len));
+    EXPECT_EQ("new", string(val, val_len));
+    EXPECT_EQ(2u, new_snap.hdr->generation);
+    qconf_snapshot_close(new_snap);
+}
+
+/**
+ *==============================================================================================
+ * Begin_Test_for function: int qconf_snapshot_open(qconf_snapshot_t &snap, const string &path)
+ * =============================================================================================
+ */
+
+// Test for qconf_snapshot_open: file not exists
+TEST_F(Test_qconf_snapshot, qconf_snapshot_open_not_exist)
+{
+    EXPECT_EQ(QCONF_ERR_OPEN, qconf_snapshot_open(snap, path));
+    EXPECT_TRUE(NULL == snap.base);
+}
+
+// Test for qconf_snapshot_open: file of other content
+TEST_F(Test_qconf_snapshot, qconf_snapshot_open_bad_format)
+{
+    FILE *fp = fopen(path, "w");
+    ASSERT_TRUE(NULL != fp);
+    for (int i = 0; i < 16; i++) fputs("not a snapshot", fp);
+    fclose(fp);
+
+    EXPECT_EQ(QCONF_ERR_DATA_FORMAT, qconf_snapshot_open(snap, path));
+    EXPECT_TRUE(NULL == snap.base);
+}
@@ -1,4 +1,10 @@
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
 #include <iostream>
+#include <map>
+#include <string>
+#include <vector>
 #include "gtest/gtest.h"
 #include "qlibc.h"
 #include "qconf_common.h"
@@ -25,6 +31,15 @@ protected:
         tbl = NULL;
     }
 
+    // only the tables with a header keep a write sequence
+    void use_group_format()
+    {
+        free(tbl);
+        size_t memsize = qhasharr_calculate_memsize_fmt(MAX_SLOT_NUM, QHASHARR_FORMAT_GROUP);
+        char* memory = (char*)malloc(sizeof(char) * memsize);
+        tbl = qhasharr_fmt(memory, memsize, QHASHARR_FORMAT_GROUP);
+    }
+
     qhasharr_t* tbl;
 };
 
@@ -611,6 +626,111 @@ TEST_F(Test_qhasharr, qhasharr_put_key_be_truncated)
   *===========================================================================================================
   */
 
+/**
+  ============================================================================================================
+  * Begin_Test_for function: bool qhasharr_put_batch(qhasharr_t *tbl, const qhasharr_op_t *ops, int nops)
+  */
+
+// Test for qhasharr_put_batch: objects are put and removed in one write sequence
+TEST_F(Test_qhasharr, qhasharr_put_batch_common)
+{
+    use_group_format();
+    EXPECT_TRUE(qhasharr_put(tbl, "old", 3, "value", 6));
+    uint32_t seq = qhasharr_read_begin(tbl);
+
+    qhasharr_op_t ops[] = {
+        {"host", 4, "10.0.0.2", 9},
+        {"password", 8, "secret2", 8},
+        {"old", 3, NULL, 0},
+        {"none", 4, NULL, 0},
+    };
+    EXPECT_TRUE(qhasharr_put_batch(tbl, ops, 4));
+    EXPECT_EQ(seq + 2, qhasharr_read_begin(tbl));
+    EXPECT_EQ(2, tbl->num);
+    EXPECT_FALSE(qhasharr_exist(tbl, "old", 3));
+
+    size_t size = 0;
+    char *value = (char*)qhasharr_get(tbl, "password", 8, &size);
+    ASSERT_TRUE(NULL != value);
+    EXPECT_STREQ("secret2", value);
+    free(value);
+}
+
+// Test for qhasharr_put_batch: nothing is changed if the objects may not fit
+TEST_F(Test_qhasharr, qhasharr_put_batch_no_space)
+{
+    use_group_format();
+    char value[_Q_HASHARR_VALUESIZE * 6] = {0};
+    EXPECT_TRUE(qhasharr_put(tbl, "old", 3, "value", 6));
+    for (int i = 1; i < MAX_SLOT_NUM - 3; i++)
+    {
+        char key[8];
+        snprintf(key, sizeof(key), "k%d", i);
+        EXPECT_TRUE(qhasharr_put(tbl, key, strlen(key), "v", 2));
+    }
+    uint32_t seq = qhasharr_read_begin(tbl);
+
+    qhasharr_op_t ops[] = {
+        {"old", 3, NULL, 0},
+        {"big", 3, value, sizeof(value)},
+    };
+    EXPECT_FALSE(qhasharr_put_batch(tbl, ops, 2));
+    EXPECT_EQ(ENOBUFS, errno);
+    EXPECT_EQ(seq, qhasharr_read_begin(tbl));
+    EXPECT_TRUE(qhasharr_exist(tbl, "old", 3));
+    EXPECT_FALSE(qhasharr_exist(tbl, "big", 3));
+
+    // too big even for the table emptied
+    qhasharr_op_t big_ops[MAX_SLOT_NUM + 1];
+    for (int i = 0; i <= MAX_SLOT_NUM; i++)
+    {
+        qhasharr_op_t op = {"big", 3, "v", 2};
+        big_ops[i] = op;
+    }
+    EXPECT_FALSE(qhasharr_put_batch(tbl, big_ops, MAX_SLOT_NUM + 1));
+    EXPECT_EQ(E2BIG, errno);
+    EXPECT_EQ(seq, qhasharr_read_begin(tbl));
+
+    qhasharr_op_t bad_ops[] = {{NULL, 0, "v", 2}};
+    EXPECT_FALSE(qhasharr_put_batch(tbl, bad_ops, 1));
+    EXPECT_EQ(EINVAL, errno);
+    EXPECT_TRUE(qhasharr_put_batch(tbl, NULL, 0));
+}
+
+// Test for qhasharr_put_batch: a batch failing halfway is rolled back
+TEST_F(Test_qhasharr, qhasharr_put_batch_rolled_back)
+{
+    char key[16];
+    for (int i = 0; tbl->usedslots < MAX_SLOT_NUM - 1; i++)
+    {
+        snprintf(key, sizeof(key), "k%d", i);
+        ASSERT_TRUE(qhasharr_put(tbl, key, strlen(key), "v", 2));
+    }
+    int usedslots = tbl->usedslots, num = tbl->num;
+
+    // two slots more seem free than there are, so the last put fails
+    tbl->usedslots -= 2;
+    qhasharr_op_t ops[] = {
+        {"k0", 2, NULL, 0},
+        {"a", 1, "new", 4},
+        {"b", 1, "new", 4},
+        {"c", 1, "new", 4},
+    };
+    EXPECT_FALSE(qhasharr_put_batch(tbl, ops, 4));
+    EXPECT_EQ(ENOBUFS, errno);
+    EXPECT_EQ(usedslots - 2, tbl->usedslots);
+    EXPECT_EQ(num, tbl->num);
+    EXPECT_TRUE(qhasharr_exist(tbl, "k0", 2));
+    EXPECT_FALSE(qhasharr_exist(tbl, "a", 1));
+    EXPECT_FALSE(qhasharr_exist(tbl, "b", 1));
+    EXPECT_FALSE(qhasharr_exist(tbl, "c", 1));
+    tbl->usedslots = usedslots;
+}
+/**
+  * End_Test_for function: bool qhasharr_put_batch(qhasharr_t *tbl, const qhasharr_op_t *ops, int nops)
+  *===========================================================================================================
+  */
+
 /**
   ============================================================================================================
   * Begin_Test_for function: void *qhasharr_get(qhasharr_t *tbl, const char *key, size_t key_size, size_t *val_size)
@@ -1296,4 +1416,1036 @@ TEST_F(Test_qhasharr, _find_empty_usedslots_equals_with_maxslots2)
   *=========================================================================================================================
   */
 
+/**
+  *================================================================================================
+  * Begin_Test_for function: uint32_t qhasharr_read_begin(qhasharr_t *tbl)
+  *                          bool qhasharr_read_retry(qhasharr_t *tbl, uint32_t seq)
+  */
+
+// Test for qhasharr_read_begin: write sequence moves on every modification
+TEST_F(Test_qhasharr, qhasharr_read_begin_sequence_moves_on_write)
+{
+    use_group_format();
+    const char* key = "hello";
+    const char* value = "world";
+
+    uint32_t seq = qhasharr_read_begin(tbl);
+    EXPECT_EQ(0u, seq % 2);
+
+    qhasharr_put(tbl, key, strlen(key), value, strlen(value) + 1);
+    EXPECT_EQ(seq + 2, qhasharr_read_begin(tbl));
+
+    qhasharr_remove(tbl, key, strlen(key));
+    EXPECT_EQ(seq + 4, qhasharr_read_begin(tbl));
+
+    qhasharr_clear(tbl);
+    EXPECT_EQ(seq + 6, qhasharr_read_begin(tbl));
+}
+
+// Test for qhasharr_read_retry: no write during the read
+TEST_F(Test_qhasharr, qhasharr_read_retry_no_write)
+{
+    use_group_format();
+    const char* key = "hello";
+    const char* value = "world";
+    qhasharr_put(tbl, key, strlen(key), value, strlen(value) + 1);
+
+    uint32_t seq = qhasharr_read_begin(tbl);
+    EXPECT_TRUE(qhasharr_exist(tbl, key, strlen(key)));
+    EXPECT_FALSE(qhasharr_read_retry(tbl, seq));
+}
+
+// Test for qhasharr_read_retry: write happens during the read
+TEST_F(Test_qhasharr, qhasharr_read_retry_write_during_read)
+{
+    use_group_format();
+    const char* key = "hello";
+    const char* value = "world";
+
+    uint32_t seq = qhasharr_read_begin(tbl);
+    qhasharr_put(tbl, key, strlen(key), value, strlen(value) + 1);
+    EXPECT_TRUE(qhasharr_read_retry(tbl, seq));
+}
+
+// Test for qhasharr_read_retry: writer died in the middle of an update
+TEST_F(Test_qhasharr, qhasharr_read_retry_interrupted_writer)
+{
+    use_group_format();
+    const char* key = "hello";
+    const char* value = "world";
+    qhasharr_put(tbl, key, strlen(key), value, strlen(value) + 1);
+
+    tbl->seq |= 1;
+
+    // the reader waits for the writer a while, then reads what is there
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint32_t seq = qhasharr_read_begin(tbl);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    EXPECT_EQ(tbl->seq, seq);
+    EXPECT_LE(50, (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000);
+    EXPECT_FALSE(qhasharr_read_retry(tbl, seq));
+    EXPECT_TRUE(qhasharr_exist(tbl, key, strlen(key)));
+
+    // and doesn't wait for the dead writer again
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    size_t size = 0;
+    char *out = (char*)qhasharr_get(tbl, key, strlen(key), &size);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ASSERT_TRUE(NULL != out);
+    EXPECT_STREQ(value, out);
+    free(out);
+    EXPECT_GT(50, (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000);
+
+    // a writer moving on makes the read retried
+    EXPECT_TRUE(qhasharr_put(tbl, "other", 5, value, strlen(value) + 1));
+    EXPECT_TRUE(qhasharr_read_retry(tbl, seq));
+
+    // clear leaves the write sequence of the interrupted writer
+    qhasharr_clear(tbl);
+    EXPECT_EQ(0u, tbl->seq % 2);
+    EXPECT_FALSE(qhasharr_exist(tbl, key, strlen(key)));
+}
+
+static volatile bool _stop_writing = false;
+
+static void *rewrite_value(void *arg)
+{
+    qhasharr_t *tbl = (qhasharr_t *)arg;
+    const char* key = "hello";
+    char value[300];
+
+    for (unsigned int i = 0; !_stop_writing; i++)
+    {
+        // value takes one to four slots and every byte is the same
+        size_t len = 10 + (i * 37) % (sizeof(value) - 10);
+        memset(value, 'a' + i % 26, len);
+        qhasharr_put(tbl, key, strlen(key), value, len);
+    }
+    return NULL;
+}
+
+// Test for qhasharr_get: lock-free reads never see a half written value
+TEST_F(Test_qhasharr, qhasharr_get_concurrent_with_writer)
+{
+    use_group_format();
+    const char* key = "hello";
+    pthread_t writer;
+    int torn = 0, found = 0;
+
+    _stop_writing = false;
+    ASSERT_EQ(0, pthread_create(&writer, NULL, rewrite_value, tbl));
+    while (!qhasharr_exist(tbl, key, strlen(key))) sched_yield();
+
+    for (int i = 0; i < 100000; i++)
+    {
+        size_t size = 0;
+        char *value = (char*)qhasharr_get(tbl, key, strlen(key), &size);
+        if (NULL == value) continue;
+
+        found++;
+        for (size_t j = 1; j < size; j++)
+        {
+            if (value[j] != value[0])
+            {
+                torn++;
+                break;
+            }
+        }
+        free(value);
+    }
+
+    _stop_writing = true;
+    pthread_join(writer, NULL);
+
+    EXPECT_LT(0, found);
+    EXPECT_EQ(0, torn);
+}
+/**
+  * End_Test_for function: uint32_t qhasharr_read_begin(qhasharr_t *tbl)
+  *=========================================================================================================================
+  */
+
+/**
+  *================================================================================================
+  * Begin_Test_for function: const void *qhasharr_get_ref(qhasharr_t *tbl, const char *key, size_t key_size,
+  *                                                     size_t *val_size, uint32_t *seq)
+  */
+
+// Test for qhasharr_get_ref: value kept in one slot
+TEST_F(Test_qhasharr, qhasharr_get_ref_one_slot)
+{
+    use_group_format();
+    const char* key = "hello";
+    const char* value = "world";
+    size_t size = 0;
+    uint32_t seq = 0;
+    qhasharr_put(tbl, key, strlen(key), value, strlen(value) + 1);
+
+    const char *ref = (const char*)qhasharr_get_ref(tbl, key, strlen(key), &size, &seq);
+    ASSERT_TRUE(NULL != ref);
+    EXPECT_EQ(strlen(value) + 1, size);
+    EXPECT_STREQ(value, ref);
+    EXPECT_FALSE(qhasharr_read_retry(tbl, seq));
+}
+
+// Test for qhasharr_get_ref: value spans several slots
+TEST_F(Test_qhasharr, qhasharr_get_ref_several_slots)
+{
+    use_group_format();
+    const char* key = "hello";
+    char value[300];
+    size_t size = 0;
+    uint32_t seq = 0;
+    memset(value, 'a', sizeof(value));
+    qhasharr_put(tbl, key, strlen(key), value, sizeof(value));
+
+    EXPECT_TRUE(NULL == qhasharr_get_ref(tbl, key, strlen(key), &size, &seq));
+    EXPECT_EQ(E2BIG, errno);
+}
+
+// Test for qhasharr_get_ref: key not exists
+TEST_F(Test_qhasharr, qhasharr_get_ref_key_not_exists)
+{
+    use_group_format();
+    const char* key = "hello";
+    size_t size = 0;
+    uint32_t seq = 0;
+
+    EXPECT_TRUE(NULL == qhasharr_get_ref(tbl, key, strlen(key), &size, &seq));
+    EXPECT_EQ(ENOENT, errno);
+}
+
+// Test for qhasharr_get_ref: reference is invalid after the value changed
+TEST_F(Test_qhasharr, qhasharr_get_ref_value_changed)
+{
+    use_group_format();
+    const char* key = "hello";
+    const char* value = "world";
+    const char* value2 = "qconf";
+    size_t size = 0;
+    uint32_t seq = 0;
+    qhasharr_put(tbl, key, strlen(key), value, strlen(value) + 1);
+
+    const char *ref = (const char*)qhasharr_get_ref(tbl, key, strlen(key), &size, &seq);
+    ASSERT_TRUE(NULL != ref);
+    qhasharr_put(tbl, key, strlen(key), value2, strlen(value2) + 1);
+    EXPECT_TRUE(qhasharr_read_retry(tbl, seq));
+
+    ref = (const char*)qhasharr_get_ref(tbl, key, strlen(key), &size, &seq);
+    ASSERT_TRUE(NULL != ref);
+    EXPECT_STREQ(value2, ref);
+    EXPECT_FALSE(qhasharr_read_retry(tbl, seq));
+}
+/**
+  * End_Test_for function: const void *qhasharr_get_ref(qhasharr_t *tbl, const char *key, size_t key_size,
+  *                                                   size_t *val_size, uint32_t *seq)
+  *=========================================================================================================================
+  */
+
+/**
+  *================================================================================================
+  * Begin_Test_for function: bool qhasharr_prepare(qhasharr_t *tbl, const char *key, size_t key_size, qhasharr_key_t *hkey)
+  *                          const void *qhasharr_get_ref_key(qhasharr_t *tbl, const char *key, size_t key_size,
+  *                                                           qhasharr_key_t *hkey, size_t *val_size, uint32_t *seq, int *idx)
+  */
+
+// Test for qhasharr_get_ref_key: the slot found is remembered, and a stale hint falls back to probing
+TEST_F(Test_qhasharr, qhasharr_get_ref_key_hint)
+{
+    use_group_format();
+    // longer than _Q_HASHARR_KEYSIZE, compared by the md5 prepared
+    string key(_Q_HASHARR_KEYSIZE + 8, 'k');
+    const char* value = "world";
+    size_t size = 0;
+    uint32_t seq = 0;
+    int idx = -1;
+    qhasharr_key_t hkey;
+    ASSERT_TRUE(qhasharr_prepare(tbl, key.data(), key.size(), &hkey));
+    EXPECT_EQ(-1, hkey.hint);
+
+    EXPECT_TRUE(NULL == qhasharr_get_ref_key(tbl, key.data(), key.size(), &hkey, &size, &seq, &idx));
+    EXPECT_EQ(ENOENT, errno);
+    EXPECT_EQ(-1, hkey.hint);
+
+    qhasharr_put(tbl, key.data(), key.size(), value, strlen(value) + 1);
+    const char *ref = (const char*)qhasharr_get_ref_key(tbl, key.data(), key.size(), &hkey, &size, &seq, &idx);
+    ASSERT_TRUE(NULL != ref);
+    EXPECT_STREQ(value, ref);
+    EXPECT_EQ(idx, hkey.hint);
+
+    // another key of the same prefix at the hint is not taken for it
+    string other(key);
+    other[other.size() - 1] = 'o';
+    int other_idx = -1;
+    qhasharr_put(tbl, other.data(), other.size(), "other", 6);
+    free(qhasharr_get_idx(tbl, other.data(), other.size(), &size, &other_idx));
+    ASSERT_LE(0, other_idx);
+    hkey.hint = other_idx;
+    ref = (const char*)qhasharr_get_ref_key(tbl, key.data(), key.size(), &hkey, &size, &seq, &idx);
+    ASSERT_TRUE(NULL != ref);
+    EXPECT_STREQ(value, ref);
+    EXPECT_NE(other_idx, idx);
+    EXPECT_EQ(idx, hkey.hint);
+
+    hkey.hint = MAX_SLOT_NUM * 2;
+    char *val = (char*)qhasharr_get_key(tbl, key.data(), key.size(), &hkey, &size, &idx);
+    ASSERT_TRUE(NULL != val);
+    EXPECT_STREQ(value, val);
+    EXPECT_EQ(idx, hkey.hint);
+    free(val);
+}
+
+// Test for qhasharr_get_key: a key prepared for another format is hashed for the table got from
+TEST_F(Test_qhasharr, qhasharr_get_key_other_format)
+{
+    size_t memsize = qhasharr_calculate_memsize_fmt(MAX_SLOT_NUM, QHASHARR_FORMAT_FPRINT);
+    void *memory = malloc(memsize);
+    qhasharr_t *fp_tbl = qhasharr_fmt(memory, memsize, QHASHARR_FORMAT_FPRINT);
+    ASSERT_TRUE(NULL != fp_tbl);
+
+    const char* key = "hello";
+    size_t size = 0;
+    qhasharr_key_t hkey;
+    ASSERT_TRUE(qhasharr_prepare(tbl, key, strlen(key), &hkey));
+    qhasharr_put(fp_tbl, key, strlen(key), "fprint", 7);
+    qhasharr_put(tbl, key, strlen(key), "linear", 7);
+
+    char *val = (char*)qhasharr_get_key(fp_tbl, key, strlen(key), &hkey, &size, NULL);
+    ASSERT_TRUE(NULL != val);
+    EXPECT_STREQ("fprint", val);
+    free(val);
+    val = (char*)qhasharr_get_key(tbl, key, strlen(key), &hkey, &size, NULL);
+    ASSERT_TRUE(NULL != val);
+    EXPECT_STREQ("linear", val);
+    free(val);
+
+    free(memory);
+}
+/**
+  * End_Test_for function: bool qhasharr_prepare(qhasharr_t *tbl, const char *key, size_t key_size, qhasharr_key_t *hkey)
+  *=========================================================================================================================
+  */
+
+/**
+  *================================================================================================
+  * Begin_Test_for function: qhasharr_t *qhasharr_fmt(void *memory, size_t memsize, int format)
+  *                          int qhasharr_format(qhasharr_t *tbl)
+  */
+
+// Test for qhasharr_format: qhasharr keeps the linear layout
+TEST_F(Test_qhasharr, qhasharr_format_linear)
+{
+    EXPECT_EQ(QHASHARR_FORMAT_LINEAR, qhasharr_format(tbl));
+    EXPECT_EQ(MAX_SLOT_NUM, tbl->maxslots);
+}
+
+// Test for qhasharr_format: linear tables are laid out as clients linked before the formats read them
+TEST_F(Test_qhasharr, qhasharr_format_linear_legacy_layout)
+{
+    qhasharr_slot_t *_tbl_slots = NULL;
+    qhasharr_init(tbl, &_tbl_slots);
+    EXPECT_EQ(3 * sizeof(int), (size_t)((char*)_tbl_slots - (char*)tbl));
+
+    // no write sequence, so nothing is referenced in place
+    const char* key = "hello";
+    const char* value = "world";
+    size_t size = 0;
+    uint32_t seq = 0;
+    EXPECT_TRUE(qhasharr_put(tbl, key, strlen(key), value, strlen(value) + 1));
+    EXPECT_EQ(0u, qhasharr_read_begin(tbl));
+    EXPECT_FALSE(qhasharr_read_retry(tbl, 0));
+    EXPECT_FALSE(qhasharr_write_interrupted(tbl));
+    EXPECT_TRUE(NULL == qhasharr_get_ref(tbl, key, strlen(key), &size, &seq));
+    EXPECT_EQ(E2BIG, errno);
+}
+
+// Test for qhasharr_check_layout: tables are checked against the memory they are attached in
+TEST_F(Test_qhasharr, qhasharr_check_layout_common)
+{
+    size_t memsize = qhasharr_calculate_memsize(MAX_SLOT_NUM);
+    EXPECT_TRUE(qhasharr_check_layout(tbl, memsize));
+    EXPECT_FALSE(qhasharr_check_layout(tbl, memsize - 1));
+    EXPECT_FALSE(qhasharr_check_layout(NULL, memsize));
+
+    use_group_format();
+    memsize = qhasharr_calculate_memsize_fmt(MAX_SLOT_NUM, QHASHARR_FORMAT_GROUP);
+    EXPECT_TRUE(qhasharr_check_layout(tbl, memsize));
+    EXPECT_FALSE(qhasharr_check_layout(tbl, memsize - 1));
+
+    // unknown format
+    tbl->format = 7;
+    EXPECT_FALSE(qhasharr_check_layout(tbl, memsize));
+    tbl->format = QHASHARR_FORMAT_GROUP;
+
+    // offsets not of this build
+    tbl->slotoff += sizeof(int);
+    EXPECT_FALSE(qhasharr_check_layout(tbl, memsize));
+}
+
+// Test for qhasharr_fmt: memory is too small
+TEST_F(Test_qhasharr, qhasharr_fmt_memory_too_small)
+{
+    char memory[64];
+    EXPECT_TRUE(NULL == qhasharr_fmt(memory, sizeof(memory), QHASHARR_FORMAT_GROUP));
+    EXPECT_EQ(EINVAL, errno);
+}
+
+// Test for qhasharr_fmt: group layout
+TEST_F(Test_qhasharr, qhasharr_fmt_group)
+{
+    size_t memsize = qhasharr_calculate_memsize_fmt(MAX_SLOT_NUM, QHASHARR_FORMAT_GROUP);
+    char *memory = (char*)malloc(memsize);
+    qhasharr_t *gtbl = qhasharr_fmt(memory, memsize, QHASHARR_FORMAT_GROUP);
+    ASSERT_TRUE(NULL != gtbl);
+    EXPECT_EQ(QHASHARR_FORMAT_GROUP, qhasharr_format(gtbl));
+    EXPECT_EQ(MAX_SLOT_NUM, gtbl->maxslots);
+
+    const char* key = "hello";
+    const char* value = "world";
+    size_t size = 0;
+    EXPECT_TRUE(qhasharr_put(gtbl, key, strlen(key), value, strlen(value) + 1));
+    char *out = (char*)qhasharr_get(gtbl, key, strlen(key), &size);
+    ASSERT_TRUE(NULL != out);
+    EXPECT_STREQ(value, out);
+    free(out);
+
+    EXPECT_TRUE(qhasharr_remove(gtbl, key, strlen(key)));
+    EXPECT_FALSE(qhasharr_exist(gtbl, key, strlen(key)));
+    free(memory);
+}
+
+// Test for qhasharr_fmt: group layout works the same as linear layout while keys come and go
+TEST_F(Test_qhasharr, qhasharr_fmt_group_same_as_linear)
+{
+    // a small table makes collisions, wrapped groups and deleted slots
+    const int maxslots = 37;
+    size_t memsize = qhasharr_calculate_memsize_fmt(maxslots, QHASHARR_FORMAT_GROUP);
+    char *memory = (char*)malloc(memsize);
+    qhasharr_t *gtbl = qhasharr_fmt(memory, memsize, QHASHARR_FORMAT_GROUP);
+    ASSERT_TRUE(NULL != gtbl);
+
+    map<string, string> kept;
+    srand(12345);
+    for (int i = 0; i < 20000; i++)
+    {
+        char key[64];
+        snprintf(key, sizeof(key), "key_%d", rand() % 60);
+        if (rand() % 3 == 0)
+        {
+            EXPECT_EQ(kept.erase(key) > 0, qhasharr_remove(gtbl, key, strlen(key)));
+            continue;
+        }
+
+        // value takes one or two slots
+        string value(1 + rand() % 150, 'a' + i % 26);
+        // a full table keeps the old value, otherwise the old one is removed
+        if (qhasharr_put(gtbl, key, strlen(key), value.data(), value.size()))
+            kept[key] = value;
+        else if (!qhasharr_exist(gtbl, key, strlen(key)))
+            kept.erase(key);
+
+        if (i % 100 != 0) continue;
+        for (int k = 0; k < 60; k++)
+        {
+            snprintf(key, sizeof(key), "key_%d", k);
+            size_t size = 0;
+            char *out = (char*)qhasharr_get(gtbl, key, strlen(key), &size);
+            map<string, string>::iterator it = kept.find(key);
+            if (it == kept.end())
+            {
+                EXPECT_TRUE(NULL == out);
+            }
+            else
+            {
+                ASSERT_TRUE(NULL != out);
+                EXPECT_EQ(it->second, string(out, size));
+            }
+            free(out);
+        }
+    }
+    EXPECT_EQ((int)kept.size(), qhasharr_size(gtbl, NULL, NULL));
+
+    qhasharr_clear(gtbl);
+    EXPECT_EQ(0, qhasharr_size(gtbl, NULL, NULL));
+    EXPECT_FALSE(qhasharr_exist(gtbl, "key_1", 5));
+    free(memory);
+}
+
+// Test for qhasharr_getnext: the directory goes through the objects only while keys come and go
+TEST_F(Test_qhasharr, qhasharr_getnext_directory)
+{
+    const int maxslots = 37;
+    size_t memsize = qhasharr_calculate_memsize_fmt(maxslots, QHASHARR_FORMAT_FPRINT);
+    char *memory = (char*)malloc(memsize);
+    qhasharr_t *gtbl = qhasharr_fmt(memory, memsize, QHASHARR_FORMAT_FPRINT);
+    ASSERT_TRUE(NULL != gtbl);
+
+    map<string, string> kept;
+    srand(54321);
+    for (int i = 0; i < 5000; i++)
+    {
+        char key[64];
+        snprintf(key, sizeof(key), "key_%d", rand() % 60);
+        if (rand() % 3 == 0)
+        {
+            if (qhasharr_remove(gtbl, key, strlen(key))) kept.erase(key);
+        }
+        else
+        {
+            string value(1 + rand() % 150, 'a' + i % 26);
+            if (qhasharr_put(gtbl, key, strlen(key), value.data(), value.size()))
+                kept[key] = value;
+            else if (!qhasharr_exist(gtbl, key, strlen(key)))
+                kept.erase(key);
+        }
+
+        if (i % 50 != 0) continue;
+        map<string, string> got;
+        qnobj_t obj;
+        int idx = 0, steps = 0;
+        while (qhasharr_getnext(gtbl, &obj, &idx))
+        {
+            steps++;
+            got[string(obj.name, obj.name_size)] = string((char*)obj.data, obj.data_size);
+            free(obj.name);
+            free(obj.data);
+        }
+        EXPECT_EQ(ENOENT, errno);
+        EXPECT_EQ(maxslots, idx);
+        EXPECT_EQ((int)kept.size(), steps);
+        EXPECT_TRUE(kept == got);
+    }
+
+    qhasharr_clear(gtbl);
+    qnobj_t obj;
+    int idx = 0;
+    EXPECT_FALSE(qhasharr_getnext(gtbl, &obj, &idx));
+    EXPECT_EQ(maxslots, idx);
+    free(memory);
+}
+/**
+  * End_Test_for function: qhasharr_t *qhasharr_fmt(void *memory, size_t memsize, int format)
+  *=========================================================================================================================
+  */
+
+/**
+  * Begin_Test_for function: qhasharr_t *qhasharr_fmt_heap(void *memory, size_t memsize, int format, size_t heapsize)
+  *=========================================================================================================================
+  */
+// Test for qhasharr_fmt_heap: only group layout has a heap
+TEST_F(Test_qhasharr, qhasharr_fmt_heap_linear)
+{
+    char memory[64 * 1024];
+    EXPECT_TRUE(NULL == qhasharr_fmt_heap(memory, sizeof(memory), QHASHARR_FORMAT_LINEAR, 4096));
+    EXPECT_EQ(EINVAL, errno);
+
+    qhasharr_t *gtbl = qhasharr_fmt(memory, sizeof(memory), QHASHARR_FORMAT_GROUP);
+    ASSERT_TRUE(NULL != gtbl);
+    qhasharr_heap_stat_t stat;
+    EXPECT_FALSE(qhasharr_heap_stat(gtbl, &stat));
+    EXPECT_EQ(ENOENT, errno);
+}
+
+// Test for qhasharr_fmt_heap: large value is kept in one slot and a heap block
+TEST_F(Test_qhasharr, qhasharr_fmt_heap_large_value)
+{
+    size_t memsize = qhasharr_calculate_memsize_heap(MAX_SLOT_NUM, QHASHARR_FORMAT_GROUP, 64 * 1024);
+    char *memory = (char*)malloc(memsize);
+    qhasharr_t *gtbl = qhasharr_fmt_heap(memory, memsize, QHASHARR_FORMAT_GROUP, 64 * 1024);
+    ASSERT_TRUE(NULL != gtbl);
+    EXPECT_EQ(MAX_SLOT_NUM, gtbl->maxslots);
+
+    const char* key = "large";
+    string value(5000, 'x');
+    EXPECT_TRUE(qhasharr_put(gtbl, key, strlen(key), value.data(), value.size()));
+    EXPECT_EQ(1, gtbl->usedslots);
+
+    size_t size = 0;
+    char *out = (char*)qhasharr_get(gtbl, key, strlen(key), &size);
+    ASSERT_TRUE(NULL != out);
+    EXPECT_EQ(value, string(out, size));
+    free(out);
+
+    // referenced in place
+    uint32_t seq = 0;
+    const char *ref = (const char*)qhasharr_get_ref(gtbl, key, strlen(key), &size, &seq);
+    ASSERT_TRUE(NULL != ref);
+    EXPECT_EQ(value, string(ref, size));
+    EXPECT_TRUE(ref > memory && ref + size <= memory + memsize);
+    EXPECT_FALSE(qhasharr_read_retry(gtbl, seq));
+
+    qhasharr_heap_stat_t stat;
+    ASSERT_TRUE(qhasharr_heap_stat(gtbl, &stat));
+    EXPECT_EQ(1u, stat.values);
+    EXPECT_EQ(8192u, stat.used);
+
+    free(memory);
+}
+
+// Test for qhasharr_fmt_heap: removed blocks are merged with their buddies
+TEST_F(Test_qhasharr, qhasharr_fmt_heap_remove_merge)
+{
+    size_t memsize = qhasharr_calculate_memsize_heap(MAX_SLOT_NUM, QHASHARR_FORMAT_GROUP, 64 * 1024);
+    char *memory = (char*)malloc(memsize);
+    qhasharr_t *gtbl = qhasharr_fmt_heap(memory, memsize, QHASHARR_FORMAT_GROUP, 64 * 1024);
+    ASSERT_TRUE(NULL != gtbl);
+
+    qhasharr_heap_stat_t empty;
+    ASSERT_TRUE(qhasharr_heap_stat(gtbl, &empty));
+    EXPECT_EQ(0u, empty.used);
+    EXPECT_EQ(0u, empty.values);
+
+    char key[32];
+    for (int i = 0; i < 20; i++)
+    {
+        snprintf(key, sizeof(key), "key_%d", i);
+        string value(100 + i * 50, 'a' + i);
+        EXPECT_TRUE(qhasharr_put(gtbl, key, strlen(key), value.data(), value.size()));
+    }
+    qhasharr_heap_stat_t stat;
+    ASSERT_TRUE(qhasharr_heap_stat(gtbl, &stat));
+    EXPECT_EQ(20u, stat.values);
+    EXPECT_EQ(20, gtbl->usedslots);
+
+    for (int i = 0; i < 20; i += 2)
+    {
+        snprintf(key, sizeof(key), "key_%d", i);
+        EXPECT_TRUE(qhasharr_remove(gtbl, key, strlen(key)));
+    }
+    for (int i = 1; i < 20; i += 2)
+    {
+        snprintf(key, sizeof(key), "key_%d", i);
+        size_t size = 0;
+        char *out = (char*)qhasharr_get(gtbl, key, strlen(key), &size);
+        ASSERT_TRUE(NULL != out);
+        EXPECT_EQ(string(100 + i * 50, 'a' + i), string(out, size));
+        free(out);
+        EXPECT_TRUE(qhasharr_remove(gtbl, key, strlen(key)));
+    }
+
+    ASSERT_TRUE(qhasharr_heap_stat(gtbl, &stat));
+    EXPECT_EQ(0u, stat.used);
+    EXPECT_EQ(0u, stat.values);
+    EXPECT_EQ(empty.freeblocks, stat.freeblocks);
+    EXPECT_EQ(empty.maxfree, stat.maxfree);
+    free(memory);
+}
+
+// Test for qhasharr_fmt_heap: value is stored across slots when the heap is full
+TEST_F(Test_qhasharr, qhasharr_fmt_heap_full)
+{
+    size_t memsize = qhasharr_calculate_memsize_heap(MAX_SLOT_NUM, QHASHARR_FORMAT_GROUP, 4096);
+    char *memory = (char*)malloc(memsize);
+    qhasharr_t *gtbl = qhasharr_fmt_heap(memory, memsize, QHASHARR_FORMAT_GROUP, 4096);
+    ASSERT_TRUE(NULL != gtbl);
+
+    string value(1500, 'v');
+    EXPECT_TRUE(qhasharr_put(gtbl, "k1", 2, value.data(), value.size()));
+    EXPECT_EQ(1, gtbl->usedslots);
+    EXPECT_TRUE(qhasharr_put(gtbl, "k2", 2, value.data(), value.size()));
+    EXPECT_LT(1 + 1, gtbl->usedslots);
+
+    size_t size = 0;
+    char *out = (char*)qhasharr_get(gtbl, "k2", 2, &size);
+    ASSERT_TRUE(NULL != out);
+    EXPECT_EQ(value, string(out, size));
+    free(out);
+
+    uint32_t seq = 0;
+    EXPECT_TRUE(NULL == qhasharr_get_ref(gtbl, "k2", 2, &size, &seq));
+    EXPECT_EQ(E2BIG, errno);
+
+    // the block is reused once it's free
+    EXPECT_TRUE(qhasharr_remove(gtbl, "k1", 2));
+    EXPECT_TRUE(qhasharr_put(gtbl, "k1", 2, value.data(), value.size()));
+    EXPECT_TRUE(NULL != qhasharr_get_ref(gtbl, "k1", 2, &size, &seq));
+
+    qhasharr_clear(gtbl);
+    qhasharr_heap_stat_t stat;
+    ASSERT_TRUE(qhasharr_heap_stat(gtbl, &stat));
+    EXPECT_EQ(0u, stat.values);
+    EXPECT_EQ(0u, stat.used);
+    free(memory);
+}
+
+// Test for qhasharr_fmt_heap: values come and go between the heap and linked slots
+TEST_F(Test_qhasharr, qhasharr_fmt_heap_same_as_linear)
+{
+    const int maxslots = 97;
+    const size_t heapsize = 16 * 1024;
+    size_t memsize = qhasharr_calculate_memsize_heap(maxslots, QHASHARR_FORMAT_GROUP, heapsize);
+    char *memory = (char*)malloc(memsize);
+    qhasharr_t *gtbl = qhasharr_fmt_heap(memory, memsize, QHASHARR_FORMAT_GROUP, heapsize);
+    ASSERT_TRUE(NULL != gtbl);
+
+    qhasharr_heap_stat_t empty;
+    ASSERT_TRUE(qhasharr_heap_stat(gtbl, &empty));
+
+    map<string, string> kept;
+    srand(54321);
+    char key[64];
+    for (int i = 0; i < 20000; i++)
+    {
+        snprintf(key, sizeof(key), "key_%d", rand() % 40);
+        if (rand() % 3 == 0)
+        {
+            EXPECT_EQ(kept.erase(key) > 0, qhasharr_remove(gtbl, key, strlen(key)));
+            continue;
+        }
+
+        string value(1 + rand() % 3000, 'a' + i % 26);
+        if (qhasharr_put(gtbl, key, strlen(key), value.data(), value.size()))
+            kept[key] = value;
+        else if (!qhasharr_exist(gtbl, key, strlen(key)))
+            kept.erase(key);
+
+        if (i % 100 != 0) continue;
+        for (map<string, string>::iterator it = kept.begin(); it != kept.end(); ++it)
+        {
+            size_t size = 0;
+            char *out = (char*)qhasharr_get(gtbl, it->first.data(), it->first.size(), &size);
+            ASSERT_TRUE(NULL != out);
+            EXPECT_EQ(it->second, string(out, size));
+            free(out);
+        }
+    }
+    EXPECT_EQ((int)kept.size(), qhasharr_size(gtbl, NULL, NULL));
+
+    for (map<string, string>::iterator it = kept.begin(); it != kept.end(); ++it)
+    {
+        EXPECT_TRUE(qhasharr_remove(gtbl, it->first.data(), it->first.size()));
+    }
+    EXPECT_EQ(0, gtbl->usedslots);
+    qhasharr_heap_stat_t stat;
+    ASSERT_TRUE(qhasharr_heap_stat(gtbl, &stat));
+    EXPECT_EQ(0u, stat.used);
+    EXPECT_EQ(empty.freeblocks, stat.freeblocks);
+    free(memory);
+}
+/**
+  * End_Test_for function: qhasharr_t *qhasharr_fmt_heap(void *memory, size_t memsize, int format, size_t heapsize)
+  *=========================================================================================================================
+  */
+
+/**
+  * Begin_Test_for format: QHASHARR_FORMAT_FPRINT
+  *=========================================================================================================================
+  */
+// Test for qhashxxh64: reference values of XXH64
+TEST_F(Test_qhasharr, qhashxxh64_reference)
+{
+    const char *text = "Nobody inspects the spammish repetition";
+    EXPECT_EQ(0xef46db3751d8e999ULL, qhashxxh64("", 0, 0));
+    EXPECT_EQ(0x44bc2cf5ad770999ULL, qhashxxh64("abc", 3, 0));
+    EXPECT_EQ(0xfbcea83c8a378bf1ULL, qhashxxh64(text, strlen(text), 0));
+}
+
+// Test for QHASHARR_FORMAT_FPRINT: truncated keys of the same prefix and length
+TEST_F(Test_qhasharr, qhasharr_fmt_fprint_truncated_key)
+{
+    size_t memsize = qhasharr_calculate_memsize_fmt(MAX_SLOT_NUM, QHASHARR_FORMAT_FPRINT);
+    char *memory = (char*)malloc(memsize);
+    qhasharr_t *gtbl = qhasharr_fmt(memory, memsize, QHASHARR_FORMAT_FPRINT);
+    ASSERT_TRUE(NULL != gtbl);
+    EXPECT_EQ(QHASHARR_FORMAT_FPRINT, qhasharr_format(gtbl));
+
+    const char *key1 = "0corp,/qconf/demo/the/common/prefix/node_a";
+    const char *key2 = "0corp,/qconf/demo/the/common/prefix/node_b";
+    EXPECT_TRUE(qhasharr_put(gtbl, key1, strlen(key1), "a", 2));
+    EXPECT_TRUE(qhasharr_put(gtbl, key2, strlen(key2), "b", 2));
+    EXPECT_EQ(2, qhasharr_size(gtbl, NULL, NULL));
+
+    size_t size = 0;
+    char *out = (char*)qhasharr_get(gtbl, key2, strlen(key2), &size);
+    ASSERT_TRUE(NULL != out);
+    EXPECT_STREQ("b", out);
+    free(out);
+
+    // no heap, the name is truncated
+    qnobj_t obj;
+    int idx = 0;
+    ASSERT_TRUE(qhasharr_getnext(gtbl, &obj, &idx));
+    EXPECT_EQ((size_t)_Q_HASHARR_KEYSIZE, obj.name_size);
+    free(obj.name);
+    free(obj.data);
+
+    EXPECT_TRUE(qhasharr_remove(gtbl, key1, strlen(key1)));
+    EXPECT_FALSE(qhasharr_exist(gtbl, key1, strlen(key1)));
+    EXPECT_TRUE(qhasharr_exist(gtbl, key2, strlen(key2)));
+    free(memory);
+}
+
+// Test for QHASHARR_FORMAT_FPRINT: truncated key is kept whole in the heap
+TEST_F(Test_qhasharr, qhasharr_fmt_fprint_key_in_heap)
+{
+    size_t memsize = qhasharr_calculate_memsize_heap(MAX_SLOT_NUM, QHASHARR_FORMAT_FPRINT, 16 * 1024);
+    char *memory = (char*)malloc(memsize);
+    qhasharr_t *gtbl = qhasharr_fmt_heap(memory, memsize, QHASHARR_FORMAT_FPRINT, 16 * 1024);
+    ASSERT_TRUE(NULL != gtbl);
+
+    string key = string("0corp,/qconf/demo/") + string(100, 'k');
+    string value(500, 'v');
+    EXPECT_TRUE(qhasharr_put(gtbl, key.data(), key.size(), value.data(), value.size()));
+
+    qhasharr_heap_stat_t stat;
+    ASSERT_TRUE(qhasharr_heap_stat(gtbl, &stat));
+    EXPECT_EQ(2u, stat.values);
+
+    qnobj_t obj;
+    int idx = 0;
+    ASSERT_TRUE(qhasharr_getnext(gtbl, &obj, &idx));
+    EXPECT_EQ(key, string(obj.name, obj.name_size));
+    EXPECT_EQ(value, string((char*)obj.data, obj.data_size));
+    free(obj.name);
+    free(obj.data);
+
+    // same prefix, length and slot content but another key
+    string other = key;
+    other[other.size() - 1] = 'x';
+    EXPECT_FALSE(qhasharr_exist(gtbl, other.data(), other.size()));
+
+    EXPECT_TRUE(qhasharr_remove(gtbl, key.data(), key.size()));
+    ASSERT_TRUE(qhasharr_heap_stat(gtbl, &stat));
+    EXPECT_EQ(0u, stat.values);
+    EXPECT_EQ(0u, stat.used);
+    free(memory);
+}
+
+// Test for QHASHARR_FORMAT_FPRINT: works the same as linear layout while keys come and go
+TEST_F(Test_qhasharr, qhasharr_fmt_fprint_same_as_linear)
+{
+    const int maxslots = 61;
+    const size_t heapsize = 8 * 1024;
+    size_t memsize = qhasharr_calculate_memsize_heap(maxslots, QHASHARR_FORMAT_FPRINT, heapsize);
+    char *memory = (char*)malloc(memsize);
+    qhasharr_t *gtbl = qhasharr_fmt_heap(memory, memsize, QHASHARR_FORMAT_FPRINT, heapsize);
+    ASSERT_TRUE(NULL != gtbl);
+
+    map<string, string> kept;
+    srand(2468);
+    char key[128];
+    for (int i = 0; i < 20000; i++)
+    {
+        // keys of the same length differ after the kept prefix
+        snprintf(key, sizeof(key), "0corp,/qconf/demo/the/common/prefix/node_%03d", rand() % 50);
+        if (rand() % 3 == 0)
+        {
+            EXPECT_EQ(kept.erase(key) > 0, qhasharr_remove(gtbl, key, strlen(key)));
+            continue;
+        }
+
+        string value(1 + rand() % 600, 'a' + i % 26);
+        if (qhasharr_put(gtbl, key, strlen(key), value.data(), value.size()))
+            kept[key] = value;
+        else if (!qhasharr_exist(gtbl, key, strlen(key)))
+            kept.erase(key);
+
+        if (i % 100 != 0) continue;
+        for (int k = 0; k < 50; k++)
+        {
+            snprintf(key, sizeof(key), "0corp,/qconf/demo/the/common/prefix/node_%03d", k);
+            size_t size = 0;
+            char *out = (char*)qhasharr_get(gtbl, key, strlen(key), &size);
+            map<string, string>::iterator it = kept.find(key);
+            if (it == kept.end())
+            {
+                EXPECT_TRUE(NULL == out);
+            }
+            else
+            {
+                ASSERT_TRUE(NULL != out);
+                EXPECT_EQ(it->second, string(out, size));
+            }
+            free(out);
+        }
+    }
+    EXPECT_EQ((int)kept.size(), qhasharr_size(gtbl, NULL, NULL));
+
+    qhasharr_clear(gtbl);
+    qhasharr_heap_stat_t stat;
+    ASSERT_TRUE(qhasharr_heap_stat(gtbl, &stat));
+    EXPECT_EQ(0u, stat.values);
+    free(memory);
+}
+
+static bool _evict_pinned(const char *key, size_t key_size, const void *value, size_t val_size)
+{
+    return key_size > 0 && 'p' == key[0];
+}
+
+// Test for qhasharr_evict: referenced and pinned objects are kept
+TEST_F(Test_qhasharr, qhasharr_evict_clock)
+{
+    unsigned char refs[MAX_SLOT_NUM] = {0};
+    int hand = 0;
+    char key[32];
+
+    for (int i = 0; i < MAX_SLOT_NUM; i++)
+    {
+        snprintf(key, sizeof(key), "%c%d", (i < 5) ? 'p' : 'k', i);
+        ASSERT_TRUE(qhasharr_put(tbl, key, strlen(key), "v", 2));
+    }
+    EXPECT_FALSE(qhasharr_put(tbl, "new", 3, "v", 2));
+    EXPECT_EQ(ENOBUFS, errno);
+
+    // every unpinned object but k19 is referenced
+    for (int i = 5; i < MAX_SLOT_NUM - 1; i++)
+    {
+        int idx = -1;
+        snprintf(key, sizeof(key), "k%d", i);
+        free(qhasharr_get_idx(tbl, key, strlen(key), NULL, &idx));
+        ASSERT_LE(0, idx);
+        refs[idx] = 1;
+    }
+
+    EXPECT_TRUE(qhasharr_evict(tbl, refs, &hand, _evict_pinned));
+    EXPECT_FALSE(qhasharr_exist(tbl, "k19", 3));
+    EXPECT_EQ(MAX_SLOT_NUM - 1, qhasharr_size(tbl, NULL, NULL));
+    EXPECT_TRUE(qhasharr_put(tbl, "new", 3, "v", 2));
+
+    // references are cleared as the hand passes, then the objects go
+    for (int i = 0; i < MAX_SLOT_NUM; i++) qhasharr_evict(tbl, refs, &hand, _evict_pinned);
+    for (int i = 0; i < 5; i++)
+    {
+        snprintf(key, sizeof(key), "p%d", i);
+        EXPECT_TRUE(qhasharr_exist(tbl, key, strlen(key)));
+    }
+    EXPECT_EQ(5, qhasharr_size(tbl, NULL, NULL));
+
+    errno = 0;
+    EXPECT_FALSE(qhasharr_evict(tbl, refs, &hand, _evict_pinned));
+    EXPECT_EQ(ENOENT, errno);
+    EXPECT_TRUE(qhasharr_evict(tbl, NULL, &hand, NULL));
+    EXPECT_EQ(4, qhasharr_size(tbl, NULL, NULL));
+    EXPECT_FALSE(qhasharr_evict(tbl, refs, NULL, NULL));
+}
+
+// Test for qhasharr_getnext_stat: every key is placed where it's got from
+TEST_F(Test_qhasharr, qhasharr_getnext_stat_placement)
+{
+    char key[32];
+    string large(200, 'x');
+    for (int i = 0; i < 8; i++)
+    {
+        snprintf(key, sizeof(key), "%c/key/%d", (i % 2) ? QCONF_DATA_TYPE_NODE : QCONF_DATA_TYPE_SERVICE, i);
+        ASSERT_TRUE(qhasharr_put(tbl, key, strlen(key), large.data(), (0 == i) ? large.size() : 4));
+    }
+
+    qhasharr_key_stat_t stat;
+    int idx = 0;
+    int keys = 0, slots = 0, heads = 0;
+    while (qhasharr_getnext_stat(tbl, &stat, &idx))
+    {
+        keys++;
+        slots += 1 + stat.extslots;
+        if (stat.idx == stat.home) heads += stat.collisions;
+        EXPECT_EQ(stat.idx, (stat.home + stat.distance) % MAX_SLOT_NUM);
+        EXPECT_FALSE(stat.inheap);
+        EXPECT_TRUE(QCONF_DATA_TYPE_NODE == stat.keytype || QCONF_DATA_TYPE_SERVICE == stat.keytype);
+        if (stat.valsize == large.size())
+            EXPECT_LT(0, stat.extslots);
+        else
+            EXPECT_EQ(4u, stat.valsize);
+    }
+    EXPECT_EQ(ENOENT, errno);
+    EXPECT_EQ(MAX_SLOT_NUM, idx);
+    EXPECT_EQ(8, keys);
+    EXPECT_EQ(8, heads);
+    EXPECT_EQ(tbl->usedslots, slots);
+
+    // a key is got from the slot it's reported in
+    snprintf(key, sizeof(key), "%c/key/%d", QCONF_DATA_TYPE_SERVICE, 0);
+    int got = -1;
+    free(qhasharr_get_idx(tbl, key, strlen(key), NULL, &got));
+    idx = got;
+    ASSERT_TRUE(qhasharr_getnext_stat(tbl, &stat, &idx));
+    EXPECT_EQ(got, stat.idx);
+    EXPECT_EQ(large.size(), stat.valsize);
+
+    EXPECT_FALSE(qhasharr_getnext_stat(tbl, NULL, &idx));
+    EXPECT_EQ(EINVAL, errno);
+}
+
+// Test for qhasharr_getnext_stat: value kept in the heap takes no extension block
+TEST_F(Test_qhasharr, qhasharr_getnext_stat_heap)
+{
+    size_t memsize = qhasharr_calculate_memsize_heap(MAX_SLOT_NUM, QHASHARR_FORMAT_GROUP, 64 * 1024);
+    char *memory = (char*)malloc(memsize);
+    qhasharr_t *gtbl = qhasharr_fmt_heap(memory, memsize, QHASHARR_FORMAT_GROUP, 64 * 1024);
+    ASSERT_TRUE(NULL != gtbl);
+
+    string value(5000, 'x');
+    ASSERT_TRUE(qhasharr_put(gtbl, "large", 5, value.data(), value.size()));
+
+    qhasharr_key_stat_t stat;
+    int idx = 0;
+    ASSERT_TRUE(qhasharr_getnext_stat(gtbl, &stat, &idx));
+    EXPECT_TRUE(stat.inheap);
+    EXPECT_EQ(0, stat.extslots);
+    EXPECT_EQ(value.size(), stat.valsize);
+    EXPECT_EQ(5u, stat.keylen);
+    EXPECT_EQ('l', stat.keytype);
+    EXPECT_EQ(1, stat.collisions);
+    EXPECT_FALSE(qhasharr_getnext_stat(gtbl, &stat, &idx));
+
+    free(memory);
+}
+
+static double lookup_nsec(qhasharr_t *tbl, const vector<string> &keys, int rounds)
+{
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    size_t found = 0;
+    for (int r = 0; r < rounds; r++)
+    {
+        for (size_t i = 0; i < keys.size(); i++)
+        {
+            found += qhasharr_exist(tbl, keys[i].data(), keys[i].size());
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    EXPECT_EQ(keys.size() * rounds, found);
+
+    double nsec = (end.tv_sec - begin.tv_sec) * 1e9 + (end.tv_nsec - begin.tv_nsec);
+    return nsec / (keys.size() * rounds);
+}
+
+// Benchmark of lookups, murmur3 and md5 against one xxHash per key.
+// Run it by --gtest_also_run_disabled_tests --gtest_filter=*benchmark*
+TEST_F(Test_qhasharr, DISABLED_qhasharr_fmt_fprint_lookup_benchmark)
+{
+    const int maxslots = 100000;
+    const int keynum = 50000;
+    int formats[] = {QHASHARR_FORMAT_LINEAR, QHASHARR_FORMAT_GROUP, QHASHARR_FORMAT_FPRINT};
+    const char *names[] = {"linear(murmur3+md5)", "group(murmur3+md5)", "fprint(xxh64)"};
+
+    vector<string> keys;
+    char key[128];
+    for (int i = 0; i < keynum; i++)
+    {
+        snprintf(key, sizeof(key), "0corp,/qconf/demo/service/module/conf_%d", i);
+        keys.push_back(key);
+    }
+
+    for (int f = 0; f < 3; f++)
+    {
+        size_t memsize = qhasharr_calculate_memsize_fmt(maxslots, formats[f]);
+        char *memory = (char*)malloc(memsize);
+        qhasharr_t *btbl = qhasharr_fmt(memory, memsize, formats[f]);
+        ASSERT_TRUE(NULL != btbl);
+        for (size_t i = 0; i < keys.size(); i++)
+        {
+            ASSERT_TRUE(qhasharr_put(btbl, keys[i].data(), keys[i].size(), "value", 6));
+        }
+
+        cout << names[f] << ": " << lookup_nsec(btbl, keys, 20) << " ns/lookup" << endl;
+        free(memory);
+    }
+}
+/**
+  * End_Test_for format: QHASHARR_FORMAT_FPRINT
+  *=========================================================================================================================
+  */
+
 // End Test for qhasharr.c